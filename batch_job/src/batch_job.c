@@ -107,6 +107,7 @@ struct batch_queue *batch_queue_create(batch_queue_type_t type)
 	batch_queue_set_feature(q, "output_directories", "yes");
 	batch_queue_set_feature(q, "batch_log_name", "%s.batchlog");
 	batch_queue_set_feature(q, "gc_size", "yes");
+	batch_queue_set_feature(q, "local_fs_stat", "yes");
 
 	q->module = NULL;
 	for (i = 0; batch_queue_modules[i]->type != BATCH_QUEUE_TYPE_UNKNOWN; i++)
@@ -254,6 +255,29 @@ batch_job_id_t batch_job_wait_timeout(struct batch_queue * q, struct batch_job_i
 	return q->module->job.wait(q, info, stoptime);
 }
 
+int batch_job_wait_many(struct batch_queue * q, batch_job_id_t * jobids, struct batch_job_info * infos, int max, time_t stoptime)
+{
+	if(max < 1)
+		return 0;
+
+	batch_job_id_t jobid = q->module->job.wait(q, &infos[0], stoptime);
+	if(jobid <= 0)
+		return jobid < 0 ? -1 : 0;
+
+	jobids[0] = jobid;
+
+	/* A stoptime of zero would block, so the rest are collected with the current time. */
+	int count;
+	for(count = 1; count < max; count++) {
+		jobid = q->module->job.wait(q, &infos[count], time(0));
+		if(jobid <= 0)
+			break;
+		jobids[count] = jobid;
+	}
+
+	return count;
+}
+
 int batch_job_remove(struct batch_queue *q, batch_job_id_t jobid)
 {
 	return q->module->job.remove(q, jobid);
@@ -118,6 +118,22 @@ If less than zero, the operation timed out or was interrupted by a system event,
 */
 batch_job_id_t batch_job_wait_timeout(struct batch_queue *q, struct batch_job_info *info, time_t stoptime);
 
+/** Wait for any number of batch jobs to complete, with a timeout.
+Blocks until a batch job completes or the current time exceeds stoptime,
+and then collects, without blocking, any other jobs that have also completed, up to max.
+This allows the caller to process many completions at once, rather than returning to wait for each one.
+@param q The queue to wait on.
+@param jobids An array of at least max entries, filled in with the jobids of the completed jobs.
+@param infos An array of at least max entries, filled in with the details of each completed job, in the same order as jobids.
+@param max The largest number of jobs to collect.
+@param stoptime An absolute time at which to stop waiting for the first job.  If less than or equal to the current time,
+then this function will check for complete jobs but will not block.
+@return If greater than zero, the number of jobs that completed.
+If equal to zero, there were no more jobs to wait for.
+If less than zero, the operation timed out or was interrupted by a system event, but may be tried again.
+*/
+int batch_job_wait_many(struct batch_queue *q, batch_job_id_t *jobids, struct batch_job_info *infos, int max, time_t stoptime);
+
 /** Remove a batch job.
 This call will start the removal process.
 You must still call @ref batch_job_wait to wait for the removal to complete.
@@ -95,6 +95,7 @@ static int batch_queue_dryrun_create (struct batch_queue *q)
 
 	batch_queue_set_feature(q, "local_job_queue", NULL);
 	batch_queue_set_feature(q, "batch_log_name", "%s.sh");
+	batch_queue_set_feature(q, "local_fs_stat", NULL);
 	batch_queue_set_option(q, "cwd", cwd);
 	return 0;
 }
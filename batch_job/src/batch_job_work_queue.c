@@ -105,7 +105,7 @@ static batch_job_id_t batch_job_wq_submit (struct batch_queue * q, const char *c
 static batch_job_id_t batch_job_wq_wait (struct batch_queue * q, struct batch_job_info * info, time_t stoptime)
 {
 	static int try_open_log = 0;
-	int timeout, taskid = -1;
+	int taskid = -1;
 
 	if(!try_open_log)
 	{
@@ -121,13 +121,16 @@ static batch_job_id_t batch_job_wq_wait (struct batch_queue * q, struct batch_jo
 		}
 	}
 
+	struct work_queue_task *t;
 	if(stoptime == 0) {
-		timeout = WORK_QUEUE_WAITFORTASK;
+		t = work_queue_wait(q->data, WORK_QUEUE_WAITFORTASK);
+	} else if(stoptime <= time(0)) {
+		/* work_queue_wait would wait a second, where a zero timeout only collects what has completed. */
+		t = work_queue_wait_internal(q->data, 0, NULL, NULL);
 	} else {
-		timeout = MAX(0, stoptime - time(0));
+		t = work_queue_wait(q->data, stoptime - time(0));
 	}
 
-	struct work_queue_task *t = work_queue_wait(q->data, timeout);
 	if(t) {
 		info->submitted = t->time_when_submitted / 1000000;
 		info->started   = t->time_when_commit_end / 1000000;
@@ -0,0 +1,179 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Compact the logs of a deltadb into the form read by the fast path of
+deltadb_query.  For each DAY.log given, the events are written as DAY.hist,
+and the checkpoint DAY.ckpt, if present, is written as the snapshot DAY.snap.
+The logs and checkpoints are left in place, and a history is only used by
+deltadb_query while its log is the same size as when it was compacted.
+*/
+
+#include "deltadb_history.h"
+#include "deltadb_stream.h"
+
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_snapshot.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct deltadb {
+	struct deltadb_history_writer *writer;
+};
+
+int deltadb_create_event( struct deltadb *db, const char *key, struct jx *jobject )
+{
+	int ok = deltadb_history_write_create(db->writer,key,jobject);
+	jx_delete(jobject);
+	return ok;
+}
+
+int deltadb_delete_event( struct deltadb *db, const char *key )
+{
+	return deltadb_history_write_delete(db->writer,key);
+}
+
+int deltadb_merge_event( struct deltadb *db, const char *key, struct jx *jobject )
+{
+	int ok = deltadb_history_write_merge(db->writer,key,jobject);
+	jx_delete(jobject);
+	return ok;
+}
+
+int deltadb_update_event( struct deltadb *db, const char *key, const char *name, struct jx *jvalue )
+{
+	int ok = deltadb_history_write_update(db->writer,key,name,jvalue);
+	jx_delete(jvalue);
+	return ok;
+}
+
+int deltadb_remove_event( struct deltadb *db, const char *key, const char *name )
+{
+	return deltadb_history_write_remove(db->writer,key,name);
+}
+
+int deltadb_time_event( struct deltadb *db, time_t starttime, time_t stoptime, time_t current )
+{
+	return deltadb_history_write_time(db->writer,current);
+}
+
+int deltadb_post_event( struct deltadb *db, const char *line )
+{
+	return 1;
+}
+
+/* Every record is kept, as the history is not read here. */
+
+int deltadb_has_key( struct deltadb *db, const char *key )
+{
+	return 1;
+}
+
+static int compact_checkpoint( const char *ckptname, const char *snapname )
+{
+	FILE *file = fopen(ckptname,"r");
+	if(!file) return 1;
+
+	struct jx *jcheckpoint = jx_parse_stream(file);
+	fclose(file);
+
+	/* Checkpoints in the old nvpair format are left for deltadb_query to read as they are. */
+	if(!jx_istype(jcheckpoint,JX_OBJECT)) {
+		fprintf(stderr,"skipping %s: not a JSON checkpoint\n",ckptname);
+		jx_delete(jcheckpoint);
+		return 1;
+	}
+
+	int ok = jx_snapshot_write(snapname,jcheckpoint);
+	if(!ok) fprintf(stderr,"couldn't write %s: %s\n",snapname,strerror(errno));
+
+	jx_delete(jcheckpoint);
+	return ok;
+}
+
+static int compact_log( const char *logname, const char *histname )
+{
+	FILE *file = fopen(logname,"r");
+	if(!file) {
+		fprintf(stderr,"couldn't open %s: %s\n",logname,strerror(errno));
+		return 0;
+	}
+
+	struct stat info;
+	if(fstat(fileno(file),&info)<0) {
+		fprintf(stderr,"couldn't stat %s: %s\n",logname,strerror(errno));
+		fclose(file);
+		return 0;
+	}
+
+	struct deltadb db;
+	db.writer = deltadb_history_writer_create(histname);
+	if(!db.writer) {
+		fprintf(stderr,"couldn't open %s: %s\n",histname,strerror(errno));
+		fclose(file);
+		return 0;
+	}
+
+	deltadb_process_stream(&db,file,0,0);
+	fclose(file);
+
+	/* The size taken before reading, so that a log appended meanwhile no longer matches. */
+	if(!deltadb_history_writer_close(db.writer,info.st_size)) {
+		fprintf(stderr,"couldn't write %s: %s\n",histname,strerror(errno));
+		unlink(histname);
+		return 0;
+	}
+
+	return 1;
+}
+
+int main( int argc, char *argv[] )
+{
+	if(argc<2) {
+		fprintf(stderr,"use: %s <day.log> ...\n",argv[0]);
+		return 1;
+	}
+
+	int failures = 0;
+
+	int i;
+	for(i=1;i<argc;i++) {
+		const char *logname = argv[i];
+
+		if(!string_suffix_is(logname,".log")) {
+			fprintf(stderr,"skipping %s: not a .log file\n",logname);
+			failures++;
+			continue;
+		}
+
+		char *base = xxstrdup(logname);
+		base[strlen(base)-4] = 0;
+
+		char *histname = string_format("%s.hist",base);
+		char *ckptname = string_format("%s.ckpt",base);
+		char *snapname = string_format("%s.snap",base);
+
+		if(!compact_log(logname,histname)) failures++;
+		if(!compact_checkpoint(ckptname,snapname)) failures++;
+
+		free(base);
+		free(histname);
+		free(ckptname);
+		free(snapname);
+	}
+
+	return failures ? 1 : 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
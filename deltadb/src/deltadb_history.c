@@ -0,0 +1,363 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "deltadb_history.h"
+#include "deltadb_stream.h"
+
+#include "jx.h"
+#include "jx_binary.h"
+#include "debug.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+A history is a header followed by the events.  Each event is one byte
+giving the type of event, as in the log, followed by its fields in order.
+A time is an int64, a key or name is a uint32 length followed by the
+characters and a terminating null, and a value is a uint32 length
+followed by the value in binary form:
+
+T time
+C key value
+D key
+M key value
+U key name value
+R key name
+
+As with jx_binary, the format is in the byte order of the writer.
+*/
+
+#define DELTADB_HISTORY_MAGIC "DELTADBH"
+#define DELTADB_HISTORY_VERSION 1
+
+struct deltadb_history_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t log_size;
+	uint64_t size;
+};
+
+struct deltadb_history_writer {
+	FILE *file;
+	char *buffer;
+	size_t buffer_size;
+	FILE *scratch;
+	int ok;
+};
+
+struct deltadb_history {
+	const char *data;
+	size_t size;
+	uint64_t log_size;
+};
+
+struct deltadb_history_writer * deltadb_history_writer_create( const char *filename )
+{
+	FILE *file = fopen(filename,"w");
+	if(!file) return 0;
+
+	struct deltadb_history_writer *w = xxmalloc(sizeof(*w));
+	w->file = file;
+	w->buffer = 0;
+	w->buffer_size = 0;
+	w->scratch = open_memstream(&w->buffer,&w->buffer_size);
+	w->ok = w->scratch!=0;
+
+	struct deltadb_history_header header;
+	memset(&header,0,sizeof(header));
+	if(fwrite(&header,sizeof(header),1,file)!=1) w->ok = 0;
+
+	return w;
+}
+
+static void write_data( struct deltadb_history_writer *w, const void *data, size_t length )
+{
+	if(w->ok && length>0 && fwrite(data,length,1,w->file)!=1) w->ok = 0;
+}
+
+static void write_string( struct deltadb_history_writer *w, const char *str )
+{
+	uint32_t length = strlen(str);
+	write_data(w,&length,sizeof(length));
+	write_data(w,str,length+1);
+}
+
+/* The value is encoded into the scratch buffer first, so that its length can precede it. */
+
+static void write_value( struct deltadb_history_writer *w, struct jx *j )
+{
+	if(!w->ok) return;
+
+	rewind(w->scratch);
+	if(!jx_binary_write(w->scratch,j) || fflush(w->scratch)!=0) {
+		w->ok = 0;
+		return;
+	}
+
+	uint32_t length = ftell(w->scratch);
+	write_data(w,&length,sizeof(length));
+	write_data(w,w->buffer,length);
+}
+
+static int write_type( struct deltadb_history_writer *w, char type )
+{
+	write_data(w,&type,1);
+	return w->ok;
+}
+
+int deltadb_history_write_create( struct deltadb_history_writer *w, const char *key, struct jx *jobject )
+{
+	write_type(w,'C');
+	write_string(w,key);
+	write_value(w,jobject);
+	return w->ok;
+}
+
+int deltadb_history_write_delete( struct deltadb_history_writer *w, const char *key )
+{
+	write_type(w,'D');
+	write_string(w,key);
+	return w->ok;
+}
+
+int deltadb_history_write_merge( struct deltadb_history_writer *w, const char *key, struct jx *jobject )
+{
+	write_type(w,'M');
+	write_string(w,key);
+	write_value(w,jobject);
+	return w->ok;
+}
+
+int deltadb_history_write_update( struct deltadb_history_writer *w, const char *key, const char *name, struct jx *jvalue )
+{
+	write_type(w,'U');
+	write_string(w,key);
+	write_string(w,name);
+	write_value(w,jvalue);
+	return w->ok;
+}
+
+int deltadb_history_write_remove( struct deltadb_history_writer *w, const char *key, const char *name )
+{
+	write_type(w,'R');
+	write_string(w,key);
+	write_string(w,name);
+	return w->ok;
+}
+
+int deltadb_history_write_time( struct deltadb_history_writer *w, time_t current )
+{
+	int64_t t = current;
+	write_type(w,'T');
+	write_data(w,&t,sizeof(t));
+	return w->ok;
+}
+
+int deltadb_history_writer_close( struct deltadb_history_writer *w, uint64_t log_size )
+{
+	int ok = w->ok;
+
+	if(ok) {
+		struct deltadb_history_header header;
+		memset(&header,0,sizeof(header));
+		memcpy(header.magic,DELTADB_HISTORY_MAGIC,sizeof(header.magic));
+		header.version = DELTADB_HISTORY_VERSION;
+		header.log_size = log_size;
+		header.size = ftell(w->file);
+
+		ok = fseek(w->file,0,SEEK_SET)==0 && fwrite(&header,sizeof(header),1,w->file)==1;
+	}
+
+	if(fclose(w->file)!=0) ok = 0;
+	if(w->scratch) fclose(w->scratch);
+	free(w->buffer);
+	free(w);
+
+	if(!ok && !errno) errno = EINVAL;
+
+	return ok;
+}
+
+struct deltadb_history * deltadb_history_open( const char *filename )
+{
+	int fd = open(filename,O_RDONLY);
+	if(fd<0) return 0;
+
+	struct stat info;
+	if(fstat(fd,&info)<0) {
+		close(fd);
+		return 0;
+	}
+
+	if((size_t)info.st_size<sizeof(struct deltadb_history_header)) {
+		close(fd);
+		errno = EINVAL;
+		return 0;
+	}
+
+	void *data = mmap(NULL,info.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+
+	if(data==MAP_FAILED) return 0;
+
+	/* Anything else, such as a log, is quietly refused, but a damaged history is reported. */
+	const struct deltadb_history_header *header = data;
+	int is_history = !memcmp(header->magic,DELTADB_HISTORY_MAGIC,sizeof(header->magic));
+	if(!is_history || header->version!=DELTADB_HISTORY_VERSION || header->size!=(uint64_t)info.st_size) {
+		if(is_history) debug(D_NOTICE,"%s is not a valid history",filename);
+		munmap(data,info.st_size);
+		errno = EINVAL;
+		return 0;
+	}
+
+	struct deltadb_history *h = xxmalloc(sizeof(*h));
+	h->data = data;
+	h->size = info.st_size;
+	h->log_size = header->log_size;
+
+	return h;
+}
+
+uint64_t deltadb_history_log_size( struct deltadb_history *h )
+{
+	return h->log_size;
+}
+
+void deltadb_history_close( struct deltadb_history *h )
+{
+	if(!h) return;
+
+	munmap((void*)h->data,h->size);
+	free(h);
+}
+
+struct deltadb_history_reader {
+	const char *data;
+	size_t size;
+	size_t offset;
+};
+
+static int read_data( struct deltadb_history_reader *r, void *data, size_t length )
+{
+	if(length>r->size-r->offset) return 0;
+	memcpy(data,r->data+r->offset,length);
+	r->offset += length;
+	return 1;
+}
+
+/* Strings are used in place, and so must end with the null that the writer put there. */
+
+static const char * read_string( struct deltadb_history_reader *r )
+{
+	uint32_t length;
+	if(!read_data(r,&length,sizeof(length))) return 0;
+	if(length>=r->size-r->offset || r->data[r->offset+length]) return 0;
+
+	const char *str = r->data+r->offset;
+	r->offset += length+1;
+	return str;
+}
+
+/* Values are located but not decoded, so that skipped events cost nothing more. */
+
+static int read_value( struct deltadb_history_reader *r, const char **data, uint32_t *length )
+{
+	if(!read_data(r,length,sizeof(*length))) return 0;
+	if(*length>r->size-r->offset) return 0;
+
+	*data = r->data+r->offset;
+	r->offset += *length;
+	return 1;
+}
+
+/* Unlike a log, a history cannot be read past a damaged event, so the rest of it is skipped. */
+
+static int corrupt_data( struct deltadb_history_reader *r )
+{
+	fprintf(stderr,"corrupt history data at offset %llu\n",(unsigned long long)r->offset);
+	return 1;
+}
+
+int deltadb_process_history( struct deltadb *db, struct deltadb_history *h, time_t starttime, time_t stoptime )
+{
+	struct deltadb_history_reader reader;
+	struct deltadb_history_reader *r = &reader;
+
+	r->data = h->data;
+	r->size = h->size;
+	r->offset = sizeof(struct deltadb_history_header);
+
+	const char *key, *name, *value;
+	uint32_t length;
+	struct jx *jvalue;
+	int64_t current;
+	char type;
+
+	while(r->offset<r->size) {
+		read_data(r,&type,1);
+
+		if(type=='C') {
+			if(!(key = read_string(r)) || !read_value(r,&value,&length)) return corrupt_data(r);
+
+			jvalue = jx_binary_decode(value,length);
+			if(!jvalue) return corrupt_data(r);
+
+			if(!deltadb_create_event(db,key,jvalue)) return 1;
+
+		} else if(type=='D') {
+			if(!(key = read_string(r))) return corrupt_data(r);
+
+			if(!deltadb_delete_event(db,key)) return 1;
+
+		} else if(type=='M') {
+			if(!(key = read_string(r)) || !read_value(r,&value,&length)) return corrupt_data(r);
+
+			if(!deltadb_has_key(db,key)) continue;
+
+			jvalue = jx_binary_decode(value,length);
+			if(!jvalue) return corrupt_data(r);
+
+			if(!deltadb_merge_event(db,key,jvalue)) return 1;
+
+		} else if(type=='U') {
+			if(!(key = read_string(r)) || !(name = read_string(r)) || !read_value(r,&value,&length)) return corrupt_data(r);
+
+			if(!deltadb_has_key(db,key)) continue;
+
+			jvalue = jx_binary_decode(value,length);
+			if(!jvalue) return corrupt_data(r);
+
+			if(!deltadb_update_event(db,key,name,jvalue)) return 1;
+
+		} else if(type=='R') {
+			if(!(key = read_string(r)) || !(name = read_string(r))) return corrupt_data(r);
+
+			if(!deltadb_remove_event(db,key,name)) return 1;
+
+		} else if(type=='T') {
+			if(!read_data(r,&current,sizeof(current))) return corrupt_data(r);
+
+			if(!deltadb_time_event(db,starttime,stoptime,current)) return 1;
+
+			if(stoptime && current>stoptime) return 0;
+
+		} else {
+			return corrupt_data(r);
+		}
+	}
+
+	return 1;
+}
+
+/* vim: set noexpandtab tabstop=4: */
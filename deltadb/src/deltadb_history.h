@@ -0,0 +1,60 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef DELTADB_HISTORY_H
+#define DELTADB_HISTORY_H
+
+/*
+A history file is the compacted form of one day of a deltadb log,
+written as DAY.hist alongside DAY.log by deltadb_compact_log.
+It holds the same events as the log, in the same order, but each
+value is stored in the binary form of jx_binary, and each value is
+preceded by its length, so that a reader may skip the events of a
+record without decoding them.  The header records the size of the
+log that was compacted, so that a history is only used in place of
+a log that has not changed since.
+*/
+
+#include "jx.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+struct deltadb;
+
+/*
+Ask the program whether a record is present in its table.
+The reader skips merge, update, and remove events of records
+that are not present, which were deleted or never passed the filter.
+*/
+
+int deltadb_has_key( struct deltadb *db, const char *key );
+
+struct deltadb_history_writer * deltadb_history_writer_create( const char *filename );
+int deltadb_history_write_create( struct deltadb_history_writer *w, const char *key, struct jx *jobject );
+int deltadb_history_write_delete( struct deltadb_history_writer *w, const char *key );
+int deltadb_history_write_merge( struct deltadb_history_writer *w, const char *key, struct jx *jobject );
+int deltadb_history_write_update( struct deltadb_history_writer *w, const char *key, const char *name, struct jx *jvalue );
+int deltadb_history_write_remove( struct deltadb_history_writer *w, const char *key, const char *name );
+int deltadb_history_write_time( struct deltadb_history_writer *w, time_t current );
+
+/* Finish the history, recording the size of the log it came from, and close it. */
+int deltadb_history_writer_close( struct deltadb_history_writer *w, uint64_t log_size );
+
+struct deltadb_history * deltadb_history_open( const char *filename );
+uint64_t deltadb_history_log_size( struct deltadb_history *h );
+void deltadb_history_close( struct deltadb_history *h );
+
+/*
+Play the events of a history, exactly as deltadb_process_stream plays
+the events of the log it came from, except that deltadb_post_event is not
+called, as there are no lines to pass to it.
+*/
+
+int deltadb_process_history( struct deltadb *db, struct deltadb_history *h, time_t starttime, time_t stoptime );
+
+#endif
@@ -5,12 +5,15 @@ See the file COPYING for details.
 */
 
 #include "deltadb_stream.h"
+#include "deltadb_history.h"
 #include "deltadb_reduction.h"
 
+#include "jx_compile.h"
 #include "jx_eval.h"
 #include "jx_database.h"
 #include "jx_print.h"
 #include "jx_parse.h"
+#include "jx_snapshot.h"
 
 #include "hash_table.h"
 #include "debug.h"
@@ -36,8 +39,8 @@ struct deltadb {
 	const char *logdir;
 	FILE *logfile;
 	int epoch_mode;
-	struct jx *filter_expr;
-	struct jx *where_expr;
+	struct jx_program *filter_program;
+	struct jx_program *where_program;
 	struct list * output_exprs;
 	struct list * reduce_exprs;
 	time_t display_every;
@@ -57,14 +60,33 @@ struct deltadb * deltadb_create( const char *logdir )
 	return db;
 }
 
-int deltadb_boolean_expr( struct jx *expr, struct jx *data )
+void deltadb_delete( struct deltadb *db )
 {
-	if(!expr) return 1;
+	char *key;
+	struct jx *j;
+
+	hash_table_firstkey(db->table);
+	while(hash_table_nextkey(db->table,&key,(void**)&j)) {
+		jx_delete(j);
+	}
+	hash_table_delete(db->table);
+
+	if(db->where_program) jx_program_delete(db->where_program);
+	if(db->filter_program) jx_program_delete(db->filter_program);
 
-	struct jx *j = jx_eval(expr,data);
-	int result = j && !jx_istype(j, JX_ERROR) && j->type==JX_BOOLEAN && j->u.boolean_value;
-	jx_delete(j);
-	return result;
+	free(db);
+}
+
+/*
+The filter and where expressions are evaluated against every record of the
+history, and so are compiled once with jx_compile.
+*/
+
+int deltadb_boolean_expr( struct jx_program *program, struct jx *data )
+{
+	if(!program) return 1;
+
+	return jx_program_istrue(program,data);
 }
 
 /*
@@ -84,7 +106,7 @@ static int compat_checkpoint_read( struct deltadb *db, const char *filename )
 				nvpair_delete(hash_table_remove(db->table,key));
 				struct jx *j = nvpair_to_jx(nv);
 				/* skip objects that don't match the filter */
-				if(deltadb_boolean_expr(db->filter_expr,j)) {
+				if(deltadb_boolean_expr(db->filter_program,j)) {
 					hash_table_insert(db->table,key,j);
 				} else {
 					jx_delete(j);
@@ -102,10 +124,63 @@ static int compat_checkpoint_read( struct deltadb *db, const char *filename )
 	return 1;
 }
 
+/* Delete every record of the table, leaving it empty. */
+
+static void table_clear( struct hash_table *table )
+{
+	char *key;
+	struct jx *j;
+
+	hash_table_firstkey(table);
+	while(hash_table_nextkey(table,&key,(void**)&j)) {
+		jx_delete(j);
+	}
+	hash_table_clear(table);
+}
+
+/*
+Read a checkpoint written as a snapshot, which
+decodes each record from the binary form rather than parsing JSON.
+A corrupt snapshot leaves the table empty and returns false, so that
+the checkpoint it was written from is read instead.
+*/
+
+static int snapshot_checkpoint_read( struct deltadb *db, const char *filename )
+{
+	struct jx_snapshot *s = jx_snapshot_open(filename);
+	if(!s) return 0;
+
+	int i;
+	for(i=0;i<jx_snapshot_size(s);i++) {
+		const char *key = jx_snapshot_key(s,i);
+		struct jx *j = jx_snapshot_value(s,i);
+		if(!key || !j) {
+			jx_delete(j);
+			jx_snapshot_close(s);
+			table_clear(db->table);
+			return 0;
+		}
+		/* skip objects that don't match the filter */
+		if(deltadb_boolean_expr(db->filter_program,j)) {
+			hash_table_insert(db->table,key,j);
+		} else {
+			jx_delete(j);
+		}
+	}
+
+	jx_snapshot_close(s);
+
+	return 1;
+}
+
 /* Get a complete checkpoint file and reconstitute the state of the table. */
 
 static int checkpoint_read( struct deltadb *db, const char *filename )
 {
+	if(jx_snapshot_check(filename)) {
+		return snapshot_checkpoint_read(db,filename);
+	}
+
 	FILE * file = fopen(filename,"r");
 	if(!file) return 0;
 
@@ -126,7 +201,7 @@ static int checkpoint_read( struct deltadb *db, const char *filename )
 	struct jx_pair *p;
 	for(p=jcheckpoint->u.pairs;p;p=p->next) {
 		if(p->key->type!=JX_STRING) continue;
-		if(!deltadb_boolean_expr(db->filter_expr,p->value)) continue;
+		if(!deltadb_boolean_expr(db->filter_program,p->value)) continue;
 		hash_table_insert(db->table,p->key->u.string_value,p->value);
 		p->value = 0;
 	}
@@ -154,7 +229,7 @@ static void display_reduce_exprs( struct deltadb *db, time_t current )
 	while(hash_table_nextkey(db->table,&key,(void**)&jobject)) {
 
 		/* Skip if the where expression doesn't match */
-		if(!deltadb_boolean_expr(db->where_expr,jobject)) continue;
+		if(!deltadb_boolean_expr(db->where_program,jobject)) continue;
 
 		/* Update each reduction with its value. */
 		list_first_item(db->reduce_exprs);
@@ -206,7 +281,7 @@ static void display_output_exprs( struct deltadb *db, time_t current )
 
 		/* Skip if the where expression doesn't match */
 
-		if(!deltadb_boolean_expr(db->where_expr,jobject)) continue;
+		if(!deltadb_boolean_expr(db->where_program,jobject)) continue;
 
 		/* Emit the current time */
 
@@ -248,7 +323,7 @@ static void display_deferred_time( struct deltadb *db )
 
 int deltadb_create_event( struct deltadb *db, const char *key, struct jx *jobject )
 {
-	if(!deltadb_boolean_expr(db->filter_expr,jobject)) {
+	if(!deltadb_boolean_expr(db->filter_program,jobject)) {
 		jx_delete(jobject);
 		return 1;
 	}
@@ -393,6 +468,11 @@ int deltadb_post_event( struct deltadb *db, const char *line )
 	return 1;
 }
 
+int deltadb_has_key( struct deltadb *db, const char *key )
+{
+	return hash_table_lookup(db->table,key)!=0;
+}
+
 static int is_leap_year( int y )
 {
 	return (y%400==0) || ( (y%4==0) && (y%100!=0) );
@@ -407,6 +487,41 @@ static int days_in_year( int y )
 	}
 }
 
+/*
+A day compacted by deltadb_compact_log has a snapshot of its checkpoint
+and a history of its log, which are read in their place while they
+are up to date.  A snapshot is up to date if it is no older than its
+checkpoint, and a history if its log is still the size it was compacted at.
+*/
+
+static int is_compacted( const char *filename, const char *original )
+{
+	struct stat info, original_info;
+	if(stat(filename,&info)<0) return 0;
+	if(stat(original,&original_info)<0) return 1;
+	return info.st_mtime>=original_info.st_mtime;
+}
+
+static struct deltadb_history * history_open( struct deltadb *db, int year, int day )
+{
+	char *logname = string_format("%s/%d/%d.log",db->logdir,year,day);
+	char *histname = string_format("%s/%d/%d.hist",db->logdir,year,day);
+
+	struct deltadb_history *history = deltadb_history_open(histname);
+
+	struct stat info;
+	if(history && stat(logname,&info)==0 && (uint64_t)info.st_size!=deltadb_history_log_size(history)) {
+		debug(D_DEBUG,"%s is out of date with %s",histname,logname);
+		deltadb_history_close(history);
+		history = 0;
+	}
+
+	free(logname);
+	free(histname);
+
+	return history;
+}
+
 /*
 Play the log from starttime to stoptime by opening the appropriate
 checkpoint file and working ahead in the various log files.
@@ -427,28 +542,44 @@ static int log_play_time( struct deltadb *db, time_t starttime, time_t stoptime
 	int stopday = stoptm->tm_yday;
 
 	char *filename = string_format("%s/%d/%d.ckpt",db->logdir,year,day);
-	checkpoint_read(db,filename);
+	char *snapname = string_format("%s/%d/%d.snap",db->logdir,year,day);
+	if(!is_compacted(snapname,filename) || !checkpoint_read(db,snapname)) {
+		checkpoint_read(db,filename);
+	}
 	free(filename);
+	free(snapname);
 
 	while(1) {
-		char *filename = string_format("%s/%d/%d.log",db->logdir,year,day);
-		FILE *file = fopen(filename,"r");
-		if(!file) {
-			file_errors += 1;
-			fprintf(stderr,"couldn't open %s: %s\n",filename,strerror(errno));
-			free(filename);
-			if (file_errors>5)
-				break;
-
-		} else {
-			free(filename);
-			int keepgoing = deltadb_process_stream(db,file,starttime,stoptime);
+		struct deltadb_history *history = history_open(db,year,day);
+		if(history) {
+			int keepgoing = deltadb_process_history(db,history,starttime,stoptime);
 			starttime = 0;
 
-			fclose(file);
+			deltadb_history_close(history);
 
-			// If we reached the endtime in the file, stop.
+			// If we reached the endtime in the history, stop.
 			if(!keepgoing) break;
+
+		} else {
+			char *filename = string_format("%s/%d/%d.log",db->logdir,year,day);
+			FILE *file = fopen(filename,"r");
+			if(!file) {
+				file_errors += 1;
+				fprintf(stderr,"couldn't open %s: %s\n",filename,strerror(errno));
+				free(filename);
+				if (file_errors>5)
+					break;
+
+			} else {
+				free(filename);
+				int keepgoing = deltadb_process_stream(db,file,starttime,stoptime);
+				starttime = 0;
+
+				fclose(file);
+
+				// If we reached the endtime in the file, stop.
+				if(!keepgoing) break;
+			}
 		}
 
 		day++;
@@ -665,8 +796,8 @@ int main( int argc, char *argv[] )
 
 	struct deltadb *db = deltadb_create(dbdir);
 
-	db->where_expr = where_expr;
-	db->filter_expr = filter_expr;
+	db->where_program = where_expr ? jx_compile(where_expr) : 0;
+	db->filter_program = filter_expr ? jx_compile(filter_expr) : 0;
 	db->epoch_mode = epoch_mode;
 	db->output_exprs = output_exprs;
 	db->reduce_exprs = reduce_exprs;
@@ -677,6 +808,7 @@ int main( int argc, char *argv[] )
 		struct deltadb_reduction *r = list_peek_head(db->reduce_exprs);
 		const char *name = jx_print_string(list_peek_head(db->output_exprs));
 		fprintf(stderr,"deltadb_query: cannot mix reductions like 'MAX(%s)' with plain outputs like '%s'\n",jx_print_string(r->expr),name);
+		deltadb_delete(db);
 		return 1;
 	}
 
@@ -689,9 +821,18 @@ int main( int argc, char *argv[] )
 	}
 
 	if(dbfile) {
+		struct deltadb_history *history = deltadb_history_open(dbfile);
+		if(history) {
+			deltadb_process_history(db,history,start_time,stop_time);
+			deltadb_history_close(history);
+			deltadb_delete(db);
+			return 0;
+		}
+
 		FILE *file = fopen(dbfile,"r");
 		if(!file) {
 			fprintf(stderr,"deltadb_query: couldn't open %s: %s\n",dbfile,strerror(errno));
+			deltadb_delete(db);
 			return 1;
 		}
 		deltadb_process_stream(db,file,start_time,stop_time);
@@ -700,5 +841,7 @@ int main( int argc, char *argv[] )
 		log_play_time(db,start_time,stop_time);
 	}
 
+	deltadb_delete(db);
+
 	return 0;
 }
@@ -0,0 +1,106 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+# The days are found by local time, so the test runs in UTC, where
+# 2020-03-01 is day 60 of the year, and starts at 1583020800.
+export TZ=UTC
+
+dbdir=compact.db
+text=compact.text
+compacted=compact.compacted
+alone=compact.alone
+
+prepare()
+{
+	mkdir -p $dbdir/2020
+
+	cat > $dbdir/2020/60.ckpt <<EOF
+{"host1":{"name":"host1","type":"wq_master","load":1,"tasks":[1,2]},"host2":{"name":"host2","type":"chirp","load":2.5}}
+EOF
+
+	cat > $dbdir/2020/60.log <<EOF
+T 1583024400
+U host1 load 3
+C host3 {"name":"host3","type":"wq_master","load":0,"owner":"alice"}
+T 1583031600
+M host2 {"load":4,"free":"yes"}
+R host1 tasks
+T 1583038800
+D host3
+U host2 name "host2.local"
+T 1583046000
+U host1 load 5
+EOF
+
+	cat > $dbdir/2020/61.log <<EOF
+T 1583110800
+C host4 {"name":"host4","type":"wq_master","load":7}
+U host1 load 6
+T 1583118000
+D host2
+R host4 load
+T 1583125200
+M host1 {"load":8,"owner":"bob"}
+EOF
+
+	return 0
+}
+
+# Query the whole of both days.
+query()
+{
+	../src/deltadb_query --db $dbdir --from 2020-03-01 --to "2020-03-02 23:00:00" --epoch "$@"
+}
+
+# Print the same queries of the database, one after the other.
+queries()
+{
+	query || return 1
+	query --output name --output load --every 1h || return 1
+	query --output 'MAX(load)' --output 'COUNT(name)' --every 2h || return 1
+	query --output name --output owner --where 'type=="wq_master"' --every 3h || return 1
+	query --filter 'type=="wq_master"' || return 1
+	../src/deltadb_query --db $dbdir --from "2020-03-01 05:00:00" --to "2020-03-02 02:00:00" --epoch --output name --output load --every 1h || return 1
+
+	return 0
+}
+
+run()
+{
+	queries > $text || return 1
+
+	# The output must not be empty, or the comparisons below prove nothing.
+	[ "$(grep -c host $text)" -gt 10 ] || return 1
+
+	../src/deltadb_compact_log $dbdir/2020/60.log $dbdir/2020/61.log || return 1
+	[ -f $dbdir/2020/60.hist -a -f $dbdir/2020/60.snap -a -f $dbdir/2020/61.hist ] || return 1
+
+	queries > $compacted || return 1
+	diff $text $compacted || return 1
+
+	# Without the logs and the checkpoint, only the compacted forms can be read.
+	mkdir -p $dbdir.orig
+	mv $dbdir/2020/60.log $dbdir/2020/61.log $dbdir/2020/60.ckpt $dbdir.orig
+	queries > $alone || return 1
+	diff $text $alone || return 1
+
+	# A log appended after it was compacted is read in place of its history.
+	mv $dbdir.orig/* $dbdir/2020
+	echo "T 1583128800" >> $dbdir/2020/61.log
+	echo "U host4 load 9" >> $dbdir/2020/61.log
+	queries > $compacted || return 1
+	grep -q "U host4 load 9" $compacted || return 1
+
+	return 0
+}
+
+clean()
+{
+	rm -rf $dbdir $dbdir.orig $text $compacted $alone
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
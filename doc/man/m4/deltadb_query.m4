@@ -65,6 +65,15 @@ LONGCODE_BEGIN
 % deltadb_query --file wq.data --from 2014-01-01 --output 'COUNT(name)' --output 'MAX(tasks_running)'
 LONGCODE_END
 
+Queries over days that are complete can be accelerated by compacting them with BOLD(deltadb_compact_log),
+which writes each DAY.log in a binary form as DAY.hist, and each DAY.ckpt as a snapshot DAY.snap, alongside the originals.
+BOLD(deltadb_query) reads these in place of the originals while they are up to date, and gives the same results.
+Updates to records that do not match the --filter expression are then skipped without being decoded. For example:
+
+LONGCODE_BEGIN
+% deltadb_compact_log /data/catalog.history/2014/*.log
+LONGCODE_END
+
 SECTION(COPYRIGHT)
 
 COPYRIGHT_BOILERPLATE
@@ -50,6 +50,7 @@ OPTIONS_BEGIN
 OPTION_ITEM(`-a, --advertise')Advertise the master information to a catalog server.
 OPTION_TRIPLET(-l, makeflow-log, logfile)Use this file for the makeflow log. (default is X.makeflowlog)
 OPTION_TRIPLET(-L, batch-log, logfile)Use this file for the batch system log. (default is X.PARAM(type)log)
+OPTION_ITEM(`--log-binary')Write a new makeflow log in a compact binary form, with periodic checkpoints so that recovery need not read the whole log. Use BOLD(makeflow_log_convert) to read it as text. An existing log is continued in the form it was begun in.
 OPTION_TRIPLET(-m, email, email)Email summary of workflow to address.
 OPTION_TRIPLET(-j, max-local, #)Max number of local jobs to run at once. (default is # of cores)
 OPTION_TRIPLET(-J, max-remote, #)Max number of remote jobs to run at once. (default is 1000 for -Twq, 100 otherwise)
@@ -199,8 +200,8 @@ SUBSECTION(Other Options)
 OPTIONS_BEGIN
 OPTION_ITEM(`-A, --disable-afs-check')Disable the check for AFS. (experts only)
 OPTION_ITEM(`-z, --zero-length-error')Force failure on zero-length output files.
-OPTION_TRIPLET(-g, gc, type)Enable garbage collection. (ref_cnt|on_demand|all)
-OPTION_PAIR(--gc-size, int)Set disk size to trigger GC. (on_demand only)
+OPTION_TRIPLET(-g, gc, type)Enable garbage collection. (ref_cnt|on_demand|size|all)
+OPTION_PAIR(--gc-size, int)Set disk size to trigger GC. (on_demand and size only)
 OPTION_TRIPLET(-G, gc-count, int)Set number of files to trigger GC. (ref_cnt only)
 OPTION_PAIR(--wrapper,script) Wrap all commands with this BOLD(script). Each rule's original recipe is appended to BOLD(script) or replaces the first occurrence of BOLD({}) in BOLD(script).
 OPTION_PAIR(--wrapper-input,file) Wrapper command requires this input file. This option may be specified more than once, defining an array of inputs. Additionally, each job executing a recipe has a unique integer identifier that replaces occurrences BOLD(%%) in BOLD(file).
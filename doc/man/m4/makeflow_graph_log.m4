@@ -15,6 +15,8 @@ The output graph is generated by using gnuplot to create a postscript
 file, which is then converted to the desired type using ImageMagick.
 The type of the output file is determined by the name, so any image
 type supported by ImageMagick can be selected.
+A binary log, written with the CODE(--log-binary) option of BOLD(makeflow),
+is first converted to text with BOLD(makeflow_log_convert).
 
 SECTION(OPTIONS)
 None.
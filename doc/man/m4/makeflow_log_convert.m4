@@ -0,0 +1,56 @@
+include(manual.h)dnl
+HEADER(makeflow_log_convert)
+
+SECTION(NAME)
+BOLD(makeflow_log_convert) - convert a binary makeflow log into a text log
+
+SECTION(SYNOPSIS)
+CODE(BOLD(makeflow_log_convert [options] PARAM(logfile) [PARAM(outfile)]))
+
+SECTION(DESCRIPTION)
+
+BOLD(makeflow_log_convert) converts a makeflow log written with the
+CODE(--log-binary) option of BOLD(makeflow) into the usual text form,
+and writes it to PARAM(outfile), or to the standard output if none is given.
+The checkpoints kept in a binary log to speed up recovery are left out,
+so that the result is the same as the log of a workflow run without
+CODE(--log-binary).  A log that is already in text form is copied as it is.
+
+BOLD(makeflow_monitor) and BOLD(makeflow_graph_log) use this tool to read binary logs.
+A program that follows a log as it grows can convert only the records
+written since its last look: with CODE(--resume) the output ends with a line
+CODE(# OFFSET) PARAM(offset), and giving that offset back with CODE(--start)
+converts the log from there.  A checkpoint that is still being written
+is not converted until it is finished.
+
+SECTION(OPTIONS)
+OPTIONS_BEGIN
+OPTION_TRIPLET(-s, start, offset)Start converting at PARAM(offset), as given by CODE(--resume).
+OPTION_ITEM(`-r, --resume')End the output with a line CODE(# OFFSET) PARAM(offset), giving the offset to start from the next time.
+OPTION_ITEM(`-v, --version')Show version string.
+OPTION_ITEM(`-h, --help')Show help text.
+OPTIONS_END
+
+SECTION(EXAMPLES)
+
+LONGCODE_BEGIN
+makeflow --log-binary big.makeflow
+makeflow_log_convert big.makeflow.makeflowlog big.log
+LONGCODE_END
+
+To convert the records added to a log since an earlier conversion:
+
+LONGCODE_BEGIN
+makeflow_log_convert --resume big.makeflow.makeflowlog > part1.log
+makeflow_log_convert --resume --start 32030 big.makeflow.makeflowlog > part2.log
+LONGCODE_END
+
+SECTION(COPYRIGHT)
+
+COPYRIGHT_BOILERPLATE
+
+SECTION(SEE ALSO)
+
+SEE_ALSO_MAKEFLOW
+
+FOOTER
@@ -12,6 +12,9 @@ CODE(makeflow_monitor) is simple BOLD(Makeflow) log monitor that displays the
 progress and statistics of a workflow based on the provided PARAM(makeflowlog).
 Once started, it will continually monitor the specified PARAM(makeflowlogs) for
 new events and update the progress display.
+A log written with the CODE(--log-binary) option of BOLD(makeflow) is read
+through BOLD(makeflow_log_convert), which converts only the records written
+since the display was last updated.
 
 SECTION(OPTIONS)
 OPTIONS_BEGIN
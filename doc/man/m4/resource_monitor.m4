@@ -102,6 +102,9 @@ OPTION_ITEM(`-h,--help')Show help text.
 OPTION_TRIPLET(-i,interval,n)Maximum interval between observations, in seconds (default=1).
 OPTION_ITEM(--pid=pid)Track pid instead of executing a command line (warning: less precise measurements).
 OPTION_ITEM(--accurate-short-processes)Accurately measure short running processes (adds overhead).
+OPTION_ITEM(--no-events-rings)Send every message from the monitored processes as a datagram (adds overhead).
+OPTION_ITEM(--no-proc-events)Find children by polling /proc, rather than from the fork events of the netlink process connector. (Events are used only when available, which usually requires root.)
+OPTION_ITEM(--cgroup-accounting)If the command runs in a cgroup v2 other than the root and that of the monitor, also measure its memory (including page cache) and cpu time from the cgroup, which accounts for processes that were not tracked.
 OPTION_TRIPLET(-c,sh,str)Read command line from CODE(str), and execute as '/bin/sh -c CODE(str)'.
 OPTION_TRIPLET(-l,limits-file,file)Use maxfile with list of var: value pairs for resource limits.
 OPTION_TRIPLET(-L,limits,string)String of the form `"var: value, var: value\' to specify resource limits. (Could be specified multiple times.)
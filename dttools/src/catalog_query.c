@@ -12,7 +12,7 @@ See the file COPYING for details.
 #include "http_query.h"
 #include "jx.h"
 #include "jx_parse.h"
-#include "jx_eval.h"
+#include "jx_compile.h"
 #include "xxmalloc.h"
 #include "stringtools.h"
 #include "debug.h"
@@ -28,6 +28,7 @@ See the file COPYING for details.
 struct catalog_query {
 	struct jx *data;
 	struct jx *filter_expr;
+	struct jx_program *filter_program;
 	struct jx_item *current;
 };
 
@@ -157,6 +158,7 @@ struct catalog_query *catalog_query_create(const char *hosts, struct jx *filter_
 			q->data = j;
 			q->current = j->u.items;
 			q->filter_expr = filter_expr;
+			q->filter_program = filter_expr ? jx_compile(filter_expr) : 0;
 
 			if(h->down) {
 				debug(D_DEBUG,"catalog server at %s is back up", h->host);
@@ -194,15 +196,8 @@ struct jx *catalog_query_read(struct catalog_query *q, time_t stoptime)
 
 		int keepit = 1;
 
-		if(q->filter_expr) {
-			struct jx * b;
-			b = jx_eval(q->filter_expr,q->current->value);
-			if(jx_istype(b, JX_BOOLEAN) && b->u.boolean_value) {
-				keepit = 1;
-			} else {
-				keepit = 0;
-			}
-			jx_delete(b);
+		if(q->filter_program) {
+			keepit = jx_program_istrue(q->filter_program,q->current->value);
 		} else {
 			keepit = 1;
 		}
@@ -222,6 +217,7 @@ struct jx *catalog_query_read(struct catalog_query *q, time_t stoptime)
 void catalog_query_delete(struct catalog_query *q)
 {
 	jx_delete(q->filter_expr);
+	jx_program_delete(q->filter_program);
 	jx_delete(q->data);
 	free(q);
 }
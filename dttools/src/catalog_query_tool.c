@@ -7,7 +7,6 @@ See the file COPYING for details.
 #include "catalog_query.h"
 #include "jx_pretty_print.h"
 #include "jx_parse.h"
-#include "jx_eval.h"
 #include "cctools.h"
 #include "debug.h"
 #include "getopt_aux.h"
@@ -117,17 +116,8 @@ int main(int argc, char *argv[])
 
 	printf("[\n");
 
+	// records are filtered by the compiled expression in catalog_query_read.
 	while((j = catalog_query_read(q, stoptime))) {
-		if(jexpr) {
-			struct jx *result = jx_eval(jexpr,j);
-			if(jx_istrue(result)) {
-				jx_delete(result);
-				// keepgoing
-			} else {
-				jx_delete(result);
-				continue;
-			}
-		}
 		if(first) {
 			first = 0;
 		} else {
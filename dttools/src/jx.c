@@ -5,6 +5,7 @@ See the file COPYING for details.
 */
 
 #include "jx.h"
+#include "jx_arena.h"
 #include "stringtools.h"
 #include "buffer.h"
 #include "xxmalloc.h"
@@ -15,9 +16,39 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <string.h>
 
+/*
+Values, pairs, items, and strings come from the arena set with
+jx_arena_set, if any, and otherwise from malloc. Those of an arena are
+released with the arena, so deleting them does nothing.
+*/
+
+static void * jx_alloc( size_t size )
+{
+	struct jx_arena *a = jx_arena_current();
+	return a ? jx_arena_alloc(a,size) : xxcalloc(1,size);
+}
+
+/* Allocate from the same place as owner, for memory that belongs to it. */
+static void * jx_alloc_for( const void *owner, size_t size )
+{
+	struct jx_arena *a = jx_arena_owner(owner);
+	return a ? jx_arena_alloc(a,size) : xxcalloc(1,size);
+}
+
+static char * jx_strdup( const char *s )
+{
+	struct jx_arena *a = jx_arena_current();
+	return a ? jx_arena_strdup(a,s) : xxstrdup(s);
+}
+
+static void jx_free( void *p )
+{
+	if(!jx_arena_owner(p)) free(p);
+}
+
 struct jx_pair * jx_pair( struct jx *key, struct jx *value, struct jx_pair *next )
 {
-	struct jx_pair *pair = calloc(1, sizeof(*pair));
+	struct jx_pair *pair = jx_alloc(sizeof(*pair));
 	pair->key = key;
 	pair->value = value;
 	pair->next = next;
@@ -26,7 +57,7 @@ struct jx_pair * jx_pair( struct jx *key, struct jx *value, struct jx_pair *next
 
 struct jx_item * jx_item( struct jx *value, struct jx_item *next )
 {
-	struct jx_item *item = calloc(1, sizeof(*item));
+	struct jx_item *item = jx_alloc(sizeof(*item));
 	item->value = value;
 	item->next = next;
 	return item;
@@ -35,8 +66,8 @@ struct jx_item * jx_item( struct jx *value, struct jx_item *next )
 struct jx_comprehension *jx_comprehension(const char *variable, struct jx *elements, struct jx *condition, struct jx_comprehension *next) {
 	assert(variable);
 	assert(elements);
-	struct jx_comprehension *comp = calloc(1, sizeof(*comp));
-	comp->variable = strdup(variable);
+	struct jx_comprehension *comp = jx_alloc(sizeof(*comp));
+	comp->variable = jx_strdup(variable);
 	comp->elements = elements;
 	comp->condition = condition;
 	comp->next = next;
@@ -45,7 +76,7 @@ struct jx_comprehension *jx_comprehension(const char *variable, struct jx *eleme
 
 static struct jx * jx_create( jx_type_t type )
 {
-	struct jx *j = xxcalloc(1, sizeof(*j));
+	struct jx *j = jx_alloc(sizeof(*j));
 	j->type = type;
 	return j;
 }
@@ -58,20 +89,28 @@ struct jx * jx_null()
 struct jx * jx_symbol( const char *symbol_name )
 {
 	struct jx *j = jx_create(JX_SYMBOL);
-	j->u.symbol_name = strdup(symbol_name);
+	j->u.symbol_name = jx_strdup(symbol_name);
 	return j;
 }
 
 struct jx * jx_string( const char *string_value )
 {
 	assert(string_value);
-	return jx_string_nocopy(strdup(string_value));
+	struct jx *j = jx_create(JX_STRING);
+	j->u.string_value = jx_strdup(string_value);
+	return j;
 }
 
 struct jx * jx_string_nocopy( char *string_value )
 {
 	struct jx *j = jx_create(JX_STRING);
 	j->u.string_value = string_value;
+
+	struct jx_arena *a = jx_arena_current();
+	if(a && !jx_arena_owner(string_value)) {
+		jx_arena_adopt(a,string_value);
+	}
+
 	return j;
 }
 
@@ -90,8 +129,7 @@ struct jx * jx_format( const char *fmt, ... )
 	buffer_dup(B, &str);
 	buffer_free(B);
 
-	j = jx_create(JX_STRING);
-	j->u.string_value = str;
+	j = jx_string_nocopy(str);
 
 	return j;
 }
@@ -163,23 +201,243 @@ struct jx * jx_arrayv( struct jx *value, ... )
 	return array;
 }
 
-struct jx * jx_lookup_guard( struct jx *j, const char *key, int *found )
+/*
+Objects are lists of pairs, which keeps the order of insertion but makes
+each lookup walk the list. Once a lookup walks past
+JX_OBJECT_INDEX_THRESHOLD pairs, the object gets an index from each string
+key to the first pair with that key, which jx_insert and jx_remove keep up
+to date. Code that pushes pairs directly onto the head of the list (as
+deltadb does) is caught up with by walking from the head to the head the
+index last saw. If that head is no longer in the list, the index is
+rebuilt.
+
+The index is an open addressing table of the pairs themselves, rather than
+a hash_table, so that the keys are not copied and removing and inserting a
+key, as merges do, does not allocate.
+*/
+
+#define JX_OBJECT_INDEX_THRESHOLD 16
+
+struct jx_object_slot {
+	unsigned hash;
+	struct jx_pair *pair;
+};
+
+struct jx_object_index {
+	struct jx_object_slot *slots;
+	unsigned capacity;
+	unsigned count;
+	struct jx_pair *head;
+	int duplicates;
+};
+
+static unsigned jx_object_hash( const char *key )
+{
+	/* FNV-1a */
+	unsigned hash = 2166136261u;
+	while(*key) {
+		hash ^= (unsigned char) *key++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int jx_pair_has_string_key( struct jx_pair *p )
+{
+	return p->key && p->key->type==JX_STRING;
+}
+
+static struct jx_object_slot * jx_object_index_slot( struct jx_object_index *index, const char *key, unsigned hash )
+{
+	unsigned i = hash & (index->capacity-1);
+
+	while(1) {
+		struct jx_object_slot *s = &index->slots[i];
+		if(!s->pair) return s;
+		if(s->hash==hash && !strcmp(s->pair->key->u.string_value,key)) return s;
+		i = (i+1) & (index->capacity-1);
+	}
+}
+
+static struct jx_pair * jx_object_index_lookup( struct jx_object_index *index, const char *key )
+{
+	return jx_object_index_slot(index,key,jx_object_hash(key))->pair;
+}
+
+static void jx_object_index_grow( struct jx_object_index *index )
+{
+	struct jx_object_slot *old = index->slots;
+	unsigned old_capacity = index->capacity;
+
+	index->capacity *= 2;
+	index->slots = jx_alloc_for(index,index->capacity*sizeof(*index->slots));
+
+	unsigned i;
+	for(i=0;i<old_capacity;i++) {
+		if(old[i].pair) {
+			*jx_object_index_slot(index,old[i].pair->key->u.string_value,old[i].hash) = old[i];
+		}
+	}
+
+	jx_free(old);
+}
+
+/* Make p the first pair with its key, as when it was just pushed. */
+static void jx_object_index_push( struct jx_object_index *index, struct jx_pair *p )
+{
+	if(!jx_pair_has_string_key(p)) return;
+
+	if(2*(index->count+1) > index->capacity) {
+		jx_object_index_grow(index);
+	}
+
+	const char *key = p->key->u.string_value;
+	unsigned hash = jx_object_hash(key);
+
+	struct jx_object_slot *s = jx_object_index_slot(index,key,hash);
+	if(s->pair) {
+		index->duplicates = 1;
+	} else {
+		index->count++;
+	}
+
+	s->hash = hash;
+	s->pair = p;
+}
+
+/* Remove the key of p, shifting back the slots of the same run so that lookups do not stop early. */
+static void jx_object_index_remove( struct jx_object_index *index, struct jx_pair *p )
+{
+	if(!jx_pair_has_string_key(p)) return;
+
+	unsigned mask = index->capacity-1;
+	struct jx_object_slot *s = jx_object_index_slot(index,p->key->u.string_value,jx_object_hash(p->key->u.string_value));
+	if(s->pair!=p) return;
+
+	unsigned hole = s - index->slots;
+	unsigned i = hole;
+
+	while(1) {
+		i = (i+1) & mask;
+		struct jx_object_slot *next = &index->slots[i];
+		if(!next->pair) break;
+
+		unsigned home = next->hash & mask;
+		if(((i-home) & mask) >= ((i-hole) & mask)) {
+			index->slots[hole] = *next;
+			hole = i;
+		}
+	}
+
+	index->slots[hole].pair = 0;
+	index->count--;
+}
+
+static void jx_object_index_delete( struct jx *j )
+{
+	if(!j->index) return;
+	jx_free(j->index->slots);
+	jx_free(j->index);
+	j->index = 0;
+}
+
+static void jx_object_index_build( struct jx *j )
+{
+	struct jx_pair *p;
+	unsigned count = 0;
+
+	for(p=j->u.pairs;p;p=p->next) count++;
+
+	struct jx_object_index *index = jx_alloc_for(j,sizeof(*index));
+	index->capacity = 2*JX_OBJECT_INDEX_THRESHOLD;
+	while(index->capacity < 2*count) index->capacity *= 2;
+	index->slots = jx_alloc_for(j,index->capacity*sizeof(*index->slots));
+	index->count = 0;
+	index->head = j->u.pairs;
+	index->duplicates = 0;
+
+	for(p=j->u.pairs;p;p=p->next) {
+		if(!jx_pair_has_string_key(p)) continue;
+
+		const char *key = p->key->u.string_value;
+		unsigned hash = jx_object_hash(key);
+
+		struct jx_object_slot *s = jx_object_index_slot(index,key,hash);
+		if(s->pair) {
+			index->duplicates = 1;
+		} else {
+			s->hash = hash;
+			s->pair = p;
+			index->count++;
+		}
+	}
+
+	j->index = index;
+}
+
+/* Bring the index up to date with pairs pushed directly onto the list. */
+static void jx_object_index_sync( struct jx *j )
 {
+	struct jx_object_index *index = j->index;
+	if(j->u.pairs==index->head) return;
+
+	int count = 0;
 	struct jx_pair *p;
+	for(p=j->u.pairs;p && p!=index->head;p=p->next) count++;
+
+	if(p!=index->head) {
+		jx_object_index_delete(j);
+		jx_object_index_build(j);
+		return;
+	}
+
+	/* push the new pairs oldest first, so that the newest shadows the rest. */
+	struct jx_pair **pushed = xxmalloc(count*sizeof(*pushed));
+	int i = 0;
+	for(p=j->u.pairs;p!=index->head;p=p->next) pushed[i++] = p;
+	while(i>0) jx_object_index_push(index,pushed[--i]);
+	free(pushed);
+
+	index->head = j->u.pairs;
+}
+
+/* Returns the first pair with the given key, indexing the object if the walk is long. */
+static struct jx_pair * jx_object_find( struct jx *j, const char *key )
+{
+	if(j->index) {
+		jx_object_index_sync(j);
+		return jx_object_index_lookup(j->index,key);
+	}
+
+	struct jx_pair *p;
+	int walked = 0;
+
+	for(p=j->u.pairs;p;p=p->next) {
+		if(jx_pair_has_string_key(p) && !strcmp(p->key->u.string_value,key)) {
+			break;
+		}
+		walked++;
+	}
 
+	if(walked>=JX_OBJECT_INDEX_THRESHOLD) {
+		jx_object_index_build(j);
+	}
+
+	return p;
+}
+
+struct jx * jx_lookup_guard( struct jx *j, const char *key, int *found )
+{
 	if(found)
 		*found = 0;
 
 	if(!j || j->type!=JX_OBJECT) return 0;
 
-	for(p=j->u.pairs;p;p=p->next) {
-		if(p && p->key && p->key->type==JX_STRING) {
-			if(!strcmp(p->key->u.string_value,key)) {
-				if(found)
-					*found = 1;
-				return p->value;
-			}
-		}
+	struct jx_pair *p = jx_object_find(j,key);
+	if(p) {
+		if(found)
+			*found = 1;
+		return p->value;
 	}
 
 	return 0;
@@ -230,6 +488,34 @@ double jx_lookup_double( struct jx *object, const char *key )
 	}
 }
 
+static struct jx * jx_object_unlink( struct jx *object, struct jx_pair *p, struct jx_pair *last )
+{
+	struct jx *value = p->value;
+
+	if(last) {
+		last->next = p->next;
+	} else {
+		object->u.pairs = p->next;
+	}
+
+	if(object->index) {
+		struct jx_object_index *index = object->index;
+		if(index->duplicates) {
+			/* an older pair with the same key may now be the first. */
+			jx_object_index_delete(object);
+		} else {
+			jx_object_index_remove(index,p);
+			index->head = object->u.pairs;
+		}
+	}
+
+	p->value = 0;
+	p->next = 0;
+	jx_pair_delete(p);
+
+	return value;
+}
+
 struct jx * jx_remove( struct jx *object, struct jx *key )
 {
 	if(!object || object->type!=JX_OBJECT) return 0;
@@ -237,18 +523,21 @@ struct jx * jx_remove( struct jx *object, struct jx *key )
 	struct jx_pair *p;
 	struct jx_pair *last = 0;
 
+	if(key && key->type==JX_STRING) {
+		struct jx_pair *target = jx_object_find(object,key->u.string_value);
+		if(!target) return 0;
+
+		/* only pointers are compared while looking for the pair before. */
+		for(p=object->u.pairs;p!=target;p=p->next) {
+			last = p;
+		}
+
+		return jx_object_unlink(object,target,last);
+	}
+
 	for(p=object->u.pairs;p;p=p->next) {
 		if(jx_equals(key,p->key)) {
-			struct jx *value = p->value;
-			if(last) {
-				last->next = p->next;
-			} else {
-				object->u.pairs = p->next;
-			}
-			p->value = 0;
-			p->next = 0;
-			jx_pair_delete(p);
-			return value;
+			return jx_object_unlink(object,p,last);
 		}
 		last = p;
 	}
@@ -259,7 +548,18 @@ struct jx * jx_remove( struct jx *object, struct jx *key )
 int jx_insert( struct jx *j, struct jx *key, struct jx *value )
 {
 	if(!j || j->type!=JX_OBJECT) return 0;
+
+	if(j->index) {
+		jx_object_index_sync(j);
+	}
+
 	j->u.pairs = jx_pair(key,value,j->u.pairs);
+
+	if(j->index) {
+		jx_object_index_push(j->index,j->u.pairs);
+		j->index->head = j->u.pairs;
+	}
+
 	return 1;
 }
 
@@ -342,7 +642,7 @@ struct jx *jx_array_concat( struct jx *array, ...) {
 		}
 		*tail = a->u.items;
 		while(*tail) tail = &(*tail)->next;
-		free(a);
+		jx_free(a);
 	}
 	va_end(ap);
 	return result;
@@ -355,7 +655,7 @@ struct jx *jx_array_shift(struct jx *array) {
 	if (i) {
 		result = i->value;
 		array->u.items = i->next;
-		free(i);
+		jx_free(i);
 	}
 	return result;
 
@@ -363,7 +663,7 @@ struct jx *jx_array_shift(struct jx *array) {
 
 void jx_pair_delete( struct jx_pair *pair )
 {
-	if(!pair) return;
+	if(!pair || jx_arena_owner(pair)) return;
 	jx_delete(pair->key);
 	jx_delete(pair->value);
 	jx_pair_delete(pair->next);
@@ -372,7 +672,7 @@ void jx_pair_delete( struct jx_pair *pair )
 
 void jx_item_delete( struct jx_item *item )
 {
-	if(!item) return;
+	if(!item || jx_arena_owner(item)) return;
 	jx_delete(item->value);
 	jx_comprehension_delete(item->comp);
 	jx_item_delete(item->next);
@@ -380,7 +680,7 @@ void jx_item_delete( struct jx_item *item )
 }
 
 void jx_comprehension_delete(struct jx_comprehension *comp) {
-	if (!comp) return;
+	if (!comp || jx_arena_owner(comp)) return;
 	free(comp->variable);
 	jx_delete(comp->elements);
 	jx_delete(comp->condition);
@@ -390,7 +690,7 @@ void jx_comprehension_delete(struct jx_comprehension *comp) {
 
 void jx_delete( struct jx *j )
 {
-	if(!j) return;
+	if(!j || jx_arena_owner(j)) return;
 
 	switch(j->type) {
 		case JX_DOUBLE:
@@ -408,6 +708,7 @@ void jx_delete( struct jx *j )
 			jx_item_delete(j->u.items);
 			break;
 		case JX_OBJECT:
+			jx_object_index_delete(j);
 			jx_pair_delete(j->u.pairs);
 			break;
 		case JX_OPERATOR:
@@ -506,9 +807,9 @@ int jx_equals( struct jx *j, struct jx *k )
 
 struct jx_comprehension *jx_comprehension_copy(struct jx_comprehension *c) {
 	if (!c) return NULL;
-	struct jx_comprehension *comp = calloc(1, sizeof(*comp));
+	struct jx_comprehension *comp = jx_alloc(sizeof(*comp));
 	comp->line = c->line;
-	comp->variable = strdup(c->variable);
+	comp->variable = jx_strdup(c->variable);
 	comp->elements = jx_copy(c->elements);
 	comp->condition = jx_copy(c->condition);
 	comp->next = jx_comprehension_copy(c->next);
@@ -518,7 +819,7 @@ struct jx_comprehension *jx_comprehension_copy(struct jx_comprehension *c) {
 struct jx_pair * jx_pair_copy( struct jx_pair *p )
 {
 	if (!p) return NULL;
-	struct jx_pair *pair = calloc(1, sizeof(*pair));
+	struct jx_pair *pair = jx_alloc(sizeof(*pair));
 	pair->key = jx_copy(p->key);
 	pair->value = jx_copy(p->value);
 	pair->next = jx_pair_copy(p->next);
@@ -529,7 +830,7 @@ struct jx_pair * jx_pair_copy( struct jx_pair *p )
 struct jx_item * jx_item_copy( struct jx_item *i )
 {
 	if (!i) return NULL;
-	struct jx_item *item = calloc(1, sizeof(*item));
+	struct jx_item *item = jx_alloc(sizeof(*item));
 	item->line = i->line;
 	item->value = jx_copy(i->value);
 	item->comp = jx_comprehension_copy(i->comp);
@@ -569,6 +870,7 @@ struct jx  *jx_copy( struct jx *j )
 			break;
 		case JX_OPERATOR:
 			c = jx_operator(j->u.oper.type, jx_copy(j->u.oper.left), jx_copy(j->u.oper.right));
+			c->u.oper.line = j->u.oper.line;
 			break;
 		case JX_ERROR:
 			c = jx_error(jx_copy(j->u.err));
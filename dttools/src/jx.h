@@ -124,6 +124,10 @@ struct jx {
 		struct jx_operator oper; /**< value of @ref JX_OPERATOR */
 		struct jx *err;  /**< error value of @ref JX_ERROR */
 	} u;
+	/** Private index of the keys of a large @ref JX_OBJECT, built by lookups.
+	Pairs may be pushed directly onto the head of u.pairs, but must be taken
+	out with @ref jx_remove so that the index stays in sync. */
+	struct jx_object_index *index;
 };
 
 /** Create a JX null value. @return A JX expression. */
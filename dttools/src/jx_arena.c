@@ -0,0 +1,230 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx_arena.h"
+#include "debug.h"
+#include "itable.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+An arena hands out memory from chunks by bumping a pointer. Chunks are
+aligned to their size, and every chunk of every arena is registered in
+jx_arena_chunks by its number (its address shifted by JX_ARENA_CHUNK_BITS),
+so that jx_arena_owner can tell in constant time whether a pointer was
+allocated from an arena, which jx_delete needs to know. Allocations larger
+than a quarter of a chunk get blocks of their own, registered in the same
+way.
+*/
+
+#define JX_ARENA_CHUNK_BITS 16
+#define JX_ARENA_CHUNK_SIZE (1<<JX_ARENA_CHUNK_BITS)
+#define JX_ARENA_ALIGN 8
+
+struct jx_arena_block {
+	char *base;
+	size_t size;
+};
+
+struct jx_arena {
+	struct jx_arena_block *chunks;
+	int chunks_count;
+	int chunks_capacity;
+	int chunk;
+
+	char *next;
+	char *limit;
+
+	struct jx_arena_block *large;
+	int large_count;
+	int large_capacity;
+
+	void **adopted;
+	int adopted_count;
+	int adopted_capacity;
+
+	uint64_t size;
+};
+
+static struct itable *jx_arena_chunks = 0;
+static struct jx_arena *jx_arena_active = 0;
+
+static void jx_arena_grow( void **array, int *capacity, size_t element_size )
+{
+	*capacity = *capacity ? 2*(*capacity) : 16;
+	*array = xxrealloc(*array, (*capacity)*element_size);
+}
+
+static char *jx_arena_block_create( struct jx_arena *a, size_t size )
+{
+	void *base;
+	if(posix_memalign(&base, JX_ARENA_CHUNK_SIZE, size)) {
+		fatal("out of memory");
+	}
+
+	if(!jx_arena_chunks) {
+		jx_arena_chunks = itable_create(0);
+	}
+
+	uintptr_t n;
+	for(n = ((uintptr_t) base) >> JX_ARENA_CHUNK_BITS; n <= (((uintptr_t) base) + size - 1) >> JX_ARENA_CHUNK_BITS; n++) {
+		itable_insert(jx_arena_chunks, n, a);
+	}
+
+	return base;
+}
+
+static void jx_arena_block_delete( struct jx_arena_block *b )
+{
+	uintptr_t n;
+	for(n = ((uintptr_t) b->base) >> JX_ARENA_CHUNK_BITS; n <= (((uintptr_t) b->base) + b->size - 1) >> JX_ARENA_CHUNK_BITS; n++) {
+		itable_remove(jx_arena_chunks, n);
+	}
+
+	free(b->base);
+}
+
+struct jx_arena *jx_arena_create(void)
+{
+	struct jx_arena *a = xxcalloc(1, sizeof(*a));
+	a->chunk = -1;
+	return a;
+}
+
+void jx_arena_clear( struct jx_arena *a )
+{
+	int i;
+
+	for(i = 0; i < a->adopted_count; i++) {
+		free(a->adopted[i]);
+	}
+	a->adopted_count = 0;
+
+	for(i = 0; i < a->large_count; i++) {
+		jx_arena_block_delete(&a->large[i]);
+	}
+	a->large_count = 0;
+
+	a->chunk = -1;
+	a->next = 0;
+	a->limit = 0;
+	a->size = 0;
+}
+
+void jx_arena_delete( struct jx_arena *a )
+{
+	if(!a) return;
+
+	jx_arena_clear(a);
+
+	int i;
+	for(i = 0; i < a->chunks_count; i++) {
+		jx_arena_block_delete(&a->chunks[i]);
+	}
+
+	if(jx_arena_active == a) {
+		jx_arena_active = 0;
+	}
+
+	if(jx_arena_chunks && itable_size(jx_arena_chunks) == 0) {
+		itable_delete(jx_arena_chunks);
+		jx_arena_chunks = 0;
+	}
+
+	free(a->chunks);
+	free(a->large);
+	free(a->adopted);
+	free(a);
+}
+
+struct jx_arena *jx_arena_set( struct jx_arena *a )
+{
+	struct jx_arena *previous = jx_arena_active;
+	jx_arena_active = a;
+	return previous;
+}
+
+struct jx_arena *jx_arena_current(void)
+{
+	return jx_arena_active;
+}
+
+struct jx_arena *jx_arena_owner( const void *ptr )
+{
+	if(!jx_arena_chunks || !ptr) return 0;
+	return itable_lookup(jx_arena_chunks, ((uintptr_t) ptr) >> JX_ARENA_CHUNK_BITS);
+}
+
+void *jx_arena_alloc( struct jx_arena *a, size_t size )
+{
+	size = (size + JX_ARENA_ALIGN - 1) & ~((size_t) JX_ARENA_ALIGN - 1);
+	if(size == 0) size = JX_ARENA_ALIGN;
+
+	a->size += size;
+
+	if(size > JX_ARENA_CHUNK_SIZE/4) {
+		if(a->large_count == a->large_capacity) {
+			jx_arena_grow((void **) &a->large, &a->large_capacity, sizeof(*a->large));
+		}
+
+		size_t block_size = (size + JX_ARENA_CHUNK_SIZE - 1) & ~((size_t) JX_ARENA_CHUNK_SIZE - 1);
+
+		struct jx_arena_block *b = &a->large[a->large_count++];
+		b->base = jx_arena_block_create(a, block_size);
+		b->size = block_size;
+
+		memset(b->base, 0, size);
+		return b->base;
+	}
+
+	if(a->next + size > a->limit) {
+		a->chunk++;
+
+		if(a->chunk == a->chunks_count) {
+			if(a->chunks_count == a->chunks_capacity) {
+				jx_arena_grow((void **) &a->chunks, &a->chunks_capacity, sizeof(*a->chunks));
+			}
+
+			struct jx_arena_block *b = &a->chunks[a->chunks_count++];
+			b->base = jx_arena_block_create(a, JX_ARENA_CHUNK_SIZE);
+			b->size = JX_ARENA_CHUNK_SIZE;
+		}
+
+		a->next = a->chunks[a->chunk].base;
+		a->limit = a->next + JX_ARENA_CHUNK_SIZE;
+	}
+
+	void *p = a->next;
+	a->next += size;
+
+	memset(p, 0, size);
+	return p;
+}
+
+char *jx_arena_strdup( struct jx_arena *a, const char *s )
+{
+	size_t length = strlen(s) + 1;
+	char *c = jx_arena_alloc(a, length);
+	memcpy(c, s, length);
+	return c;
+}
+
+void jx_arena_adopt( struct jx_arena *a, void *ptr )
+{
+	if(a->adopted_count == a->adopted_capacity) {
+		jx_arena_grow((void **) &a->adopted, &a->adopted_capacity, sizeof(*a->adopted));
+	}
+	a->adopted[a->adopted_count++] = ptr;
+}
+
+uint64_t jx_arena_size( struct jx_arena *a )
+{
+	return a->size;
+}
+
+/* vim: set noexpandtab tabstop=4: */
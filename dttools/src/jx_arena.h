@@ -0,0 +1,88 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef JX_ARENA_H
+#define JX_ARENA_H
+
+/** @file jx_arena.h Regions for JX values.
+By default every value, pair, item, and string of a JX tree is allocated
+with malloc and released by @ref jx_delete. When an arena is set with
+@ref jx_arena_set, the values created by the JX library (by parsing,
+@ref jx_eval, @ref jx_copy, and the constructors in jx.h) are instead
+allocated from the arena, and are released all at once when the arena is
+cleared or deleted. For example, to filter a set of records:
+
+<pre>
+struct jx_arena *a = jx_arena_create();
+struct jx_arena *previous = jx_arena_set(a);
+
+for(...) {
+	struct jx *r = jx_eval(filter, record);
+	...
+	jx_arena_clear(a);
+}
+
+jx_arena_set(previous);
+jx_arena_delete(a);
+</pre>
+
+@ref jx_delete does nothing on values of an arena, so code written for
+values from malloc works unchanged. Values of an arena must not be used
+after the arena is cleared or deleted, and so must not be inserted into
+values that outlive it. Values created while an arena is set belong to
+the arena even when inserted into values from malloc. Arenas are not
+thread safe.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Create an empty arena. @return A new arena. */
+struct jx_arena *jx_arena_create(void);
+
+/** Release all the values of an arena and the arena itself.
+@param a The arena to delete. If it is set, no arena is set afterwards.
+*/
+void jx_arena_delete(struct jx_arena *a);
+
+/** Release all the values of an arena, keeping its memory for reuse.
+@param a The arena to clear.
+*/
+void jx_arena_clear(struct jx_arena *a);
+
+/** Allocate the values created from now on from an arena.
+@param a The arena to use, or null to allocate with malloc again.
+@return The arena that was set before, or null if none was set.
+*/
+struct jx_arena *jx_arena_set(struct jx_arena *a);
+
+/** Get the arena that values are currently allocated from. @return The arena set, or null. */
+struct jx_arena *jx_arena_current(void);
+
+/** Find the arena a value was allocated from.
+@param ptr A value, pair, item, or string of the JX library.
+@return The arena that owns ptr, or null if ptr was allocated with malloc.
+*/
+struct jx_arena *jx_arena_owner(const void *ptr);
+
+/** Allocate zeroed memory from an arena. @param a The arena. @param size The number of bytes. @return The memory allocated. */
+void *jx_arena_alloc(struct jx_arena *a, size_t size);
+
+/** Copy a string into an arena. @param a The arena. @param s The string to copy. @return The copy. */
+char *jx_arena_strdup(struct jx_arena *a, const char *s);
+
+/** Free memory from malloc when an arena is cleared or deleted.
+@param a The arena.
+@param ptr Memory allocated with malloc, now owned by the arena.
+*/
+void jx_arena_adopt(struct jx_arena *a, void *ptr);
+
+/** Get the number of bytes allocated from an arena since it was created or cleared. @param a The arena. @return The number of bytes. */
+uint64_t jx_arena_size(struct jx_arena *a);
+
+#endif
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,228 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Measures jx allocation with and without an arena. A set of records like
+those of the catalog is parsed, evaluated against a filter, and copied,
+and a list comprehension like those of makeflow JX workflows is expanded
+in a context with many definitions. Each workload is run with values from
+malloc, deleted with jx_delete, and with values from an arena, released
+with jx_arena_clear after each batch of records. The best time of the
+given number of runs is reported for each.
+*/
+
+#include "jx.h"
+#include "jx_arena.h"
+#include "jx_eval.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "stringtools.h"
+#include "timestamp.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int records_count = 100000;
+static int repeats       = 3;
+
+/* The arena is cleared after this many records, as a filter would after each batch. */
+#define BATCH 1000
+
+static void show_help(const char *cmd)
+{
+	printf("Usage: %s [options]\n", cmd);
+	printf("Where options are:\n");
+	printf("-n <n>  Number of records. (default: %d)\n", records_count);
+	printf("-r <n>  Number of runs per workload. (default: %d)\n", repeats);
+	printf("-h      Show this help screen.\n");
+}
+
+static char *make_record(int n)
+{
+	return string_format(
+		"{\"type\":\"wq_master\",\"name\":\"host%d.cluster.example.edu\",\"port\":%d,\"owner\":\"user%d\","
+		"\"project\":\"analysis-%d\",\"tasks_waiting\":%d,\"tasks_running\":%d,\"workers\":%d,"
+		"\"categories\":[{\"name\":\"default\",\"tasks\":%d},{\"name\":\"merge\",\"tasks\":%d}],"
+		"\"lastheardfrom\":%d,\"preferred\":true}",
+		n, 9000 + n % 1000, n % 97, n % 13, n % 500, n % 300, n % 64, n % 50, n % 7, 1600000000 + n);
+}
+
+static timestamp_t run_parse(char **texts, int n, struct jx_arena *arena)
+{
+	timestamp_t start = timestamp_get();
+
+	int i;
+	for(i = 0; i < n; i++) {
+		struct jx *j = jx_parse_string(texts[i]);
+		if(!j) return 0;
+		jx_delete(j);
+		if(arena && i % BATCH == BATCH - 1) jx_arena_clear(arena);
+	}
+
+	if(arena) jx_arena_clear(arena);
+
+	return timestamp_get() - start;
+}
+
+static timestamp_t run_eval(struct jx **records, int n, struct jx *filter, struct jx_arena *arena)
+{
+	timestamp_t start = timestamp_get();
+
+	int i, matches = 0;
+	for(i = 0; i < n; i++) {
+		struct jx *r = jx_eval(filter, records[i]);
+		if(jx_istrue(r)) {
+			matches++;
+		}
+		jx_delete(r);
+		if(arena && i % BATCH == BATCH - 1) jx_arena_clear(arena);
+	}
+
+	if(arena) jx_arena_clear(arena);
+
+	timestamp_t elapsed = timestamp_get() - start;
+
+	return matches > 0 ? elapsed : 0;
+}
+
+static timestamp_t run_copy(struct jx **records, int n, struct jx_arena *arena)
+{
+	timestamp_t start = timestamp_get();
+
+	int i;
+	for(i = 0; i < n; i++) {
+		jx_delete(jx_copy(records[i]));
+		if(arena && i % BATCH == BATCH - 1) jx_arena_clear(arena);
+	}
+
+	if(arena) jx_arena_clear(arena);
+
+	return timestamp_get() - start;
+}
+
+static timestamp_t run_comprehension(struct jx *expr, struct jx *context, int n, struct jx_arena *arena)
+{
+	timestamp_t start = timestamp_get();
+
+	struct jx *r = jx_eval(expr, context);
+	int ok = jx_istype(r, JX_ARRAY) && jx_array_length(r) == n;
+	jx_delete(r);
+
+	if(arena) jx_arena_clear(arena);
+
+	timestamp_t elapsed = timestamp_get() - start;
+
+	return ok ? elapsed : 0;
+}
+
+static void keep_best(timestamp_t *best, timestamp_t t)
+{
+	if(t && (!*best || t < *best)) *best = t;
+}
+
+static void report(const char *workload, timestamp_t heap, timestamp_t arena)
+{
+	if(!heap || !arena) {
+		printf("%-14s failed\n", workload);
+	} else {
+		printf("%-14s %10.3f s %10.3f s %8.2fx\n", workload, heap / 1000000.0, arena / 1000000.0, ((double) heap) / arena);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	while((c = getopt(argc, argv, "n:r:h")) != -1) {
+		switch(c) {
+		case 'n':
+			records_count = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if(records_count < 1 || repeats < 1) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	char **texts = malloc(records_count * sizeof(*texts));
+	struct jx **records = malloc(records_count * sizeof(*records));
+
+	int i;
+	for(i = 0; i < records_count; i++) {
+		texts[i] = make_record(i);
+		records[i] = jx_parse_string(texts[i]);
+	}
+
+	struct jx *filter = jx_parse_string("type==\"wq_master\" && tasks_waiting+tasks_running>100 && owner==\"user\"+\"1\" && workers>2");
+
+	/* a workflow context with many definitions, and a rule per element. */
+	struct jx *context = jx_object(NULL);
+	for(i = 0; i < 200; i++) {
+		char *key = string_format("DEFINITION_%d", i);
+		jx_insert_string(context, key, "/some/path/to/a/file");
+		free(key);
+	}
+	char *text = string_format("[{\"command\":\"./sim -n \"+N+\" > out.\"+N, \"outputs\":[\"out.\"+N], \"inputs\":[\"sim\"]} for N in range(%d)]", records_count / 10);
+	struct jx *comprehension = jx_parse_string(text);
+	free(text);
+
+	printf("records: %d\n", records_count);
+	printf("%-14s %12s %12s %9s\n", "workload", "malloc", "arena", "speedup");
+
+	struct jx_arena *arena = jx_arena_create();
+
+	timestamp_t parse[2] = {0, 0}, eval[2] = {0, 0}, copy[2] = {0, 0}, comp[2] = {0, 0};
+
+	int r;
+	for(r = 0; r < repeats; r++) {
+		int mode;
+		for(mode = 0; mode < 2; mode++) {
+			struct jx_arena *a = mode ? arena : NULL;
+			struct jx_arena *previous = jx_arena_set(a);
+
+			keep_best(&parse[mode], run_parse(texts, records_count, a));
+			keep_best(&eval[mode], run_eval(records, records_count, filter, a));
+			keep_best(&copy[mode], run_copy(records, records_count, a));
+			keep_best(&comp[mode], run_comprehension(comprehension, context, records_count / 10, a));
+
+			jx_arena_set(previous);
+		}
+	}
+
+	report("parse", parse[0], parse[1]);
+	report("eval", eval[0], eval[1]);
+	report("copy", copy[0], copy[1]);
+	report("comprehension", comp[0], comp[1]);
+
+	jx_arena_delete(arena);
+
+	for(i = 0; i < records_count; i++) {
+		free(texts[i]);
+		jx_delete(records[i]);
+	}
+	free(texts);
+	free(records);
+
+	jx_delete(filter);
+	jx_delete(context);
+	jx_delete(comprehension);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -160,57 +160,77 @@ int jx_binary_write( FILE *stream, struct jx *j )
 	return 1;
 }
 
-static int jx_binary_read_data( FILE *stream, void *data, unsigned length )
+/*
+Values are read either from a stream, or from a buffer in memory, such as
+a mapped snapshot, which is checked so that a truncated value cannot read
+past its end.
+*/
+
+struct jx_binary_source {
+	FILE *stream;
+	const uint8_t *data;
+	size_t length;
+	size_t offset;
+};
+
+static int jx_binary_read_data( struct jx_binary_source *s, void *data, unsigned length )
 {
-	return fread(data,length,1,stream);
+	if(s->stream) return fread(data,length,1,s->stream);
+
+	if(s->length-s->offset < length) return 0;
+	memcpy(data,s->data+s->offset,length);
+	s->offset += length;
+	return 1;
 }
 
-static int jx_binary_read_uint8( FILE *stream, uint8_t *i )
+static int jx_binary_read_uint8( struct jx_binary_source *s, uint8_t *i )
 {
-	return jx_binary_read_data(stream,i,sizeof(*i));
+	return jx_binary_read_data(s,i,sizeof(*i));
 }
 
-static int jx_binary_read_uint16( FILE *stream, uint16_t *i )
+static int jx_binary_read_uint16( struct jx_binary_source *s, uint16_t *i )
 {
-	return jx_binary_read_data(stream,i,sizeof(*i));
+	return jx_binary_read_data(s,i,sizeof(*i));
 }
 
-static int jx_binary_read_uint32( FILE *stream, uint32_t *i )
+static int jx_binary_read_uint32( struct jx_binary_source *s, uint32_t *i )
 {
-	return jx_binary_read_data(stream,i,sizeof(*i));
+	return jx_binary_read_data(s,i,sizeof(*i));
 }
 
-static int jx_binary_read_int8( FILE *stream, int8_t *i )
+static int jx_binary_read_int8( struct jx_binary_source *s, int8_t *i )
 {
-	return jx_binary_read_data(stream,i,sizeof(*i));
+	return jx_binary_read_data(s,i,sizeof(*i));
 }
 
-static int jx_binary_read_int16( FILE *stream, int16_t *i )
+static int jx_binary_read_int16( struct jx_binary_source *s, int16_t *i )
 {
-	return jx_binary_read_data(stream,i,sizeof(*i));
+	return jx_binary_read_data(s,i,sizeof(*i));
 }
 
-static int jx_binary_read_int32( FILE *stream, int32_t *i )
+static int jx_binary_read_int32( struct jx_binary_source *s, int32_t *i )
 {
-	return jx_binary_read_data(stream,i,sizeof(*i));
+	return jx_binary_read_data(s,i,sizeof(*i));
 }
 
-static int jx_binary_read_int64( FILE *stream, int64_t *i )
+static int jx_binary_read_int64( struct jx_binary_source *s, int64_t *i )
 {
-	return jx_binary_read_data(stream,i,sizeof(*i));
+	return jx_binary_read_data(s,i,sizeof(*i));
 }
 
-static int jx_binary_read_double( FILE *stream, double *d )
+static int jx_binary_read_double( struct jx_binary_source *s, double *d )
 {
-	return jx_binary_read_data(stream,d,sizeof(*d));
+	return jx_binary_read_data(s,d,sizeof(*d));
 }
 
-static struct jx_pair * jx_binary_read_pair( FILE *stream )
+static struct jx * jx_binary_read_value( struct jx_binary_source *s );
+
+static struct jx_pair * jx_binary_read_pair( struct jx_binary_source *s )
 {
-	struct jx *a = jx_binary_read(stream);
+	struct jx *a = jx_binary_read_value(s);
 	if(!a) return 0;
 
-	struct jx *b = jx_binary_read(stream);
+	struct jx *b = jx_binary_read_value(s);
 	if(!b) {
 		jx_delete(a);
 		return 0;
@@ -219,39 +239,41 @@ static struct jx_pair * jx_binary_read_pair( FILE *stream )
 	return jx_pair(a,b,0);
 }
 
-static struct jx_item * jx_binary_read_item( FILE *stream )
+static struct jx_item * jx_binary_read_item( struct jx_binary_source *s )
 {
-	struct jx *a = jx_binary_read(stream);
+	struct jx *a = jx_binary_read_value(s);
 	if(!a) return 0;
 
 	return jx_item(a,0);
 }
 
-static struct jx * jx_binary_read_string( FILE *stream, uint32_t length )
+static struct jx * jx_binary_read_string( struct jx_binary_source *s, uint32_t length )
 {
-	char *s = malloc(length+1);
-	jx_binary_read_data(stream,s,length);
-	s[length] = 0;
-	return jx_string_nocopy(s);
+	if(!s->stream && s->length-s->offset < length) return 0;
+
+	char *str = malloc(length+1);
+	jx_binary_read_data(s,str,length);
+	str[length] = 0;
+	return jx_string_nocopy(str);
 }
 
-struct jx * jx_binary_read( FILE *stream )
+static struct jx * jx_binary_read_value( struct jx_binary_source *s )
 {
 	uint8_t type;
-	int8_t i8;
-	int16_t i16;
-	int32_t i32;
-	int64_t i64;
-	uint8_t u8;
-	uint16_t u16;
-	uint32_t u32;
-	double d;
+	int8_t i8 = 0;
+	int16_t i16 = 0;
+	int32_t i32 = 0;
+	int64_t i64 = 0;
+	uint8_t u8 = 0;
+	uint16_t u16 = 0;
+	uint32_t u32 = 0;
+	double d = 0;
 	struct jx *arr;
 	struct jx *obj;
 	struct jx_pair **pair;
 	struct jx_item **item;
 	
-	int result = jx_binary_read_uint8(stream,&type);
+	int result = jx_binary_read_uint8(s,&type);
 	if(!result) return 0;
 
 	switch(type) {
@@ -264,34 +286,34 @@ struct jx * jx_binary_read( FILE *stream )
 		case JX_BINARY_INTEGER0:
 			return jx_integer(0);
 		case JX_BINARY_INTEGER8:
-			jx_binary_read_int8(stream,&i8);
+			jx_binary_read_int8(s,&i8);
 			return jx_integer(i8);
 		case JX_BINARY_INTEGER16:
-			jx_binary_read_int16(stream,&i16);
+			jx_binary_read_int16(s,&i16);
 			return jx_integer(i16);
 		case JX_BINARY_INTEGER32:
-			jx_binary_read_int32(stream,&i32);
+			jx_binary_read_int32(s,&i32);
 			return jx_integer(i32);
 		case JX_BINARY_INTEGER64:
-			jx_binary_read_int64(stream,&i64);
+			jx_binary_read_int64(s,&i64);
 			return jx_integer(i64);
 		case JX_BINARY_DOUBLE:
-			jx_binary_read_double(stream,&d);
+			jx_binary_read_double(s,&d);
 			return jx_double(d);
 		case JX_BINARY_STRING8:
-			jx_binary_read_uint8(stream,&u8);
-			return jx_binary_read_string(stream,u8);
+			jx_binary_read_uint8(s,&u8);
+			return jx_binary_read_string(s,u8);
 		case JX_BINARY_STRING16:
-			jx_binary_read_uint16(stream,&u16);
-			return jx_binary_read_string(stream,u16);
+			jx_binary_read_uint16(s,&u16);
+			return jx_binary_read_string(s,u16);
 		case JX_BINARY_STRING32:
-			jx_binary_read_uint32(stream,&u32);
-			return jx_binary_read_string(stream,u32);
+			jx_binary_read_uint32(s,&u32);
+			return jx_binary_read_string(s,u32);
 		case JX_BINARY_ARRAY:
 			arr = jx_array(0);
 			item = &arr->u.items;
 			while(1) {
-				*item = jx_binary_read_item(stream);
+				*item = jx_binary_read_item(s);
 				if(*item) {
 					item = &(*item)->next;
 				} else {
@@ -304,7 +326,7 @@ struct jx * jx_binary_read( FILE *stream )
 			obj = jx_object(0);
 			pair = &obj->u.pairs;
 			while(1) {
-				*pair = jx_binary_read_pair(stream);
+				*pair = jx_binary_read_pair(s);
 				if(*pair) {
 					pair = &(*pair)->next;
 				} else {
@@ -324,4 +346,15 @@ struct jx * jx_binary_read( FILE *stream )
 	return 0;
 }
 
+struct jx * jx_binary_read( FILE *stream )
+{
+	struct jx_binary_source s = {stream, 0, 0, 0};
+	return jx_binary_read_value(&s);
+}
+
+struct jx * jx_binary_decode( const void *data, size_t length )
+{
+	struct jx_binary_source s = {0, data, length, 0};
+	return jx_binary_read_value(&s);
+}
 
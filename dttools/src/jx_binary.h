@@ -32,4 +32,12 @@ int jx_binary_write( FILE *stream, struct jx *j );
 
 struct jx * jx_binary_read( FILE *stream );
 
+/** Decode a JX expression in binary form from memory.
+@param data The start of the binary data.
+@param length The number of bytes of data, which are never read past.
+@return A JX expression, or null on failure.
+*/
+
+struct jx * jx_binary_decode( const void *data, size_t length );
+
 #endif
@@ -0,0 +1,543 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx_compile.h"
+#include "jx_arena.h"
+#include "jx_eval.h"
+#include "debug.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+A program is a tree of codes stored in an array, each a constant, a
+symbol, or an operator on the codes of its operands. Values are atomic and
+borrowed: strings point into the compiled expression or into the context,
+so evaluating a program allocates nothing. Each distinct symbol has a
+slot, and the slots are bound to their values in the context before each
+evaluation, by a single walk of the pairs of the context rather than a
+lookup for each symbol. Whenever the result of an operator would need to be
+allocated (such as the concatenation of strings) or a value is not atomic,
+the evaluation gives up and the expression is evaluated by jx_eval instead.
+Operators are evaluated exactly as in jx_eval: the right operand first,
+without short circuits, with the same promotions and the same errors. An
+error is only detected here; its message is produced by jx_eval.
+*/
+
+typedef enum {
+	JX_CODE_CONSTANT,
+	JX_CODE_SYMBOL,
+	JX_CODE_OPERATOR,
+} jx_code_type_t;
+
+typedef enum {
+	JX_CODE_OK,
+	JX_CODE_ERROR,
+	JX_CODE_FALLBACK,
+} jx_code_status_t;
+
+struct jx_code_value {
+	jx_type_t type;
+	union {
+		int boolean_value;
+		jx_int_t integer_value;
+		double double_value;
+		const char *string_value;
+	} u;
+};
+
+struct jx_code {
+	jx_code_type_t type;
+	jx_operator_t oper;
+	int left;
+	int right;
+	int slot;
+	struct jx_code_value value;
+};
+
+struct jx_slot {
+	const char *name;
+	int bound;
+	jx_code_status_t status;
+	struct jx_code_value value;
+};
+
+/* The number of pairs of a context walked to bind slots before using jx_lookup. */
+#define JX_PROGRAM_WALK 16
+
+struct jx_program {
+	struct jx *expr;
+
+	struct jx_code *codes;
+	int codes_count;
+	int codes_capacity;
+	int root;
+
+	struct jx_slot *slots;
+	int slots_count;
+	int slots_capacity;
+
+};
+
+static jx_code_status_t jx_code_load(struct jx *j, struct jx_code_value *v)
+{
+	v->type = j->type;
+
+	switch(j->type) {
+		case JX_NULL:
+			return JX_CODE_OK;
+		case JX_BOOLEAN:
+			v->u.boolean_value = j->u.boolean_value;
+			return JX_CODE_OK;
+		case JX_INTEGER:
+			v->u.integer_value = j->u.integer_value;
+			return JX_CODE_OK;
+		case JX_DOUBLE:
+			v->u.double_value = j->u.double_value;
+			return JX_CODE_OK;
+		case JX_STRING:
+			v->u.string_value = j->u.string_value;
+			return JX_CODE_OK;
+		case JX_ERROR:
+			return JX_CODE_ERROR;
+		default:
+			return JX_CODE_FALLBACK;
+	}
+}
+
+static struct jx *jx_code_export(const struct jx_code_value *v)
+{
+	switch(v->type) {
+		case JX_BOOLEAN:
+			return jx_boolean(v->u.boolean_value);
+		case JX_INTEGER:
+			return jx_integer(v->u.integer_value);
+		case JX_DOUBLE:
+			return jx_double(v->u.double_value);
+		case JX_STRING:
+			return jx_string(v->u.string_value);
+		default:
+			return jx_null();
+	}
+}
+
+static void jx_code_boolean(struct jx_code_value *v, int b)
+{
+	v->type = JX_BOOLEAN;
+	v->u.boolean_value = b;
+}
+
+static void jx_code_integer(struct jx_code_value *v, jx_int_t i)
+{
+	v->type = JX_INTEGER;
+	v->u.integer_value = i;
+}
+
+static void jx_code_double(struct jx_code_value *v, double d)
+{
+	v->type = JX_DOUBLE;
+	v->u.double_value = d;
+}
+
+/* Applies an operator as jx_eval_operator does, where left is null for a unary operator. */
+static jx_code_status_t jx_code_apply(jx_operator_t oper, const struct jx_code_value *left, const struct jx_code_value *right, struct jx_code_value *result)
+{
+	struct jx_code_value l, r;
+
+	r = *right;
+	if(left) l = *left;
+
+	if(left && l.type != r.type) {
+		if(l.type == JX_INTEGER && r.type == JX_DOUBLE) {
+			jx_code_double(&l, l.u.integer_value);
+		} else if(l.type == JX_DOUBLE && r.type == JX_INTEGER) {
+			jx_code_double(&r, r.u.integer_value);
+		} else if(oper == JX_OP_EQ) {
+			jx_code_boolean(result, 0);
+			return JX_CODE_OK;
+		} else if(oper == JX_OP_NE) {
+			jx_code_boolean(result, 1);
+			return JX_CODE_OK;
+		} else if(oper == JX_OP_ADD && ((l.type == JX_STRING && r.type != JX_NULL) || (r.type == JX_STRING && l.type != JX_NULL))) {
+			return JX_CODE_FALLBACK;
+		} else {
+			return JX_CODE_ERROR;
+		}
+	}
+
+	switch(r.type) {
+		case JX_NULL:
+			switch(oper) {
+				case JX_OP_EQ: jx_code_boolean(result, 1); return JX_CODE_OK;
+				case JX_OP_NE: jx_code_boolean(result, 0); return JX_CODE_OK;
+				default: return JX_CODE_ERROR;
+			}
+		case JX_BOOLEAN: {
+			int a = left ? l.u.boolean_value : 0;
+			int b = r.u.boolean_value;
+			switch(oper) {
+				case JX_OP_EQ:  jx_code_boolean(result, a==b); return JX_CODE_OK;
+				case JX_OP_NE:  jx_code_boolean(result, a!=b); return JX_CODE_OK;
+				case JX_OP_AND: jx_code_boolean(result, a&&b); return JX_CODE_OK;
+				case JX_OP_OR:  jx_code_boolean(result, a||b); return JX_CODE_OK;
+				case JX_OP_NOT: jx_code_boolean(result, !b);   return JX_CODE_OK;
+				default: return JX_CODE_ERROR;
+			}
+		}
+		case JX_INTEGER: {
+			jx_int_t a = left ? l.u.integer_value : 0;
+			jx_int_t b = r.u.integer_value;
+			switch(oper) {
+				case JX_OP_EQ:  jx_code_boolean(result, a==b); return JX_CODE_OK;
+				case JX_OP_NE:  jx_code_boolean(result, a!=b); return JX_CODE_OK;
+				case JX_OP_LT:  jx_code_boolean(result, a<b);  return JX_CODE_OK;
+				case JX_OP_LE:  jx_code_boolean(result, a<=b); return JX_CODE_OK;
+				case JX_OP_GT:  jx_code_boolean(result, a>b);  return JX_CODE_OK;
+				case JX_OP_GE:  jx_code_boolean(result, a>=b); return JX_CODE_OK;
+				case JX_OP_ADD: jx_code_integer(result, a+b);  return JX_CODE_OK;
+				case JX_OP_SUB: jx_code_integer(result, a-b);  return JX_CODE_OK;
+				case JX_OP_MUL: jx_code_integer(result, a*b);  return JX_CODE_OK;
+				case JX_OP_DIV:
+					if(b==0) return JX_CODE_ERROR;
+					jx_code_integer(result, a/b);
+					return JX_CODE_OK;
+				case JX_OP_MOD:
+					if(b==0) return JX_CODE_ERROR;
+					jx_code_integer(result, a%b);
+					return JX_CODE_OK;
+				default: return JX_CODE_ERROR;
+			}
+		}
+		case JX_DOUBLE: {
+			double a = left ? l.u.double_value : 0;
+			double b = r.u.double_value;
+			switch(oper) {
+				case JX_OP_EQ:  jx_code_boolean(result, a==b); return JX_CODE_OK;
+				case JX_OP_NE:  jx_code_boolean(result, a!=b); return JX_CODE_OK;
+				case JX_OP_LT:  jx_code_boolean(result, a<b);  return JX_CODE_OK;
+				case JX_OP_LE:  jx_code_boolean(result, a<=b); return JX_CODE_OK;
+				case JX_OP_GT:  jx_code_boolean(result, a>b);  return JX_CODE_OK;
+				case JX_OP_GE:  jx_code_boolean(result, a>=b); return JX_CODE_OK;
+				case JX_OP_ADD: jx_code_double(result, a+b);   return JX_CODE_OK;
+				case JX_OP_SUB: jx_code_double(result, a-b);   return JX_CODE_OK;
+				case JX_OP_MUL: jx_code_double(result, a*b);   return JX_CODE_OK;
+				case JX_OP_DIV:
+					if(b==0) return JX_CODE_ERROR;
+					jx_code_double(result, a/b);
+					return JX_CODE_OK;
+				case JX_OP_MOD:
+					if(b==0) return JX_CODE_ERROR;
+					// same as jx_eval, which computes the remainder of the integer parts.
+					jx_code_double(result, (jx_int_t)a%(jx_int_t)b);
+					return JX_CODE_OK;
+				default: return JX_CODE_ERROR;
+			}
+		}
+		case JX_STRING: {
+			const char *a = left ? l.u.string_value : "";
+			const char *b = r.u.string_value;
+			switch(oper) {
+				case JX_OP_EQ:  jx_code_boolean(result, strcmp(a,b)==0); return JX_CODE_OK;
+				case JX_OP_NE:  jx_code_boolean(result, strcmp(a,b)!=0); return JX_CODE_OK;
+				case JX_OP_LT:  jx_code_boolean(result, strcmp(a,b)<0);  return JX_CODE_OK;
+				case JX_OP_LE:  jx_code_boolean(result, strcmp(a,b)<=0); return JX_CODE_OK;
+				case JX_OP_GT:  jx_code_boolean(result, strcmp(a,b)>0);  return JX_CODE_OK;
+				case JX_OP_GE:  jx_code_boolean(result, strcmp(a,b)>=0); return JX_CODE_OK;
+				case JX_OP_ADD: return JX_CODE_FALLBACK;
+				default: return JX_CODE_ERROR;
+			}
+		}
+		default:
+			return JX_CODE_FALLBACK;
+	}
+}
+
+/*
+The value of an operator is kept in its code, so that values are passed by
+reference, without copies. Constant operands are loaded without a
+recursive call.
+*/
+
+static jx_code_status_t jx_code_eval(struct jx_program *p, int n, const struct jx_code_value **v)
+{
+	struct jx_code *c = &p->codes[n];
+	struct jx_slot *s;
+
+	switch(c->type) {
+		case JX_CODE_CONSTANT:
+			*v = &c->value;
+			return JX_CODE_OK;
+		case JX_CODE_SYMBOL:
+			s = &p->slots[c->slot];
+			*v = &s->value;
+			return s->status;
+		case JX_CODE_OPERATOR:
+			break;
+	}
+
+	const struct jx_code_value *l = NULL, *r = NULL;
+	jx_code_status_t status;
+	struct jx_code *o;
+
+	o = &p->codes[c->right];
+	if(o->type == JX_CODE_CONSTANT) {
+		r = &o->value;
+	} else if((status = jx_code_eval(p, c->right, &r)) != JX_CODE_OK) {
+		return status;
+	}
+
+	if(c->left >= 0) {
+		o = &p->codes[c->left];
+		if(o->type == JX_CODE_CONSTANT) {
+			l = &o->value;
+		} else if((status = jx_code_eval(p, c->left, &l)) != JX_CODE_OK) {
+			return status;
+		}
+	}
+
+	*v = &c->value;
+	return jx_code_apply(c->oper, l, r, &c->value);
+}
+
+static int jx_code_append(struct jx_program *p, jx_code_type_t type)
+{
+	if(p->codes_count == p->codes_capacity) {
+		p->codes_capacity = p->codes_capacity ? 2*p->codes_capacity : 16;
+		p->codes = xxrealloc(p->codes, p->codes_capacity*sizeof(*p->codes));
+	}
+
+	struct jx_code *c = &p->codes[p->codes_count];
+	memset(c, 0, sizeof(*c));
+	c->type = type;
+	c->left = c->right = c->slot = -1;
+
+	return p->codes_count++;
+}
+
+static int jx_code_slot(struct jx_program *p, const char *name)
+{
+	int i;
+	for(i = 0; i < p->slots_count; i++) {
+		if(!strcmp(p->slots[i].name, name)) return i;
+	}
+
+	if(p->slots_count == p->slots_capacity) {
+		p->slots_capacity = p->slots_capacity ? 2*p->slots_capacity : 8;
+		p->slots = xxrealloc(p->slots, p->slots_capacity*sizeof(*p->slots));
+	}
+
+	struct jx_slot *s = &p->slots[p->slots_count];
+	memset(s, 0, sizeof(*s));
+	s->name = name;
+
+	return p->slots_count++;
+}
+
+static int jx_code_isnative(jx_operator_t oper)
+{
+	switch(oper) {
+		case JX_OP_EQ:
+		case JX_OP_NE:
+		case JX_OP_LE:
+		case JX_OP_LT:
+		case JX_OP_GE:
+		case JX_OP_GT:
+		case JX_OP_ADD:
+		case JX_OP_SUB:
+		case JX_OP_MUL:
+		case JX_OP_DIV:
+		case JX_OP_MOD:
+		case JX_OP_AND:
+		case JX_OP_OR:
+		case JX_OP_NOT:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* Returns the code of j, or -1 if j must be evaluated by jx_eval. */
+static int jx_code_compile(struct jx_program *p, struct jx *j)
+{
+	int n;
+
+	switch(j->type) {
+		case JX_NULL:
+		case JX_BOOLEAN:
+		case JX_INTEGER:
+		case JX_DOUBLE:
+		case JX_STRING:
+			n = jx_code_append(p, JX_CODE_CONSTANT);
+			jx_code_load(j, &p->codes[n].value);
+			return n;
+		case JX_SYMBOL: {
+			int slot = jx_code_slot(p, j->u.symbol_name);
+			n = jx_code_append(p, JX_CODE_SYMBOL);
+			p->codes[n].slot = slot;
+			return n;
+		}
+		case JX_OPERATOR: {
+			struct jx_operator *o = &j->u.oper;
+			if(!jx_code_isnative(o->type) || !o->right) return -1;
+
+			int mark = p->codes_count;
+
+			int left = -1;
+			if(o->left) {
+				left = jx_code_compile(p, o->left);
+				if(left < 0) return -1;
+			}
+
+			int right = jx_code_compile(p, o->right);
+			if(right < 0) return -1;
+
+			/* an operator on constants is replaced by its value, unless it fails. */
+			if(p->codes[right].type == JX_CODE_CONSTANT && (left < 0 || p->codes[left].type == JX_CODE_CONSTANT)) {
+				struct jx_code_value value;
+				if(jx_code_apply(o->type, left < 0 ? NULL : &p->codes[left].value, &p->codes[right].value, &value) == JX_CODE_OK) {
+					p->codes_count = mark;
+					n = jx_code_append(p, JX_CODE_CONSTANT);
+					p->codes[n].value = value;
+					return n;
+				}
+			}
+
+			n = jx_code_append(p, JX_CODE_OPERATOR);
+			p->codes[n].oper = o->type;
+			p->codes[n].left = left;
+			p->codes[n].right = right;
+			return n;
+		}
+		default:
+			return -1;
+	}
+}
+
+struct jx_program *jx_compile(struct jx *expr)
+{
+	struct jx_program *p = xxcalloc(1, sizeof(*p));
+
+	// the program may outlive the current arena, so its expression is allocated with malloc.
+	struct jx_arena *a = jx_arena_set(NULL);
+	p->expr = jx_copy(expr);
+	jx_arena_set(a);
+
+	p->root = p->expr ? jx_code_compile(p, p->expr) : -1;
+
+	if(p->root < 0) {
+		debug(D_JX, "expression is evaluated with jx_eval");
+		p->codes_count = 0;
+		p->slots_count = 0;
+	}
+
+	return p;
+}
+
+static void jx_slot_bind(struct jx_slot *s, struct jx *value)
+{
+	s->status = value ? jx_code_load(value, &s->value) : JX_CODE_ERROR;
+	s->bound = 1;
+}
+
+/*
+Binds each slot to the value of the first pair with its name, as jx_lookup
+would. The walk stops once every slot is bound, and leaves the rest to
+jx_lookup if the context is long, so that it is indexed as usual.
+*/
+
+static void jx_program_bind(struct jx_program *p, struct jx *context)
+{
+	int i, unbound = p->slots_count;
+
+	for(i = 0; i < p->slots_count; i++) {
+		p->slots[i].bound = 0;
+	}
+
+	if(context && !context->index) {
+		struct jx_pair *q;
+		int walked = 0;
+
+		for(q = context->u.pairs; q && unbound > 0 && walked < JX_PROGRAM_WALK; q = q->next, walked++) {
+			struct jx *k = q->key;
+			if(!k || k->type != JX_STRING) continue;
+
+			for(i = 0; i < p->slots_count; i++) {
+				struct jx_slot *s = &p->slots[i];
+				if(!s->bound && s->name[0] == k->u.string_value[0] && !strcmp(s->name, k->u.string_value)) {
+					jx_slot_bind(s, q->value);
+					unbound--;
+					break;
+				}
+			}
+		}
+	}
+
+	for(i = 0; i < p->slots_count && unbound > 0; i++) {
+		struct jx_slot *s = &p->slots[i];
+		if(!s->bound) {
+			jx_slot_bind(s, jx_lookup(context, s->name));
+			unbound--;
+		}
+	}
+}
+
+static jx_code_status_t jx_program_run(struct jx_program *p, struct jx *context, const struct jx_code_value **v)
+{
+	if(p->root < 0 || (context && !jx_istype(context, JX_OBJECT))) {
+		return JX_CODE_FALLBACK;
+	}
+
+	jx_program_bind(p, context);
+
+	return jx_code_eval(p, p->root, v);
+}
+
+struct jx *jx_program_eval(struct jx_program *p, struct jx *context)
+{
+	const struct jx_code_value *v;
+
+	if(jx_program_run(p, context, &v) == JX_CODE_OK) {
+		return jx_code_export(v);
+	}
+
+	return jx_eval(p->expr, context);
+}
+
+int jx_program_istrue(struct jx_program *p, struct jx *context)
+{
+	const struct jx_code_value *v;
+
+	switch(jx_program_run(p, context, &v)) {
+		case JX_CODE_OK:
+			return v->type == JX_BOOLEAN && v->u.boolean_value;
+		case JX_CODE_ERROR:
+			return 0;
+		default: {
+			struct jx *r = jx_eval(p->expr, context);
+			int result = jx_istrue(r);
+			jx_delete(r);
+			return result;
+		}
+	}
+}
+
+int jx_program_isnative(struct jx_program *p)
+{
+	return p->root >= 0;
+}
+
+void jx_program_delete(struct jx_program *p)
+{
+	if(!p) return;
+
+	jx_delete(p->expr);
+	free(p->codes);
+	free(p->slots);
+	free(p);
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,55 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef JX_COMPILE_H
+#define JX_COMPILE_H
+
+/** @file jx_compile.h Compiled JX expressions.
+An expression that is evaluated against many contexts, such as the filter
+of a catalog query or of a deltadb query, may be compiled once with
+@ref jx_compile and then evaluated with @ref jx_program_eval or
+@ref jx_program_istrue. The symbols of the program are resolved to slots,
+the operators on literals are folded, and the comparisons, arithmetic, and
+logic on atomic values are evaluated without allocating memory. Any other
+construct (function calls, lookups, arrays, objects) is evaluated with
+@ref jx_eval, so that the results of a program are always those of
+@ref jx_eval on the original expression. Programs are not thread safe.
+*/
+
+#include "jx.h"
+
+/** Compile an expression.
+@param expr The expression to compile, which is copied.
+@return A new program, which must be deleted with @ref jx_program_delete.
+*/
+struct jx_program *jx_compile(struct jx *expr);
+
+/** Evaluate a program.
+@param p The program to evaluate.
+@param context An object in which values will be found.
+@return A newly created result, the same as that of @ref jx_eval on the compiled expression, which must be deleted with @ref jx_delete.
+*/
+struct jx *jx_program_eval(struct jx_program *p, struct jx *context);
+
+/** Test whether a program evaluates to true.
+@param p The program to evaluate.
+@param context An object in which values will be found.
+@return Non-zero if the result is the boolean true, the same as @ref jx_istrue of @ref jx_program_eval, zero otherwise.
+*/
+int jx_program_istrue(struct jx_program *p, struct jx *context);
+
+/** Check whether a program is evaluated without @ref jx_eval.
+@param p The program.
+@return Non-zero if every operator of the program is compiled.
+*/
+int jx_program_isnative(struct jx_program *p);
+
+/** Delete a program. @param p The program to delete. */
+void jx_program_delete(struct jx_program *p);
+
+#endif
+
+/* vim: set noexpandtab tabstop=4: */
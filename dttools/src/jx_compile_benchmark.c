@@ -0,0 +1,162 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Measures the evaluation of filters on a set of records like those of the
+catalog, with jx_eval and with programs from jx_compile, as catalog and
+deltadb queries do. Each filter is evaluated against every record, and the
+best time of the given number of runs is reported for each.
+*/
+
+#include "jx.h"
+#include "jx_compile.h"
+#include "jx_eval.h"
+#include "jx_parse.h"
+#include "stringtools.h"
+#include "timestamp.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int records_count = 100000;
+static int repeats       = 3;
+
+static const char *filters[] = {
+	"type==\"wq_master\"",
+	"type==\"wq_master\" && tasks_waiting+tasks_running>100 && workers>2",
+	"owner==\"user1\" && project!=\"analysis-0\" && lastheardfrom>1600000000+60*60 && !(port<9100)",
+	"tasks_waiting*1.5>=workers*10 || preferred==false",
+	0,
+};
+
+static void show_help(const char *cmd)
+{
+	printf("Usage: %s [options]\n", cmd);
+	printf("Where options are:\n");
+	printf("-n <n>  Number of records. (default: %d)\n", records_count);
+	printf("-r <n>  Number of runs per filter. (default: %d)\n", repeats);
+	printf("-h      Show this help screen.\n");
+}
+
+static char *make_record(int n)
+{
+	return string_format(
+		"{\"type\":\"%s\",\"name\":\"host%d.cluster.example.edu\",\"port\":%d,\"owner\":\"user%d\","
+		"\"project\":\"analysis-%d\",\"tasks_waiting\":%d,\"tasks_running\":%d,\"workers\":%d,"
+		"\"categories\":[{\"name\":\"default\",\"tasks\":%d},{\"name\":\"merge\",\"tasks\":%d}],"
+		"\"lastheardfrom\":%d,\"preferred\":%s}",
+		n % 3 ? "wq_master" : "chirp", n, 9000 + n % 1000, n % 97, n % 13, n % 500, n % 300, n % 64, n % 50, n % 7, 1600000000 + n, n % 5 ? "true" : "false");
+}
+
+static timestamp_t run_eval(struct jx **records, int n, struct jx *filter, int *matches)
+{
+	timestamp_t start = timestamp_get();
+
+	int i;
+	*matches = 0;
+	for(i = 0; i < n; i++) {
+		struct jx *r = jx_eval(filter, records[i]);
+		if(jx_istrue(r)) {
+			(*matches)++;
+		}
+		jx_delete(r);
+	}
+
+	return timestamp_get() - start;
+}
+
+static timestamp_t run_program(struct jx **records, int n, struct jx_program *p, int *matches)
+{
+	timestamp_t start = timestamp_get();
+
+	int i;
+	*matches = 0;
+	for(i = 0; i < n; i++) {
+		if(jx_program_istrue(p, records[i])) {
+			(*matches)++;
+		}
+	}
+
+	return timestamp_get() - start;
+}
+
+static void keep_best(timestamp_t *best, timestamp_t t)
+{
+	if(!*best || t < *best) *best = t;
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	while((c = getopt(argc, argv, "n:r:h")) != -1) {
+		switch(c) {
+		case 'n':
+			records_count = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if(records_count < 1 || repeats < 1) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	struct jx **records = malloc(records_count * sizeof(*records));
+
+	int i;
+	for(i = 0; i < records_count; i++) {
+		char *text = make_record(i);
+		records[i] = jx_parse_string(text);
+		free(text);
+	}
+
+	printf("records: %d\n", records_count);
+	printf("%-8s %8s %12s %12s %9s\n", "filter", "matches", "jx_eval", "jx_compile", "speedup");
+
+	int f;
+	for(f = 0; filters[f]; f++) {
+		struct jx *filter = jx_parse_string(filters[f]);
+		struct jx_program *p = jx_compile(filter);
+
+		timestamp_t eval = 0, program = 0;
+		int eval_matches = 0, program_matches = 0;
+
+		int r;
+		for(r = 0; r < repeats; r++) {
+			keep_best(&eval, run_eval(records, records_count, filter, &eval_matches));
+			keep_best(&program, run_program(records, records_count, p, &program_matches));
+		}
+
+		if(eval_matches != program_matches) {
+			printf("%-8d failed: %d matches with jx_eval, %d with jx_compile\n", f, eval_matches, program_matches);
+		} else {
+			printf("%-8d %8d %10.3f s %10.3f s %8.2fx\n", f, eval_matches, eval / 1000000.0, program / 1000000.0, program ? ((double) eval) / program : 0);
+		}
+
+		jx_program_delete(p);
+		jx_delete(filter);
+	}
+
+	for(i = 0; i < records_count; i++) {
+		jx_delete(records[i]);
+	}
+	free(records);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -7,6 +7,7 @@ See the file COPYING for details.
 #include "jx_database.h"
 #include "jx_print.h"
 #include "jx_parse.h"
+#include "jx_snapshot.h"
 
 #include "hash_table.h"
 #include "debug.h"
@@ -62,6 +63,33 @@ static int checkpoint_write( struct jx_database *db, const char *filename )
 	return 1;
 }
 
+/*
+Write the current state of the table as a snapshot, which is read in
+place of the checkpoint while it is no older.  The object only borrows
+the values of the table, and gives them back before it is deleted.
+*/
+
+static int snapshot_write( struct jx_database *db, const char *filename )
+{
+	char *key;
+	struct jx *jobject;
+	struct jx *jsnapshot = jx_object(0);
+
+	hash_table_firstkey(db->table);
+	while((hash_table_nextkey(db->table,&key,(void**)&jobject))) {
+		jsnapshot->u.pairs = jx_pair(jx_string(key),jobject,jsnapshot->u.pairs);
+	}
+
+	int ok = jx_snapshot_write(filename,jsnapshot);
+	if(!ok) debug(D_NOTICE,"could not write snapshot %s: %s",filename,strerror(errno));
+
+	struct jx_pair *p;
+	for(p=jsnapshot->u.pairs;p;p=p->next) p->value = 0;
+	jx_delete(jsnapshot);
+
+	return ok;
+}
+
 /*
 Read a checkpoint in the (deprecated) nvpair format.  This will allow for a seamless upgrade by permitting the new JX database to continue from an nvpair checkpoint.
 */
@@ -92,10 +120,62 @@ static int compat_checkpoint_read( struct jx_database *db, const char *filename
 	return 1;
 }
 
+/* Delete every record of the table, leaving it empty. */
+
+static void table_clear( struct hash_table *table )
+{
+	char *key;
+	struct jx *j;
+
+	hash_table_firstkey(table);
+	while(hash_table_nextkey(table,&key,(void**)&j)) {
+		jx_delete(j);
+	}
+	hash_table_clear(table);
+}
+
+/*
+Read a checkpoint written as a snapshot, which decodes each record
+from the binary form rather than parsing JSON.
+A corrupt snapshot leaves the table empty and returns false, so that
+the checkpoint it was written from is read instead.
+*/
+
+static int snapshot_checkpoint_read( struct jx_database *db, const char *filename )
+{
+	struct jx_snapshot *s = jx_snapshot_open(filename);
+	if(!s) {
+		debug(D_NOTICE, "could not open checkpoint snapshot %s: %s", filename, strerror(errno));
+		return 0;
+	}
+
+	int i;
+	for(i=0;i<jx_snapshot_size(s);i++) {
+		const char *key = jx_snapshot_key(s,i);
+		struct jx *j = jx_snapshot_value(s,i);
+		if(!key || !j) {
+			debug(D_NOTICE, "checkpoint snapshot %s is corrupt", filename);
+			jx_delete(j);
+			jx_snapshot_close(s);
+			table_clear(db->table);
+			return 0;
+		}
+		hash_table_insert(db->table,key,j);
+	}
+
+	jx_snapshot_close(s);
+
+	return 1;
+}
+
 /* Get a complete checkpoint file and reconstitute the state of the table. */
 
 static int checkpoint_read( struct jx_database *db, const char *filename )
 {
+	if(jx_snapshot_check(filename)) {
+		return snapshot_checkpoint_read(db,filename);
+	}
+
 	FILE * file = fopen(filename,"r");
 	if(!file) return 0;
 
@@ -160,6 +240,8 @@ static void log_select( struct jx_database *db )
 	if(write_checkpoint_file) {
 		sprintf(filename,"%s/%d/%d.ckpt",db->logdir,db->logyear,db->logday);
 		checkpoint_write(db,filename);
+		sprintf(filename,"%s/%d/%d.snap",db->logdir,db->logyear,db->logday);
+		snapshot_write(db,filename);
 	}
 
 }
@@ -419,8 +501,17 @@ static int log_recover( struct jx_database *db, time_t snapshot )
 	int year = t->tm_year + 1900;
 	int day = t->tm_yday;
 
+	char snapname[PATH_MAX];
+	struct stat info, snapinfo;
+
 	sprintf(filename,"%s/%d/%d.ckpt",db->logdir,year,day);
-	checkpoint_read(db,filename);
+	sprintf(snapname,"%s/%d/%d.snap",db->logdir,year,day);
+
+	// Prefer the snapshot, unless the checkpoint was written after it.
+	int use_snapshot = stat(snapname,&snapinfo)==0 && (stat(filename,&info)<0 || snapinfo.st_mtime>=info.st_mtime);
+	if(!use_snapshot || !checkpoint_read(db,snapname)) {
+		checkpoint_read(db,filename);
+	}
 
 	sprintf(filename,"%s/%d/%d.log",db->logdir,year,day);
 	log_replay(db,filename,snapshot);
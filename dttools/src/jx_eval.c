@@ -6,6 +6,7 @@ See the file COPYING for details.
 
 #include "jx_eval.h"
 #include "debug.h"
+#include "jx_arena.h"
 #include "jx_function.h"
 #include "jx_print.h"
 
@@ -15,22 +16,8 @@ See the file COPYING for details.
 #include <math.h>
 
 // FAILOP(jx_operator *op, struct jx *left, struct jx *right, const char *message)
-// left, right, and message are evaluated exactly once
-#define FAILOP(op, left, right, message) do { \
-	assert(op); \
-	assert(message); \
-	struct jx *t = jx_operator(op->type, left, right); \
-	char *s = jx_print_string(t); \
-	struct jx *e = jx_error(jx_format( \
-		"on line %d, %s: %s", \
-		op->line, \
-		s, \
-		message \
-	)); \
-	jx_delete(t); \
-	free(s); \
-	return e; \
-} while (false)
+// left and right are borrowed, and only printed into the error message
+#define FAILOP(op, left, right, message) return jx_eval_failop(op, left, right, message)
 
 // FAILARR(struct jx *array, const char *message)
 #define FAILARR(array, message) do { \
@@ -45,6 +32,29 @@ See the file COPYING for details.
 
 static struct jx *jx_check_errors(struct jx *j);
 
+static struct jx *jx_eval_failop(struct jx_operator *op, struct jx *left, struct jx *right, const char *message) {
+	assert(op);
+	assert(message);
+
+	// an operator on the stack, so that the operands need not be copied
+	struct jx t;
+	memset(&t, 0, sizeof(t));
+	t.type = JX_OPERATOR;
+	t.u.oper.type = op->type;
+	t.u.oper.left = left;
+	t.u.oper.right = right;
+
+	char *s = jx_print_string(&t);
+	struct jx *e = jx_error(jx_format(
+		"on line %d, %s: %s",
+		op->line,
+		s,
+		message
+	));
+	free(s);
+	return e;
+}
+
 static struct jx *jx_eval_null(struct jx_operator *op, struct jx *left, struct jx *right) {
 	assert(op);
 	switch(op->type) {
@@ -52,7 +62,7 @@ static struct jx *jx_eval_null(struct jx_operator *op, struct jx *left, struct j
 			return jx_boolean(1);
 		case JX_OP_NE:
 			return jx_boolean(0);
-		default: FAILOP(op, jx_null(), jx_null(), "unsupported operator on null");
+		default: FAILOP(op, left ? left : right, right, "unsupported operator on null");
 	}
 }
 
@@ -72,7 +82,7 @@ static struct jx *jx_eval_boolean(struct jx_operator *op, struct jx *left, struc
 			return jx_boolean(a||b);
 		case JX_OP_NOT:
 			return jx_boolean(!b);
-		default: FAILOP(op, jx_copy(left), jx_copy(right), "unsupported operator on boolean");
+		default: FAILOP(op, left, right, "unsupported operator on boolean");
 	}
 }
 
@@ -101,12 +111,12 @@ static struct jx *jx_eval_integer(struct jx_operator *op, struct jx *left, struc
 		case JX_OP_MUL:
 			return jx_integer(a*b);
 		case JX_OP_DIV:
-			if(b==0) FAILOP(op, jx_copy(left), jx_copy(right), "division by zero");
+			if(b==0) FAILOP(op, left, right, "division by zero");
 			return jx_integer(a/b);
 		case JX_OP_MOD:
-			if(b==0) FAILOP(op, jx_copy(left), jx_copy(right), "division by zero");
+			if(b==0) FAILOP(op, left, right, "division by zero");
 			return jx_integer(a%b);
-		default: FAILOP(op, jx_copy(left), jx_copy(right), "unsupported operator on integer");
+		default: FAILOP(op, left, right, "unsupported operator on integer");
 	}
 }
 
@@ -135,12 +145,12 @@ static struct jx *jx_eval_double(struct jx_operator *op, struct jx *left, struct
 		case JX_OP_MUL:
 			return jx_double(a*b);
 		case JX_OP_DIV:
-			if(b==0) FAILOP(op, jx_copy(left), jx_copy(right), "division by zero");
+			if(b==0) FAILOP(op, left, right, "division by zero");
 			return jx_double(a/b);
 		case JX_OP_MOD:
-			if(b==0) FAILOP(op, jx_copy(left), jx_copy(right), "division by zero");
+			if(b==0) FAILOP(op, left, right, "division by zero");
 			return jx_double((jx_int_t)a%(jx_int_t)b);
-		default: FAILOP(op, jx_copy(left), jx_copy(right), "unsupported operator on double");
+		default: FAILOP(op, left, right, "unsupported operator on double");
 	}
 }
 
@@ -164,22 +174,20 @@ static struct jx *jx_eval_string(struct jx_operator *op, struct jx *left, struct
 			return jx_boolean(strcmp(a,b)>=0);
 		case JX_OP_ADD:
 			return jx_format("%s%s",a,b);
-		default: FAILOP(op, jx_copy(left), jx_copy(right), "unsupported operator on string");
+		default: FAILOP(op, left, right, "unsupported operator on string");
 	}
 }
 
 static struct jx *jx_eval_array(struct jx_operator *op, struct jx *left, struct jx *right) {
 	assert(op);
-	if (!(left && right)) FAILOP(op, jx_copy(left), jx_copy(right), "missing arguments to array operator");
+	if (!(left && right)) FAILOP(op, left, right, "missing arguments to array operator");
 
 	switch(op->type) {
 		case JX_OP_EQ:
 			return jx_boolean(jx_equals(left, right));
 		case JX_OP_NE:
 			return jx_boolean(!jx_equals(left, right));
-		case JX_OP_ADD:
-			return jx_check_errors(jx_array_concat(jx_copy(left), jx_copy(right), NULL));
-		default: FAILOP(op, jx_copy(left), jx_copy(right), "unsupported operator on array");
+		default: FAILOP(op, left, right, "unsupported operator on array");
 	}
 }
 
@@ -249,9 +257,9 @@ static struct jx *jx_eval_slice(struct jx *array, struct jx *slice) {
 			right->line
 		));
 	}
-	if (left && left->type != JX_INTEGER) FAILOP((&slice->u.oper), jx_copy(left), jx_copy(right),
+	if (left && left->type != JX_INTEGER) FAILOP((&slice->u.oper), left, right,
 		"slice indices must be integers");
-	if (right && right->type != JX_INTEGER) FAILOP((&slice->u.oper), jx_copy(left), jx_copy(right),
+	if (right && right->type != JX_INTEGER) FAILOP((&slice->u.oper), left, right,
 		"slice indices must be integers");
 
 	struct jx *result = jx_array(NULL);
@@ -349,9 +357,12 @@ static struct jx * jx_eval_operator( struct jx_operator *o, struct jx *context )
 	if(o->type==JX_OP_CALL && jx_istype(o->left,JX_SYMBOL)) {
 		const char *name = o->left->u.symbol_name;
 		if(!strcmp("select",name) || !strcmp("project",name)) {
+			// the expression is modified, so it must not refer to values of the current arena.
+			struct jx_arena *a = jx_arena_set(jx_arena_owner(o->right));
 			struct jx *r = jx_array_shift(o->right);
 			r = jx_string(jx_print_string((r)));
 			jx_array_insert(o->right, r);
+			jx_arena_set(a);
 		}
 	}
 
@@ -416,10 +427,18 @@ static struct jx * jx_eval_operator( struct jx_operator *o, struct jx *context )
 			/* fall through */
  			
 		} else {
-			FAILOP(o, left, right, "mismatched types for operator");
+			result = jx_eval_failop(o, left, right, "mismatched types for operator");
+			goto DONE;
 		}
 	}
 
+	// the operands are not used after a concatenation, so they are consumed by it.
+	if(o->type==JX_OP_ADD && jx_istype(left,JX_ARRAY) && jx_istype(right,JX_ARRAY)) {
+		result = jx_check_errors(jx_array_concat(left, right, NULL));
+		left = right = NULL;
+		goto DONE;
+	}
+
 	switch(right->type) {
 		case JX_NULL:
 			result = jx_eval_null(o, left, right);
@@ -439,7 +458,9 @@ static struct jx * jx_eval_operator( struct jx_operator *o, struct jx *context )
 		case JX_ARRAY:
 			result = jx_eval_array(o, left, right);
 			break;
-		default: FAILOP(o, left, right, "rvalue does not support operators");
+		default:
+			result = jx_eval_failop(o, left, right, "rvalue does not support operators");
+			break;
 	}
 
 DONE:
@@ -449,6 +470,23 @@ DONE:
 	return result;
 }
 
+/*
+The context of each element of a comprehension is the variable, followed by
+the pairs of the enclosing context, which are borrowed rather than copied,
+as is the value of the element.
+*/
+
+static struct jx *jx_eval_comprehension_context(struct jx_comprehension *comp, struct jx *value, struct jx *context) {
+	return jx_object(jx_pair(jx_string(comp->variable), value, context ? context->u.pairs : NULL));
+}
+
+static void jx_eval_comprehension_context_delete(struct jx *ctx) {
+	struct jx_pair *p = ctx->u.pairs;
+	p->value = NULL;
+	p->next = NULL;
+	jx_delete(ctx);
+}
+
 static struct jx_item *jx_eval_comprehension(struct jx *body, struct jx_comprehension *comp, struct jx *context) {
 	assert(body);
 	assert(comp);
@@ -468,18 +506,17 @@ static struct jx_item *jx_eval_comprehension(struct jx *body, struct jx_comprehe
 	struct jx *j = NULL;
 	void *i = NULL;
 	while ((j = jx_iterate_array(list, &i))) {
-		struct jx *ctx = jx_copy(context);
-		jx_insert(ctx, jx_string(comp->variable), jx_copy(j));
+		struct jx *ctx = jx_eval_comprehension_context(comp, j, context);
 		if (comp->condition) {
 			struct jx *cond = jx_eval(comp->condition, ctx);
 			if (jx_istype(cond, JX_ERROR)) {
-				jx_delete(ctx);
+				jx_eval_comprehension_context_delete(ctx);
 				jx_delete(list);
 				jx_item_delete(result);
 				return jx_item(cond, NULL);
 			}
 			if (!jx_istype(cond, JX_BOOLEAN)) {
-				jx_delete(ctx);
+				jx_eval_comprehension_context_delete(ctx);
 				jx_delete(list);
 				jx_item_delete(result);
 				char *s = jx_print_string(cond);
@@ -494,14 +531,14 @@ static struct jx_item *jx_eval_comprehension(struct jx *body, struct jx_comprehe
 			int ok = cond->u.boolean_value;
 			jx_delete(cond);
 			if (!ok) {
-				jx_delete(ctx);
+				jx_eval_comprehension_context_delete(ctx);
 				continue;
 			}
 		}
 
 		if (comp->next) {
 			struct jx_item *val = jx_eval_comprehension(body, comp->next, ctx);
-			jx_delete(ctx);
+			jx_eval_comprehension_context_delete(ctx);
 			if (result) {
 				tail->next = val;
 			} else {
@@ -513,7 +550,7 @@ static struct jx_item *jx_eval_comprehension(struct jx *body, struct jx_comprehe
 
 		} else {
 			struct jx *val = jx_eval(body, ctx);
-			jx_delete(ctx);
+			jx_eval_comprehension_context_delete(ctx);
 			if (!val) {
 				jx_delete(list);
 				jx_item_delete(result);
@@ -560,6 +597,7 @@ static struct jx_item *jx_eval_item(struct jx_item *item, struct jx *context) {
 	}
 }
 
+// the first error found is taken out of j, rather than copied, before j is deleted
 static struct jx *jx_check_errors(struct jx *j)
 {
 	struct jx *err = NULL;
@@ -567,7 +605,8 @@ static struct jx *jx_check_errors(struct jx *j)
 		case JX_ARRAY:
 			for(struct jx_item *i = j->u.items; i; i = i->next) {
 				if(jx_istype(i->value, JX_ERROR)) {
-					err = jx_copy(i->value);
+					err = i->value;
+					i->value = NULL;
 					jx_delete(j);
 					return err;
 				}
@@ -575,8 +614,13 @@ static struct jx *jx_check_errors(struct jx *j)
 			return j;
 		case JX_OBJECT:
 			for(struct jx_pair *p = j->u.pairs; p; p = p->next) {
-				if (jx_istype(p->key, JX_ERROR)) err = jx_copy(p->key);
-				if (!err && jx_istype(p->value, JX_ERROR)) err = jx_copy(p->value);
+				if (jx_istype(p->key, JX_ERROR)) {
+					err = p->key;
+					p->key = NULL;
+				} else if (jx_istype(p->value, JX_ERROR)) {
+					err = p->value;
+					p->value = NULL;
+				}
 				if (err) {
 					jx_delete(j);
 					return err;
@@ -0,0 +1,210 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Measures lookups in large jx objects. A set of records like those of the
+catalog, each with the given number of keys, is evaluated against a
+constraint expression with jx_eval, each key of each record is looked up
+with jx_lookup, and updates are merged into the records with jx_remove and
+jx_insert, as deltadb does. The best time of the given number of runs is
+reported for each workload.
+*/
+
+#include "jx.h"
+#include "jx_eval.h"
+#include "jx_parse.h"
+#include "stringtools.h"
+#include "timestamp.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int records_count = 10000;
+static int keys_count    = 100;
+static int repeats       = 3;
+
+static void show_help(const char *cmd)
+{
+	printf("Usage: %s [options]\n", cmd);
+	printf("Where options are:\n");
+	printf("-n <n>  Number of records. (default: %d)\n", records_count);
+	printf("-k <n>  Number of keys per record. (default: %d)\n", keys_count);
+	printf("-r <n>  Number of runs per workload. (default: %d)\n", repeats);
+	printf("-h      Show this help screen.\n");
+}
+
+/* The well known keys of a catalog record come first, and so are the last
+ * in the list of pairs, as jx_insert pushes pairs on the head. */
+static struct jx *make_record(int n, int keys)
+{
+	struct jx *j = jx_object(NULL);
+
+	jx_insert_string(j, "type", n % 2 ? "wq_master" : "chirp");
+	jx_insert_string(j, "name", "host.cluster.example.edu");
+	jx_insert_integer(j, "port", 9000 + n % 1000);
+	jx_insert_string(j, "owner", "user");
+	jx_insert_integer(j, "tasks_waiting", n % 500);
+	jx_insert_integer(j, "workers", n % 64);
+
+	int i;
+	for(i = 6; i < keys; i++) {
+		char *key = string_format("attribute_%d", i);
+		jx_insert_integer(j, key, i);
+		free(key);
+	}
+
+	return j;
+}
+
+static timestamp_t run_eval(struct jx **records, int n)
+{
+	struct jx *expr = jx_parse_string("type==\"wq_master\" && tasks_waiting>100 && workers>8 && owner==\"user\"");
+
+	timestamp_t start = timestamp_get();
+
+	int i, matches = 0;
+	for(i = 0; i < n; i++) {
+		struct jx *r = jx_eval(expr, records[i]);
+		if(jx_istrue(r)) {
+			matches++;
+		}
+		jx_delete(r);
+	}
+
+	timestamp_t elapsed = timestamp_get() - start;
+
+	jx_delete(expr);
+
+	return matches > 0 ? elapsed : 0;
+}
+
+static timestamp_t run_lookup(struct jx **records, int n, int keys)
+{
+	char **names = malloc(keys * sizeof(*names));
+
+	int i, k;
+	for(k = 0; k < keys; k++) {
+		names[k] = string_format("attribute_%d", k);
+	}
+
+	timestamp_t start = timestamp_get();
+
+	int found = 0;
+	for(i = 0; i < n; i++) {
+		for(k = 0; k < keys; k++) {
+			if(jx_lookup(records[i], names[k])) {
+				found++;
+			}
+		}
+	}
+
+	timestamp_t elapsed = timestamp_get() - start;
+
+	for(k = 0; k < keys; k++) {
+		free(names[k]);
+	}
+	free(names);
+
+	return found > 0 ? elapsed : 0;
+}
+
+/* Each run updates different keys, as the attributes that change between
+ * updates of a record vary. */
+static timestamp_t run_merge(struct jx **records, int n, int keys, int run)
+{
+	timestamp_t start = timestamp_get();
+
+	int i, k;
+	for(i = 0; i < n; i++) {
+		for(k = 0; k < 10; k++) {
+			char *name = string_format("attribute_%d", 6 + (i * 7 + k * 13 + run * 31) % (keys - 6));
+			struct jx *key = jx_string(name);
+			jx_delete(jx_remove(records[i], key));
+			jx_insert(records[i], key, jx_integer(k));
+			free(name);
+		}
+	}
+
+	return timestamp_get() - start;
+}
+
+static void report(const char *workload, timestamp_t best, double operations)
+{
+	if(best == 0) {
+		printf("%-8s failed\n", workload);
+	} else {
+		printf("%-8s %10.3f s %12.0f ops/s\n", workload, best / 1000000.0, operations / (best / 1000000.0));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	while((c = getopt(argc, argv, "n:k:r:h")) != -1) {
+		switch(c) {
+		case 'n':
+			records_count = atoi(optarg);
+			break;
+		case 'k':
+			keys_count = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if(records_count < 1 || keys_count < 7 || repeats < 1) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	struct jx **records = malloc(records_count * sizeof(*records));
+
+	int i;
+	for(i = 0; i < records_count; i++) {
+		records[i] = make_record(i, keys_count);
+	}
+
+	printf("records: %d, keys per record: %d\n", records_count, keys_count);
+
+	timestamp_t best_eval = 0, best_lookup = 0, best_merge = 0;
+
+	int r;
+	for(r = 0; r < repeats; r++) {
+		timestamp_t t;
+
+		t = run_eval(records, records_count);
+		if(t && (!best_eval || t < best_eval)) best_eval = t;
+
+		t = run_lookup(records, records_count, keys_count);
+		if(t && (!best_lookup || t < best_lookup)) best_lookup = t;
+
+		t = run_merge(records, records_count, keys_count, r);
+		if(t && (!best_merge || t < best_merge)) best_merge = t;
+	}
+
+	report("eval", best_eval, records_count);
+	report("lookup", best_lookup, ((double) records_count) * keys_count);
+	report("merge", best_merge, records_count * 10.0);
+
+	for(i = 0; i < records_count; i++) {
+		jx_delete(records[i]);
+	}
+	free(records);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
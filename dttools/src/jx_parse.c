@@ -10,12 +10,14 @@ See the file COPYING for details.
 
 #include "stringtools.h"
 #include "debug.h"
+#include "macros.h"
 
 #include <assert.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 typedef enum {
 	JX_TOKEN_SYMBOL,
@@ -61,18 +63,29 @@ typedef enum {
 
 #define MAX_TOKEN_SIZE 65536
 
+/*
+Files and links are read in blocks of this size, and then scanned from
+memory. A string is scanned in place. Regular files are left positioned
+just after the text parsed when the parser is deleted. Other streams are
+read a line at a time, so that the parser never waits for more input than
+the line it is parsing.
+*/
+
+#define JX_PARSE_BUFFER_SIZE 65536
+
 struct jx_parser {
 	char token[MAX_TOKEN_SIZE];
 	FILE *source_file;
-	const char *source_string;
+	bool source_file_seekable;
 	struct link *source_link;
+	char *buffer;
+	const char *cursor;
+	const char *limit;
 	unsigned line;
 	time_t stoptime;
 	char *error_string;
 	int errors;
 	bool strict_mode;
-	bool putback_char_valid;
-	int putback_char;
 	bool putback_token_valid;
 	jx_token_t putback_token;
 	jx_int_t integer_value;
@@ -89,18 +102,28 @@ struct jx_parser *jx_parser_create(bool strict_mode) {
 
 void jx_parser_read_stream( struct jx_parser *p, FILE *file )
 {
+	struct stat info;
+
 	p->source_file = file;
+	p->source_file_seekable = fstat(fileno(file),&info)==0 && S_ISREG(info.st_mode);
+
+	if(!p->buffer) p->buffer = malloc(JX_PARSE_BUFFER_SIZE+1);
+	p->cursor = p->limit = p->buffer;
 }
 
 void jx_parser_read_string( struct jx_parser *p, const char *str )
 {
-	p->source_string = str;
+	p->cursor = str;
+	p->limit = str + strlen(str);
 }
 
 void jx_parser_read_link( struct jx_parser *p, struct link *l, time_t stoptime )
 {
 	p->source_link = l;
 	p->stoptime = stoptime;
+
+	if(!p->buffer) p->buffer = malloc(JX_PARSE_BUFFER_SIZE+1);
+	p->cursor = p->limit = p->buffer;
 }
 
 int jx_parser_errors( struct jx_parser *p )
@@ -113,8 +136,22 @@ const char * jx_parser_error_string( struct jx_parser *p )
 	return p->error_string;
 }
 
+void jx_parser_unread_buffer( struct jx_parser *p )
+{
+	if(!p->source_file)
+		return;
+
+	/* give back to the file what was read but not parsed. */
+	if(p->source_file_seekable && p->cursor < p->limit) {
+		fseek(p->source_file, -(long)(p->limit - p->cursor), SEEK_CUR);
+	}
+
+	p->cursor = p->limit = p->buffer;
+}
+
 void jx_parser_delete( struct jx_parser *p )
 {
+	free(p->buffer);
 	free(p->error_string);
 	free(p);
 }
@@ -150,44 +187,113 @@ static struct jx *jx_add_lineno(struct jx_parser *p, struct jx *j) {
 	return j;
 }
 
-static int jx_getchar( struct jx_parser *p )
-{
-	int c=0;
+/*
+Read the next block of the source into the buffer.
+Returns false at the end of the source.
+*/
 
-	if(p->putback_char_valid) {
-		p->putback_char_valid = false;
-		if (p->putback_char == '\n') ++p->line;
-		return p->putback_char;
-	}
+static bool jx_fill( struct jx_parser *p )
+{
+	ssize_t n = 0;
 
 	if(p->source_file) {
-		c = fgetc(p->source_file);
-	} else if(p->source_string) {
-		c = *p->source_string;
-		if(c) {
-			p->source_string++;
-		} else {
-			c = EOF;
+		if(p->source_file_seekable) {
+			n = fread(p->buffer,1,JX_PARSE_BUFFER_SIZE,p->source_file);
+		} else if(fgets(p->buffer,JX_PARSE_BUFFER_SIZE+1,p->source_file)) {
+			n = strlen(p->buffer);
 		}
 	} else if(p->source_link) {
-		char ch;
-		int result = link_read(p->source_link,&ch,1,p->stoptime);
-		if(result==1) {
-			c = ch;
-		} else {
-			c = EOF;
-		}
+		n = link_read_avail(p->source_link,p->buffer,JX_PARSE_BUFFER_SIZE,p->stoptime);
+	} else {
+		/* a string has no more than what was given. */
+		return false;
+	}
+
+	if(n<=0) {
+		p->cursor = p->limit = p->buffer;
+		return false;
 	}
 
+	p->cursor = p->buffer;
+	p->limit = p->buffer + n;
+	return true;
+}
+
+static int jx_getchar( struct jx_parser *p )
+{
+	if(p->cursor==p->limit && !jx_fill(p)) return EOF;
+
+	int c = (unsigned char) *p->cursor++;
 	if (c == '\n') ++p->line;
 	return c;
 }
 
+/*
+Only the last character read may be put back,
+which is then always still in the buffer.
+*/
+
 static void jx_ungetchar( struct jx_parser *p, int c )
 {
+	if (c == EOF) return;
 	if (c == '\n') --p->line;
-	p->putback_char = c;
-	p->putback_char_valid = true;
+	p->cursor--;
+}
+
+/*
+Skip whitespace up to the next character that is not, or the end of the buffer.
+*/
+
+static void jx_skip_space( struct jx_parser *p )
+{
+	while(p->cursor<p->limit && isspace((unsigned char)*p->cursor)) {
+		if(*p->cursor=='\n') ++p->line;
+		p->cursor++;
+	}
+}
+
+/*
+Copy into token the characters of a string up to the next quote,
+escape, newline, or the end of the buffer, starting at position i.
+Returns the new position.
+*/
+
+static int jx_scan_string_run( struct jx_parser *p, int i )
+{
+	size_t length = MIN((size_t)(p->limit - p->cursor),(size_t)(MAX_TOKEN_SIZE - i));
+
+	const char *end = memchr(p->cursor,'\"',length);
+	if(end) length = end - p->cursor;
+
+	end = memchr(p->cursor,'\\',length);
+	if(end) length = end - p->cursor;
+
+	end = memchr(p->cursor,'\n',length);
+	if(end) length = end - p->cursor;
+
+	memcpy(&p->token[i],p->cursor,length);
+	p->cursor += length;
+
+	return i + length;
+}
+
+/*
+Copy into token the characters from the buffer accepted by the given
+class, starting at position i, leaving room for the terminator.
+Returns the new position.
+*/
+
+static int jx_scan_run( struct jx_parser *p, int i, int (*accept)(int c) )
+{
+	while(i<MAX_TOKEN_SIZE-1 && p->cursor<p->limit && accept((unsigned char)*p->cursor)) {
+		p->token[i++] = *p->cursor++;
+	}
+	return i;
+}
+
+static int jx_is_symbol_char( int c )
+{
+	return isalnum(c) || c=='_';
 }
 
 static int jx_scan_unicode( struct jx_parser *s )
@@ -254,6 +360,7 @@ static jx_token_t jx_scan( struct jx_parser *s )
 	}
 
 	retry:
+	jx_skip_space(s);
 	c = jx_getchar(s);
 
 	if(isspace(c)) {
@@ -317,6 +424,9 @@ static jx_token_t jx_scan( struct jx_parser *s )
 	} else if(c=='\"') {
 		int i;
 		for(i=0;i<MAX_TOKEN_SIZE;i++) {
+			i = jx_scan_string_run(s,i);
+			if(i>=MAX_TOKEN_SIZE) break;
+
 			int n = jx_scan_string_char(s);
 			if(n==EOF) {
 				if(i>10) i = 10;
@@ -346,6 +456,7 @@ static jx_token_t jx_scan( struct jx_parser *s )
 		s->token[0] = c;
 		int i;
 		for(i=1;i<MAX_TOKEN_SIZE;i++) {
+			i = jx_scan_run(s,i,isdigit);
 			c = jx_getchar(s);
 			if(strchr("0123456789.",c)) {
 				s->token[i] = c;
@@ -382,6 +493,7 @@ static jx_token_t jx_scan( struct jx_parser *s )
 		s->token[0] = c;
 		int i;
 		for(i=1;i<MAX_TOKEN_SIZE;i++) {
+			i = jx_scan_run(s,i,jx_is_symbol_char);
 			c = jx_getchar(s);
 			if(isalnum(c) || c=='_') {
 				s->token[i] = c;
@@ -936,6 +1048,7 @@ struct jx * jx_parse( struct jx_parser *s )
 static struct jx * jx_parse_finish( struct jx_parser *p )
 {
 	struct jx * j = jx_parse(p);
+	jx_parser_unread_buffer(p);
 	if(jx_parser_errors(p)) {
 		debug(D_JX|D_NOTICE, "parse error: %s", jx_parser_error_string(p));
 		jx_parser_delete(p);
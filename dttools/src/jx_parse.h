@@ -57,13 +57,22 @@ int jx_parse_cmd_define(struct jx *jx_args, char *define_stmt);
 /** Create a JX parser object.  @return A parser object. */
 struct jx_parser *jx_parser_create(bool strict_mode);
 
-/** Attach parser to a file.  @param p A parser object.  @param file A standard IO stream. */
+/** Attach parser to a file.
+A regular file is read in blocks, and so the parser may read past the end of the value it returns.
+Call @ref jx_parser_unread_buffer to move the file back to just past the last token scanned,
+before reading from the file by other means, or closing it.
+Other streams are read a line at a time.
+@param p A parser object.  @param file A standard IO stream. */
 void jx_parser_read_stream( struct jx_parser *p, FILE *file );
 
 /** Attach parser to a string.  @param p A parser object.  @param str A JSON string to parse. */
 void jx_parser_read_string( struct jx_parser *p, const char *str );
 
-/** Attach parser to a link.  @param p A parser object.  @param l A @ref link object.  @param stoptime The absolute time at which to stop. */
+/** Attach parser to a link.
+The link is read with @ref link_read_avail, and so the parser may consume bytes past the end
+of the value it returns. Those bytes cannot be given back to the link, so the link should carry
+nothing else after the values read by the parser.
+@param p A parser object.  @param l A @ref link object.  @param stoptime The absolute time at which to stop. */
 void jx_parser_read_link( struct jx_parser *p, struct link *l, time_t stoptime );
 
 /** Parse and return a single value. This function is useful for streaming multiple independent values from a single source. @param p A parser object @return A JX expression which must be deleted with @ref jx_delete. If the parse fails or no JSON value is present, null is returned. */
@@ -78,7 +87,14 @@ int jx_parser_errors( struct jx_parser *p );
 /** Return text of first parse error encountered. @param p A parser object. @return Error string, if available, null otherwise. */
 const char *jx_parser_error_string( struct jx_parser *p );
 
-/** Delete a parser.  @param p The parser to delete. */
+/** Give back to the file attached with @ref jx_parser_read_stream what was read but not yet parsed.
+A seekable file is moved back to just past the last token scanned, which may be the one following
+the last value parsed. For other streams the rest of the current line is lost. Does nothing for strings and links.
+@param p A parser object. */
+void jx_parser_unread_buffer( struct jx_parser *p );
+
+/** Delete a parser. The file or link attached to the parser is not closed, nor moved back.
+@param p The parser to delete. */
 void jx_parser_delete( struct jx_parser *p );
 
 /* Private function used by jx_print to put parens in the right place. */
@@ -0,0 +1,216 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Measures the throughput of jx_parse. A JSON array of records like those of a
+catalog checkpoint is written to a temporary file, and then parsed from the
+file, from a string in memory, and from a link fed by another process. The
+best time of the given number of runs is reported for each source.
+*/
+
+#include "jx.h"
+#include "jx_parse.h"
+#include "link.h"
+#include "full_io.h"
+#include "timestamp.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int size_mb = 64;
+static int repeats = 3;
+
+static void show_help(const char *cmd)
+{
+	printf("Usage: %s [options]\n", cmd);
+	printf("Where options are:\n");
+	printf("-s <mb>  Approximate size of the JSON document in MB. (default: %d)\n", size_mb);
+	printf("-r <n>   Number of runs per source. (default: %d)\n", repeats);
+	printf("-h       Show this help screen.\n");
+}
+
+static int write_document(FILE *f, int64_t size)
+{
+	int64_t written = 0;
+	int records = 0;
+
+	written += fprintf(f, "[\n");
+
+	while(written < size) {
+		if(records > 0) {
+			written += fprintf(f, ",\n");
+		}
+
+		written += fprintf(f,
+			"{\"type\":\"wq_master\",\"name\":\"host%d.cluster.example.edu\",\"address\":\"10.32.%d.%d\",\"port\":%d,"
+			"\"owner\":\"user%d\",\"project\":\"analysis-%d\",\"version\":\"7.1.0 FINAL\",\"load\":%.3f,"
+			"\"tasks_waiting\":%d,\"tasks_running\":%d,\"workers\":%d,\"capacity_memory\":%d,"
+			"\"categories\":[{\"name\":\"default\",\"tasks\":%d},{\"name\":\"merge\",\"tasks\":%d}],"
+			"\"starttime\":%d,\"lastheardfrom\":%d,\"preferred\":true,\"note\":null}",
+			records, records % 256, (records / 256) % 256, 9000 + records % 1000,
+			records % 97, records % 13, (records % 1000) / 100.0,
+			records % 500, records % 300, records % 64, 4096 * (records % 16),
+			records % 50, records % 7,
+			1600000000 + records, 1600003600 + records);
+
+		records++;
+	}
+
+	written += fprintf(f, "\n]\n");
+
+	return records;
+}
+
+static int check(struct jx *j, int records)
+{
+	int ok = jx_istype(j, JX_ARRAY) && jx_array_length(j) == records;
+	jx_delete(j);
+
+	return ok;
+}
+
+static timestamp_t parse_file(const char *path, int records)
+{
+	timestamp_t start = timestamp_get();
+	struct jx *j = jx_parse_file(path);
+	timestamp_t elapsed = timestamp_get() - start;
+
+	return check(j, records) ? elapsed : 0;
+}
+
+static timestamp_t parse_string(const char *document, int records)
+{
+	timestamp_t start = timestamp_get();
+	struct jx *j = jx_parse_string(document);
+	timestamp_t elapsed = timestamp_get() - start;
+
+	return check(j, records) ? elapsed : 0;
+}
+
+static timestamp_t parse_link(const char *document, size_t length, int records)
+{
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		return 0;
+	}
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		close(fds[0]);
+		full_write(fds[1], document, length);
+		close(fds[1]);
+		_exit(0);
+	}
+
+	close(fds[1]);
+
+	struct link *l = link_attach_to_fd(fds[0]);
+
+	timestamp_t start = timestamp_get();
+	struct jx *j = jx_parse_link(l, time(0) + 600);
+	timestamp_t elapsed = timestamp_get() - start;
+
+	link_close(l);
+	waitpid(pid, NULL, 0);
+
+	return check(j, records) ? elapsed : 0;
+}
+
+static void report(const char *source, timestamp_t best, size_t length)
+{
+	if(best == 0) {
+		printf("%-8s failed\n", source);
+	} else {
+		printf("%-8s %10.3f s %10.2f MB/s\n", source, best / 1000000.0, (length / (1024.0 * 1024.0)) / (best / 1000000.0));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	while((c = getopt(argc, argv, "s:r:h")) != -1) {
+		switch(c) {
+		case 's':
+			size_mb = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if(size_mb < 1 || repeats < 1) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	char path[] = "jx_parse_benchmark.XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0) {
+		fprintf(stderr, "could not create temporary file: %s\n", strerror(errno));
+		return 1;
+	}
+
+	FILE *f = fdopen(fd, "w+");
+	int records = write_document(f, ((int64_t) size_mb) << 20);
+
+	size_t length = ftell(f);
+	char *document = malloc(length + 1);
+
+	rewind(f);
+	if(fread(document, 1, length, f) != length) {
+		fprintf(stderr, "could not read %s: %s\n", path, strerror(errno));
+		unlink(path);
+		return 1;
+	}
+	document[length] = '\0';
+	fclose(f);
+
+	printf("document: %.2f MB, %d records\n", length / (1024.0 * 1024.0), records);
+
+	timestamp_t best_file = 0, best_string = 0, best_link = 0;
+
+	int i;
+	for(i = 0; i < repeats; i++) {
+		timestamp_t t;
+
+		t = parse_file(path, records);
+		if(t && (!best_file || t < best_file)) best_file = t;
+
+		t = parse_string(document, records);
+		if(t && (!best_string || t < best_string)) best_string = t;
+
+		t = parse_link(document, length, records);
+		if(t && (!best_link || t < best_link)) best_link = t;
+	}
+
+	report("file", best_file, length);
+	report("string", best_string, length);
+	report("link", best_link, length);
+
+	unlink(path);
+	free(document);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,313 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx_snapshot.h"
+#include "jx_binary.h"
+#include "debug.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+A snapshot is laid out as a header, then for each key in sorted order the
+key with its terminating null followed by the value in the binary form of
+jx_binary_write, and then the table of entries, aligned to eight bytes,
+which gives the offsets of each key and value. A lookup is a binary search
+of the table, and decodes only the value found. The size of the file is
+kept in the header, so that a truncated snapshot is not opened, and the
+offsets of each entry are checked before they are used.
+*/
+
+#define JX_SNAPSHOT_MAGIC "JXSNAPSH"
+#define JX_SNAPSHOT_VERSION 1
+
+struct jx_snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint64_t table_offset;
+	uint64_t size;
+};
+
+struct jx_snapshot_entry {
+	uint64_t key_offset;
+	uint64_t value_offset;
+	uint64_t value_length;
+};
+
+struct jx_snapshot {
+	const char *data;
+	size_t size;
+	int count;
+	const struct jx_snapshot_entry *table;
+};
+
+struct jx_snapshot_pair {
+	const char *key;
+	struct jx *value;
+	int position;
+};
+
+static int jx_snapshot_pair_compare(const void *a, const void *b)
+{
+	const struct jx_snapshot_pair *x = a;
+	const struct jx_snapshot_pair *y = b;
+
+	int result = strcmp(x->key, y->key);
+	if(result) return result;
+
+	return x->position - y->position;
+}
+
+int jx_snapshot_write(const char *filename, struct jx *object)
+{
+	if(!jx_istype(object, JX_OBJECT)) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	int count = 0;
+	struct jx_pair *p;
+	for(p = object->u.pairs; p; p = p->next) count++;
+
+	/* sorted by key and then by position, the first pair with each key is kept. */
+	struct jx_snapshot_pair *pairs = xxmalloc((count + 1) * sizeof(*pairs));
+	count = 0;
+	for(p = object->u.pairs; p; p = p->next) {
+		if(!jx_istype(p->key, JX_STRING)) continue;
+		pairs[count].key = p->key->u.string_value;
+		pairs[count].value = p->value;
+		pairs[count].position = count;
+		count++;
+	}
+
+	qsort(pairs, count, sizeof(*pairs), jx_snapshot_pair_compare);
+
+	struct jx_snapshot_entry *table = xxmalloc((count + 1) * sizeof(*table));
+	struct jx_snapshot_header header;
+	memset(&header, 0, sizeof(header));
+
+	/* written beside the snapshot and renamed over it, so that readers never see it half written. */
+	char *tmpname = string_format("%s.tmp.%d", filename, (int) getpid());
+
+	FILE *file = fopen(tmpname, "w");
+	if(!file) {
+		free(tmpname);
+		free(pairs);
+		free(table);
+		return 0;
+	}
+
+	errno = 0;
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	int i, n = 0;
+	for(i = 0; i < count && ok; i++) {
+		if(i > 0 && !strcmp(pairs[i].key, pairs[i - 1].key)) continue;
+
+		struct jx_snapshot_entry *e = &table[n++];
+
+		e->key_offset = ftell(file);
+		ok = fwrite(pairs[i].key, strlen(pairs[i].key) + 1, 1, file) == 1;
+
+		e->value_offset = ftell(file);
+		ok = ok && jx_binary_write(file, pairs[i].value);
+		e->value_length = ftell(file) - e->value_offset;
+	}
+
+	if(ok) {
+		static const char padding[8];
+		long offset = ftell(file);
+		ok = fwrite(padding, (8 - offset % 8) % 8, 1, file) <= 1;
+
+		header.table_offset = ftell(file);
+		ok = ok && fwrite(table, sizeof(*table), n, file) == (size_t) n;
+	}
+
+	if(ok) {
+		memcpy(header.magic, JX_SNAPSHOT_MAGIC, sizeof(header.magic));
+		header.version = JX_SNAPSHOT_VERSION;
+		header.count = n;
+		header.size = ftell(file);
+
+		ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+	}
+
+	if(!ok && !errno) errno = EINVAL;
+
+	if(fclose(file) != 0) ok = 0;
+
+	if(ok && rename(tmpname, filename) != 0) ok = 0;
+
+	if(!ok) {
+		int saved_errno = errno;
+		unlink(tmpname);
+		errno = saved_errno;
+	}
+
+	free(tmpname);
+	free(pairs);
+	free(table);
+
+	return ok;
+}
+
+static int jx_snapshot_header_valid(const struct jx_snapshot_header *h, size_t size)
+{
+	return !memcmp(h->magic, JX_SNAPSHOT_MAGIC, sizeof(h->magic))
+		&& h->version == JX_SNAPSHOT_VERSION
+		&& h->size == size
+		&& h->table_offset % 8 == 0
+		&& h->table_offset <= size
+		&& (size - h->table_offset) / sizeof(struct jx_snapshot_entry) >= h->count;
+}
+
+struct jx_snapshot *jx_snapshot_open(const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0) return 0;
+
+	struct stat info;
+	if(fstat(fd, &info) < 0) {
+		close(fd);
+		return 0;
+	}
+
+	if((size_t) info.st_size < sizeof(struct jx_snapshot_header)) {
+		close(fd);
+		errno = EINVAL;
+		return 0;
+	}
+
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(data == MAP_FAILED) return 0;
+
+	const struct jx_snapshot_header *h = data;
+	if(!jx_snapshot_header_valid(h, info.st_size)) {
+		debug(D_NOTICE, "%s is not a valid snapshot", filename);
+		munmap(data, info.st_size);
+		errno = EINVAL;
+		return 0;
+	}
+
+	struct jx_snapshot *s = xxmalloc(sizeof(*s));
+	s->data = data;
+	s->size = info.st_size;
+	s->count = h->count;
+	s->table = (const struct jx_snapshot_entry *) (s->data + h->table_offset);
+
+	return s;
+}
+
+int jx_snapshot_check(const char *filename)
+{
+	char magic[8];
+
+	FILE *file = fopen(filename, "r");
+	if(!file) return 0;
+
+	int result = fread(magic, sizeof(magic), 1, file) == 1 && !memcmp(magic, JX_SNAPSHOT_MAGIC, sizeof(magic));
+
+	fclose(file);
+
+	return result;
+}
+
+int jx_snapshot_size(struct jx_snapshot *s)
+{
+	return s->count;
+}
+
+const char *jx_snapshot_key(struct jx_snapshot *s, int n)
+{
+	if(n < 0 || n >= s->count) return 0;
+
+	uint64_t offset = s->table[n].key_offset;
+	if(offset >= s->size) return 0;
+
+	const char *key = s->data + offset;
+	if(!memchr(key, 0, s->size - offset)) return 0;
+
+	return key;
+}
+
+struct jx *jx_snapshot_value(struct jx_snapshot *s, int n)
+{
+	if(n < 0 || n >= s->count) return 0;
+
+	const struct jx_snapshot_entry *e = &s->table[n];
+	if(e->value_offset > s->size || e->value_length > s->size - e->value_offset) return 0;
+
+	return jx_binary_decode(s->data + e->value_offset, e->value_length);
+}
+
+struct jx *jx_snapshot_lookup(struct jx_snapshot *s, const char *key)
+{
+	int low = 0;
+	int high = s->count - 1;
+
+	while(low <= high) {
+		int middle = low + (high - low) / 2;
+
+		const char *k = jx_snapshot_key(s, middle);
+		if(!k) return 0;
+
+		int result = strcmp(key, k);
+		if(result == 0) {
+			return jx_snapshot_value(s, middle);
+		} else if(result < 0) {
+			high = middle - 1;
+		} else {
+			low = middle + 1;
+		}
+	}
+
+	return 0;
+}
+
+struct jx *jx_snapshot_load(struct jx_snapshot *s)
+{
+	struct jx *object = jx_object(0);
+	struct jx_pair **tail = &object->u.pairs;
+
+	int i;
+	for(i = 0; i < s->count; i++) {
+		const char *key = jx_snapshot_key(s, i);
+		struct jx *value = jx_snapshot_value(s, i);
+
+		if(!key || !value) {
+			jx_delete(value);
+			jx_delete(object);
+			return 0;
+		}
+
+		*tail = jx_pair(jx_string(key), value, 0);
+		tail = &(*tail)->next;
+	}
+
+	return object;
+}
+
+void jx_snapshot_close(struct jx_snapshot *s)
+{
+	if(!s) return;
+
+	munmap((void *) s->data, s->size);
+	free(s);
+}
+
+/* vim: set noexpandtab tabstop=4: */
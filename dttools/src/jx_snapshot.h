@@ -0,0 +1,82 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef JX_SNAPSHOT_H
+#define JX_SNAPSHOT_H
+
+/** @file jx_snapshot.h Memory mapped snapshots of JX objects.
+A snapshot stores the pairs of a large JX object, such as the checkpoint
+of a @ref jx_database, in the binary form of @ref jx_binary.h, with a
+table of the keys in sorted order. A snapshot is opened by mapping it into
+memory, which takes constant time, and each value is decoded only when it
+is looked up, so that a program that needs a few records of a large
+snapshot neither reads nor keeps the rest. Like @ref jx_binary.h, the
+format is in the byte order of the writer, and is meant for internal
+storage rather than exchange.
+*/
+
+#include "jx.h"
+
+/** Write an object as a snapshot.
+Pairs with keys that are not strings are left out, as are pairs with the
+same key as an earlier pair, as @ref jx_lookup would never find them.
+The snapshot is written to a temporary file in the same directory and
+renamed into place, so that a reader sees either the old snapshot or the
+complete new one.
+@param filename The file to write.
+@param object The object to write, whose values must be constant.
+@return True on success, false on failure, with errno set.
+*/
+int jx_snapshot_write(const char *filename, struct jx *object);
+
+/** Open a snapshot.
+@param filename The file to open.
+@return A snapshot, or null if the file could not be opened or is not a snapshot, with errno set.
+*/
+struct jx_snapshot *jx_snapshot_open(const char *filename);
+
+/** Check whether a file is a snapshot.
+@param filename The file to check.
+@return True if the file starts as a snapshot does, false otherwise.
+*/
+int jx_snapshot_check(const char *filename);
+
+/** Get the number of keys of a snapshot. @param s The snapshot. @return The number of keys. */
+int jx_snapshot_size(struct jx_snapshot *s);
+
+/** Get a key of a snapshot.
+@param s The snapshot.
+@param n The position of the key, from zero, in sorted order.
+@return The key, which is valid until the snapshot is closed, or null if n is out of range or the snapshot is corrupt.
+*/
+const char *jx_snapshot_key(struct jx_snapshot *s, int n);
+
+/** Decode a value of a snapshot.
+@param s The snapshot.
+@param n The position of the value, from zero, in the sorted order of the keys.
+@return A new value, which must be deleted with @ref jx_delete, or null if n is out of range or the snapshot is corrupt.
+*/
+struct jx *jx_snapshot_value(struct jx_snapshot *s, int n);
+
+/** Look up and decode the value of a key.
+@param s The snapshot.
+@param key The key to look up.
+@return A new value, which must be deleted with @ref jx_delete, or null if the key is not found.
+*/
+struct jx *jx_snapshot_lookup(struct jx_snapshot *s, const char *key);
+
+/** Decode a whole snapshot.
+@param s The snapshot.
+@return A new object with all the pairs of the snapshot, or null if the snapshot is corrupt.
+*/
+struct jx *jx_snapshot_load(struct jx_snapshot *s);
+
+/** Close a snapshot. @param s The snapshot to close. */
+void jx_snapshot_close(struct jx_snapshot *s);
+
+#endif
+
+/* vim: set noexpandtab tabstop=4: */
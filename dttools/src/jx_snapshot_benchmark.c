@@ -0,0 +1,259 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Compares loading a checkpoint of catalog records as JSON, as checkpoint_read
+of jx_database does, with loading the same checkpoint as a snapshot. The
+whole checkpoint is loaded into a hash table both ways, and then single
+records are read from the snapshot by opening it and looking up one key,
+which JSON can only do by loading everything. The best time of the given
+number of runs is reported for each.
+*/
+
+#include "hash_table.h"
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "jx_snapshot.h"
+#include "stringtools.h"
+#include "timestamp.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int records_count = 100000;
+static int repeats       = 3;
+
+/* The number of single records looked up in each run. */
+#define LOOKUPS 100
+
+static void show_help(const char *cmd)
+{
+	printf("Usage: %s [options]\n", cmd);
+	printf("Where options are:\n");
+	printf("-n <n>  Number of records. (default: %d)\n", records_count);
+	printf("-r <n>  Number of runs per workload. (default: %d)\n", repeats);
+	printf("-h      Show this help screen.\n");
+}
+
+static char *make_key(int n)
+{
+	return string_format("host%d.cluster.example.edu:%d", n, 9000 + n % 1000);
+}
+
+static struct jx *make_record(int n)
+{
+	char *text = string_format(
+		"{\"type\":\"wq_master\",\"name\":\"host%d.cluster.example.edu\",\"port\":%d,\"owner\":\"user%d\","
+		"\"project\":\"analysis-%d\",\"tasks_waiting\":%d,\"tasks_running\":%d,\"workers\":%d,"
+		"\"categories\":[{\"name\":\"default\",\"tasks\":%d},{\"name\":\"merge\",\"tasks\":%d}],"
+		"\"lastheardfrom\":%d,\"load\":%f,\"preferred\":true}",
+		n, 9000 + n % 1000, n % 97, n % 13, n % 500, n % 300, n % 64, n % 50, n % 7, 1600000000 + n, n / 7.0);
+	struct jx *j = jx_parse_string(text);
+	free(text);
+	return j;
+}
+
+/* Writes the checkpoint as checkpoint_write of jx_database does. */
+static int write_json(const char *filename, struct jx *checkpoint)
+{
+	FILE *file = fopen(filename, "w");
+	if(!file) return 0;
+
+	int first = 1;
+	struct jx_pair *p;
+
+	fprintf(file, "{\n");
+	for(p = checkpoint->u.pairs; p; p = p->next) {
+		if(!first) fprintf(file, ",\n");
+		first = 0;
+		fprintf(file, "\"%s\":\n", p->key->u.string_value);
+		jx_print_stream(p->value, file);
+	}
+	fprintf(file, "}\n");
+
+	fclose(file);
+	return 1;
+}
+
+static void delete_table(struct hash_table *table)
+{
+	char *key;
+	struct jx *j;
+
+	hash_table_firstkey(table);
+	while(hash_table_nextkey(table, &key, (void **) &j)) {
+		jx_delete(j);
+	}
+	hash_table_delete(table);
+}
+
+static timestamp_t run_json(const char *filename, int n)
+{
+	timestamp_t start = timestamp_get();
+
+	FILE *file = fopen(filename, "r");
+	if(!file) return 0;
+
+	struct jx *checkpoint = jx_parse_stream(file);
+	fclose(file);
+	if(!checkpoint) return 0;
+
+	struct hash_table *table = hash_table_create(0, 0);
+
+	struct jx_pair *p;
+	for(p = checkpoint->u.pairs; p; p = p->next) {
+		hash_table_insert(table, p->key->u.string_value, p->value);
+		p->value = 0;
+	}
+	jx_delete(checkpoint);
+
+	timestamp_t elapsed = timestamp_get() - start;
+
+	int ok = hash_table_size(table) == n;
+	delete_table(table);
+
+	return ok ? elapsed : 0;
+}
+
+static timestamp_t run_snapshot(const char *filename, int n)
+{
+	timestamp_t start = timestamp_get();
+
+	struct jx_snapshot *s = jx_snapshot_open(filename);
+	if(!s) return 0;
+
+	struct hash_table *table = hash_table_create(0, 0);
+
+	int i;
+	for(i = 0; i < jx_snapshot_size(s); i++) {
+		hash_table_insert(table, jx_snapshot_key(s, i), jx_snapshot_value(s, i));
+	}
+	jx_snapshot_close(s);
+
+	timestamp_t elapsed = timestamp_get() - start;
+
+	int ok = hash_table_size(table) == n;
+	delete_table(table);
+
+	return ok ? elapsed : 0;
+}
+
+static timestamp_t run_lookup(const char *filename, int n)
+{
+	timestamp_t start = timestamp_get();
+
+	int i, found = 0;
+	for(i = 0; i < LOOKUPS; i++) {
+		struct jx_snapshot *s = jx_snapshot_open(filename);
+		if(!s) return 0;
+
+		char *key = make_key((i * 7919) % n);
+		struct jx *j = jx_snapshot_lookup(s, key);
+		if(j) found++;
+		jx_delete(j);
+		free(key);
+
+		jx_snapshot_close(s);
+	}
+
+	timestamp_t elapsed = timestamp_get() - start;
+
+	return found == LOOKUPS ? elapsed : 0;
+}
+
+static void keep_best(timestamp_t *best, timestamp_t t)
+{
+	if(t && (!*best || t < *best)) *best = t;
+}
+
+static void report(const char *workload, timestamp_t best, int operations)
+{
+	if(!best) {
+		printf("%-16s failed\n", workload);
+	} else {
+		printf("%-16s %10.6f s\n", workload, best / 1000000.0 / operations);
+	}
+}
+
+static long file_size(const char *filename)
+{
+	struct stat info;
+	return stat(filename, &info) == 0 ? (long) info.st_size : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	while((c = getopt(argc, argv, "n:r:h")) != -1) {
+		switch(c) {
+		case 'n':
+			records_count = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if(records_count < 1 || repeats < 1) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	struct jx *checkpoint = jx_object(NULL);
+
+	int i;
+	for(i = 0; i < records_count; i++) {
+		char *key = make_key(i);
+		jx_insert(checkpoint, jx_string(key), make_record(i));
+		free(key);
+	}
+
+	char *json = string_format("jx_snapshot_benchmark.%d.ckpt", (int) getpid());
+	char *snapshot = string_format("jx_snapshot_benchmark.%d.snap", (int) getpid());
+
+	if(!write_json(json, checkpoint) || !jx_snapshot_write(snapshot, checkpoint)) {
+		fprintf(stderr, "couldn't write checkpoints in the current directory\n");
+		return 1;
+	}
+
+	jx_delete(checkpoint);
+
+	printf("records: %d, json: %ld bytes, snapshot: %ld bytes\n", records_count, file_size(json), file_size(snapshot));
+
+	timestamp_t best_json = 0, best_snapshot = 0, best_lookup = 0;
+
+	int r;
+	for(r = 0; r < repeats; r++) {
+		keep_best(&best_json, run_json(json, records_count));
+		keep_best(&best_snapshot, run_snapshot(snapshot, records_count));
+		keep_best(&best_lookup, run_lookup(snapshot, records_count));
+	}
+
+	report("json load", best_json, 1);
+	report("snapshot load", best_snapshot, 1);
+	report("snapshot record", best_lookup, LOOKUPS);
+
+	unlink(json);
+	unlink(snapshot);
+	free(json);
+	free(snapshot);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,157 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cctools.h"
+#include "getopt.h"
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_pretty_print.h"
+#include "jx_print.h"
+#include "jx_snapshot.h"
+
+static void show_help() {
+	const char *optfmt = "%2s %-20s %s\n";
+	printf("usage: jx_snapshot_tool [OPTIONS] create <JSON-FILE> <SNAPSHOT>\n");
+	printf("       jx_snapshot_tool [OPTIONS] export <SNAPSHOT>\n");
+	printf("       jx_snapshot_tool [OPTIONS] get <SNAPSHOT> <KEY>\n");
+	printf("       jx_snapshot_tool [OPTIONS] list <SNAPSHOT>\n");
+	printf("\n");
+	printf("create converts a JSON object, such as a catalog checkpoint, into a snapshot.\n");
+	printf("export prints a snapshot as a JSON object, get prints the value of one key,\n");
+	printf("and list prints the keys of a snapshot.\n");
+	printf("OPTIONS are:\n");
+	printf(optfmt, "-p", "--pretty", "Print more readable JSON");
+	printf(optfmt, "-v", "--version", "Show version number");
+	printf(optfmt, "-h", "--help", "Help: Show these options");
+}
+
+static const struct option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"version", no_argument, 0, 'v'},
+	{"pretty", no_argument, 0, 'p'},
+	{0, 0, 0, 0}};
+
+static int do_create(const char *input, const char *output) {
+	FILE *stream = fopen(input, "r");
+	if (!stream) {
+		fprintf(stderr, "failed to open input file %s: %s\n", input, strerror(errno));
+		return 1;
+	}
+
+	struct jx *body = jx_parse_stream(stream);
+	fclose(stream);
+
+	if (!jx_istype(body, JX_OBJECT)) {
+		fprintf(stderr, "%s does not contain a JSON object\n", input);
+		jx_delete(body);
+		return 1;
+	}
+
+	int ok = jx_snapshot_write(output, body);
+	if (!ok) {
+		fprintf(stderr, "failed to write snapshot %s: %s\n", output, strerror(errno));
+	}
+
+	jx_delete(body);
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+	void (*print_stream)(struct jx *, FILE *) = jx_print_stream;
+
+	int c;
+	while ((c = getopt_long(argc, argv, "vhp", long_options, NULL)) > -1) {
+		switch (c) {
+			case 'p':
+				print_stream = jx_pretty_print_stream;
+				break;
+			case 'h':
+				show_help();
+				return 0;
+			case 'v':
+				cctools_version_print(stdout, "jx_snapshot_tool");
+				return 0;
+			default:
+				show_help();
+				return 1;
+		}
+	}
+
+	int args = argc - optind;
+	if (args < 2) {
+		show_help();
+		return 1;
+	}
+
+	const char *command = argv[optind];
+	const char *filename = argv[optind + 1];
+
+	if (!strcmp(command, "create")) {
+		if (args != 3) {
+			show_help();
+			return 1;
+		}
+		return do_create(filename, argv[optind + 2]);
+	}
+
+	if ((!strcmp(command, "get") && args != 3) || (strcmp(command, "get") && args != 2)) {
+		show_help();
+		return 1;
+	}
+
+	struct jx_snapshot *s = jx_snapshot_open(filename);
+	if (!s) {
+		fprintf(stderr, "failed to open snapshot %s: %s\n", filename, strerror(errno));
+		return 1;
+	}
+
+	int result = 0;
+
+	if (!strcmp(command, "export")) {
+		struct jx *body = jx_snapshot_load(s);
+		if (body) {
+			print_stream(body, stdout);
+			printf("\n");
+			jx_delete(body);
+		} else {
+			fprintf(stderr, "snapshot %s is corrupt\n", filename);
+			result = 1;
+		}
+	} else if (!strcmp(command, "get")) {
+		struct jx *value = jx_snapshot_lookup(s, argv[optind + 2]);
+		if (value) {
+			print_stream(value, stdout);
+			printf("\n");
+			jx_delete(value);
+		} else {
+			fprintf(stderr, "key %s not found in %s\n", argv[optind + 2], filename);
+			result = 1;
+		}
+	} else if (!strcmp(command, "list")) {
+		int i;
+		for (i = 0; i < jx_snapshot_size(s); i++) {
+			const char *key = jx_snapshot_key(s, i);
+			if (!key) {
+				fprintf(stderr, "snapshot %s is corrupt\n", filename);
+				result = 1;
+				break;
+			}
+			printf("%s\n", key);
+		}
+	} else {
+		show_help();
+		result = 1;
+	}
+
+	jx_snapshot_close(s);
+	return result;
+}
+
+/* vim: set noexpandtab tabstop=4: */
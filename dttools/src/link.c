@@ -22,9 +22,16 @@ See the file COPYING for details.
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/utsname.h>
 
+#ifdef CCTOOLS_OPSYS_LINUX
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#endif
+
 #include <fcntl.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -46,6 +53,9 @@ See the file COPYING for details.
 #define TCP_HIGH_PORT_DEFAULT 32767
 #endif
 
+/* Most bytes held by a corked link. Larger writes go out at once, together with what is held. */
+#define LINK_OUTPUT_MAX (1<<16)
+
 enum link_type {
 	LINK_TYPE_STANDARD,
 	LINK_TYPE_FILE,
@@ -58,8 +68,34 @@ struct link {
 	char *buffer_start;
 	size_t buffer_length;
 	char buffer[1<<16];
+	char *output;          /* writes held while the link is corked, allocated on first use */
+	size_t output_length;
+	int corked;            /* nesting depth of link_cork */
 	char raddr[LINK_ADDRESS_MAX];
 	int rport;
+	struct link_poller *poller;
+	int poller_index;
+	int poller_events;
+	int poller_slot;
+	int poller_buffered;
+};
+
+struct link_poller {
+#ifdef CCTOOLS_OPSYS_LINUX
+	int epfd;
+	struct epoll_event *events;
+	int events_size;
+#endif
+	/* links[i] is the registered link at link->poller_index == i. Without
+	 * epoll, the poll table is kept between waits, with fds[i] for links[i]. */
+	struct link **links;
+	struct pollfd *fds;
+	int size;
+	int capacity;
+	/* Links with data in their read buffer, which poll would not report. */
+	struct link **buffered;
+	int buffered_size;
+	int buffered_capacity;
 };
 
 static int link_send_window = 65536;
@@ -280,9 +316,17 @@ static struct link *link_create()
 	link->fd = -1;
 	link->buffer_start = link->buffer;
 	link->buffer_length = 0;
+	link->output = 0;
+	link->output_length = 0;
+	link->corked = 0;
 	link->raddr[0] = 0;
 	link->rport = 0;
 	link->type = LINK_TYPE_STANDARD;
+	link->poller = 0;
+	link->poller_index = -1;
+	link->poller_events = 0;
+	link->poller_slot = -1;
+	link->poller_buffered = 0;
 
 	return link;
 }
@@ -543,17 +587,26 @@ failure:
 	return 0;
 }
 
+static void link_poller_mark_buffered(struct link_poller *p, struct link *link);
+static int flush_output(struct link *link, time_t stoptime);
+
 static ssize_t fill_buffer(struct link *link, time_t stoptime)
 {
 	if(link->buffer_length > 0)
 		return link->buffer_length;
 
+	/* The other end may be waiting for what is held before answering. */
+	if(!flush_output(link, stoptime))
+		return -1;
+
 	while(1) {
 		ssize_t chunk = read(link->fd, link->buffer, sizeof(link->buffer));
 		if(chunk > 0) {
 			link->read += chunk;
 			link->buffer_start = link->buffer;
 			link->buffer_length = chunk;
+			if(link->poller)
+				link_poller_mark_buffered(link->poller, link);
 			return chunk;
 		} else if(chunk == 0) {
 			link->buffer_start = link->buffer;
@@ -604,6 +657,9 @@ ssize_t link_read(struct link *link, char *data, size_t count, time_t stoptime)
 
 	/* Otherwise, pull it all off the wire. */
 
+	if(count > 0 && !flush_output(link, stoptime))
+		return total > 0 ? total : -1;
+
 	while(count > 0) {
 		chunk = read(link->fd, data, count);
 		if(chunk < 0) {
@@ -658,6 +714,9 @@ ssize_t link_read_avail(struct link *link, char *data, size_t count, time_t stop
 
 	/* Next, read what is available off the wire */
 
+	if(count > 0 && !flush_output(link, stoptime))
+		return total;
+
 	while(count > 0) {
 		chunk = read(link->fd, data, count);
 		if(chunk < 0) {
@@ -718,6 +777,97 @@ int link_readline(struct link *link, char *line, size_t length, time_t stoptime)
 	return 0;
 }
 
+/*
+Write the output held by a corked link followed by count bytes of data,
+gathered with writev so that both usually leave in a single system call.
+Returns the number of bytes of data written, like link_write.
+*/
+
+static ssize_t write_with_output(struct link *link, const char *data, size_t count, time_t stoptime)
+{
+	size_t held = link->output_length;
+	size_t total = held + count;
+	size_t done = 0;
+	ssize_t chunk = 0;
+
+	while(done < total) {
+		struct iovec iov[2];
+		int n = 0;
+
+		if(done < held) {
+			iov[n].iov_base = link->output + done;
+			iov[n].iov_len = held - done;
+			n++;
+		}
+
+		if(count > 0) {
+			size_t d = done > held ? done - held : 0;
+			iov[n].iov_base = (char *) data + d;
+			iov[n].iov_len = count - d;
+			n++;
+		}
+
+		chunk = writev(link->fd, iov, n);
+		if(chunk < 0) {
+			if(errno_is_temporary(errno) && link_sleep(link, stoptime, 0, 1)) {
+				continue;
+			} else {
+				break;
+			}
+		} else if(chunk == 0) {
+			break;
+		} else {
+			link->written += chunk;
+			done += chunk;
+		}
+	}
+
+	/* What could not be sent is dropped, as the link is broken anyway. */
+	link->output_length = 0;
+
+	if(done < held) {
+		return -1;
+	} else if(done > held) {
+		return done - held;
+	} else if(count == 0 || chunk == 0) {
+		return 0;
+	} else {
+		return -1;
+	}
+}
+
+static int flush_output(struct link *link, time_t stoptime)
+{
+	if(link->output_length == 0)
+		return 1;
+
+	return write_with_output(link, NULL, 0, stoptime) == 0;
+}
+
+void link_cork(struct link *link)
+{
+	if(!link)
+		return;
+
+	if(!link->output)
+		link->output = malloc(LINK_OUTPUT_MAX);
+
+	if(link->output)
+		link->corked++;
+}
+
+int link_uncork(struct link *link, time_t stoptime)
+{
+	if(!link || link->corked < 1)
+		return 1;
+
+	link->corked--;
+	if(link->corked > 0)
+		return 1;
+
+	return flush_output(link, stoptime);
+}
+
 ssize_t link_write(struct link *link, const char *data, size_t count, time_t stoptime)
 {
 	ssize_t total = 0;
@@ -726,6 +876,16 @@ ssize_t link_write(struct link *link, const char *data, size_t count, time_t sto
 	if (!link)
 		return errno = EINVAL, -1;
 
+	if(link->corked) {
+		if(link->output_length + count <= LINK_OUTPUT_MAX) {
+			memcpy(link->output + link->output_length, data, count);
+			link->output_length += count;
+			return count;
+		} else {
+			return write_with_output(link, data, count, stoptime);
+		}
+	}
+
 	while(count > 0) {
 		chunk = write(link->fd, data, count);
 		if(chunk < 0) {
@@ -786,6 +946,19 @@ ssize_t link_putvfstring(struct link *link, const char *fmt, time_t stoptime, va
 	const char *str;
 	buffer_t B;
 
+	/* A corked link takes the string directly into what it holds. */
+	if(link && link->corked) {
+		va_list va2;
+		size_t room = LINK_OUTPUT_MAX - link->output_length;
+		va_copy(va2, va);
+		int n = vsnprintf(link->output + link->output_length, room, fmt, va2);
+		va_end(va2);
+		if(n >= 0 && (size_t) n < room) {
+			link->output_length += n;
+			return n;
+		}
+	}
+
 	buffer_init(&B);
 	if (buffer_putvfstring(&B, fmt, va) == -1)
 		return -1;
@@ -811,10 +984,13 @@ ssize_t link_putfstring(struct link *link, const char *fmt, time_t stoptime, ...
 void link_close(struct link *link)
 {
 	if(link) {
+		if(link->poller)
+			link_poller_remove(link->poller, link);
 		if(link->fd >= 0)
 			close(link->fd);
 		if(link->rport)
 			debug(D_TCP, "disconnected from %s port %d", link->raddr, link->rport);
+		free(link->output);
 		free(link);
 	}
 }
@@ -822,6 +998,9 @@ void link_close(struct link *link)
 void link_detach(struct link *link)
 {
 	if(link) {
+		if(link->poller)
+			link_poller_remove(link->poller, link);
+		free(link->output);
 		free(link);
 	}
 }
@@ -912,10 +1091,186 @@ ssize_t link_stream_to_buffer(struct link * link, char **buffer, time_t stoptime
 	return total;
 }
 
+#ifdef CCTOOLS_OPSYS_LINUX
+
+/*
+Transfers between a tcp link and a file descriptor can be done by the kernel
+without copying the data through user space: sendfile from a regular file
+into the socket, and splice from the socket into a pipe, and from the pipe
+into the file. These return the bytes transferred, -1 on error, or
+LINK_ZERO_COPY_UNAVAILABLE if the descriptors do not support it and nothing
+was transferred, in which case the caller falls back to the buffered copy.
+*/
+
+#define LINK_ZERO_COPY_UNAVAILABLE -2
+
+static int zero_copy_unsupported(int err)
+{
+	return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP;
+}
+
+static int64_t stream_from_fd_sendfile(struct link *link, int fd, int64_t length, time_t stoptime)
+{
+	int64_t total = 0;
+
+	while(length > 0) {
+		ssize_t chunk = sendfile(link->fd, fd, NULL, MIN(length, 1<<30));
+		if(chunk > 0) {
+			link->written += chunk;
+			total += chunk;
+			length -= chunk;
+		} else if(chunk == 0) {
+			break;
+		} else if(errno_is_temporary(errno)) {
+			if(!link_sleep(link, stoptime, 0, 1))
+				return -1;
+		} else if(total == 0 && zero_copy_unsupported(errno)) {
+			return LINK_ZERO_COPY_UNAVAILABLE;
+		} else {
+			return -1;
+		}
+	}
+
+	return total;
+}
+
+/*
+Once data has been spliced from the socket into the pipe, it is no longer in
+the socket, so if the descriptor refuses a splice from the pipe, the data is
+read back out of the pipe and written instead of being lost.
+*/
+
+static ssize_t drain_pipe_to_fd(int pipefd, int fd, ssize_t length)
+{
+	char buffer[65536];
+	ssize_t total = 0;
+
+	while(total < length) {
+		ssize_t ractual = read(pipefd, buffer, MIN(length - total, (ssize_t) sizeof(buffer)));
+		if(ractual <= 0)
+			return -1;
+		if(full_write(fd, buffer, ractual) != ractual)
+			return -1;
+		total += ractual;
+	}
+
+	return total;
+}
+
+static int64_t stream_to_fd_splice(struct link *link, int fd, int64_t length, time_t stoptime)
+{
+	int64_t total = 0;
+	int splice_out = 1;
+	int p[2];
+
+	/* splice refuses descriptors opened for appending. */
+	int flags = fcntl(fd, F_GETFL);
+	if(flags < 0 || (flags & O_APPEND))
+		return LINK_ZERO_COPY_UNAVAILABLE;
+
+	if(pipe(p) < 0)
+		return LINK_ZERO_COPY_UNAVAILABLE;
+
+	while(length > 0) {
+		ssize_t chunk = splice(link->fd, NULL, p[1], NULL, MIN(length, (int64_t) sizeof(link->buffer)), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if(chunk > 0) {
+			link->read += chunk;
+			while(chunk > 0) {
+				ssize_t wactual = -1;
+				if(splice_out) {
+					wactual = splice(p[0], NULL, fd, NULL, chunk, SPLICE_F_MOVE);
+					if(wactual < 0 && zero_copy_unsupported(errno)) {
+						splice_out = 0;
+					}
+				}
+				if(!splice_out) {
+					wactual = drain_pipe_to_fd(p[0], fd, chunk);
+				}
+				if(wactual <= 0) {
+					total = -1;
+					goto done;
+				}
+				chunk -= wactual;
+				total += wactual;
+				length -= wactual;
+			}
+		} else if(chunk == 0) {
+			break;
+		} else if(errno_is_temporary(errno)) {
+			if(!link_sleep(link, stoptime, 1, 0))
+				break;
+		} else if(total == 0 && zero_copy_unsupported(errno)) {
+			total = LINK_ZERO_COPY_UNAVAILABLE;
+			break;
+		} else {
+			break;
+		}
+	}
+
+done:
+	close(p[0]);
+	close(p[1]);
+
+	return total;
+}
+
+/*
+Returns the descriptor under a stream of a regular file, with the stream
+flushed so that the descriptor may be used directly, or -1 otherwise. Once
+done, the stream is moved to the offset of the descriptor.
+*/
+
+static int stream_zero_copy_fd(FILE *file)
+{
+	struct stat info;
+	int fd = fileno(file);
+
+	if(fd < 0 || fstat(fd, &info) < 0 || !S_ISREG(info.st_mode))
+		return -1;
+
+	if(fflush(file) != 0)
+		return -1;
+
+	return fd;
+}
+
+static void stream_zero_copy_done(FILE *file, int fd)
+{
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+	if(offset >= 0)
+		fseeko(file, offset, SEEK_SET);
+}
+
+#endif
+
 int64_t link_stream_to_fd(struct link * link, int fd, int64_t length, time_t stoptime)
 {
 	int64_t total = 0;
 
+	if(!flush_output(link, stoptime))
+		return -1;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	/* Data already read into the link buffer is written out first, then the
+	 * rest is spliced. Short transfers are not worth setting up a pipe. */
+	if(link->type == LINK_TYPE_STANDARD && length - (int64_t) link->buffer_length >= (int64_t) sizeof(link->buffer)) {
+		if(link->buffer_length > 0) {
+			ssize_t chunk = link->buffer_length;
+			if(full_write(fd, link->buffer_start, chunk) != chunk)
+				return -1;
+			link->buffer_start += chunk;
+			link->buffer_length = 0;
+			total += chunk;
+			length -= chunk;
+		}
+
+		int64_t actual = stream_to_fd_splice(link, fd, length, stoptime);
+		if(actual != LINK_ZERO_COPY_UNAVAILABLE) {
+			return actual < 0 ? actual : total + actual;
+		}
+	}
+#endif
+
 	while(length > 0) {
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -941,6 +1296,17 @@ int64_t link_stream_to_file(struct link * link, FILE * file, int64_t length, tim
 {
 	int64_t total = 0;
 
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(link->type == LINK_TYPE_STANDARD && length >= (int64_t) sizeof(link->buffer)) {
+		int fd = stream_zero_copy_fd(file);
+		if(fd >= 0) {
+			total = link_stream_to_fd(link, fd, length, stoptime);
+			stream_zero_copy_done(file, fd);
+			return total;
+		}
+	}
+#endif
+
 	while(length > 0) {
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -966,6 +1332,27 @@ int64_t link_stream_from_fd(struct link * link, int fd, int64_t length, time_t s
 {
 	int64_t total = 0;
 
+	/* A short file is held along with the rest by a corked link. */
+	if(link->corked && length >= 0 && (size_t) length <= LINK_OUTPUT_MAX - link->output_length) {
+		ssize_t actual = full_read(fd, link->output + link->output_length, length);
+		if(actual > 0)
+			link->output_length += actual;
+		return actual;
+	}
+
+	if(!flush_output(link, stoptime))
+		return -1;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	struct stat info;
+	if(link->type == LINK_TYPE_STANDARD && length > 0 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+		int64_t actual = stream_from_fd_sendfile(link, fd, length, stoptime);
+		if(actual != LINK_ZERO_COPY_UNAVAILABLE) {
+			return actual;
+		}
+	}
+#endif
+
 	while(length > 0) {
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -991,6 +1378,17 @@ int64_t link_stream_from_file(struct link * link, FILE * file, int64_t length, t
 {
 	int64_t total = 0;
 
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(link->type == LINK_TYPE_STANDARD && length >= (int64_t) sizeof(link->buffer)) {
+		int fd = stream_zero_copy_fd(file);
+		if(fd >= 0) {
+			total = link_stream_from_fd(link, fd, length, stoptime);
+			stream_zero_copy_done(file, fd);
+			return total;
+		}
+	}
+#endif
+
 	while(1) {
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -1113,4 +1511,242 @@ int link_poll(struct link_info *links, int nlinks, int msec)
 	return result;
 }
 
+struct link_poller *link_poller_create(void)
+{
+	struct link_poller *p = calloc(1, sizeof(*p));
+	if(!p)
+		return 0;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	p->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(p->epfd < 0) {
+		debug(D_TCP, "couldn't create epoll set: %s", strerror(errno));
+		free(p);
+		return 0;
+	}
+#endif
+
+	return p;
+}
+
+void link_poller_delete(struct link_poller *p)
+{
+	if(!p)
+		return;
+
+	int i;
+	for(i = 0; i < p->size; i++) {
+		p->links[i]->poller = 0;
+		p->links[i]->poller_index = -1;
+		p->links[i]->poller_buffered = 0;
+	}
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	close(p->epfd);
+	free(p->events);
+#endif
+
+	free(p->fds);
+	free(p->links);
+	free(p->buffered);
+	free(p);
+}
+
+static void link_poller_mark_buffered(struct link_poller *p, struct link *link)
+{
+	if(link->poller_buffered)
+		return;
+
+	if(p->buffered_size >= p->buffered_capacity) {
+		int capacity = p->buffered_capacity ? 2 * p->buffered_capacity : 8;
+		struct link **buffered = realloc(p->buffered, capacity * sizeof(*buffered));
+		if(!buffered)
+			fatal("couldn't allocate memory for link poller: %s", strerror(errno));
+		p->buffered = buffered;
+		p->buffered_capacity = capacity;
+	}
+
+	p->buffered[p->buffered_size++] = link;
+	link->poller_buffered = 1;
+}
+
+int link_poller_add(struct link_poller *p, struct link *link, int events)
+{
+	if(link->poller)
+		return link->poller == p;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.data.ptr = link;
+	if(events & LINK_READ)
+		ev.events |= EPOLLIN | EPOLLRDHUP;
+	if(events & LINK_WRITE)
+		ev.events |= EPOLLOUT;
+
+	if(epoll_ctl(p->epfd, EPOLL_CTL_ADD, link->fd, &ev) < 0) {
+		debug(D_TCP, "couldn't add fd %d to epoll set: %s", link->fd, strerror(errno));
+		return 0;
+	}
+#endif
+
+	if(p->size >= p->capacity) {
+		int capacity = p->capacity ? 2 * p->capacity : 8;
+		struct link **links = realloc(p->links, capacity * sizeof(*links));
+		if(!links)
+			fatal("couldn't allocate memory for link poller: %s", strerror(errno));
+		p->links = links;
+#ifndef CCTOOLS_OPSYS_LINUX
+		struct pollfd *fds = realloc(p->fds, capacity * sizeof(*fds));
+		if(!fds)
+			fatal("couldn't allocate memory for link poller: %s", strerror(errno));
+		p->fds = fds;
+#endif
+		p->capacity = capacity;
+	}
+
+#ifndef CCTOOLS_OPSYS_LINUX
+	p->fds[p->size].fd = link->fd;
+	p->fds[p->size].events = link_to_poll(events);
+	p->fds[p->size].revents = 0;
+#endif
+	p->links[p->size] = link;
+	link->poller_index = p->size;
+	link->poller_events = events;
+	link->poller = p;
+	p->size++;
+
+	if(link->buffer_length > 0)
+		link_poller_mark_buffered(p, link);
+
+	return 1;
+}
+
+void link_poller_remove(struct link_poller *p, struct link *link)
+{
+	if(link->poller != p)
+		return;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	epoll_ctl(p->epfd, EPOLL_CTL_DEL, link->fd, &ev);
+#endif
+
+	/* move the last entry into the freed slot to keep the table dense. */
+	int last = p->size - 1;
+	if(link->poller_index != last) {
+		p->links[link->poller_index] = p->links[last];
+		p->links[link->poller_index]->poller_index = link->poller_index;
+#ifndef CCTOOLS_OPSYS_LINUX
+		p->fds[link->poller_index] = p->fds[last];
+#endif
+	}
+	p->size--;
+
+	if(link->poller_buffered) {
+		int i;
+		for(i = 0; i < p->buffered_size; i++) {
+			if(p->buffered[i] == link) {
+				p->buffered[i] = p->buffered[--p->buffered_size];
+				break;
+			}
+		}
+	}
+
+	link->poller = 0;
+	link->poller_index = -1;
+	link->poller_buffered = 0;
+}
+
+static int link_poller_add_ready(struct link_info *ready, int n, struct link *link, int revents)
+{
+	if(link->poller_slot >= 0) {
+		ready[link->poller_slot].revents |= revents;
+		return n;
+	}
+
+	ready[n].link = link;
+	ready[n].events = link->poller_events;
+	ready[n].revents = revents;
+	link->poller_slot = n;
+
+	return n + 1;
+}
+
+int link_poller_wait(struct link_poller *p, struct link_info *ready, int max, int msec)
+{
+	int n = 0;
+	int i;
+
+	if(max < 1)
+		return 0;
+
+	/* Links with data already waiting are ready now, so do not sit in the
+	 * wait. Links whose buffer has been drained are dropped from the list. */
+	i = 0;
+	while(i < p->buffered_size) {
+		struct link *link = p->buffered[i];
+		if(link->buffer_length == 0) {
+			link->poller_buffered = 0;
+			p->buffered[i] = p->buffered[--p->buffered_size];
+			continue;
+		}
+		if(n < max)
+			n = link_poller_add_ready(ready, n, link, LINK_READ);
+		i++;
+	}
+
+	if(n > 0)
+		msec = 0;
+
+	int result;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(p->events_size < max) {
+		struct epoll_event *events = realloc(p->events, max * sizeof(*events));
+		if(!events)
+			fatal("couldn't allocate memory for link poller: %s", strerror(errno));
+		p->events = events;
+		p->events_size = max;
+	}
+
+	/* leave room for the links not yet reported. */
+	result = epoll_wait(p->epfd, p->events, max - n > 0 ? max - n : 1, msec);
+
+	for(i = 0; i < result; i++) {
+		struct epoll_event *ev = &p->events[i];
+		int revents = 0;
+		if(ev->events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+			revents |= LINK_READ;
+		if(ev->events & EPOLLOUT)
+			revents |= LINK_WRITE;
+		if(revents && (n < max || ((struct link *) ev->data.ptr)->poller_slot >= 0))
+			n = link_poller_add_ready(ready, n, ev->data.ptr, revents);
+	}
+#else
+	result = poll(p->fds, p->size, msec);
+
+	for(i = 0; i < p->size && result > 0 && n < max; i++) {
+		short r = p->fds[i].revents;
+		if(!r)
+			continue;
+		int revents = poll_to_link(r);
+		if(r & (POLLERR | POLLNVAL))
+			revents |= LINK_READ;
+		if(revents)
+			n = link_poller_add_ready(ready, n, p->links[i], revents);
+	}
+#endif
+
+	for(i = 0; i < n; i++) {
+		ready[i].link->poller_slot = -1;
+	}
+
+	if(result < 0 && n == 0)
+		return -1;
+
+	return n;
+}
+
 /* vim: set noexpandtab tabstop=4: */
@@ -200,6 +200,24 @@ ssize_t link_putfstring(struct link *link, const char *fmt, time_t stoptime, ...
 */
 ssize_t link_putvfstring(struct link *link, const char *fmt, time_t stoptime, va_list va);
 
+/** Hold small writes to a connection until @ref link_uncork is called.
+Writes made in between are gathered, so that a burst of short messages
+goes out in one or a few system calls instead of one per message. A write
+too large to be held is sent at once, together with what is held. Reading
+from the link, or streaming a file to or from it, sends what is held first,
+so that a request is never held while waiting for its answer.
+Calls may be nested; what is held is sent when the outermost call is undone.
+@param link The link to cork.
+*/
+void link_cork(struct link *link);
+
+/** Send the writes held by @ref link_cork, and stop holding writes.
+@param link The link to uncork.
+@param stoptime The time at which to abort.
+@return One if everything held was sent, zero otherwise.
+*/
+int link_uncork(struct link *link, time_t stoptime);
+
 /** Block until a link is readable or writable.
 @param link The link to wait on.
 @param usec The maximum number of microseconds to wait.
@@ -346,4 +364,47 @@ Wait for a activity on a an array of links.
 
 int link_poll(struct link_info *array, int nlinks, int msec);
 
+/** A persistent set of links to wait on. See @ref link_poller_create. */
+struct link_poller;
+
+/** Create a persistent set of links to wait on.
+Unlike @ref link_poll, which takes the whole array of links at every call,
+links are registered once with @ref link_poller_add, and @ref link_poller_wait
+only returns the links that are ready. Thus, links that are idle cost nothing
+per wait. On Linux the set is kept in the kernel with epoll, elsewhere it falls
+back to poll over a table that is kept between calls.
+@return A new link poller, or null on failure.
+*/
+struct link_poller *link_poller_create(void);
+
+/** Delete a link poller. The links in the poller are not closed.
+@param p The link poller to delete.
+*/
+void link_poller_delete(struct link_poller *p);
+
+/** Add a link to a poller.
+A link may be in at most one poller at a time. A link is removed from its poller when closed with @ref link_close.
+@param p The link poller.
+@param link The link to add.
+@param events The events to wait for (@ref LINK_READ or @ref LINK_WRITE).
+@return One on success, zero on failure.
+*/
+int link_poller_add(struct link_poller *p, struct link *link, int events);
+
+/** Remove a link from a poller.
+@param p The link poller.
+@param link The link to remove. Nothing happens if the link is not in the poller.
+*/
+void link_poller_remove(struct link_poller *p, struct link *link);
+
+/** Wait for activity on the links of a poller.
+Links that have data waiting in their read buffer are always reported as readable.
+@param p The link poller.
+@param ready Pointer to an array of @ref link_info structures, which is filled with the links that are ready, and the events that occurred in the revents field.
+@param max The length of the ready array.
+@param msec The number of milliseconds to wait for activity.  Zero indicates do not wait at all, while -1 indicates wait forever.
+@return The number of links filled in the ready array, or less than zero on error.
+*/
+int link_poller_wait(struct link_poller *p, struct link_info *ready, int max, int msec);
+
 #endif
@@ -0,0 +1,191 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Measures how fast resource_monitor accounts memory maps. A synthetic smaps
+file with the given number of mappings is written, with file mappings that
+overlap (as when several processes map the same libraries) and anonymous
+mappings. The file is then parsed and its segments merged the given number
+of times, reporting the time per pass and the totals found.
+*/
+
+#include "rmonitor_poll_internal.h"
+#include "timestamp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int mappings = 50000;
+static int repeats  = 10;
+static const char *output_path = NULL;
+
+static void show_help(const char *cmd)
+{
+	printf("Usage: %s [options]\n", cmd);
+	printf("Where options are:\n");
+	printf("-n <n>     Number of mappings in the smaps file. (default: %d)\n", mappings);
+	printf("-r <n>     Number of times the file is parsed. (default: %d)\n", repeats);
+	printf("-o <file>  Keep the smaps file generated at <file>.\n");
+	printf("-h         Show this help screen.\n");
+}
+
+static void write_mapping(FILE *f, uint64_t start, uint64_t size, uint64_t offset, const char *path, uint64_t rss, uint64_t private)
+{
+	uint64_t kb = size / 1024;
+
+	fprintf(f, "%012" PRIx64 "-%012" PRIx64 " r-xp %08" PRIx64 " 08:01 %-8d                   %s\n", start, start + size, offset, path[0] ? 266469 : 0, path);
+	fprintf(f, "Size:               %8" PRIu64 " kB\n", kb);
+	fprintf(f, "KernelPageSize:            4 kB\n");
+	fprintf(f, "MMUPageSize:               4 kB\n");
+	fprintf(f, "Rss:                %8" PRIu64 " kB\n", rss);
+	fprintf(f, "Pss:                %8" PRIu64 " kB\n", private + (rss - private) / 2);
+	fprintf(f, "Shared_Clean:       %8" PRIu64 " kB\n", rss - private);
+	fprintf(f, "Shared_Dirty:              0 kB\n");
+	fprintf(f, "Private_Clean:      %8" PRIu64 " kB\n", private / 2);
+	fprintf(f, "Private_Dirty:      %8" PRIu64 " kB\n", private - private / 2);
+	fprintf(f, "Referenced:         %8" PRIu64 " kB\n", rss);
+	fprintf(f, "Anonymous:          %8" PRIu64 " kB\n", path[0] ? 0 : rss);
+	fprintf(f, "LazyFree:                  0 kB\n");
+	fprintf(f, "AnonHugePages:             0 kB\n");
+	fprintf(f, "ShmemPmdMapped:            0 kB\n");
+	fprintf(f, "FilePmdMapped:             0 kB\n");
+	fprintf(f, "Shared_Hugetlb:            0 kB\n");
+	fprintf(f, "Private_Hugetlb:           0 kB\n");
+	fprintf(f, "Swap:                      0 kB\n");
+	fprintf(f, "SwapPss:                   0 kB\n");
+	fprintf(f, "Locked:                    0 kB\n");
+	fprintf(f, "THPeligible:               0\n");
+	fprintf(f, "VmFlags: rd ex mr mw me sd\n");
+}
+
+/* Three out of five mappings are of files, at offsets that overlap among
+ * mappings of the same file. The rest are anonymous. */
+static void write_smaps(FILE *f, int n)
+{
+	int files = n / 50 + 1;
+	uint64_t address = 0x400000;
+
+	srand(1);
+
+	int i;
+	for(i = 0; i < n; i++) {
+		char path[64];
+		uint64_t size, offset;
+
+		if(i % 5 < 3) {
+			snprintf(path, sizeof(path), "/usr/lib/libsynthetic%d.so", rand() % files);
+			size   = (1 + rand() % 4) * 16 * 4096;
+			offset = (rand() % 64) * 16 * 4096;
+		} else {
+			path[0] = '\0';
+			size    = (1 + rand() % 256) * 4096;
+			offset  = 0;
+		}
+
+		uint64_t rss     = (rand() % (size / 4096 + 1)) * 4;
+		uint64_t private = path[0] ? rss / 4 : rss;
+
+		write_mapping(f, address, size, offset, path, rss, private);
+
+		address += size + 4096;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	while((c = getopt(argc, argv, "n:r:o:h")) != -1) {
+		switch(c) {
+		case 'n':
+			mappings = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 'o':
+			output_path = optarg;
+			break;
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if(mappings < 1 || repeats < 1) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	char template[] = "rmonitor_maps_benchmark.XXXXXX";
+	const char *path = output_path ? output_path : template;
+
+	int fd;
+	if(output_path) {
+		fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	} else {
+		fd = mkstemp(template);
+	}
+
+	if(fd < 0) {
+		fprintf(stderr, "could not create %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	FILE *f = fdopen(dup(fd), "w");
+	write_smaps(f, mappings);
+	fclose(f);
+
+	struct rmonitor_maps *maps = rmonitor_maps_create();
+	struct rmonitor_mem_info mem;
+
+	timestamp_t best = 0;
+	timestamp_t total = 0;
+
+	int i;
+	for(i = 0; i < repeats; i++) {
+		memset(&mem, 0, sizeof(mem));
+		lseek(fd, 0, SEEK_SET);
+
+		timestamp_t start = timestamp_get();
+		rmonitor_maps_read(maps, fd);
+		rmonitor_maps_collate(maps, &mem);
+		timestamp_t elapsed = timestamp_get() - start;
+
+		total += elapsed;
+		if(i == 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	rmonitor_maps_delete(maps);
+	close(fd);
+
+	if(!output_path) {
+		unlink(template);
+	}
+
+	printf("mappings:      %d\n", mappings);
+	printf("pass (best):   %.3f ms\n", best / 1000.0);
+	printf("pass (mean):   %.3f ms\n", total / 1000.0 / repeats);
+	printf("mappings/s:    %.0f\n", mappings / (best / 1000000.0));
+	printf("virtual:       %" PRIu64 " kB\n", mem.virtual);
+	printf("resident:      %" PRIu64 " kB\n", mem.resident);
+	printf("private:       %" PRIu64 " kB\n", mem.private);
+	printf("shared:        %" PRIu64 " kB\n", mem.shared);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
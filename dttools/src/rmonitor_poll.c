@@ -11,6 +11,9 @@ See the file COPYING for details.
 #include <errno.h>
 #include <limits.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include <sys/time.h>
 
 #include "debug.h"
@@ -30,7 +33,12 @@ See the file COPYING for details.
  * Helper functions
 ***/
 
-#define ANON_MAPS_NAME "[anon]"
+
+/* /proc files read whole, and at every poll. */
+enum { PROC_FILE_STAT, PROC_FILE_STATUS, PROC_FILE_IO, PROC_FILES };
+#define PROC_FILE_SIZE 8192
+
+#define CGROUP_V2_MOUNT "/sys/fs/cgroup"
 
 uint64_t usecs_since_epoch()
 {
@@ -64,15 +72,15 @@ void rmonitor_poll_all_processes_once(struct itable *processes, struct rmonitor_
 	{
 		int status = rmonitor_poll_process_once(p);
 
-		/* do not consider process if some error is found. */
+		/* the deltas of cpu time and io are zero if they could not be read. */
+		acc_cpu_time_usage(&acc->cpu, &p->cpu);
+		acc_sys_io_usage(&acc->io, &p->io);
+
+		/* do not consider the rest of the process if some error is found. */
 		if(status != 0)
 			continue;
 
 		acc_mem_usage(&acc->mem, &p->mem);
-
-		acc_cpu_time_usage(&acc->cpu, &p->cpu);
-
-		acc_sys_io_usage(&acc->io, &p->io);
 		acc_map_io_usage(&acc->io, &p->io);
 	}
 
@@ -130,15 +138,40 @@ void rmonitor_poll_all_fss_once(struct itable *filesysms, struct rmonitor_filesy
  * filesystem.
 ***/
 
+static int rmonitor_parse_cpu_time_usage(const char *buffer, struct rmonitor_cpu_time_info *cpu);
+static int rmonitor_parse_mem_usage(const char *buffer, struct rmonitor_mem_info *mem);
+static int rmonitor_parse_sys_io_usage(const char *buffer, struct rmonitor_io_info *io);
+static ssize_t rmonitor_read_process_file(struct rmonitor_process_info *p, int which, char *buffer, size_t size);
+
 int rmonitor_poll_process_once(struct rmonitor_process_info *p)
 {
+	char buffer[PROC_FILE_SIZE];
 	int status = 0;
 
 	debug(D_RMON, "monitoring process: %d\n", p->pid);
 
-	status |= rmonitor_get_cpu_time_usage(p->pid, &p->cpu);
-	status |= rmonitor_get_mem_usage(p->pid, &p->mem);
-	status |= rmonitor_get_sys_io_usage(p->pid, &p->io);
+	p->cpu.delta = 0;
+
+	if(rmonitor_read_process_file(p, PROC_FILE_STAT, buffer, sizeof(buffer)) < 0) {
+		status |= 1;
+	} else {
+		status |= rmonitor_parse_cpu_time_usage(buffer, &p->cpu);
+	}
+
+	if(rmonitor_read_process_file(p, PROC_FILE_STATUS, buffer, sizeof(buffer)) < 0) {
+		status |= 1;
+	} else {
+		status |= rmonitor_parse_mem_usage(buffer, &p->mem);
+	}
+
+	p->io.delta_chars_read    = 0;
+	p->io.delta_chars_written = 0;
+
+	if(rmonitor_read_process_file(p, PROC_FILE_IO, buffer, sizeof(buffer)) < 0) {
+		status |= 1;
+	} else {
+		status |= rmonitor_parse_sys_io_usage(buffer, &p->io);
+	}
 
 	return status;
 }
@@ -169,6 +202,165 @@ int rmonitor_poll_fs_once(struct rmonitor_filesys_info *f)
  * Utility functions (open log files, proc files, measure time)
  ***/
 
+/* The /proc files read at every poll are kept open, as long as there are
+ * descriptors to spare, and are read whole with pread to be parsed in a
+ * single pass. A descriptor keeps referring to the same process, thus once
+ * the process exits reads fail even if its pid is reused. */
+
+struct rmonitor_proc_files
+{
+	int fds[PROC_FILES];
+};
+
+static const char *proc_file_names[PROC_FILES] = { "stat", "status", "io" };
+
+static int proc_fds_open = 0;
+static int proc_fds_max  = -1;
+
+static int proc_fds_available(void)
+{
+	if(proc_fds_max < 0) {
+		struct rlimit limit;
+		if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+			/* leave half of the descriptors for everything else. */
+			proc_fds_max = limit.rlim_cur / 2;
+		} else {
+			proc_fds_max = 512;
+		}
+	}
+
+	return proc_fds_open < proc_fds_max;
+}
+
+static int open_proc_fd(pid_t pid, const char *filename)
+{
+	char path[PATH_MAX];
+
+	if(pid > -1) {
+		snprintf(path, sizeof(path), "/proc/%d/%s", pid, filename);
+	} else {
+		snprintf(path, sizeof(path), "/proc/%s", filename);
+	}
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		debug(D_RMON, "could not process file %s : %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	return fd;
+}
+
+/* Read the whole file from the start, null terminated. Returns the number of bytes read, or -1 on error. */
+static ssize_t read_proc_fd(int fd, char *buffer, size_t size)
+{
+	ssize_t n = pread(fd, buffer, size - 1, 0);
+	if(n < 0) {
+		return -1;
+	}
+
+	buffer[n] = '\0';
+
+	return n;
+}
+
+static ssize_t rmonitor_read_proc_file(pid_t pid, const char *filename, char *buffer, size_t size)
+{
+	int fd = open_proc_fd(pid, filename);
+	if(fd < 0) {
+		return -1;
+	}
+
+	ssize_t n = read_proc_fd(fd, buffer, size);
+	close(fd);
+
+	return n;
+}
+
+static ssize_t rmonitor_read_process_file(struct rmonitor_process_info *p, int which, char *buffer, size_t size)
+{
+	if(!p->files) {
+		p->files = malloc(sizeof(*p->files));
+
+		int i;
+		for(i = 0; i < PROC_FILES; i++) {
+			p->files->fds[i] = -1;
+		}
+	}
+
+	int *fd = &p->files->fds[which];
+
+	if(*fd < 0) {
+		if(!proc_fds_available()) {
+			return rmonitor_read_proc_file(p->pid, proc_file_names[which], buffer, size);
+		}
+
+		*fd = open_proc_fd(p->pid, proc_file_names[which]);
+		if(*fd < 0) {
+			return -1;
+		}
+
+		proc_fds_open++;
+	}
+
+	return read_proc_fd(*fd, buffer, size);
+}
+
+void rmonitor_poll_process_close(struct rmonitor_process_info *p)
+{
+	if(!p->files) {
+		return;
+	}
+
+	int i;
+	for(i = 0; i < PROC_FILES; i++) {
+		if(p->files->fds[i] > -1) {
+			close(p->files->fds[i]);
+			proc_fds_open--;
+		}
+	}
+
+	free(p->files);
+	p->files = NULL;
+}
+
+/* Parse in a single pass the lines of the form "name value" of a /proc
+ * file. Returns 0 if all the attributes were found, and 1 otherwise.
+ * Attributes not found are left unmodified. */
+struct proc_attribute
+{
+	const char *name;
+	uint64_t   *value;
+};
+
+static int rmonitor_parse_int_attributes(const char *buffer, struct proc_attribute *attributes, int n)
+{
+	const char *line = buffer;
+	int found = 0;
+
+	while(line && *line && found < n) {
+		int i;
+		for(i = 0; i < n; i++) {
+			size_t length = strlen(attributes[i].name);
+			if(strncmp(line, attributes[i].name, length) == 0) {
+				if(sscanf(line + length, "%" SCNu64, attributes[i].value) == 1) {
+					found++;
+				}
+				break;
+			}
+		}
+
+		line = strchr(line, '\n');
+		if(line) {
+			line++;
+		}
+	}
+
+	return found < n;
+}
+
 FILE *open_proc_file(pid_t pid, char *filename)
 {
 		FILE *fproc;
@@ -330,23 +522,32 @@ int rmonitor_get_cpu_time_usage(pid_t pid, struct rmonitor_cpu_time_info *cpu)
 {
 	/* /proc/[pid]/stat */
 
-	uint64_t kernel, user;
+	char buffer[PROC_FILE_SIZE];
 
+	if(rmonitor_read_proc_file(pid, "stat", buffer, sizeof(buffer)) < 0)
+		return 1;
 
-	FILE *fstat = open_proc_file(pid, "stat");
-	if(!fstat)
+	return rmonitor_parse_cpu_time_usage(buffer, cpu);
+}
+
+static int rmonitor_parse_cpu_time_usage(const char *buffer, struct rmonitor_cpu_time_info *cpu)
+{
+	uint64_t kernel, user;
+
+	/* the command name may have spaces, so fields are counted from its closing parenthesis. */
+	const char *fields = strrchr(buffer, ')');
+	if(!fields)
 		return 1;
 
 	int n;
-	n = fscanf(fstat,
-			"%*s" /* pid */ "%*s" /* cmd line */ "%*s" /* state */ "%*s" /* pid of parent */
+	n = sscanf(fields + 1,
+			"%*s" /* state */ "%*s" /* pid of parent */
 			"%*s" /* group ID */ "%*s" /* session id */ "%*s" /* tty pid */ "%*s" /* tty group ID */
 			"%*s" /* linux/sched.h flags */ "%*s %*s %*s %*s" /* faults */
 			"%" SCNu64 /* user mode time (in clock ticks) */
 			"%" SCNu64 /* kernel mode time (in clock ticks) */
 			/* .... */,
 			&kernel, &user);
-	fclose(fstat);
 
 	if(n != 2)
 		return 1;
@@ -386,23 +587,30 @@ int rmonitor_get_mem_usage(pid_t pid, struct rmonitor_mem_info *mem)
 {
 	// /proc/[pid]/status:
 
-	FILE *fmem = open_proc_file(pid, "status");
-	if(!fmem)
+	char buffer[PROC_FILE_SIZE];
+
+	if(rmonitor_read_proc_file(pid, "status", buffer, sizeof(buffer)) < 0)
 		return 1;
 
-	int status = 0;
+	return rmonitor_parse_mem_usage(buffer, mem);
+}
+
+static int rmonitor_parse_mem_usage(const char *buffer, struct rmonitor_mem_info *mem)
+{
 	/* in kB */
-	status |= rmonitor_get_int_attribute(fmem, "VmPeak:", &mem->virtual,  1);
-	status |= rmonitor_get_int_attribute(fmem, "VmHWM:",  &mem->resident, 1);
-	status |= rmonitor_get_int_attribute(fmem, "VmLib:",  &mem->shared,   1);
-	status |= rmonitor_get_int_attribute(fmem, "VmExe:",  &mem->text,     1);
-	status |= rmonitor_get_int_attribute(fmem, "VmData:", &mem->data,     1);
+	struct proc_attribute attributes[] = {
+		{ "VmPeak:", &mem->virtual  },
+		{ "VmHWM:",  &mem->resident },
+		{ "VmLib:",  &mem->shared   },
+		{ "VmExe:",  &mem->text     },
+		{ "VmData:", &mem->data     },
+	};
+
+	int status = rmonitor_parse_int_attributes(buffer, attributes, sizeof(attributes)/sizeof(*attributes));
 
 	/* from smaps when reading maps. */
 	mem->swap = 0;
 
-	fclose(fmem);
-
 	/* in MB */
 	mem->virtual  = DIV_INT_ROUND_UP(mem->virtual,  1024);
 	mem->resident = DIV_INT_ROUND_UP(mem->resident, 1024);
@@ -422,131 +630,319 @@ void acc_mem_usage(struct rmonitor_mem_info *acc, struct rmonitor_mem_info *othe
 		acc->shared   += other->shared;
 }
 
-struct rmonitor_mem_info *rmonitor_get_map_info(FILE *fmem, int rewind_flag) {
-	static int anon_map_count = 0;
+/***
+ * Memory maps, from /proc/[pid]/smaps.
+ *
+ * smaps is read through a fixed buffer and parsed in a single pass, without
+ * allocations per line. Each mapping becomes a segment in an array, with its
+ * boundaries moved to the offsets in its file, so that the mappings of a
+ * file by several processes can be merged. File names are replaced by ids,
+ * and anonymous mappings get an id of their own, so they are never merged.
+ ***/
 
-	if(!fmem)
-		return NULL;
+#define SMAPS_BUFFER (1<<16)
 
-	if(rewind_flag)
-		rewind(fmem);
+struct rmonitor_map_segment
+{
+	uint64_t name;
+	uint64_t start;
+	uint64_t end;
 
-	struct rmonitor_mem_info *info = malloc(sizeof(struct rmonitor_mem_info));
+	/* in kB */
+	uint64_t resident;
+	uint64_t referenced;
+	uint64_t swap;
+	uint64_t private;
+	uint64_t shared;
+};
+
+struct rmonitor_maps
+{
+	struct rmonitor_map_segment *segments;
+	size_t count;
+	size_t capacity;
 
-	uint64_t offset;
-	char map_info_line[PATH_MAX];
-	char map_name_found[PATH_MAX];
-	while( fgets(map_info_line, PATH_MAX, fmem) )
-	{
-		// start-end                 perm   offset device inode                       path
-		// 560019f25000-56001a127000 r-xp 00000000 08:01 266469                     /usr/bin/vim.basic
+	struct hash_table *names;   /* file name -> id */
+	uint64_t next_name;
+};
+
+struct smaps_reader
+{
+	int    fd;
+	size_t start;
+	size_t end;
+	int    eof;
+	char   buffer[SMAPS_BUFFER + 1];
+};
+
+/* Returns the next line, null terminated, or NULL at the end of the file.
+ * Lines longer than the buffer are cut. */
+static char *smaps_next_line(struct smaps_reader *r)
+{
+	while(1) {
+		char *line = r->buffer + r->start;
+		size_t length = r->end - r->start;
+
+		char *newline = memchr(line, '\n', length);
+		if(newline) {
+			*newline = '\0';
+			r->start = newline - r->buffer + 1;
+			return line;
+		}
+
+		if(r->eof || length == SMAPS_BUFFER) {
+			if(length == 0)
+				return NULL;
+
+			line[length] = '\0';
+			r->start = r->end;
+			return line;
+		}
 
-		int n;
-		n = sscanf(map_info_line, "%llx-%llx %*s %llx %*s %*s %s", (long long unsigned int *) &(info->map_start), (long long unsigned int *)  &(info->map_end), (long long unsigned int *) &offset, map_name_found);
+		/* keep the partial line, and fill the rest of the buffer. */
+		memmove(r->buffer, line, length);
+		r->start = 0;
+		r->end   = length;
 
-		/* continue if we do not get at least start, end, and offset */
-		if(n < 3)
+		ssize_t n = read(r->fd, r->buffer + r->end, SMAPS_BUFFER - r->end);
+		if(n < 0 && errno == EINTR)
 			continue;
 
-		/* file maps are always an absolute pathname. consider maps without a filename as different. */
-		if(n < 4 || map_name_found[0] != '/') {
-			info->map_name = string_format("ANON_MAPS_NAME.%d", anon_map_count);
-			anon_map_count++;
+		if(n <= 0) {
+			r->eof = 1;
 		} else {
-			info->map_name = xxstrdup(map_name_found);
+			r->end += n;
 		}
+	}
+}
 
-		// move boundaries to origin
-		info->map_end   = info->map_end - info->map_start + offset;
-		info->map_start = offset;
+static const char *smaps_parse_hex(const char *s, uint64_t *value)
+{
+	uint64_t v = 0;
 
-		return info;
+	for(;; s++) {
+		if(*s >= '0' && *s <= '9') {
+			v = (v << 4) | (*s - '0');
+		} else if(*s >= 'a' && *s <= 'f') {
+			v = (v << 4) | (*s - 'a' + 10);
+		} else {
+			break;
+		}
 	}
 
-	free(info);
+	*value = v;
 
-	return NULL;
+	return s;
 }
 
-static double rmonitor_mem_info_priority(void *item) {
-	assert(item);
-	struct rmonitor_mem_info *i = item;
-	return -1*(i->map_start);
+static const char *smaps_skip_field(const char *s)
+{
+	while(*s == ' ')
+		s++;
+
+	while(*s && *s != ' ')
+		s++;
+
+	while(*s == ' ')
+		s++;
+
+	return s;
 }
 
-int rmonitor_get_mmaps_usage(pid_t pid, struct hash_table *maps)
+/* start-end                 perm   offset device inode                       path
+ * 560019f25000-56001a127000 r-xp 00000000 08:01 266469                     /usr/bin/vim.basic */
+static int smaps_parse_header(const char *line, uint64_t *start, uint64_t *end, uint64_t *offset, const char **path)
 {
-	// /proc/[pid]/smaps:
+	const char *s = smaps_parse_hex(line, start);
+	if(*s != '-')
+		return 0;
 
-	FILE *fmem = open_proc_file(pid, "smaps");
-	if(!fmem)
-		return 1;
+	s = smaps_parse_hex(s + 1, end);
+	if(*s != ' ')
+		return 0;
 
-	struct rmonitor_mem_info *info;
-	while((info = rmonitor_get_map_info(fmem, 0))) {
+	s = smaps_skip_field(s);   /* perm */
+	s = smaps_parse_hex(s, offset);
+	s = smaps_skip_field(s);   /* device */
+	s = smaps_skip_field(s);   /* inode */
 
-		uint64_t rss, pss, swap, ref;
-		uint64_t private_dirty, private_clean;
+	*path = s;
 
-		int status = 0;
+	return 1;
+}
 
-		/* order is important, this is how the fields appear in smaps */
-		/* in kB! */
-		status |= rmonitor_get_int_attribute(fmem, "Rss:",           &rss, 0);
-		status |= rmonitor_get_int_attribute(fmem, "Pss:",           &pss, 0);
-		status |= rmonitor_get_int_attribute(fmem, "Private_Clean:", &private_clean, 0);
-		status |= rmonitor_get_int_attribute(fmem, "Private_Dirty:", &private_dirty, 0);
-		status |= rmonitor_get_int_attribute(fmem, "Referenced:",    &ref, 0);
-		status |= rmonitor_get_int_attribute(fmem, "Swap:",          &swap, 0);
+/* fields of a mapping needed, in the order they appear in smaps. */
+enum { SMAPS_RSS = 1, SMAPS_PRIVATE_CLEAN = 2, SMAPS_PRIVATE_DIRTY = 4, SMAPS_REFERENCED = 8, SMAPS_SWAP = 16, SMAPS_ALL = 31 };
+
+static const struct {
+	const char *name;
+	size_t length;
+	int field;
+} smaps_fields[] = {
+	{ "Rss:",           4,  SMAPS_RSS           },
+	{ "Private_Clean:", 14, SMAPS_PRIVATE_CLEAN },
+	{ "Private_Dirty:", 14, SMAPS_PRIVATE_DIRTY },
+	{ "Referenced:",    11, SMAPS_REFERENCED    },
+	{ "Swap:",          5,  SMAPS_SWAP          },
+};
+
+/* Returns the field of an attribute line, or 0 if it is not needed. */
+static int smaps_parse_field(const char *line, uint64_t *value)
+{
+	size_t i;
+	for(i = 0; i < sizeof(smaps_fields)/sizeof(*smaps_fields); i++) {
+		if(line[0] == smaps_fields[i].name[0] && strncmp(line, smaps_fields[i].name, smaps_fields[i].length) == 0) {
+			const char *s = line + smaps_fields[i].length;
+			while(*s == ' ')
+				s++;
+
+			uint64_t v = 0;
+			for(; *s >= '0' && *s <= '9'; s++)
+				v = v*10 + (*s - '0');
+
+			*value = v;
+			return smaps_fields[i].field;
+		}
+	}
 
-		/* error reading a field, we simply skip the record. */
-		if(status) {
-			free(info);
+	return 0;
+}
+
+struct rmonitor_maps *rmonitor_maps_create(void)
+{
+	struct rmonitor_maps *maps = calloc(1, sizeof(*maps));
+
+	maps->names     = hash_table_create(0, 0);
+	maps->next_name = 1;
+
+	return maps;
+}
+
+void rmonitor_maps_delete(struct rmonitor_maps *maps)
+{
+	if(!maps)
+		return;
+
+	hash_table_delete(maps->names);
+	free(maps->segments);
+	free(maps);
+}
+
+static uint64_t rmonitor_maps_name(struct rmonitor_maps *maps, const char *path)
+{
+	/* file maps are always an absolute pathname. consider maps without a filename as different. */
+	if(path[0] != '/')
+		return maps->next_name++;
+
+	uint64_t name = (uint64_t) (uintptr_t) hash_table_lookup(maps->names, path);
+	if(!name) {
+		name = maps->next_name++;
+		hash_table_insert(maps->names, path, (void *) (uintptr_t) name);
+	}
+
+	return name;
+}
+
+static void rmonitor_maps_add(struct rmonitor_maps *maps, struct rmonitor_map_segment *s, uint64_t private_clean, uint64_t private_dirty)
+{
+	/* private and shared may or may not be currently resident, (e.g.,
+	 swap). That is: rss = private + shared - swap = referenced - swap.  In
+	 the following, we try to compute private and shared that are actually
+	 resident. Since we do not have enough information, we assume the worst
+	 case that all private pages are resident. If swap is zero, then
+	 resident private and resident shared will have the correct values. */
+
+	s->private = MIN(private_dirty + private_clean, s->resident);
+	s->shared  = s->resident - s->private;
+
+	if(maps->count == maps->capacity) {
+		maps->capacity = MAX(1024, 2*maps->capacity);
+		maps->segments = realloc(maps->segments, maps->capacity * sizeof(*maps->segments));
+	}
+
+	maps->segments[maps->count++] = *s;
+}
+
+int rmonitor_maps_read(struct rmonitor_maps *maps, int fd)
+{
+	struct smaps_reader *r = malloc(sizeof(*r));
+	r->fd    = fd;
+	r->start = 0;
+	r->end   = 0;
+	r->eof   = 0;
+
+	struct rmonitor_map_segment s;
+	uint64_t private_clean = 0, private_dirty = 0;
+	int in_segment = 0;
+	int found = 0;
+
+	char *line;
+	while((line = smaps_next_line(r))) {
+		/* attribute lines start with a capital letter, and headers with an address. */
+		if(line[0] >= 'A' && line[0] <= 'Z') {
+			if(!in_segment)
+				continue;
+
+			uint64_t value;
+			int field = smaps_parse_field(line, &value);
+
+			switch(field) {
+				case SMAPS_RSS:           s.resident    = value; break;
+				case SMAPS_PRIVATE_CLEAN: private_clean = value; break;
+				case SMAPS_PRIVATE_DIRTY: private_dirty = value; break;
+				case SMAPS_REFERENCED:    s.referenced  = value; break;
+				case SMAPS_SWAP:          s.swap        = value; break;
+			}
+
+			found |= field;
 			continue;
 		}
 
-		info->resident   = rss;
-		info->referenced = ref;
-		info->swap       = swap;
-
-		/* private and shared may or may not be currently resident, (e.g.,
-		 swap). That is: rss = private + shared - swap = referenced - swap.  In
-		 the following, we try to compute private and shared that are actually
-		 resident. Since we do not have enough information, we assume the worst
-		 case that all private pages are resident. If swap is zero, then
-		 resident private and resident shared will have the correct values. */
-
-		info->private  = MIN(private_dirty + private_clean, rss);
-		info->shared   = MAX(rss - info->private, 0);
-
-		/* add the info to a sorted list per map, by start. Overlaping maps will be merged later. */
-		struct list *infos = hash_table_lookup(maps, info->map_name);
-		if(!infos) {
-			infos = list_create();
-			hash_table_insert(maps, info->map_name, infos);
-		}
+		/* error reading a field, we simply skip the record. */
+		if(in_segment && found == SMAPS_ALL)
+			rmonitor_maps_add(maps, &s, private_clean, private_dirty);
+
+		uint64_t start, end, offset;
+		const char *path;
 
-		list_push_priority(infos, rmonitor_mem_info_priority, info);
+		in_segment = smaps_parse_header(line, &start, &end, &offset, &path);
+		found = 0;
+
+		if(in_segment) {
+			memset(&s, 0, sizeof(s));
+
+			s.name  = rmonitor_maps_name(maps, path);
+
+			// move boundaries to origin
+			s.start = offset;
+			s.end   = end - start + offset;
+		}
 	}
 
-	fclose(fmem);
+	if(in_segment && found == SMAPS_ALL)
+		rmonitor_maps_add(maps, &s, private_clean, private_dirty);
+
+	free(r);
 
 	return 0;
 }
 
-int rmonitor_poll_maps_once(struct itable *processes, struct rmonitor_mem_info *mem) {
-	/* set result to 0. */
-	bzero(mem, sizeof(struct rmonitor_mem_info));
+static int rmonitor_map_segment_cmp(const void *a, const void *b)
+{
+	const struct rmonitor_map_segment *x = a;
+	const struct rmonitor_map_segment *y = b;
 
-	struct hash_table *maps_per_file = hash_table_create(0, 0);
+	if(x->name != y->name)
+		return x->name < y->name ? -1 : 1;
 
-	uint64_t pid;
-	struct rmonitor_process_info *pinfo;
-	itable_firstkey(processes);
-	while(itable_nextkey(processes, &pid, (void *) &pinfo)) {
-		rmonitor_get_mmaps_usage(pid, maps_per_file);
-	}
+	if(x->start != y->start)
+		return x->start < y->start ? -1 : 1;
 
+	return 0;
+}
+
+void rmonitor_maps_collate(struct rmonitor_maps *maps, struct rmonitor_mem_info *mem)
+{
 	/* Accumulate the maps we just found per file. First, we merge together all
 	 * the maps segment that overlap. With this, we do not overcount private
 	 * segments, but do consider that segments are shared as little as
@@ -567,69 +963,135 @@ int rmonitor_poll_maps_once(struct itable *processes, struct rmonitor_mem_info *
 	 * bounds.
 	 */
 
-	char *map_name;
-	struct list *infos;
-
-	hash_table_firstkey(maps_per_file);
-	while(hash_table_nextkey(maps_per_file, &map_name, (void *) &infos )) {
-
-		struct rmonitor_mem_info *info, *next;
-		while((info = list_pop_head(infos))) {
-			while((next = list_peek_head(infos))) {
-				/* do we need to merge with the next segment? */
-				if(info->map_end > next->map_start) {
-					info->private  += next->private;
-					info->shared   += next->shared;
-					info->resident += next->resident;
-					info->referenced += next->referenced;
-					info->swap     += next->swap;
-
-					info->map_end = MAX(info->map_end, next->map_end);
-
-					list_pop_head(infos);
-					if(next->map_name)
-						free(next->map_name);
-					free(next);
-				} else {
-					break;
-				}
-			}
+	qsort(maps->segments, maps->count, sizeof(*maps->segments), rmonitor_map_segment_cmp);
 
-			/* a series of upper bounds: */
-			/* by adding referenced, we assumed a worst case of non-sharing
-			 * memory, but referenced cannot be larger than the virtual size: */
-			info->virtual  = DIV_INT_ROUND_UP(info->map_end - info->map_start, 1024); /* bytes to kB. */
-			info->referenced = MIN(info->referenced, info->virtual);
+	size_t i = 0;
+	while(i < maps->count) {
+		struct rmonitor_map_segment info = maps->segments[i++];
 
-			/* similarly, resident cannot be larger than referenced. */
-			info->resident = MIN(info->resident, info->referenced);
+		/* do we need to merge with the next segments? */
+		while(i < maps->count) {
+			struct rmonitor_map_segment *next = &maps->segments[i];
 
-			/* and, resident private cannot be larger than resident. */
-			info->private  = MIN(info->private, info->resident);
+			if(next->name != info.name || info.end <= next->start)
+				break;
 
-			/* lastly, resident shared memory cannot be larger than the whole
-			 * resident size minus the resident private memory. */
-			info->shared = MIN(info->shared, info->resident - info->private);
+			info.private    += next->private;
+			info.shared     += next->shared;
+			info.resident   += next->resident;
+			info.referenced += next->referenced;
+			info.swap       += next->swap;
 
-			/* once the individual values have been found, we added together to the result. */
-			mem->virtual     += info->virtual;
-			mem->referenced  += info->referenced;
-			mem->shared      += info->shared;
-			mem->private     += info->private;
+			info.end = MAX(info.end, next->end);
+			i++;
+		}
 
-			/* note that we add private + shared, rather than resident,
-			 * otherwise we will overcount shared. */
-			mem->resident += info->private + info->shared;
+		/* a series of upper bounds: */
+		/* by adding referenced, we assumed a worst case of non-sharing
+		 * memory, but referenced cannot be larger than the virtual size: */
+		uint64_t virtual = DIV_INT_ROUND_UP(info.end - info.start, 1024); /* bytes to kB. */
+		info.referenced = MIN(info.referenced, virtual);
 
-			if(info->map_name)
-				free(info->map_name);
-			free(info);
-		}
+		/* similarly, resident cannot be larger than referenced. */
+		info.resident = MIN(info.resident, info.referenced);
+
+		/* and, resident private cannot be larger than resident. */
+		info.private  = MIN(info.private, info.resident);
+
+		/* lastly, resident shared memory cannot be larger than the whole
+		 * resident size minus the resident private memory. */
+		info.shared = MIN(info.shared, info.resident - info.private);
+
+		/* once the individual values have been found, we added together to the result. */
+		mem->virtual     += virtual;
+		mem->referenced  += info.referenced;
+		mem->shared      += info.shared;
+		mem->private     += info.private;
 
-		list_delete(infos);
+		/* note that we add private + shared, rather than resident,
+		 * otherwise we will overcount shared. */
+		mem->resident += info.private + info.shared;
 	}
 
-	hash_table_delete(maps_per_file);
+	maps->count     = 0;
+	maps->next_name = 1;
+	hash_table_clear(maps->names);
+}
+
+/* With a single process there is nothing to merge across processes, and the
+ * totals from smaps_rollup are enough. The virtual size, which the rollup
+ * does not report, is taken from status. */
+static int rmonitor_get_mmaps_rollup(struct rmonitor_process_info *p, struct rmonitor_mem_info *mem)
+{
+	char buffer[PROC_FILE_SIZE];
+
+	uint64_t rss, referenced, swap, private_clean, private_dirty, virtual;
+
+	struct proc_attribute rollup[] = {
+		{ "Rss:",           &rss           },
+		{ "Private_Clean:", &private_clean },
+		{ "Private_Dirty:", &private_dirty },
+		{ "Referenced:",    &referenced    },
+		{ "Swap:",          &swap          },
+	};
+
+	if(rmonitor_read_proc_file(p->pid, "smaps_rollup", buffer, sizeof(buffer)) < 0)
+		return 1;
+
+	if(rmonitor_parse_int_attributes(buffer, rollup, sizeof(rollup)/sizeof(*rollup)))
+		return 1;
+
+	struct proc_attribute status[] = { { "VmSize:", &virtual } };
+
+	if(rmonitor_read_process_file(p, PROC_FILE_STATUS, buffer, sizeof(buffer)) < 0)
+		return 1;
+
+	if(rmonitor_parse_int_attributes(buffer, status, 1))
+		return 1;
+
+	/* the same bounds as when merging segments. */
+	mem->virtual    = virtual;
+	mem->referenced = MIN(referenced, virtual);
+	mem->resident   = MIN(rss, mem->referenced);
+	mem->private    = MIN(private_clean + private_dirty, mem->resident);
+	mem->shared     = mem->resident - mem->private;
+
+	return 0;
+}
+
+int rmonitor_poll_maps_once(struct itable *processes, struct rmonitor_mem_info *mem) {
+	static struct rmonitor_maps *maps = NULL;
+
+	/* set result to 0. */
+	bzero(mem, sizeof(struct rmonitor_mem_info));
+
+	uint64_t pid;
+	struct rmonitor_process_info *pinfo;
+
+	int from_rollup = 0;
+
+	if(itable_size(processes) == 1) {
+		itable_firstkey(processes);
+		itable_nextkey(processes, &pid, (void *) &pinfo);
+		from_rollup = rmonitor_get_mmaps_rollup(pinfo, mem) == 0;
+	}
+
+	if(!from_rollup) {
+		if(!maps)
+			maps = rmonitor_maps_create();
+
+		itable_firstkey(processes);
+		while(itable_nextkey(processes, &pid, (void *) &pinfo)) {
+			int fd = open_proc_fd(pid, "smaps");
+			if(fd < 0)
+				continue;
+
+			rmonitor_maps_read(maps, fd);
+			close(fd);
+		}
+
+		rmonitor_maps_collate(maps, mem);
+	}
 
 	/* all the values computed are in kB, we convert to MB. */
 	mem->virtual      = DIV_INT_ROUND_UP(mem->virtual,  1024);
@@ -648,25 +1110,30 @@ int rmonitor_get_sys_io_usage(pid_t pid, struct rmonitor_io_info *io)
 	   any characters.
 	*/
 
-	FILE *fio = open_proc_file(pid, "io");
-	uint64_t cread, cwritten;
-	int rstatus, wstatus;
+	char buffer[PROC_FILE_SIZE];
 
 	io->delta_chars_read = 0;
 	io->delta_chars_written = 0;
 
-	if(!fio)
+	if(rmonitor_read_proc_file(pid, "io", buffer, sizeof(buffer)) < 0)
 		return 1;
 
+	return rmonitor_parse_sys_io_usage(buffer, io);
+}
+
+static int rmonitor_parse_sys_io_usage(const char *buffer, struct rmonitor_io_info *io)
+{
+	uint64_t cread, cwritten;
+
 	/* We really want "bytes_read", but there are issues with
 	 * distributed filesystems. Instead, we also count page
 	 * faulting in another function below. */
-	rstatus  = rmonitor_get_int_attribute(fio, "rchar", &cread, 1);
-	wstatus  = rmonitor_get_int_attribute(fio, "write_bytes", &cwritten, 1);
+	struct proc_attribute attributes[] = {
+		{ "rchar:",       &cread    },
+		{ "write_bytes:", &cwritten },
+	};
 
-	fclose(fio);
-
-	if(rstatus || wstatus)
+	if(rmonitor_parse_int_attributes(buffer, attributes, sizeof(attributes)/sizeof(*attributes)))
 		return 1;
 
 	io->delta_chars_read    = cread    - io->chars_read;
@@ -685,6 +1152,154 @@ void acc_sys_io_usage(struct rmonitor_io_info *acc, struct rmonitor_io_info *oth
 }
 
 /* We compute the resident memory changes from mmap files. */
+/***
+ * Functions to measure a cgroup v2.
+ ***/
+
+/* Path of the cgroup v2 of pid, relative to its mount point. */
+static char *rmonitor_cgroup_path(pid_t pid)
+{
+	char buffer[PROC_FILE_SIZE];
+
+	if(rmonitor_read_proc_file(pid, "cgroup", buffer, sizeof(buffer)) < 0)
+		return NULL;
+
+	/* in cgroup v2, the hierarchy is the line with id 0 and no controllers. */
+	char *line = buffer;
+	while(line && *line) {
+		char *end = strchr(line, '\n');
+		if(end)
+			*end = '\0';
+
+		if(strncmp(line, "0::", 3) == 0)
+			return xxstrdup(line + 3);
+
+		line = end ? end + 1 : NULL;
+	}
+
+	return NULL;
+}
+
+static int open_cgroup_fd(struct rmonitor_cgroup_info *cg, const char *filename)
+{
+	char *path = string_format("%s/%s", cg->path, filename);
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		debug(D_RMON, "could not open %s : %s\n", path, strerror(errno));
+	} else {
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	free(path);
+
+	return fd;
+}
+
+static int read_cgroup_int(int fd, const char *attribute, uint64_t *value)
+{
+	char buffer[PROC_FILE_SIZE];
+
+	if(read_proc_fd(fd, buffer, sizeof(buffer)) < 0)
+		return 1;
+
+	if(!attribute)
+		return sscanf(buffer, "%" SCNu64, value) != 1;
+
+	struct proc_attribute attributes[] = { { attribute, value } };
+
+	return rmonitor_parse_int_attributes(buffer, attributes, 1);
+}
+
+/*
+The cgroup is measured only if it holds the processes of the command
+alone. The root cgroup accounts for the whole machine, and the cgroup of
+the monitor itself, which a command that was not moved elsewhere inherits,
+is usually shared with the rest of a session, service, or container.
+*/
+struct rmonitor_cgroup_info *rmonitor_cgroup_open(pid_t pid)
+{
+	char *path = rmonitor_cgroup_path(pid);
+	char *own_path = rmonitor_cgroup_path(getpid());
+
+	int shared = !path || strcmp(path, "/") == 0 || (own_path && strcmp(path, own_path) == 0);
+	free(own_path);
+
+	if(shared || access(CGROUP_V2_MOUNT "/cgroup.controllers", F_OK) != 0) {
+		debug(D_RMON, "process %d does not run in a cgroup v2 of its own.\n", pid);
+		free(path);
+		return NULL;
+	}
+
+	struct rmonitor_cgroup_info *cg = calloc(1, sizeof(*cg));
+	cg->path = string_format("%s%s", CGROUP_V2_MOUNT, path);
+	free(path);
+
+	cg->fd_memory_current = open_cgroup_fd(cg, "memory.current");
+	cg->fd_memory_peak    = open_cgroup_fd(cg, "memory.peak");
+	cg->fd_cpu_stat       = open_cgroup_fd(cg, "cpu.stat");
+
+	if(cg->fd_memory_current < 0 || cg->fd_cpu_stat < 0 || read_cgroup_int(cg->fd_cpu_stat, "usage_usec", &cg->cpu_initial)) {
+		rmonitor_cgroup_close(cg);
+		return NULL;
+	}
+
+	/* a peak above the current usage was reached before the command was
+	 * measured, and so memory.peak cannot be used. */
+	uint64_t current, peak;
+	if(cg->fd_memory_peak > -1 && (read_cgroup_int(cg->fd_memory_current, NULL, &current) || read_cgroup_int(cg->fd_memory_peak, NULL, &peak) || peak > current)) {
+		debug(D_RMON, "ignoring memory.peak of cgroup %s, as it predates the command.\n", cg->path);
+		close(cg->fd_memory_peak);
+		cg->fd_memory_peak = -1;
+	}
+
+	debug(D_RMON, "measuring cgroup %s\n", cg->path);
+
+	return cg;
+}
+
+int rmonitor_poll_cgroup_once(struct rmonitor_cgroup_info *cg)
+{
+	uint64_t current, peak, usage;
+
+	if(read_cgroup_int(cg->fd_memory_current, NULL, &current))
+		return 1;
+
+	if(read_cgroup_int(cg->fd_cpu_stat, "usage_usec", &usage))
+		return 1;
+
+	/* in bytes */
+	cg->memory_current = DIV_INT_ROUND_UP(current, MEGABYTE);
+
+	if(cg->fd_memory_peak > -1 && !read_cgroup_int(cg->fd_memory_peak, NULL, &peak)) {
+		cg->memory_peak = DIV_INT_ROUND_UP(peak, MEGABYTE);
+	} else {
+		cg->memory_peak = MAX(cg->memory_peak, cg->memory_current);
+	}
+
+	cg->cpu_time = usage > cg->cpu_initial ? usage - cg->cpu_initial : 0;
+
+	return 0;
+}
+
+void rmonitor_cgroup_close(struct rmonitor_cgroup_info *cg)
+{
+	if(!cg)
+		return;
+
+	if(cg->fd_memory_current > -1)
+		close(cg->fd_memory_current);
+
+	if(cg->fd_memory_peak > -1)
+		close(cg->fd_memory_peak);
+
+	if(cg->fd_cpu_stat > -1)
+		close(cg->fd_cpu_stat);
+
+	free(cg->path);
+	free(cg);
+}
+
 int rmonitor_get_map_io_usage(pid_t pid, struct rmonitor_io_info *io)
 {
 	/* /proc/[pid]/smaps */
@@ -695,19 +1310,33 @@ int rmonitor_get_map_io_usage(pid_t pid, struct rmonitor_io_info *io)
 	kbytes_resident_accum    = 0;
 	io->delta_bytes_faulted = 0;
 
-	FILE *fsmaps = open_proc_file(pid, "smaps");
-	if(!fsmaps)
+	int fd = open_proc_fd(pid, "smaps");
+	if(fd < 0)
 	{
 		return 1;
 	}
 
-	char dummy_line[1024];
+	struct smaps_reader *r = malloc(sizeof(*r));
+	r->fd    = fd;
+	r->start = 0;
+	r->end   = 0;
+	r->eof   = 0;
+
+	int file_map = 0;
 
 	/* Look for next mmap file */
-	while(fgets(dummy_line, 1024, fsmaps))
-		if(strchr(dummy_line, '/'))
-			if(rmonitor_get_int_attribute(fsmaps, "Rss:", &kbytes_resident, 0) == 0)
+	char *line;
+	while((line = smaps_next_line(r))) {
+		if(line[0] >= 'A' && line[0] <= 'Z') {
+			if(file_map && smaps_parse_field(line, &kbytes_resident) == SMAPS_RSS)
 				kbytes_resident_accum += kbytes_resident;
+		} else {
+			file_map = strchr(line, '/') != NULL;
+		}
+	}
+
+	free(r);
+	close(fd);
 
 	if((kbytes_resident_accum * 1024) > io->bytes_faulted)
 		io->delta_bytes_faulted = (kbytes_resident_accum * 1024) - io->bytes_faulted;
@@ -715,8 +1344,6 @@ int rmonitor_get_map_io_usage(pid_t pid, struct rmonitor_io_info *io)
 	/* in bytes */
 	io->bytes_faulted = (kbytes_resident_accum * 1024);
 
-	fclose(fsmaps);
-
 	return 0;
 }
 
@@ -849,9 +1476,11 @@ struct rmsummary *rmonitor_measure_process(pid_t pid) {
 	struct rmsummary *tr = rmsummary_create(-1);
 
 	struct rmonitor_process_info p;
+	memset(&p, 0, sizeof(p));
 	p.pid = pid;
 
 	err = rmonitor_poll_process_once(&p);
+	rmonitor_poll_process_close(&p);
 	if(err != 0)
 		return NULL;
 
@@ -1000,6 +1629,7 @@ struct rmsummary *rmonitor_minimonitor(minimonitor_op op, uint64_t pid) {
 				itable_firstkey(processes);
 				while(itable_nextkey(processes, &pid, (void **) &p)) {
 					itable_remove(processes, pid);
+					rmonitor_poll_process_close(p);
 					free(p);
 				}
 				first_pid = 0;
@@ -1036,6 +1666,7 @@ struct rmsummary *rmonitor_minimonitor(minimonitor_op op, uint64_t pid) {
 			p = itable_lookup(processes, pid);
 			if(p) {
 				itable_remove(processes, pid);
+				rmonitor_poll_process_close(p);
 				free(p);
 				if(pid == first_pid) {
 					first_pid = 0;
@@ -40,11 +40,22 @@ void rmonitor_poll_all_processes_once(struct itable *processes, struct rmonitor_
 void rmonitor_poll_all_wds_once(      struct hash_table *wdirs, struct rmonitor_wdir_info *acc, int max_time_for_measurement);
 void rmonitor_poll_all_fss_once(      struct itable *filesysms, struct rmonitor_filesys_info *acc);
 
+/* Returns nonzero if any of cpu time, memory, or io could not be read. The deltas
+ * of cpu time and io are zero for those that could not be read, so that they may
+ * still be accumulated, as for a process that exited and has no memory left. */
 int rmonitor_poll_process_once(struct rmonitor_process_info *p);
+void rmonitor_poll_process_close(struct rmonitor_process_info *p);
 int rmonitor_poll_wd_once(     struct rmonitor_wdir_info    *d, int max_time_for_measurement);
 int rmonitor_poll_fs_once(     struct rmonitor_filesys_info *f);
 int rmonitor_poll_maps_once(   struct itable *processes, struct rmonitor_mem_info *mem);
 
+/* Segments of memory maps read from smaps files. Collating merges the segments
+ * per file, adds the totals in kB to mem, and empties maps for the next poll. */
+struct rmonitor_maps *rmonitor_maps_create(void);
+int  rmonitor_maps_read(struct rmonitor_maps *maps, int fd);
+void rmonitor_maps_collate(struct rmonitor_maps *maps, struct rmonitor_mem_info *mem);
+void rmonitor_maps_delete(struct rmonitor_maps *maps);
+
 void rmonitor_info_to_rmsummary(struct rmsummary *tr, struct rmonitor_process_info *p, struct rmonitor_wdir_info *d, struct rmonitor_filesys_info *f, uint64_t start_time);
 
 int rmonitor_get_cpu_time_usage(pid_t pid,        struct rmonitor_cpu_time_info *cpu);
@@ -55,6 +66,10 @@ int rmonitor_get_dsk_usage(     const char *path, struct statfs *disk);
 
 int rmonitor_get_loadavg(struct rmonitor_load_info *load);
 
+struct rmonitor_cgroup_info *rmonitor_cgroup_open(pid_t pid);
+int  rmonitor_poll_cgroup_once(struct rmonitor_cgroup_info *cg);
+void rmonitor_cgroup_close(struct rmonitor_cgroup_info *cg);
+
 int rmonitor_get_wd_usage(struct rmonitor_wdir_info *d, int max_time_for_measurement);
 
 void acc_cpu_time_usage( struct rmonitor_cpu_time_info *acc, struct rmonitor_cpu_time_info *other);
@@ -55,10 +55,6 @@ struct rmonitor_mem_info
 	uint64_t private;
 	uint64_t shared;
 
-	char    *map_name;
-	uint64_t map_start;
-	uint64_t map_end;
-
 	uint64_t text;
 	uint64_t data;
 };
@@ -136,6 +132,24 @@ struct rmonitor_process_info
 	struct rmonitor_io_info       io;
 	struct rmonitor_load_info     load;
 	struct rmonitor_wdir_info    *wd;
+
+	struct rmonitor_proc_files   *files; // /proc files kept open between polls, or NULL.
+};
+
+/* Usage of the cgroup v2 in which the processes measured run. */
+struct rmonitor_cgroup_info
+{
+	char *path;
+
+	int fd_memory_current;
+	int fd_memory_peak;              // -1 if the kernel does not provide memory.peak.
+	int fd_cpu_stat;
+
+	uint64_t cpu_initial;            // usecs of cpu already used when the cgroup was opened.
+
+	uint64_t cpu_time;               // usecs, since the cgroup was opened.
+	uint64_t memory_current;         // MB
+	uint64_t memory_peak;            // MB
 };
 
 #endif
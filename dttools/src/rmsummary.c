@@ -831,8 +831,8 @@ struct list *rmsummary_parse_file_multiple(const char *filename)
 			list_push_tail(lst, s);
 	} while(s);
 
-	fclose(stream);
 	jx_parser_delete(p);
+	fclose(stream);
 
 	return lst;
 }
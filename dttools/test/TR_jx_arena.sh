@@ -0,0 +1,114 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="arena.test"
+
+prepare()
+{
+	${CC} -g -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jx.h"
+#include "jx_arena.h"
+#include "jx_eval.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+
+int main(int argc, char **argv) {
+	const char *text = "{\"name\":\"a\", \"n\":[1,2,3], \"inner\":{\"x\":1.5}}";
+
+	struct jx *heap = jx_parse_string(text);
+	struct jx *expr = jx_parse_string("[x*2 for x in n if x>1]");
+	assert(!jx_arena_owner(heap));
+
+	struct jx_arena *arena = jx_arena_create();
+	assert(!jx_arena_set(arena));
+	assert(jx_arena_current() == arena);
+
+	/* parsing, copies, evaluation, and constructors allocate from the arena. */
+	struct jx *parsed = jx_parse_string(text);
+	assert(jx_arena_owner(parsed) == arena);
+	assert(jx_equals(parsed, heap));
+
+	struct jx *copy = jx_copy(heap);
+	assert(jx_arena_owner(copy) == arena);
+	assert(jx_arena_owner(copy->u.pairs) == arena);
+	assert(jx_equals(copy, heap));
+
+	struct jx *result = jx_eval(expr, heap);
+	struct jx *expected = jx_parse_string("[4,6]");
+	assert(jx_arena_owner(result) == arena);
+	assert(jx_equals(result, expected));
+
+	struct jx *formatted = jx_format("%s-%d", "value", 10);
+	assert(!strcmp(formatted->u.string_value, "value-10"));
+
+	/* deleting values of the arena does nothing. */
+	jx_delete(parsed);
+	assert(jx_equals(copy, heap));
+
+	/* errors take their operands without copies. */
+	struct jx *bad = jx_parse_string("name/2");
+	struct jx *err = jx_eval(bad, heap);
+	assert(jx_istype(err, JX_ERROR));
+
+	/* large objects get an index from their arena. */
+	struct jx *large = jx_object(NULL);
+	char key[32];
+	int i;
+	for(i = 0; i < 100; i++) {
+		sprintf(key, "key%d", i);
+		jx_insert_integer(large, key, i);
+	}
+	assert(!jx_lookup(large, "missing"));
+	assert(jx_lookup_integer(large, "key7") == 7);
+
+	assert(jx_arena_size(arena) > 0);
+
+	assert(jx_arena_set(NULL) == arena);
+
+	/* values from malloc are not affected. */
+	struct jx *after = jx_parse_string(text);
+	assert(!jx_arena_owner(after));
+	assert(jx_equals(after, heap));
+	jx_delete(after);
+
+	jx_arena_clear(arena);
+	assert(jx_arena_size(arena) == 0);
+
+	jx_arena_set(arena);
+	struct jx *again = jx_parse_string(text);
+	assert(jx_arena_owner(again) == arena);
+	assert(jx_equals(again, heap));
+	jx_arena_set(NULL);
+
+	jx_arena_delete(arena);
+
+	jx_delete(heap);
+	jx_delete(expr);
+
+	return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,143 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="compile.test"
+
+prepare()
+{
+	${CC} -g -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jx.h"
+#include "jx_compile.h"
+#include "jx_eval.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+
+static const char *contexts[] = {
+	"{\"a\":1, \"b\":2.5, \"c\":0, \"s\":\"x\", \"t\":\"abc\", \"yes\":true, \"no\":false, \"n\":null, \"list\":[1,2], \"obj\":{\"k\":1}, \"alias\":a, \"sum\":a+c}",
+	"{\"a\":-3, \"b\":0.0, \"c\":7, \"s\":\"\", \"t\":\"x\", \"yes\":false, \"no\":true, \"n\":null, \"list\":[], \"obj\":{}, \"alias\":b, \"sum\":b*2}",
+	"{\"a\":\"str\", \"b\":true, \"yes\":1}",
+	"{}",
+	0,
+};
+
+static const char *exprs[] = {
+	"a==1", "a!=1", "a<c", "a<=c", "a>c", "a>=c",
+	"a+c", "a-c", "a*c", "a/c", "a%c", "c/a", "c%a", "-a", "-b",
+	"a+b", "b+a", "a<b", "b>=a", "b/c", "b%c", "b%a",
+	"s==\"x\"", "s<t", "s>=t", "s!=t", "s+t", "s+a", "a+s", "s+n", "s-t", "-s",
+	"yes && no", "yes || no", "!yes", "not no", "yes==no", "yes<no", "yes+no",
+	"n==null", "n!=null", "n<null", "n==a", "n!=a", "a==\"1\"", "a!=yes", "a<yes", "a && yes",
+	"missing==1", "missing", "1==missing", "a==1 && missing", "missing && a==1",
+	"alias>0", "sum==1", "list==[1,2]", "list[0]==1", "obj[\"k\"]==1", "len(list)>1",
+	"1+2*3==7", "10/0", "\"a\"+\"b\"==\"ab\"", "1<2 && 2.5>1", "!(1>2)", "null==null",
+	"a>0 && b>0 || s==\"x\"", "(a+c)*2>5 && !no", "a*b+c/2.0",
+	"a==1 && a>0 && a<5 && a!=3", "t>=\"abc\" && s<=\"x\"",
+	"1", "\"text\"", "true", "null", "a", "s", "b",
+	0,
+};
+
+static int check(const char *text, struct jx *context)
+{
+	struct jx *expr = jx_parse_string(text);
+	assert(expr);
+
+	struct jx_program *p = jx_compile(expr);
+
+	struct jx *expected = jx_eval(expr, context);
+	struct jx *result = jx_program_eval(p, context);
+
+	int ok = jx_equals(expected, result) && jx_program_istrue(p, context) == jx_istrue(expected);
+	if(!ok) {
+		char *c = context ? jx_print_string(context) : strdup("null");
+		char *e = jx_print_string(expected);
+		char *r = jx_print_string(result);
+		fprintf(stderr, "%s in %s: expected %s, got %s\n", text, c, e, r);
+		free(c);
+		free(e);
+		free(r);
+	}
+
+	jx_delete(expected);
+	jx_delete(result);
+	jx_program_delete(p);
+	jx_delete(expr);
+
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	int i, j, failures = 0;
+
+	for(i = 0; i < (int) (sizeof(contexts)/sizeof(*contexts)); i++) {
+		struct jx *context = contexts[i] ? jx_parse_string(contexts[i]) : NULL;
+		assert(context || !contexts[i]);
+		for(j = 0; exprs[j]; j++) {
+			if(!check(exprs[j], context)) failures++;
+		}
+		jx_delete(context);
+	}
+
+	/* symbols past the first pairs of a long context are found by jx_lookup, and then by its index. */
+	struct jx *large = jx_parse_string(contexts[0]);
+	char name[32];
+	for(i = 0; i < 40; i++) {
+		sprintf(name, "filler%d", i);
+		jx_insert_integer(large, name, i);
+	}
+	for(i = 0; i < 2; i++) {
+		for(j = 0; exprs[j]; j++) {
+			if(!check(exprs[j], large)) failures++;
+		}
+	}
+	jx_delete(large);
+
+	/* operators on scalars are compiled, and literals folded. */
+	struct jx *expr = jx_parse_string("type==\"wq_master\" && tasks>10*10 && owner==\"user\"");
+	struct jx_program *p = jx_compile(expr);
+	assert(jx_program_isnative(p));
+	jx_delete(expr);
+
+	struct jx *record = jx_parse_string("{\"type\":\"wq_master\", \"tasks\":101, \"owner\":\"user\"}");
+	assert(jx_program_istrue(p, record));
+	struct jx *key = jx_string("tasks");
+	jx_delete(jx_remove(record, key));
+	jx_delete(key);
+	jx_insert_integer(record, "tasks", 100);
+	assert(!jx_program_istrue(p, record));
+	jx_delete(record);
+	jx_program_delete(p);
+
+	/* anything else is evaluated with jx_eval. */
+	expr = jx_parse_string("len(list)>1");
+	p = jx_compile(expr);
+	assert(!jx_program_isnative(p));
+	jx_program_delete(p);
+	jx_delete(expr);
+
+	return failures ? 1 : 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,135 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="object_index.test"
+
+prepare()
+{
+	${CC} -g -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+
+/* Lookup by walking the pairs, as jx_lookup did before objects were indexed. */
+static struct jx *walk(struct jx *j, const char *key)
+{
+	struct jx_pair *p;
+	for(p = j->u.pairs; p; p = p->next) {
+		if(p->key->type == JX_STRING && !strcmp(p->key->u.string_value, key)) {
+			return p->value;
+		}
+	}
+	return NULL;
+}
+
+static void check(struct jx *j, int keys)
+{
+	char key[32];
+	int i;
+	for(i = 0; i < keys; i++) {
+		sprintf(key, "key%d", i);
+		assert(jx_lookup(j, key) == walk(j, key));
+	}
+}
+
+int main(int argc, char **argv) {
+	char key[32];
+	int i;
+
+	struct jx *j = jx_object(NULL);
+	for(i = 0; i < 100; i++) {
+		sprintf(key, "key%d", i);
+		jx_insert(j, jx_string(key), jx_integer(i));
+	}
+
+	/* a miss walks all the pairs, and indexes the object. */
+	assert(!jx_lookup(j, "missing"));
+	check(j, 120);
+
+	/* iteration order does not change. */
+	char *before = jx_print_string(j);
+
+	/* the newest of duplicated keys is found, and the older one after removal. */
+	jx_insert(j, jx_string("key10"), jx_integer(1000));
+	assert(jx_lookup_integer(j, "key10") == 1000);
+	struct jx *k = jx_string("key10");
+	jx_delete(jx_remove(j, k));
+	assert(jx_lookup_integer(j, "key10") == 10);
+	check(j, 120);
+
+	char *after = jx_print_string(j);
+	assert(!strcmp(before, after));
+	free(before);
+	free(after);
+
+	/* removal of the first, last, and missing keys. */
+	jx_delete(jx_remove(j, k));
+	assert(!jx_lookup(j, "key10"));
+	jx_delete(k);
+
+	k = jx_string("key99");
+	jx_delete(jx_remove(j, k));
+	jx_delete(k);
+
+	k = jx_string("key0");
+	jx_delete(jx_remove(j, k));
+	assert(!jx_remove(j, k));
+	jx_delete(k);
+
+	for(i = 100; i < 110; i++) {
+		sprintf(key, "key%d", i);
+		jx_insert(j, jx_string(key), jx_integer(i));
+	}
+	check(j, 120);
+
+	/* pairs pushed directly on the list, as deltadb does. */
+	for(i = 0; i < 5; i++) {
+		sprintf(key, "key%d", 50 + i);
+		j->u.pairs = jx_pair(jx_string(key), jx_integer(-i), j->u.pairs);
+	}
+	assert(jx_lookup_integer(j, "key52") == -2);
+	check(j, 120);
+
+	/* pairs taken off the head directly. */
+	struct jx_pair *p = j->u.pairs;
+	j->u.pairs = p->next;
+	p->next = NULL;
+	jx_pair_delete(p);
+	assert(jx_lookup_integer(j, "key54") == 54);
+	check(j, 120);
+
+	/* merges of large objects. */
+	struct jx *m = jx_merge(j, j, NULL);
+	check(m, 120);
+	assert(jx_lookup_integer(m, "key60") == 60);
+	jx_delete(m);
+
+	jx_delete(j);
+
+	return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
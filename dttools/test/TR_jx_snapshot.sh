@@ -0,0 +1,160 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="snapshot.test"
+snapshot="snapshot.test.snap"
+json="snapshot.test.json"
+database="snapshot.test.db"
+
+prepare()
+{
+	${CC} -g -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "jx.h"
+#include "jx_binary.h"
+#include "jx_database.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "jx_snapshot.h"
+
+int main(int argc, char **argv) {
+	struct jx *object = jx_parse_string("{\"b\":[1,2.5,\"x\",null], \"a\":{\"k\":true, \"n\":-70000}, \"c\":\"text\", \"b\":\"duplicate\", \"e\":{}}");
+	assert(object);
+
+	assert(jx_snapshot_write("$snapshot", object));
+	assert(jx_snapshot_check("$snapshot"));
+
+	struct jx_snapshot *s = jx_snapshot_open("$snapshot");
+	assert(s);
+
+	/* keys are sorted, and only the first of duplicate keys is kept. */
+	assert(jx_snapshot_size(s) == 4);
+	assert(!strcmp(jx_snapshot_key(s, 0), "a"));
+	assert(!strcmp(jx_snapshot_key(s, 3), "e"));
+	assert(!jx_snapshot_key(s, 4));
+
+	const char *keys[] = {"a", "b", "c", "e"};
+	int i;
+	for(i = 0; i < 4; i++) {
+		struct jx *value = jx_snapshot_lookup(s, keys[i]);
+		assert(jx_equals(value, jx_lookup(object, keys[i])));
+		jx_delete(value);
+	}
+	assert(!jx_snapshot_lookup(s, "d"));
+	assert(!jx_snapshot_lookup(s, ""));
+
+	struct jx *loaded = jx_snapshot_load(s);
+	assert(jx_istype(loaded, JX_OBJECT));
+	for(i = 0; i < 4; i++) {
+		assert(jx_equals(jx_lookup(loaded, keys[i]), jx_lookup(object, keys[i])));
+	}
+	jx_delete(loaded);
+
+	jx_snapshot_close(s);
+
+	/* values are decoded from memory without reading past their end. */
+	struct jx *value = jx_lookup(object, "a");
+	FILE *file = fopen("$snapshot", "w");
+	jx_binary_write(file, value);
+	long length = ftell(file);
+	fclose(file);
+	char *data = malloc(length);
+	file = fopen("$snapshot", "r");
+	assert(fread(data, length, 1, file) == 1);
+	fclose(file);
+	struct jx *decoded = jx_binary_decode(data, length);
+	assert(jx_equals(decoded, value));
+	jx_delete(decoded);
+	decoded = jx_binary_decode(data, length - 3);
+	assert(!jx_equals(decoded, value));
+	jx_delete(decoded);
+	free(data);
+
+	/* files that are not snapshots are not opened. */
+	assert(!jx_snapshot_check("$snapshot"));
+	assert(!jx_snapshot_open("$snapshot"));
+	assert(!jx_snapshot_open("$snapshot.missing"));
+	assert(!jx_snapshot_write("$snapshot", jx_lookup(object, "c")));
+
+	jx_delete(object);
+
+	/* a database recovers from the checkpoint when its snapshot is corrupt. */
+	char ckpt[1024], snap[1024];
+	time_t now = time(0);
+	struct tm *t = gmtime(&now);
+	sprintf(ckpt, "$database/%d", t->tm_year + 1900);
+	mkdir("$database", 0777);
+	mkdir(ckpt, 0777);
+	sprintf(ckpt, "$database/%d/%d.ckpt", t->tm_year + 1900, t->tm_yday);
+	sprintf(snap, "$database/%d/%d.snap", t->tm_year + 1900, t->tm_yday);
+
+	object = jx_parse_string("{\"host1\":{\"port\":1}, \"host2\":{\"port\":2}, \"host3\":{\"port\":3}}");
+	file = fopen(ckpt, "w");
+	jx_print_stream(object, file);
+	fclose(file);
+	assert(jx_snapshot_write(snap, object));
+
+	/* overwrite the type of the last value, after the first were decoded. */
+	file = fopen(snap, "r+");
+	fseek(file, 0, SEEK_END);
+	length = ftell(file);
+	data = malloc(length);
+	rewind(file);
+	assert(fread(data, length, 1, file) == 1);
+	char *last = memmem(data, length, "host3", 6);
+	assert(last);
+	fseek(file, last - data + 6, SEEK_SET);
+	fputc(0xee, file);
+	fclose(file);
+	free(data);
+
+	struct jx_database *db = jx_database_create("$database");
+	assert(db);
+	for(i = 1; i <= 3; i++) {
+		char key[16];
+		sprintf(key, "host%d", i);
+		struct jx *expected = jx_lookup(object, key);
+		assert(jx_equals(jx_database_lookup(db, key), expected));
+	}
+	jx_delete(object);
+
+	return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe" || return 1
+
+	echo '{"host1":{"name":"one","port":1}, "host2":{"name":"two","port":2}}' > "$json"
+	../src/jx_snapshot_tool create "$json" "$snapshot" || return 1
+	[ "$(../src/jx_snapshot_tool list "$snapshot" | tr '\n' ' ')" = "host1 host2 " ] || return 1
+	[ "$(../src/jx_snapshot_tool get "$snapshot" host2)" = '{"name":"two","port":2}' ] || return 1
+	../src/jx_snapshot_tool get "$snapshot" host3 && return 1
+
+	../src/jx_snapshot_tool export "$snapshot" > "$json.out" || return 1
+	../src/jx_snapshot_tool create "$json.out" "$snapshot.again" || return 1
+	cmp "$snapshot" "$snapshot.again" || return 1
+
+	return 0
+}
+
+clean()
+{
+	rm -rf "$exe" "$snapshot" "$snapshot.again" "$json" "$json.out" "$database"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
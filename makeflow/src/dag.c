@@ -184,8 +184,80 @@ void dag_count_states(struct dag *d)
 		d->node_states[i] = 0;
 	}
 
+	for(i = 0; i < DAG_NODE_STATE_MAX; i++) {
+		d->local_node_states[i] = 0;
+	}
+
 	for(n = d->nodes; n; n = n->next) {
 		d->node_states[n->state]++;
+		if(n->local_job) {
+			d->local_node_states[n->state]++;
+		}
+	}
+}
+
+/*
+Count the sources of each node that should not exist yet, and queue each
+waiting node that has none, in the order of d->nodes. From then on the
+counts and the queue are kept up to date as files and nodes change state,
+so that finding ready nodes costs in proportion to the nodes that became
+ready, rather than to the size of the dag.
+*/
+
+void dag_compile_ready(struct dag *d)
+{
+	struct dag_node *n;
+	struct dag_file *f;
+
+	if(!d->ready_nodes)
+		d->ready_nodes = list_create();
+
+	for(n = d->nodes; n; n = n->next) {
+		n->sources_missing = 0;
+		list_first_item(n->source_files);
+		while((f = list_next_item(n->source_files))) {
+			if(!dag_file_should_exist(f))
+				n->sources_missing++;
+		}
+		dag_node_queue_ready(d, n);
+	}
+}
+
+/*
+Queue a node for dispatch if it is waiting with all of its sources present
+and is not already queued. Nothing is queued before dag_compile_ready.
+*/
+
+void dag_node_queue_ready(struct dag *d, struct dag_node *n)
+{
+	if(!d->ready_nodes || n->ready_queued)
+		return;
+
+	if(n->state != DAG_NODE_STATE_WAITING || n->sources_missing > 0)
+		return;
+
+	list_push_tail(d->ready_nodes, n);
+	n->ready_queued = 1;
+}
+
+/*
+Queue every file that is already complete, as recovered from the log.
+From then on, files are queued as they become complete, so that garbage
+collection costs in proportion to the files it may collect, rather than
+to all the files of the dag.
+*/
+
+void dag_compile_collectible(struct dag *d)
+{
+	struct dag_file *f;
+	char *name;
+
+	if(!d->collectible_files)
+		d->collectible_files = list_create();
+
+	hash_table_firstkey(d->files);
+	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
+		dag_file_queue_collectible(d, f);
 	}
 }
 
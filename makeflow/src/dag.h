@@ -38,6 +38,9 @@ struct dag {
 	/* Dynamic states related to execution via Makeflow. */
 	FILE *logfile;
 	int node_states[DAG_NODE_STATE_MAX];/* node_states[STATE] keeps the count of nodes that have state STATE \in dag_node_state_t. */
+	int local_node_states[DAG_NODE_STATE_MAX];/* As node_states, but only counting nodes with the LOCAL prefix. */
+	struct list *ready_nodes;           /* Nodes queued as WAITING with all sources present, in the order they became so. Entries may be stale. */
+	struct list *collectible_files;     /* Files queued as COMPLETE, with no consumers left to run, in the order they became so. Entries may be stale. */
 	int nodeid_counter;                 /* Keeps a count of production rules read so far (used for the value of dag_node->nodeid). */
 
 	struct itable *local_job_table;     /* Mapping from unique integers dag_node->jobid to nodes, rules with prefix LOCAL. */
@@ -58,6 +61,11 @@ void dag_compile_ancestors(struct dag *d);
 void dag_find_ancestor_depth(struct dag *d);
 void dag_count_states(struct dag *d);
 
+void dag_compile_ready(struct dag *d);
+void dag_node_queue_ready(struct dag *d, struct dag_node *n);
+
+void dag_compile_collectible(struct dag *d);
+
 struct dag_file *dag_file_lookup_or_create(struct dag *d, const char *filename);
 struct dag_file *dag_file_from_name(struct dag *d, const char *filename);
 
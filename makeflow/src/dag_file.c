@@ -22,6 +22,7 @@ struct dag_file * dag_file_create( const char *filename )
 	f->actual_size = 0;
 	f->estimated_size = GIGABYTE;
 	f->reference_count = 0;
+	f->collect_queued = 0;
 	f->state = DAG_FILE_STATE_UNKNOWN;
 	f->type = DAG_FILE_TYPE_INTERMEDIATE;
 	f->source = NULL;
@@ -159,6 +160,42 @@ int dag_file_coexist_files(struct set *s, struct dag_file *f)
 	return 0;
 }
 
+void dag_file_update_consumers(struct dag *d, struct dag_file *f, int existed)
+{
+	struct dag_node *n;
+
+	if(!d->ready_nodes)
+		return;
+
+	int exists = dag_file_should_exist(f);
+	if(exists == existed)
+		return;
+
+	/* A cursor, as the caller may be walking the same list. */
+	struct list_cursor *cur = list_cursor_create(f->needed_by);
+	for(list_seek(cur, 0); list_get(cur, (void **) &n); list_next(cur)) {
+		if(exists) {
+			n->sources_missing--;
+			dag_node_queue_ready(d, n);
+		} else {
+			n->sources_missing++;
+		}
+	}
+	list_cursor_destroy(cur);
+}
+
+void dag_file_queue_collectible(struct dag *d, struct dag_file *f)
+{
+	if(!d->collectible_files || f->collect_queued)
+		return;
+
+	if(f->state != DAG_FILE_STATE_COMPLETE)
+		return;
+
+	list_push_tail(d->collectible_files, f);
+	f->collect_queued = 1;
+}
+
 void dag_file_mount_clean(struct dag_file *df) {
 	if(!df) return;
 
@@ -57,6 +57,7 @@ struct dag_file {
 	uint64_t actual_size;           /* File size reported by stat */
 	uint64_t estimated_size;        /* File size estimation provided prior to execution */
 	int    reference_count;         /* How many nodes still to run need this file */
+	int    collect_queued;          /* Flag: is this file queued for garbage collection? */
 	time_t creation_logged;         /* Time that file creation is logged */
 	dag_file_state_t state;         /* Enum: DAG_FILE_STATE_{INTIAL,EXPECT,...} */
 	dag_file_type_t type;           /* Enum: DAG_FILE_TYPE_{INPUT,...} */
@@ -140,6 +141,23 @@ set of nodes.
 @return One if used, zero if not.
 */
 int dag_file_coexist_files(struct set *s, struct dag_file *f);
+/** Update the count of missing sources of each node that needs a file, after
+the file changed state, and queue the nodes that became ready. Does nothing
+before @ref dag_compile_ready.
+@param d The dag of the file.
+@param f dag_file that changed state.
+@param existed The value of @ref dag_file_should_exist before the change.
+*/
+void dag_file_update_consumers(struct dag *d, struct dag_file *f, int existed);
+
+/** Queue a file for garbage collection if it is complete, that is, no node
+still to run needs it, and it is not already queued. Does nothing before
+@ref dag_compile_collectible.
+@param d The dag of the file.
+@param f dag_file that changed state.
+*/
+void dag_file_queue_collectible(struct dag *d, struct dag_file *f);
+
 /* dag_file_mount_clean cleans up the mem space allocated for dag_file due to the usage of mountfile
  */
 void dag_file_mount_clean( struct dag_file *df );
@@ -48,6 +48,7 @@ See the file COPYING for details.
 #include "makeflow_summary.h"
 #include "makeflow_gc.h"
 #include "makeflow_log.h"
+#include "makeflow_stat.h"
 #include "makeflow_mounts.h"
 #include "makeflow_catalog_reporter.h"
 #include "makeflow_local_resources.h"
@@ -96,6 +97,15 @@ an example.
 
 #define MAX_REMOTE_JOBS_DEFAULT 100
 
+/* Largest number of completed jobs collected from a queue in one pass of the main loop. */
+#define MAKEFLOW_WAIT_BATCH_MAX 1000
+
+/* Interval between reports of the completion rate in the log, in microseconds. */
+#define MAKEFLOW_RATE_INTERVAL (60 * 1000 * 1000)
+
+/* Largest number of threads used to check the files of the dag at startup. */
+#define MAKEFLOW_CHECK_FILES_THREADS 16
+
 /*
 Flags to control the basic behavior of the Makeflow main loop. 
 */
@@ -125,10 +135,6 @@ static makeflow_gc_method_t makeflow_gc_method = MAKEFLOW_GC_NONE;
 static uint64_t makeflow_gc_size   = 0;
 /* # of files after which GC is run */
 static int makeflow_gc_count  = -1;
-/* Iterations of wait loop prior ot GC check */
-static int makeflow_gc_barrier = 1;
-/* Determines next gc_barrier to make checks less frequent with large number of tasks */
-static double makeflow_gc_task_ratio = 0.05;
 
 /*
 Makeflow manages two queues of jobs.
@@ -210,6 +216,7 @@ SYMBOLs are category labels (SYMBOLs should be deprecated
 once weaver/pbui tools are updated.)
 */
 static int log_verbose_mode = 0;
+static int log_binary_mode = 0;
 
 /*
 Send periodic reports of type "makeflow" to the catalog
@@ -647,8 +654,6 @@ static enum job_submit_status makeflow_node_submit(struct dag *d, struct dag_nod
 
 static int makeflow_node_ready(struct dag *d, struct dag_node *n, const struct rmsummary *resources)
 {
-	struct dag_file *f;
-
 	if(n->state != DAG_NODE_STATE_WAITING)
 		return 0;
 
@@ -665,14 +670,8 @@ static int makeflow_node_ready(struct dag *d, struct dag_node *n, const struct r
 			return 0;
 	}
 
-	list_first_item(n->source_files);
-	while((f = list_next_item(n->source_files))) {
-		if(dag_file_should_exist(f)) {
-			continue;
-		} else {
-			return 0;
-		}
-	}
+	if(n->sources_missing > 0)
+		return 0;
 
 	/* If all makeflow checks pass for this node we will 
 	return the result of the hooks, which will be 1 if all pass
@@ -685,28 +684,75 @@ static int makeflow_node_ready(struct dag *d, struct dag_node *n, const struct r
 }
 
 int makeflow_nodes_local_waiting_count(const struct dag *d) {
-	int count = 0;
-
-	
-	struct dag_node *n;
-	for(n = d->nodes; n; n = n->next) {
-		if(n->state == DAG_NODE_STATE_WAITING && is_local_job(n))
-			count++;
-	}
+	if(batch_queue_type == BATCH_QUEUE_TYPE_LOCAL)
+		return d->node_states[DAG_NODE_STATE_WAITING];
 
-	return count;
+	return d->local_node_states[DAG_NODE_STATE_WAITING];
 }
 
 int makeflow_nodes_remote_waiting_count(const struct dag *d) {
-	int count = 0;
+	return d->node_states[DAG_NODE_STATE_WAITING] - makeflow_nodes_local_waiting_count(d);
+}
+
+/*
+Nodes that are ready to run as far as their sources go, taken from
+d->ready_nodes and held here until they are submitted, separately for each
+queue, so that a full queue is not walked at all. Nodes stay in the order
+they became ready.
+*/
 
+static struct list *ready_local_nodes = 0;
+static struct list *ready_remote_nodes = 0;
+
+/*
+Try to submit each node of a ready list, keeping those that cannot run yet,
+and dropping those that were submitted or are no longer ready. Stops early
+when the queue is full, or the workflow is aborted.
+*/
+
+static void makeflow_dispatch_ready_list(struct dag *d, struct list *ready, int *submission_timeout)
+{
 	struct dag_node *n;
-	for(n = d->nodes; n; n = n->next) {
-		if(n->state == DAG_NODE_STATE_WAITING && !is_local_job(n))
-			count++;
-	}
 
-	return count;
+	struct list_cursor *cur = list_cursor_create(ready);
+	for(list_seek(cur, 0); list_get(cur, (void **) &n); list_next(cur)) {
+		if(n->local_job && local_queue) {
+			if(dag_local_jobs_running(d) >= local_jobs_max)
+				break;
+		} else {
+			if(dag_remote_jobs_running(d) >= remote_jobs_max)
+				break;
+		}
+
+		if(n->state != DAG_NODE_STATE_WAITING || n->sources_missing > 0) {
+			n->ready_queued = 0;
+			list_drop(cur);
+			continue;
+		}
+
+		if(!is_local_job(n) && *submission_timeout)
+			continue;
+
+		const struct rmsummary *resources = dag_node_dynamic_label(n);
+
+		if(makeflow_node_ready(d, n, resources)) {
+			enum job_submit_status status = makeflow_node_submit(d, n, resources);
+
+			if(status == JOB_SUBMISSION_ABORTED) {
+				break;
+			} else if(status == JOB_SUBMISSION_TIMEOUT) {
+				debug(D_MAKEFLOW_RUN, "batch submissions are timing-out. Only submitting local jobs for the rest of this cycle.");
+				*submission_timeout = 1;
+			}
+
+			/* A node that is waiting again, such as after a timeout, stays in place. */
+			if(n->state != DAG_NODE_STATE_WAITING) {
+				n->ready_queued = 0;
+				list_drop(cur);
+			}
+		}
+	}
+	list_cursor_destroy(cur);
 }
 
 /*
@@ -717,6 +763,19 @@ static void makeflow_dispatch_ready_jobs(struct dag *d)
 {
 	struct dag_node *n;
 
+	if(!ready_local_nodes) {
+		ready_local_nodes = list_create();
+		ready_remote_nodes = list_create();
+	}
+
+	while((n = list_pop_head(d->ready_nodes))) {
+		if(n->local_job && local_queue) {
+			list_push_tail(ready_local_nodes, n);
+		} else {
+			list_push_tail(ready_remote_nodes, n);
+		}
+	}
+
 	/* When submitting to an external queue if there are no resources
 	 * available, such as vms in amazon, then the submission fails with a
 	 * timeout. When this occurs, submission_timeout is set to 1, and only
@@ -727,25 +786,9 @@ static void makeflow_dispatch_ready_jobs(struct dag *d)
 	 */
 	int submission_timeout = 0;
 
-	for(n = d->nodes; n; n = n->next) {
-		if(dag_remote_jobs_running(d) >= remote_jobs_max && dag_local_jobs_running(d) >= local_jobs_max) {
-			break;
-		}
-
-		const struct rmsummary *resources = dag_node_dynamic_label(n);
-
-		if(makeflow_node_ready(d, n, resources)) {
-			if(is_local_job(n) || !submission_timeout) {
-				enum job_submit_status status = makeflow_node_submit(d, n, resources);
-
-				if(status == JOB_SUBMISSION_ABORTED) {
-					break;
-				} else if(status == JOB_SUBMISSION_TIMEOUT) {
-					debug(D_MAKEFLOW_RUN, "batch submissions are timing-out. Only submitting local jobs for the rest of this cycle.");
-					submission_timeout = 1;
-				}
-			}
-		}
+	makeflow_dispatch_ready_list(d, ready_local_nodes, &submission_timeout);
+	if(!makeflow_abort_flag) {
+		makeflow_dispatch_ready_list(d, ready_remote_nodes, &submission_timeout);
 	}
 }
 
@@ -924,14 +967,17 @@ a prior run that was logged.
 
 static int makeflow_check_files(struct dag *d)
 {
-	struct stat buf;
 	struct dag_file *f;
 	char *name;
 	int errors = 0;
 	int warnings = 0;
+	int count = 0;
+	int i;
 
 	printf("checking files for unexpected changes...  (use --skip-file-check to skip this step)\n");
 
+	struct dag_file **files = xxmalloc(hash_table_size(d->files) * sizeof(*files));
+
 	hash_table_firstkey(d->files);
 	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
 
@@ -941,8 +987,24 @@ static int makeflow_check_files(struct dag *d)
 		/* Skip any file that should not exist yet. */
 		if(!dag_file_should_exist(f)) continue;
 
-		/* Check for the presence of the file. */
-		int result = batch_fs_stat(remote_queue, f->filename, &buf );
+		files[count++] = f;
+	}
+
+	/* Check for the presence of all the files at once, which is much faster than one by one on a shared filesystem. */
+	struct makeflow_stat *stats = xxmalloc(count * sizeof(*stats));
+	for(i = 0; i < count; i++) {
+		stats[i].path = files[i]->filename;
+	}
+
+	makeflow_stat_many(remote_queue, stats, count, MAKEFLOW_CHECK_FILES_THREADS);
+
+	for(i = 0; i < count; i++) {
+		f = files[i];
+		int result = stats[i].result;
+		struct stat *buf = &stats[i].buf;
+
+		/* A reset of an earlier file may have cleaned up this one. */
+		if(!dag_file_should_exist(f)) continue;
 
 		if(dag_file_is_source(f)) {
 			/* Source files must exist before running */
@@ -958,7 +1020,7 @@ static int makeflow_check_files(struct dag *d)
 				makeflow_log_file_state_change(d, f, DAG_FILE_STATE_UNKNOWN);
 				makeflow_node_reset(d,f->created_by);
 				warnings++;
-			} else if(!S_ISDIR(buf.st_mode) && difftime(buf.st_mtime, f->creation_logged) > 0) {
+			} else if(!S_ISDIR(buf->st_mode) && difftime(buf->st_mtime, f->creation_logged) > 0) {
 				/* Recreate descendants by resetting all nodes that consume this file. */
 				printf("warning: %s was previously created by makeflow, but someone else modified it!\n",f->filename);
 				makeflow_node_reset_by_file(d,f);
@@ -967,6 +1029,9 @@ static int makeflow_check_files(struct dag *d)
 		}
 	}
 
+	free(stats);
+	free(files);
+
 	if(errors>0 || warnings>0) {
 		printf("found %d errors and %d warnings during consistency check.\n", errors,warnings);
 	}
@@ -1013,25 +1078,72 @@ static int makeflow_check_batch_consistency(struct dag *d)
 	}
 }
 
+/*
+Collect the jobs that have completed in a queue, waiting until stoptime
+for the first one, and mark the node of each complete. All the jobs that
+completed meanwhile are handled together, so that a busy queue does not
+return to the main loop for each one. Returns the number collected.
+*/
+
+static int makeflow_reap_jobs(struct dag *d, struct batch_queue *queue, struct itable *job_table, time_t stoptime)
+{
+	static batch_job_id_t *jobids = 0;
+	static struct batch_job_info *infos = 0;
+
+	if(!jobids) {
+		jobids = xxmalloc(MAKEFLOW_WAIT_BATCH_MAX * sizeof(*jobids));
+		infos = xxmalloc(MAKEFLOW_WAIT_BATCH_MAX * sizeof(*infos));
+	}
+
+	int count = batch_job_wait_many(queue, jobids, infos, MAKEFLOW_WAIT_BATCH_MAX, stoptime);
+
+	int i;
+	for(i = 0; i < count; i++) {
+		batch_job_id_t jobid = jobids[i];
+
+		if(queue == remote_queue) {
+			printf("job %"PRIbjid" completed\n",jobid);
+		}
+		debug(D_MAKEFLOW_RUN, "Job %" PRIbjid " has returned.\n", jobid);
+
+		struct dag_node *n = itable_remove(job_table, jobid);
+		if(n){
+			// Stop gap until batch_job_wait returns task struct
+			batch_task_set_info(n->task, &infos[i]);
+			makeflow_node_complete(d, n, queue, n->task);
+		}
+	}
+
+	if(count > 1) {
+		debug(D_MAKEFLOW_RUN, "%d jobs returned together.\n", count);
+	}
+
+	return MAX(count, 0);
+}
+
 /*
 Main loop for running a makeflow: submit jobs, wait for completion, keep going until everything done.
 */
 
 static void makeflow_run( struct dag *d )
 {
-	struct dag_node *n;
-	batch_job_id_t jobid;
-	struct batch_job_info info;
 	// Start Catalog at current time
 	timestamp_t start = timestamp_get();
 	// Last Report is created stall for first reporting.
 	timestamp_t last_time = start - (60 * 1000 * 1000);
+	// Completions counted since the last report of the rate to the log.
+	timestamp_t last_rate_time = start;
+	int completed_since_rate = 0;
+	int completed_total = 0;
 
 	//reporting to catalog
 	if(catalog_reporting_on){
 		makeflow_catalog_summary(d, project, batch_queue_type, start);
 	}
 
+	dag_compile_ready(d);
+	dag_compile_collectible(d);
+
 	while(!makeflow_abort_flag) {
 		makeflow_dispatch_ready_jobs(d);
 		/*
@@ -1048,19 +1160,11 @@ static void makeflow_run( struct dag *d )
 			break;
 		}
 
+		int completed = 0;
+
 		if(dag_remote_jobs_running(d)) {
 			int tmp_timeout = 5;
-			jobid = batch_job_wait_timeout(remote_queue, &info, time(0) + tmp_timeout);
-			if(jobid > 0) {
-				printf("job %"PRIbjid" completed\n",jobid);
-				debug(D_MAKEFLOW_RUN, "Job %" PRIbjid " has returned.\n", jobid);
-				n = itable_remove(d->remote_job_table, jobid);
-				if(n){
-					// Stop gap until batch_job_wait returns task struct
-					batch_task_set_info(n->task, &info);
-					makeflow_node_complete(d, n, remote_queue, n->task);
-				}
-			}
+			completed += makeflow_reap_jobs(d, remote_queue, d->remote_job_table, time(0) + tmp_timeout);
 		}
 
 		if(dag_local_jobs_running(d)) {
@@ -1073,18 +1177,12 @@ static void makeflow_run( struct dag *d )
 				stoptime = time(0) + tmp_timeout;
 			}
 
-			jobid = batch_job_wait_timeout(local_queue, &info, stoptime);
-			if(jobid > 0) {
-				debug(D_MAKEFLOW_RUN, "Job %" PRIbjid " has returned.\n", jobid);
-				n = itable_remove(d->local_job_table, jobid);
-				if(n){
-					// Stop gap until batch_job_wait returns task struct
-					batch_task_set_info(n->task, &info);
-					makeflow_node_complete(d, n, local_queue, n->task);
-				}
-			}
+			completed += makeflow_reap_jobs(d, local_queue, d->local_job_table, stoptime);
 		}
 
+		completed_since_rate += completed;
+		completed_total += completed;
+
 		/* Report to catalog */
 		timestamp_t now = timestamp_get();
 		/* If in reporting mode and 1 min has transpired */
@@ -1093,13 +1191,16 @@ static void makeflow_run( struct dag *d )
 			last_time = now;
 		}
 
-		/* Rather than try to garbage collect after each time in this
-		 * wait loop, perform garbage collection after a proportional
-		 * amount of tasks have passed. */
-		makeflow_gc_barrier--;
-		if(makeflow_gc_method != MAKEFLOW_GC_NONE && makeflow_gc_barrier == 0) {
+		if((now-last_rate_time) > MAKEFLOW_RATE_INTERVAL) {
+			makeflow_log_rate_event(d, completed_since_rate, now-last_rate_time, completed_total);
+			completed_since_rate = 0;
+			last_rate_time = now;
+		}
+
+		/* Garbage collection only considers the files that became complete,
+		 * and so is cheap enough to check each time in this wait loop. */
+		if(makeflow_gc_method != MAKEFLOW_GC_NONE) {
 			makeflow_gc(d, remote_queue, makeflow_gc_method, makeflow_gc_size, makeflow_gc_count);
-			makeflow_gc_barrier = MAX(d->nodeid_counter * makeflow_gc_task_ratio, 1);
 		}
 	}
 
@@ -1108,6 +1209,10 @@ static void makeflow_run( struct dag *d )
 		makeflow_catalog_summary(d, project,batch_queue_type,start);
 	}
 
+	if(completed_since_rate > 0) {
+		makeflow_log_rate_event(d, completed_since_rate, timestamp_get()-last_rate_time, completed_total);
+	}
+
 	if(makeflow_abort_flag) {
 		makeflow_abort_all(d);
 	} else if(!makeflow_failed_flag && makeflow_gc_method != MAKEFLOW_GC_NONE) {
@@ -1162,6 +1267,7 @@ static void show_help_run(const char *cmd)
 	printf("    --jx-args=<file>            File defining JX variables for JX workflow.\n");
 	printf("    --jx-define=<VAR>=<EXPR>	Set the JX variable VAR to JX expression EXPR.\n");
 	printf("    --log-verbose               Add node id symbol tags in the makeflow log.\n");
+	printf("    --log-binary                Write a new makeflow log in binary form, for faster recovery.\n");
 	printf(" -j,--max-local=<#>             Max number of local jobs to run at once.\n");
 	printf(" -J,--max-remote=<#>            Max number of remote jobs to run at once.\n");
 	printf(" -R,--retry                     Retry failed batch jobs up to 5 times.\n");
@@ -1183,8 +1289,8 @@ static void show_help_run(const char *cmd)
 	printf(" -A,--disable-afs-check         Disable the check for AFS. (experts only.)\n");
 	printf("    --cache=<dir>               Use this dir to cache downloaded mounted files.\n");
 	printf(" -X,--change-directory=<dir>    Change to <dir> before executing the workflow.\n");
-	printf(" -g,--gc=<type>                 Enable garbage collector.(ref_cnt|on_demand|all)\n");
-	printf("    --gc-size=<int>             Set disk size to trigger GC (on_demand only)\n");
+	printf(" -g,--gc=<type>                 Enable garbage collector.(ref_cnt|on_demand|size|all)\n");
+	printf("    --gc-size=<int>             Set disk size to trigger GC (on_demand and size only)\n");
 	printf(" -G,--gc-count=<int>            Set number of files to trigger GC.(ref_cnt only)\n");
 	printf("    --mounts=<mountfile>        Use this file as a mountlist\n");
 	printf("    --skip-file-check           Do not check for file existence before running.\n");
@@ -1411,6 +1517,7 @@ int main(int argc, char *argv[])
 		LONG_OPT_VC3_OPT,
 		LONG_OPT_VERBOSE_PARSING,
 		LONG_OPT_LOG_VERBOSE_MODE,
+		LONG_OPT_LOG_BINARY_MODE,
 		LONG_OPT_WORKING_DIR,
 		LONG_OPT_PREFERRED_CONNECTION,
 		LONG_OPT_WQ_WAIT_FOR_WORKERS,
@@ -1524,6 +1631,7 @@ int main(int argc, char *argv[])
 		{"vc3-options", required_argument, 0, LONG_OPT_VC3_OPT},
 		{"version", no_argument, 0, 'v'},
 		{"log-verbose", no_argument, 0, LONG_OPT_LOG_VERBOSE_MODE},
+		{"log-binary", no_argument, 0, LONG_OPT_LOG_BINARY_MODE},
 		{"working-dir", required_argument, 0, LONG_OPT_WORKING_DIR},
 		{"skip-file-check", no_argument, 0, LONG_OPT_SKIP_FILE_CHECK},
 		{"umbrella-binary", required_argument, 0, LONG_OPT_UMBRELLA_BINARY},
@@ -1640,6 +1748,8 @@ int main(int argc, char *argv[])
 					makeflow_gc_method = MAKEFLOW_GC_ON_DEMAND;
 					if(makeflow_gc_count < 0)
 						makeflow_gc_count = 16;	/* Try to collect at most 16 files. */
+				} else if(strcasecmp(optarg, "size") == 0) {
+					makeflow_gc_method = MAKEFLOW_GC_SIZE;
 				} else if(strcasecmp(optarg, "all") == 0) {
 					makeflow_gc_method = MAKEFLOW_GC_ALL;
 					if(makeflow_gc_count < 0)
@@ -1835,6 +1945,9 @@ int main(int argc, char *argv[])
 			case LONG_OPT_LOG_VERBOSE_MODE:
 				log_verbose_mode = 1;
 				break;
+			case LONG_OPT_LOG_BINARY_MODE:
+				log_binary_mode = 1;
+				break;
 			case LONG_OPT_WRAPPER:
 				if (makeflow_hook_register(&makeflow_hook_basic_wrapper, &hook_args) == MAKEFLOW_HOOK_FAILURE)
 					goto EXIT_WITH_FAILURE;
@@ -2387,7 +2500,7 @@ int main(int argc, char *argv[])
 	/* In case when the user uses --cache option to specify the mount cache dir and the log file also has
 	 * a cache dir logged, these two dirs must be the same. Otherwise exit.
 	 */
-	if(makeflow_log_recover(d, logfilename, log_verbose_mode, remote_queue, clean_mode )) {
+	if(makeflow_log_recover(d, logfilename, log_verbose_mode, log_binary_mode, remote_queue, clean_mode )) {
 		goto EXIT_WITH_FAILURE;
 	}
 
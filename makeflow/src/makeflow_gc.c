@@ -41,6 +41,16 @@ include measuring available space and inodes consumed.
 
 static int makeflow_gc_collected = 0;
 
+/*
+Files that could not be deleted are set aside here, rather than queued
+again at once, and go back to the end of the queue only when another file
+has become collectible, so that a file that cannot be deleted is not
+retried, and the disk measured, on every pass of the main loop.  They
+remain marked as queued, so that they are not queued twice.
+*/
+
+static struct list *makeflow_gc_failed = 0;
+
 /*
 Return true if disk space falls below the fixed minimum. (inexpensive!)
 XXX this value should be configurable.
@@ -130,9 +140,13 @@ void makeflow_parse_input_outputs( struct dag *d )
 	}
 }
 
-/* Clean a specific file, while emitting an appropriate message. */
+/*
+Delete a file, while emitting an appropriate message.  Returns zero if
+the file is gone.  A file that could not be deleted is recorded as deleted
+anyway if forget is set, and is otherwise left as it was, to be tried again.
+*/
 
-int makeflow_clean_file( struct dag *d, struct batch_queue *queue, struct dag_file *f)
+static int makeflow_delete_file( struct dag *d, struct batch_queue *queue, struct dag_file *f, int forget )
 {
 	if(!f || f->type == DAG_FILE_TYPE_GLOBAL)
 		return 1;
@@ -146,15 +160,23 @@ int makeflow_clean_file( struct dag *d, struct batch_queue *queue, struct dag_fi
 		makeflow_hook_file_deleted(f);
 
 	} else if(errno != ENOENT) {
-		if(f->state == DAG_FILE_STATE_EXPECT || dag_file_should_exist(f))
+		debug(D_MAKEFLOW_RUN, "Makeflow: Couldn't delete %s: %s\n", f->filename, strerror(errno));
+
+		if(forget && (f->state == DAG_FILE_STATE_EXPECT || dag_file_should_exist(f)))
 			makeflow_log_file_state_change(d, f, DAG_FILE_STATE_DELETE);
 
-		debug(D_MAKEFLOW_RUN, "Makeflow: Couldn't delete %s: %s\n", f->filename, strerror(errno));
 		return 1;
 	}
 	return 0;
 }
 
+/* Clean a specific file, while emitting an appropriate message. */
+
+int makeflow_clean_file( struct dag *d, struct batch_queue *queue, struct dag_file *f)
+{
+	return makeflow_delete_file(d, queue, f, 1);
+}
+
 /*
 Clean up all the files generated by this task.
 Note that a task is generated from a node by applying
@@ -270,43 +292,195 @@ int makeflow_clean(struct dag *d, struct batch_queue *queue, makeflow_clean_dept
 	return 0;
 }
 
-/* Collect available garbage, up to a limit of maxfiles. */
+/* Return true if a file that was queued as complete may still be collected. */
+
+static int makeflow_gc_collectible( struct dag *d, struct dag_file *f )
+{
+	return f->state == DAG_FILE_STATE_COMPLETE
+		&& f->type != DAG_FILE_TYPE_GLOBAL
+		&& !dag_file_is_source(f)
+		&& !set_lookup(d->outputs, f)
+		&& !set_lookup(d->inputs, f);
+}
+
+static void makeflow_gc_record( struct dag *d, int collected, timestamp_t start_time )
+{
+	/* Record total amount of files collected to Makeflowlog. */
+	if(collected > 0) {
+		makeflow_gc_collected += collected;
+		makeflow_log_gc_event(d,collected,timestamp_get()-start_time,makeflow_gc_collected);
+	}
+}
+
+/*
+Collection by size keeps the files it has not collected yet in a heap,
+ordered by size with the largest on top, so that each collection only
+adds the files that became collectible since the last one, and removes
+as many files as it deletes.
+*/
+
+struct makeflow_gc_entry {
+	uint64_t size;
+	struct dag_file *file;
+};
+
+static struct makeflow_gc_entry *makeflow_gc_heap = 0;
+static int makeflow_gc_heap_count = 0;
+static int makeflow_gc_heap_capacity = 0;
+
+static void makeflow_gc_heap_push( struct dag_file *f )
+{
+	if(makeflow_gc_heap_count == makeflow_gc_heap_capacity) {
+		makeflow_gc_heap_capacity = makeflow_gc_heap_capacity ? 2 * makeflow_gc_heap_capacity : 64;
+		makeflow_gc_heap = xxrealloc(makeflow_gc_heap, makeflow_gc_heap_capacity * sizeof(*makeflow_gc_heap));
+	}
+
+	struct makeflow_gc_entry e = { dag_file_size(f), f };
+
+	int i = makeflow_gc_heap_count++;
+	while(i > 0) {
+		int parent = (i - 1) / 2;
+		if(makeflow_gc_heap[parent].size >= e.size)
+			break;
+		makeflow_gc_heap[i] = makeflow_gc_heap[parent];
+		i = parent;
+	}
+	makeflow_gc_heap[i] = e;
+}
+
+static struct dag_file *makeflow_gc_heap_pop( void )
+{
+	if(makeflow_gc_heap_count == 0)
+		return 0;
+
+	struct dag_file *f = makeflow_gc_heap[0].file;
+	struct makeflow_gc_entry e = makeflow_gc_heap[--makeflow_gc_heap_count];
+
+	int i = 0;
+	while(1) {
+		int child = 2 * i + 1;
+		if(child >= makeflow_gc_heap_count)
+			break;
+		if(child + 1 < makeflow_gc_heap_count && makeflow_gc_heap[child + 1].size > makeflow_gc_heap[child].size)
+			child++;
+		if(e.size >= makeflow_gc_heap[child].size)
+			break;
+		makeflow_gc_heap[i] = makeflow_gc_heap[child];
+		i = child;
+	}
+	if(makeflow_gc_heap_count > 0)
+		makeflow_gc_heap[i] = e;
+
+	return f;
+}
+
+static void makeflow_gc_fail( struct dag_file *f )
+{
+	if(!makeflow_gc_failed)
+		makeflow_gc_failed = list_create();
+
+	list_push_tail(makeflow_gc_failed, f);
+	f->collect_queued = 1;
+}
+
+/* Queue again the files that could not be deleted before. */
+
+static void makeflow_gc_retry( struct dag *d )
+{
+	struct dag_file *f;
+
+	if(!makeflow_gc_failed)
+		return;
+
+	while((f = list_pop_head(makeflow_gc_failed))) {
+		list_push_tail(d->collectible_files, f);
+	}
+}
+
+/*
+Collect available garbage, trying at most maxfiles files.  Files are taken
+from the queue of complete files, and those that are no longer complete,
+or are inputs or outputs of the workflow, are dropped from it.  Files that
+could not be deleted are set aside until another file becomes collectible.
+*/
 
 static void makeflow_gc_all( struct dag *d, struct batch_queue *queue, int maxfiles)
 {
 	int collected = 0;
+	int attempted = 0;
 	struct dag_file *f;
-	char *name;
 
-	timestamp_t start_time, stop_time;
+	timestamp_t start_time = timestamp_get();
 
-	/* This will walk the table of files to collect and will remove any
-	 * that are below or equal to the threshold. */
-	start_time = timestamp_get();
-	hash_table_firstkey(d->files);
-	while(hash_table_nextkey(d->files, &name, (void **) &f) && collected < maxfiles) {
-		if(f->state == DAG_FILE_STATE_COMPLETE
-			&& !dag_file_is_source(f)
-			&& !set_lookup(d->outputs, f)
-			&& !set_lookup(d->inputs, f)
-			&& makeflow_clean_file(d, queue, f)){
+	/* Files left by a collection by size are also collected. */
+	while((f = makeflow_gc_heap_pop())) {
+		list_push_tail(d->collectible_files, f);
+	}
+
+	while(attempted < maxfiles && (f = list_pop_head(d->collectible_files))) {
+		f->collect_queued = 0;
+		if(!makeflow_gc_collectible(d, f))
+			continue;
+		attempted++;
+		if(makeflow_delete_file(d, queue, f, 0) == 0) {
 			collected++;
+		} else {
+			makeflow_gc_fail(f);
 		}
 	}
 
-	stop_time = timestamp_get();
+	makeflow_gc_record(d, collected, start_time);
+}
 
-	/* Record total amount of files collected to Makeflowlog. */
-	if(collected > 0) {
-		makeflow_gc_collected += collected;
-		makeflow_log_gc_event(d,collected,stop_time-start_time,makeflow_gc_collected);
+/*
+Collect the largest files first, until there is enough space available,
+and keep the rest in the heap for a later collection.
+*/
+
+static void makeflow_gc_largest( struct dag *d, struct batch_queue *queue, uint64_t size)
+{
+	int collected = 0;
+	struct dag_file *f;
+
+	timestamp_t start_time = timestamp_get();
+
+	while((f = list_pop_head(d->collectible_files))) {
+		if(makeflow_gc_collectible(d, f)) {
+			makeflow_gc_heap_push(f);
+		} else {
+			f->collect_queued = 0;
+		}
 	}
+
+	while(makeflow_gc_heap_count > 0 && directory_low_disk(".", size)) {
+		f = makeflow_gc_heap_pop();
+		f->collect_queued = 0;
+		if(!makeflow_gc_collectible(d, f))
+			continue;
+		if(makeflow_delete_file(d, queue, f, 0) == 0) {
+			collected++;
+		} else {
+			makeflow_gc_fail(f);
+		}
+	}
+
+	makeflow_gc_record(d, collected, start_time);
 }
 
 /* Collect garbage only if conditions warrant. */
 
 void makeflow_gc( struct dag *d, struct batch_queue *queue, makeflow_gc_method_t method, uint64_t size, int count)
 {
+	/* Nothing may be collected until some file is no longer needed. */
+	if(!d->collectible_files)
+		return;
+
+	if(list_size(d->collectible_files) > 0) {
+		makeflow_gc_retry(d);
+	} else if(makeflow_gc_heap_count == 0) {
+		return;
+	}
+
 	if(size == 0)
 		size = MAKEFLOW_MIN_SPACE;
 	switch (method) {
@@ -325,7 +499,7 @@ void makeflow_gc( struct dag *d, struct batch_queue *queue, makeflow_gc_method_t
 	case MAKEFLOW_GC_SIZE:
 		if(directory_low_disk(".", size)) {
 			debug(D_MAKEFLOW_RUN, "Performing size (%d) garbage collection", count);
-			makeflow_gc_all(d, queue, INT_MAX);
+			makeflow_gc_largest(d, queue, size);
 		}
 		break;
 	case MAKEFLOW_GC_ALL:
@@ -6,6 +6,7 @@ See the file COPYING for details.
 
 #include "batch_file.h"
 #include "makeflow_log.h"
+#include "makeflow_log_binary.h"
 #include "makeflow_gc.h"
 #include "dag.h"
 #include "get_line.h"
@@ -13,6 +14,9 @@ See the file COPYING for details.
 
 #include "timestamp.h"
 #include "list.h"
+#include "buffer.h"
+#include "hash_table.h"
+#include "macros.h"
 #include "debug.h"
 #include "xxmalloc.h"
 
@@ -22,6 +26,7 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdarg.h>
 
 #define MAX_BUFFER_SIZE 4096
 
@@ -70,6 +75,14 @@ collected - the number of files were collected in this garbage collection cycle.
 time_spent - the length of time this cycle took.
 total_collected - the total number of files has been collected so far since the start this makeflow execution.
 
+Line format: # RATE timestamp completed time_spent completions_per_second total_completed
+
+timestamp - the unix time (in microseconds) when this line is written to the log file.
+completed - the number of jobs that completed since the previous RATE line, or the start of this makeflow execution.
+time_spent - the length of time (in microseconds) over which they completed.
+completions_per_second - the rate at which jobs completed over that time.
+total_completed - the total number of jobs that have completed so far since the start of this makeflow execution.
+
 Line format: # CACHE timestamp cache_dir
 
 timestamp - the unix time (in microseconds) when this line is written to the log file.
@@ -103,10 +116,111 @@ filename - the filename specified within the dag_file whose state has changed.
 timestamp - the unix time (in microseconds) when this line is written to the log file.
 
 These event types indicate that the workflow as a whole has started or completed in the indicated manner.
+
+----
+
+If makeflow is given --log-binary, the log is written instead in the binary form
+described in makeflow_log_binary.h, which holds the same events, along with
+periodic checkpoints so that recovery need not read the whole log.
+makeflow_log_convert turns a binary log back into the form above.
+An existing log is always continued in the form it was begun in.
 */
 
 void makeflow_node_decide_reset( struct dag *d, struct dag_node *n, int silent );
 
+/* Whether the log is in binary form, and the number of state changes written since its last checkpoint. */
+static int log_binary_mode = 0;
+static int log_binary_records = 0;
+
+/* A checkpoint is written at least this often, and otherwise once there are as many records since the last as it would hold itself. */
+#define MAKEFLOW_LOG_CHECKPOINT_MIN 1000
+
+/*
+Write one event that is not a change of state, as a line of the text log,
+or as a record holding that line.
+*/
+
+static void makeflow_log_printf( struct dag *d, const char *fmt, ... )
+{
+	va_list args;
+	va_start(args, fmt);
+
+	if(log_binary_mode) {
+		buffer_t b;
+		buffer_init(&b);
+		buffer_abortonfailure(&b, 1);
+		buffer_putvfstring(&b, fmt, args);
+
+		size_t length;
+		char *line = (char *) buffer_tolstring(&b, &length);
+		if(length > 0 && line[length-1] == '\n') {
+			line[length-1] = 0;
+		}
+		makeflow_log_binary_write_line(d->logfile, line);
+		buffer_free(&b);
+	} else {
+		vfprintf(d->logfile, fmt, args);
+	}
+
+	va_end(args);
+}
+
+/*
+Write the state of every node and file that has left its initial state,
+along with the mounts and the cache, so that recovery may begin here.
+*/
+
+static void makeflow_log_checkpoint( struct dag *d )
+{
+	struct dag_node *n;
+	struct dag_file *f;
+	char *filename;
+	timestamp_t time = timestamp_get();
+
+	fflush(d->logfile);
+	uint64_t begin = ftello(d->logfile);
+
+	makeflow_log_binary_write_checkpoint_begin(d->logfile, time, d->completed_files, d->deleted_files);
+
+	if(d->cache_dir) {
+		makeflow_log_printf(d, "# CACHE %" PRIu64 " %s\n", time, d->cache_dir);
+	}
+
+	hash_table_firstkey(d->files);
+	while(hash_table_nextkey(d->files, &filename, (void **) &f)) {
+		if(f->source) {
+			makeflow_log_printf(d, "# MOUNT %" PRIu64 " %s %s %s %d\n", time, f->filename, f->source, f->cache_name, f->type);
+		}
+		/* Within a checkpoint, the time of a file is when its creation was logged, if ever. */
+		if(f->state != DAG_FILE_STATE_UNKNOWN && f->type != DAG_FILE_TYPE_GLOBAL) {
+			makeflow_log_binary_write_file(d->logfile, (timestamp_t) f->creation_logged * 1000000, f->filename, f->state, dag_file_size(f));
+		}
+	}
+
+	for(n = d->nodes; n; n = n->next) {
+		if(n->state != DAG_NODE_STATE_WAITING) {
+			makeflow_log_binary_write_node(d->logfile, time, n->nodeid, n->state, n->jobid, d->node_states, d->nodeid_counter);
+		}
+	}
+
+	if(!makeflow_log_binary_write_checkpoint_end(d->logfile, begin)) {
+		debug(D_NOTICE, "couldn't write checkpoint to makeflow log: %s", strerror(errno));
+	}
+
+	log_binary_records = 0;
+}
+
+/* Count a change of state, and write a checkpoint when enough have accumulated. */
+
+static void makeflow_log_binary_record_written( struct dag *d )
+{
+	int limit = MAX(d->nodeid_counter + hash_table_size(d->files), MAKEFLOW_LOG_CHECKPOINT_MIN);
+
+	if(++log_binary_records >= limit) {
+		makeflow_log_checkpoint(d);
+	}
+}
+
 /*
 To balance between performance and consistency, we sync the log every 60 seconds
 on ordinary events, but sync immediately on important events like a makeflow restart.
@@ -138,7 +252,7 @@ void makeflow_log_close( struct dag *d )
 
 void makeflow_log_started_event( struct dag *d )
 {
-	fprintf(d->logfile, "# STARTED %" PRIu64 "\n", timestamp_get());
+	makeflow_log_printf(d, "# STARTED %" PRIu64 "\n", timestamp_get());
 	makeflow_log_sync(d,1);
 }
 
@@ -147,7 +261,7 @@ void makeflow_log_aborted_event( struct dag *d )
 	/* In the case where Makeflow exits prior to creating the DAG or opening log. */
 	if(!d || !d->logfile) return;
 
-	fprintf(d->logfile, "# ABORTED %" PRIu64 "\n", timestamp_get());
+	makeflow_log_printf(d, "# ABORTED %" PRIu64 "\n", timestamp_get());
 	makeflow_log_sync(d,1);
 }
 
@@ -156,7 +270,7 @@ void makeflow_log_failed_event( struct dag *d )
 	/* In the case where Makeflow exits prior to creating the DAG or opening log. */
 	if(!d || !d->logfile) return;
 
-	fprintf(d->logfile, "# FAILED %" PRIu64 "\n", timestamp_get());
+	makeflow_log_printf(d, "# FAILED %" PRIu64 "\n", timestamp_get());
 	makeflow_log_sync(d,1);
 }
 
@@ -165,23 +279,23 @@ void makeflow_log_completed_event( struct dag *d )
 	/* In the case where Makeflow exits prior to creating the DAG or opening log. */
 	if(!d || !d->logfile) return;
 
-	fprintf(d->logfile, "# COMPLETED %" PRIu64 "\n", timestamp_get());
+	makeflow_log_printf(d, "# COMPLETED %" PRIu64 "\n", timestamp_get());
 	makeflow_log_sync(d,1);
 }
 
 void makeflow_log_mount_event( struct dag *d, const char *target, const char *source, const char *cache_name, dag_file_source_t type ) {
-	fprintf(d->logfile, "# MOUNT %" PRIu64 " %s %s %s %d\n", timestamp_get(), target, source, cache_name, type);
+	makeflow_log_printf(d, "# MOUNT %" PRIu64 " %s %s %s %d\n", timestamp_get(), target, source, cache_name, type);
 	makeflow_log_sync(d,1);
 }
 
 void makeflow_log_cache_event( struct dag *d, const char *cache_dir ) {
-	fprintf(d->logfile, "# CACHE %" PRIu64 " %s\n", timestamp_get(), cache_dir);
+	makeflow_log_printf(d, "# CACHE %" PRIu64 " %s\n", timestamp_get(), cache_dir);
 	makeflow_log_sync(d,1);
 }
 
 void makeflow_log_event( struct dag *d, char *name, uint64_t value)
 {
-	fprintf(d->logfile, "# EVENT\t%"PRIu64"\t%s\t%" PRIu64 "\n", timestamp_get(), name, value);
+	makeflow_log_printf(d, "# EVENT\t%"PRIu64"\t%s\t%" PRIu64 "\n", timestamp_get(), name, value);
 	makeflow_log_sync(d,1);
 }
 
@@ -192,10 +306,23 @@ void makeflow_log_state_change( struct dag *d, struct dag_node *n, int newstate
 	if(d->node_states[n->state] > 0) {
 		d->node_states[n->state]--;
 	}
+	if(n->local_job && d->local_node_states[n->state] > 0) {
+		d->local_node_states[n->state]--;
+	}
 	n->state = newstate;
 	d->node_states[n->state]++;
+	if(n->local_job) {
+		d->local_node_states[n->state]++;
+	}
+
+	dag_node_queue_ready(d, n);
 
-	fprintf(d->logfile, "%" PRIu64 " %d %d %" PRIbjid " %d %d %d %d %d %d\n", timestamp_get(), n->nodeid, newstate, n->jobid, d->node_states[0], d->node_states[1], d->node_states[2], d->node_states[3], d->node_states[4], d->nodeid_counter);
+	if(log_binary_mode) {
+		makeflow_log_binary_write_node(d->logfile, timestamp_get(), n->nodeid, newstate, n->jobid, d->node_states, d->nodeid_counter);
+		makeflow_log_binary_record_written(d);
+	} else {
+		fprintf(d->logfile, "%" PRIu64 " %d %d %" PRIbjid " %d %d %d %d %d %d\n", timestamp_get(), n->nodeid, newstate, n->jobid, d->node_states[0], d->node_states[1], d->node_states[2], d->node_states[3], d->node_states[4], d->nodeid_counter);
+	}
 
 	makeflow_log_sync(d,0);
 }
@@ -204,19 +331,27 @@ void makeflow_log_file_state_change( struct dag *d, struct dag_file *f, int news
 {
 	debug(D_MAKEFLOW_RUN, "file %s %s -> %s\n", f->filename, dag_file_state_name(f->state), dag_file_state_name(newstate));
 
+	int existed = dag_file_should_exist(f);
 	f->state = newstate;
+	dag_file_update_consumers(d, f, existed);
+	dag_file_queue_collectible(d, f);
 
 	/* If a file is a wrapper global file do not log to avoid cleaning floating global files. */
 	if(f->type == DAG_FILE_TYPE_GLOBAL) return;
 
 	timestamp_t time = timestamp_get();
-	fprintf(d->logfile, "# FILE %" PRIu64 " %s %d %" PRIu64 "\n", time, f->filename, f->state, dag_file_size(f));
 	if(f->state == DAG_FILE_STATE_EXISTS){
 		d->completed_files += 1;
 		f->creation_logged = (time_t) (time / 1000000);
 	} else if(f->state == DAG_FILE_STATE_DELETE) {
 		d->deleted_files += 1;
 	}
+	if(log_binary_mode) {
+		makeflow_log_binary_write_file(d->logfile, time, f->filename, f->state, dag_file_size(f));
+		makeflow_log_binary_record_written(d);
+	} else {
+		fprintf(d->logfile, "# FILE %" PRIu64 " %s %d %" PRIu64 "\n", time, f->filename, f->state, dag_file_size(f));
+	}
 	makeflow_log_sync(d,0);
 }
 
@@ -252,13 +387,20 @@ void makeflow_log_dag_file_list_state_change( struct dag *d, struct list *file_l
 
 void makeflow_log_alloc_event( struct dag *d, struct makeflow_alloc *a )
 {
-	fprintf(d->logfile, "# ALLOC %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64"\n", timestamp_get(), a->storage->total, a->storage->used, a->storage->greedy, a->storage->commit, a->storage->free, d->total_file_size);
+	makeflow_log_printf(d, "# ALLOC %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64"\n", timestamp_get(), a->storage->total, a->storage->used, a->storage->greedy, a->storage->commit, a->storage->free, d->total_file_size);
 	makeflow_log_sync(d,0);
 }
 
 void makeflow_log_gc_event( struct dag *d, int collected, timestamp_t elapsed, int total_collected )
 {
-	fprintf(d->logfile, "# GC %" PRIu64 " %d %" PRIu64 " %d\n", timestamp_get(), collected, elapsed, total_collected);
+	makeflow_log_printf(d, "# GC %" PRIu64 " %d %" PRIu64 " %d\n", timestamp_get(), collected, elapsed, total_collected);
+	makeflow_log_sync(d,0);
+}
+
+void makeflow_log_rate_event( struct dag *d, int completed, timestamp_t elapsed, int total_completed )
+{
+	double rate = elapsed > 0 ? completed * 1000000.0 / elapsed : 0;
+	makeflow_log_printf(d, "# RATE %" PRIu64 " %d %" PRIu64 " %.2f %d\n", timestamp_get(), completed, elapsed, rate, total_completed);
 	makeflow_log_sync(d,0);
 }
 
@@ -272,141 +414,286 @@ void makeflow_log_dag_structure( struct dag *d )
 {
 	struct dag_file *f;
 	struct dag_node *n, *p;
+	buffer_t b;
+
+	buffer_init(&b);
+	buffer_abortonfailure(&b, 1);
 
 	for(n = d->nodes; n; n = n->next) {
 		/* Record node information to log */
-		fprintf(d->logfile, "# NODE\t%d\t%s\n", n->nodeid, n->command);
+		makeflow_log_printf(d, "# NODE\t%d\t%s\n", n->nodeid, n->command);
 
 		/* Record the node category to the log */
-		fprintf(d->logfile, "# CATEGORY\t%d\t%s\n", n->nodeid, n->category->name);
-		fprintf(d->logfile, "# SYMBOL\t%d\t%s\n", n->nodeid, n->category->name);   /* also write the SYMBOL as alias of CATEGORY, deprecated. */
+		makeflow_log_printf(d, "# CATEGORY\t%d\t%s\n", n->nodeid, n->category->name);
+		makeflow_log_printf(d, "# SYMBOL\t%d\t%s\n", n->nodeid, n->category->name);   /* also write the SYMBOL as alias of CATEGORY, deprecated. */
 
 		/* Record node parents to log */
-		fprintf(d->logfile, "# PARENTS\t%d", n->nodeid);
+		buffer_rewind(&b, 0);
 		list_first_item(n->source_files);
 		while( (f = list_next_item(n->source_files)) ) {
 			p = f->created_by;
 			if(p)
-				fprintf(d->logfile, "\t%d", p->nodeid);
+				buffer_printf(&b, "\t%d", p->nodeid);
 		}
-		fputc('\n', d->logfile);
+		makeflow_log_printf(d, "# PARENTS\t%d%s\n", n->nodeid, buffer_tostring(&b));
 
 		/* Record node inputs to log */
-		fprintf(d->logfile, "# SOURCES\t%d", n->nodeid);
+		buffer_rewind(&b, 0);
 		list_first_item(n->source_files);
 		while( (f = list_next_item(n->source_files)) ) {
-			fprintf(d->logfile, "\t%s", f->filename);
+			buffer_printf(&b, "\t%s", f->filename);
 		}
-		fputc('\n', d->logfile);
+		makeflow_log_printf(d, "# SOURCES\t%d%s\n", n->nodeid, buffer_tostring(&b));
 
 		/* Record node outputs to log */
-		fprintf(d->logfile, "# TARGETS\t%d", n->nodeid);
+		buffer_rewind(&b, 0);
 		list_first_item(n->target_files);
 		while( (f = list_next_item(n->target_files)) ) {
-			fprintf(d->logfile, "\t%s", f->filename);
+			buffer_printf(&b, "\t%s", f->filename);
 		}
-		fputc('\n', d->logfile);
+		makeflow_log_printf(d, "# TARGETS\t%d%s\n", n->nodeid, buffer_tostring(&b));
 
 		/* Record translated command to log */
-		fprintf(d->logfile, "# COMMAND\t%d\t%s\n", n->nodeid, n->command);
+		makeflow_log_printf(d, "# COMMAND\t%d\t%s\n", n->nodeid, n->command);
+	}
+
+	buffer_free(&b);
+}
+
+/*
+Replay a change in the state of a node or file, as found in the log.
+*/
+
+static void makeflow_log_recover_node( struct dag *d, timestamp_t time, int nodeid, int state, int jobid )
+{
+	struct dag_node *n = itable_lookup(d->node_table, nodeid);
+	if(n) {
+		n->state = state;
+		n->jobid = jobid;
+		/* Log timestamp is in microseconds, we need seconds for diff. */
+		n->previous_completion = (time_t) (time / 1000000);
+	}
+}
+
+static void makeflow_log_recover_file( struct dag *d, timestamp_t time, const char *filename, int file_state, int in_checkpoint )
+{
+	struct dag_file *f = dag_file_lookup_or_create(d, filename);
+	f->state = file_state;
+	if(in_checkpoint) {
+		/* The checkpoint gives the counts of files itself, and the time that the file was created. */
+		f->creation_logged = (time_t) (time / 1000000);
+	} else if(file_state == DAG_FILE_STATE_EXISTS){
+		d->completed_files += 1;
+		f->creation_logged = (time_t) (time / 1000000);
+	} else if(file_state == DAG_FILE_STATE_DELETE){
+		d->deleted_files += 1;
 	}
 }
 
+/*
+Replay one line of the text log, which is also the form of events in the
+binary log other than changes of state.  Returns zero on success, or -1
+if the log is inconsistent with the mounts or cache given to makeflow.
+*/
+
+static int makeflow_log_recover_line( struct dag *d, const char *line, const char *filename, int linenum )
+{
+	char file[MAX_BUFFER_SIZE];
+	char source[PATH_MAX], cache_dir[NAME_MAX], cache_name[NAME_MAX];
+	int nodeid, state, jobid, file_state, type;
+	struct dag_file *f;
+	timestamp_t previous_completion_time;
+	uint64_t size;
+
+	if(sscanf(line, "# FILE %" SCNu64 " %s %d %" SCNu64 "", &previous_completion_time, file, &file_state, &size) == 4) {
+		makeflow_log_recover_file(d, previous_completion_time, file, file_state, 0);
+	} else if(sscanf(line, "# CACHE %" SCNu64 " %s", &previous_completion_time, cache_dir) == 2) {
+		/* if the user specifies a cache dir using --cache dir, ignore the info from the log file */
+		if(!d->cache_dir) {
+			d->cache_dir = xxstrdup(cache_dir);
+		} else {
+			/* There are two possible reasons for the inconsistency:
+			 * 1) the cache dir specified via the --cache opt and in the log file mismatch;
+			 * 2) the log file includes multiple different CACHE entries.
+			 */
+			if(strcmp(cache_dir, d->cache_dir)) {
+				fprintf(stderr, "The --cache option (%s) does not match the cache dir (%s) in the log file!\n", d->cache_dir, cache_dir);
+				return -1;
+			}
+		}
+	} else if(sscanf(line, "# MOUNT %" SCNu64 " %s %s %s %d", &previous_completion_time, file, source, cache_name, &type) == 5) {
+		f = dag_file_lookup_or_create(d, file);
+
+		if(!f->source) {
+			f->source = xxstrdup(source);
+			f->cache_name = xxstrdup(cache_name);
+			f->type = type;
+		} else {
+			/* If a mount entry is specified in the mountfile and logged in a log file at the same time, they must not conflict with each other. */
+			/* If a mount entry is logged in a log file multiple times deliberately or not, they must not conflict with each other. */
+			if(makeflow_mount_check_consistency(file, f->source, source, d->cache_dir, cache_name)) {
+				return -1;
+			}
+		}
+	} else if(line[0] == '#') {
+		/* Ignore any other comment lines */
+	} else if(sscanf(line, "%" SCNu64 " %d %d %d", &previous_completion_time, &nodeid, &state, &jobid) == 4) {
+		makeflow_log_recover_node(d, previous_completion_time, nodeid, state, jobid);
+	} else {
+		fprintf(stderr, "makeflow: %s appears to be corrupted on line %d\n", filename, linenum);
+		exit(1);
+	}
+
+	return 0;
+}
+
+static int makeflow_log_recover_text( struct dag *d, FILE *file, const char *filename )
+{
+	char *line;
+	int linenum = 0;
+
+	while((line = get_line(file))) {
+		linenum++;
+		int result = makeflow_log_recover_line(d, line, filename, linenum);
+		free(line);
+		if(result) return result;
+	}
+
+	return 0;
+}
+
+/*
+Replay a binary log from its last checkpoint.  The checkpoint gives the
+counts of files and the state of everything that has changed, and the
+records after it are replayed as in the text log.  The position after the
+last complete record is given in end, so that a record cut short by a
+crash may be discarded.
+*/
+
+static int makeflow_log_recover_binary( struct dag *d, FILE *file, const char *filename, uint64_t checkpoint, uint64_t *end )
+{
+	struct makeflow_log_record r;
+	int in_checkpoint = 0;
+	int recordnum = 0;
+	int result = 0;
+	int status;
+
+	memset(&r, 0, sizeof(r));
+
+	if(checkpoint) {
+		printf("recovering from checkpoint at offset %" PRIu64 "...\n", checkpoint);
+		fseeko(file, checkpoint, SEEK_SET);
+	}
+
+	*end = ftello(file);
+
+	while((status = makeflow_log_binary_read(file, &r)) > 0) {
+		recordnum++;
+
+		switch(r.type) {
+			case MAKEFLOW_LOG_RECORD_NODE:
+				makeflow_log_recover_node(d, r.time, r.nodeid, r.state, r.jobid);
+				break;
+			case MAKEFLOW_LOG_RECORD_FILE:
+				makeflow_log_recover_file(d, r.time, r.text, r.state, in_checkpoint);
+				break;
+			case MAKEFLOW_LOG_RECORD_LINE:
+				result = makeflow_log_recover_line(d, r.text, filename, recordnum);
+				break;
+			case MAKEFLOW_LOG_RECORD_CHECKPOINT_BEGIN:
+				d->completed_files = r.completed_files;
+				d->deleted_files = r.deleted_files;
+				in_checkpoint = 1;
+				break;
+			case MAKEFLOW_LOG_RECORD_CHECKPOINT_END:
+				in_checkpoint = 0;
+				break;
+			default:
+				break;
+		}
+
+		if(result) break;
+
+		*end = ftello(file);
+	}
+
+	if(status < 0) {
+		fprintf(stderr, "makeflow: %s ends with an incomplete record, which will be discarded.\n", filename);
+	}
+
+	makeflow_log_record_free(&r);
+
+	return result;
+}
+
 /*
 Recover the state of the workflow so far by reading back the state
 from the log file, if it exists.  (If not, create a new log.)
 */
 
-int makeflow_log_recover(struct dag *d, const char *filename, int verbose_mode, struct batch_queue *queue, makeflow_clean_depth clean_mode )
+int makeflow_log_recover(struct dag *d, const char *filename, int verbose_mode, int binary_mode, struct batch_queue *queue, makeflow_clean_depth clean_mode )
 {
-	char *line, file[MAX_BUFFER_SIZE];
-	int nodeid, state, jobid, file_state;
 	int first_run = 1;
+	uint64_t checkpoint = 0;
+	uint64_t binary_end = 0;
 	struct dag_node *n;
-	struct dag_file *f;
-	timestamp_t previous_completion_time;
-	uint64_t size;
 
-	d->logfile = fopen(filename, "r");
-	if(d->logfile) {
-		int linenum = 0;
+	FILE *file = fopen(filename, "r");
+	if(file) {
 		first_run = 0;
+		int result;
 
 		printf("recovering from log file %s...\n",filename);
 
-		while((line = get_line(d->logfile))) {
-			char source[PATH_MAX], cache_dir[NAME_MAX], cache_name[NAME_MAX];
-			int type;
-			linenum++;
-
-			if(sscanf(line, "# FILE %" SCNu64 " %s %d %" SCNu64 "", &previous_completion_time, file, &file_state, &size) == 4) {
-				f = dag_file_lookup_or_create(d, file);
-				f->state = file_state;
-				if(file_state == DAG_FILE_STATE_EXISTS){
-					d->completed_files += 1;
-					f->creation_logged = (time_t) (previous_completion_time / 1000000);
-				} else if(file_state == DAG_FILE_STATE_DELETE){
-					d->deleted_files += 1;
-				}
-			} else if(sscanf(line, "# CACHE %" SCNu64 " %s", &previous_completion_time, cache_dir) == 2) {
-				/* if the user specifies a cache dir using --cache dir, ignore the info from the log file */
-				if(!d->cache_dir) {
-					d->cache_dir = xxstrdup(cache_dir);
-				} else {
-					/* There are two possible reasons for the inconsistency:
-					 * 1) the cache dir specified via the --cache opt and in the log file mismatch;
-					 * 2) the log file includes multiple different CACHE entries.
-					 */
-					if(strcmp(cache_dir, d->cache_dir)) {
-						fprintf(stderr, "The --cache option (%s) does not match the cache dir (%s) in the log file!\n", d->cache_dir, cache_dir);
-						free(line);
-						return -1;
-					}
-				}
-			} else if(sscanf(line, "# MOUNT %" SCNu64 " %s %s %s %d", &previous_completion_time, file, source, cache_name, &type) == 5) {
-				f = dag_file_lookup_or_create(d, file);
-
-				if(!f->source) {
-					f->source = xxstrdup(source);
-					f->cache_name = xxstrdup(cache_name);
-					f->type = type;
-				} else {
-					/* If a mount entry is specified in the mountfile and logged in a log file at the same time, they must not conflict with each other. */
-					/* If a mount entry is logged in a log file multiple times deliberately or not, they must not conflict with each other. */
-					if(makeflow_mount_check_consistency(file, f->source, source, d->cache_dir, cache_name)) {
-						free(line);
-						return -1;
-					}
-				}
-			} else if(line[0] == '#') {
-				/* Ignore any other comment lines */
-			} else if(sscanf(line, "%" SCNu64 " %d %d %d", &previous_completion_time, &nodeid, &state, &jobid) == 4) {
-				n = itable_lookup(d->node_table, nodeid);
-				if(n) {
-					n->state = state;
-					n->jobid = jobid;
-					/* Log timestamp is in microseconds, we need seconds for diff. */
-					n->previous_completion = (time_t) (previous_completion_time / 1000000);
-				}
-			} else {
-				fprintf(stderr, "makeflow: %s appears to be corrupted on line %d\n", filename, linenum);
-				exit(1);
-			}
-			free(line);
+		if(makeflow_log_binary_check(file, &checkpoint)) {
+			if(!binary_mode) debug(D_MAKEFLOW_RUN, "%s is a binary log, and will be continued as one.\n", filename);
+			binary_mode = 1;
+			result = makeflow_log_recover_binary(d, file, filename, checkpoint, &binary_end);
+		} else {
+			if(binary_mode) printf("%s is a text log, and will be continued as one.\n", filename);
+			binary_mode = 0;
+			result = makeflow_log_recover_text(d, file, filename);
 		}
-		fclose(d->logfile);
+
+		fclose(file);
+		if(result) return result;
 	} else {
 		printf("creating new log file %s...\n",filename);
 	}
 
-	d->logfile = fopen(filename, "a");
-	if(!d->logfile) {
-		fprintf(stderr, "makeflow: couldn't open logfile %s: %s\n", filename, strerror(errno));
-		exit(1);
-	}
-	if(setvbuf(d->logfile, NULL, _IOLBF, BUFSIZ) != 0) {
-		fprintf(stderr, "makeflow: couldn't set line buffer on logfile %s: %s\n", filename, strerror(errno));
-		exit(1);
+	log_binary_mode = binary_mode;
+	log_binary_records = 0;
+
+	if(binary_mode) {
+		/* Not in append mode, so that the position of the last checkpoint can be written to the header. */
+		if(first_run) {
+			d->logfile = fopen(filename, "w");
+		} else {
+			d->logfile = fopen(filename, "r+");
+		}
+		if(!d->logfile) {
+			fprintf(stderr, "makeflow: couldn't open logfile %s: %s\n", filename, strerror(errno));
+			exit(1);
+		}
+		if(first_run) {
+			if(!makeflow_log_binary_write_header(d->logfile)) {
+				fprintf(stderr, "makeflow: couldn't write logfile %s: %s\n", filename, strerror(errno));
+				exit(1);
+			}
+		} else if(ftruncate(fileno(d->logfile), binary_end) < 0 || fseeko(d->logfile, binary_end, SEEK_SET) < 0) {
+			fprintf(stderr, "makeflow: couldn't append to logfile %s: %s\n", filename, strerror(errno));
+			exit(1);
+		}
+	} else {
+		d->logfile = fopen(filename, "a");
+		if(!d->logfile) {
+			fprintf(stderr, "makeflow: couldn't open logfile %s: %s\n", filename, strerror(errno));
+			exit(1);
+		}
+		if(setvbuf(d->logfile, NULL, _IOLBF, BUFSIZ) != 0) {
+			fprintf(stderr, "makeflow: couldn't set line buffer on logfile %s: %s\n", filename, strerror(errno));
+			exit(1);
+		}
 	}
 
 	if(first_run && verbose_mode) {
@@ -33,10 +33,12 @@ void makeflow_log_dag_file_list_state_change( struct dag *d, struct list *fl, in
 void makeflow_log_batch_file_list_state_change( struct dag *d, struct list *fl, int newstate );
 void makeflow_log_alloc_event( struct dag *d, struct makeflow_alloc *alloc );
 void makeflow_log_gc_event( struct dag *d, int collected, timestamp_t elapsed, int total_collected );
+void makeflow_log_rate_event( struct dag *d, int completed, timestamp_t elapsed, int total_completed );
 void makeflow_log_close(struct dag *d );
 
 /* return 0 on success, return non-zero on failure. */
-int makeflow_log_recover( struct dag *d, const char *filename, int verbose_mode, struct batch_queue *queue, makeflow_clean_depth clean_mode );
+/* A new log is written in binary form if binary_mode is set, but an existing log is always continued in its own form. */
+int makeflow_log_recover( struct dag *d, const char *filename, int verbose_mode, int binary_mode, struct batch_queue *queue, makeflow_clean_depth clean_mode );
 
 /* write the info of a dependency specified in the mountfile into the logging system
  * @param d: a dag structure
@@ -0,0 +1,315 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "makeflow_log_binary.h"
+
+#include "xxmalloc.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+The log is a header followed by records.  Each record is one byte giving
+its type, the length of its body, and the body, so that a reader can tell
+a record that was cut short by a crash, and pass over a type that it does
+not know.  The length and all numbers in the body are variable length
+integers, seven bits to a byte with the high bit set on all but the last,
+and signed numbers are first zigzag encoded.  The bodies are, in order:
+
+N time nodeid state jobid node_states[5] nodeid_counter
+F time state size filename
+L line
+K time completed_files deleted_files
+E time
+
+Names and lines fill the rest of the body, and are not terminated.
+Within a checkpoint, the time of a file is the time its creation was
+logged, or zero if it never was.
+The header is in the byte order of the writer, as with the other binary
+formats here.
+*/
+
+#define MAKEFLOW_LOG_BINARY_VERSION 1
+
+struct makeflow_log_binary_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t checkpoint;
+};
+
+/* Enough for the numbers of any record, which are at most ten bytes each. */
+#define MAKEFLOW_LOG_BINARY_NUMBERS_MAX 160
+
+int makeflow_log_binary_check( FILE *file, uint64_t *checkpoint )
+{
+	struct makeflow_log_binary_header header;
+
+	rewind(file);
+	if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, MAKEFLOW_LOG_BINARY_MAGIC, sizeof(header.magic))) {
+		rewind(file);
+		return 0;
+	}
+
+	*checkpoint = header.version == MAKEFLOW_LOG_BINARY_VERSION ? header.checkpoint : 0;
+	return 1;
+}
+
+int makeflow_log_binary_write_header( FILE *file )
+{
+	struct makeflow_log_binary_header header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAKEFLOW_LOG_BINARY_MAGIC, sizeof(header.magic));
+	header.version = MAKEFLOW_LOG_BINARY_VERSION;
+
+	return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+/* The numbers of a record are encoded into a buffer first, so that the length of the body can precede them. */
+
+struct record_buffer {
+	unsigned char data[MAKEFLOW_LOG_BINARY_NUMBERS_MAX];
+	size_t length;
+};
+
+static void put_unsigned( struct record_buffer *b, uint64_t value )
+{
+	while(value >= 0x80) {
+		b->data[b->length++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	b->data[b->length++] = value;
+}
+
+static void put_signed( struct record_buffer *b, int64_t value )
+{
+	put_unsigned(b, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+static int write_record( FILE *file, makeflow_log_record_t type, struct record_buffer *b, const char *text )
+{
+	struct record_buffer start;
+	size_t text_length = text ? strlen(text) : 0;
+
+	start.length = 0;
+	start.data[start.length++] = type;
+	put_unsigned(&start, b->length + text_length);
+
+	return fwrite(start.data, start.length, 1, file) == 1
+		&& (b->length == 0 || fwrite(b->data, b->length, 1, file) == 1)
+		&& (text_length == 0 || fwrite(text, text_length, 1, file) == 1);
+}
+
+int makeflow_log_binary_write_node( FILE *file, timestamp_t time, int nodeid, int state, int64_t jobid, const int *node_states, int nodeid_counter )
+{
+	struct record_buffer b;
+	int i;
+
+	b.length = 0;
+	put_unsigned(&b, time);
+	put_signed(&b, nodeid);
+	put_signed(&b, state);
+	put_signed(&b, jobid);
+	for(i = 0; i < MAKEFLOW_LOG_RECORD_STATES; i++) {
+		put_signed(&b, node_states[i]);
+	}
+	put_signed(&b, nodeid_counter);
+
+	return write_record(file, MAKEFLOW_LOG_RECORD_NODE, &b, 0);
+}
+
+int makeflow_log_binary_write_file( FILE *file, timestamp_t time, const char *filename, int state, uint64_t size )
+{
+	struct record_buffer b;
+
+	b.length = 0;
+	put_unsigned(&b, time);
+	put_signed(&b, state);
+	put_unsigned(&b, size);
+
+	return write_record(file, MAKEFLOW_LOG_RECORD_FILE, &b, filename);
+}
+
+int makeflow_log_binary_write_line( FILE *file, const char *line )
+{
+	struct record_buffer b;
+
+	b.length = 0;
+
+	return write_record(file, MAKEFLOW_LOG_RECORD_LINE, &b, line);
+}
+
+int makeflow_log_binary_write_checkpoint_begin( FILE *file, timestamp_t time, int completed_files, int deleted_files )
+{
+	struct record_buffer b;
+
+	b.length = 0;
+	put_unsigned(&b, time);
+	put_signed(&b, completed_files);
+	put_signed(&b, deleted_files);
+
+	return write_record(file, MAKEFLOW_LOG_RECORD_CHECKPOINT_BEGIN, &b, 0);
+}
+
+int makeflow_log_binary_write_checkpoint_end( FILE *file, uint64_t begin )
+{
+	struct record_buffer b;
+
+	b.length = 0;
+	put_unsigned(&b, timestamp_get());
+
+	int ok = write_record(file, MAKEFLOW_LOG_RECORD_CHECKPOINT_END, &b, 0);
+
+	/* The header may only point at a checkpoint that is entirely on disk. */
+	ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+
+	return ok && pwrite(fileno(file), &begin, sizeof(begin), offsetof(struct makeflow_log_binary_header, checkpoint)) == sizeof(begin);
+}
+
+/* Numbers are taken from the front of the body, failing if they run past its end. */
+
+struct record_reader {
+	const unsigned char *data;
+	size_t length;
+	size_t offset;
+	int ok;
+};
+
+static uint64_t get_unsigned( struct record_reader *r )
+{
+	uint64_t value = 0;
+	int shift = 0;
+
+	while(r->ok) {
+		if(r->offset >= r->length || shift > 63) {
+			r->ok = 0;
+			break;
+		}
+		unsigned char c = r->data[r->offset++];
+		value |= (uint64_t) (c & 0x7f) << shift;
+		if(!(c & 0x80)) break;
+		shift += 7;
+	}
+
+	return value;
+}
+
+static int64_t get_signed( struct record_reader *r )
+{
+	uint64_t value = get_unsigned(r);
+	return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+int makeflow_log_binary_read( FILE *file, struct makeflow_log_record *r )
+{
+	int type = fgetc(file);
+	if(type == EOF)
+		return 0;
+
+	uint64_t length = 0;
+	int shift = 0;
+	int c;
+
+	do {
+		c = fgetc(file);
+		if(c == EOF || shift > 63)
+			return -1;
+		length |= (uint64_t) (c & 0x7f) << shift;
+		shift += 7;
+	} while(c & 0x80);
+
+	if(!r->text || r->text_size < length + 1) {
+		/* A length that runs past the end of the log is corrupt, and must not be allocated. */
+		struct stat info;
+		off_t offset = ftello(file);
+		if(fstat(fileno(file), &info) < 0 || offset < 0 || length > (uint64_t) (info.st_size - offset))
+			return -1;
+
+		r->text_size = length + 1;
+		r->text = xxrealloc(r->text, r->text_size);
+	}
+
+	if(length > 0 && fread(r->text, length, 1, file) != 1)
+		return -1;
+
+	r->type = type;
+
+	struct record_reader reader;
+	reader.data = (const unsigned char *) r->text;
+	reader.length = length;
+	reader.offset = 0;
+	reader.ok = 1;
+
+	int i;
+
+	switch(r->type) {
+		case MAKEFLOW_LOG_RECORD_NODE:
+			r->time = get_unsigned(&reader);
+			r->nodeid = get_signed(&reader);
+			r->state = get_signed(&reader);
+			r->jobid = get_signed(&reader);
+			for(i = 0; i < MAKEFLOW_LOG_RECORD_STATES; i++) {
+				r->node_states[i] = get_signed(&reader);
+			}
+			r->nodeid_counter = get_signed(&reader);
+			break;
+		case MAKEFLOW_LOG_RECORD_FILE:
+			r->time = get_unsigned(&reader);
+			r->state = get_signed(&reader);
+			r->size = get_unsigned(&reader);
+			break;
+		case MAKEFLOW_LOG_RECORD_CHECKPOINT_BEGIN:
+			r->time = get_unsigned(&reader);
+			r->completed_files = get_signed(&reader);
+			r->deleted_files = get_signed(&reader);
+			break;
+		case MAKEFLOW_LOG_RECORD_CHECKPOINT_END:
+			r->time = get_unsigned(&reader);
+			break;
+		default:
+			break;
+	}
+
+	if(!reader.ok)
+		return -1;
+
+	/* What follows the numbers is the name or line, moved to the front as a string. */
+	memmove(r->text, r->text + reader.offset, length - reader.offset);
+	r->text[length - reader.offset] = 0;
+
+	return 1;
+}
+
+void makeflow_log_binary_print( FILE *out, const struct makeflow_log_record *r )
+{
+	switch(r->type) {
+		case MAKEFLOW_LOG_RECORD_NODE:
+			fprintf(out, "%" PRIu64 " %d %d %" PRId64 " %d %d %d %d %d %d\n", r->time, r->nodeid, r->state, r->jobid, r->node_states[0], r->node_states[1], r->node_states[2], r->node_states[3], r->node_states[4], r->nodeid_counter);
+			break;
+		case MAKEFLOW_LOG_RECORD_FILE:
+			fprintf(out, "# FILE %" PRIu64 " %s %d %" PRIu64 "\n", r->time, r->text, r->state, r->size);
+			break;
+		case MAKEFLOW_LOG_RECORD_LINE:
+			fprintf(out, "%s\n", r->text);
+			break;
+		default:
+			break;
+	}
+}
+
+void makeflow_log_record_free( struct makeflow_log_record *r )
+{
+	free(r->text);
+	r->text = 0;
+	r->text_size = 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,92 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef MAKEFLOW_LOG_BINARY_H
+#define MAKEFLOW_LOG_BINARY_H
+
+#include "timestamp.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+The binary makeflow log holds the same events as the text log, but each
+is a record that is written and read without formatting or parsing.  Node
+state changes and file state changes have records of their own, and every
+other event is kept as its text line.
+
+Periodically, makeflow writes a checkpoint: a group of records giving the
+state of every node and file that is not in its initial state, and once it
+is complete, its position is recorded in the header.  Recovery then reads
+only from the last checkpoint onwards, rather than the whole log.
+
+makeflow_log_convert turns a binary log back into the text log, leaving
+out the checkpoints, for the tools that read the text log.
+*/
+
+#define MAKEFLOW_LOG_BINARY_MAGIC "MFLOGBIN"
+
+typedef enum {
+	MAKEFLOW_LOG_RECORD_NODE = 'N',             /* A node changed state. */
+	MAKEFLOW_LOG_RECORD_FILE = 'F',             /* A file changed state. */
+	MAKEFLOW_LOG_RECORD_LINE = 'L',             /* Any other event, as its line in the text log. */
+	MAKEFLOW_LOG_RECORD_CHECKPOINT_BEGIN = 'K', /* The records that follow are a checkpoint. */
+	MAKEFLOW_LOG_RECORD_CHECKPOINT_END = 'E'    /* The checkpoint is complete. */
+} makeflow_log_record_t;
+
+#define MAKEFLOW_LOG_RECORD_STATES 5
+
+struct makeflow_log_record {
+	makeflow_log_record_t type;
+	timestamp_t time;
+
+	int nodeid;
+	int state;                                 /* New state of a node or file. */
+	int64_t jobid;
+	int node_states[MAKEFLOW_LOG_RECORD_STATES];/* Count of nodes in each state, after a node changed state. */
+	int nodeid_counter;
+
+	uint64_t size;                             /* Size of a file. */
+	int completed_files;                       /* Counters of the dag, at a checkpoint. */
+	int deleted_files;
+
+	char *text;                                /* Name of a file, or text of a line. */
+	size_t text_size;
+};
+
+/* Return true if the file begins with the header of a binary log, leaving the file after the header, and giving the position of the last checkpoint, or zero. */
+int makeflow_log_binary_check( FILE *file, uint64_t *checkpoint );
+
+/* Write the header of a new binary log. */
+int makeflow_log_binary_write_header( FILE *file );
+
+int makeflow_log_binary_write_node( FILE *file, timestamp_t time, int nodeid, int state, int64_t jobid, const int *node_states, int nodeid_counter );
+int makeflow_log_binary_write_file( FILE *file, timestamp_t time, const char *filename, int state, uint64_t size );
+int makeflow_log_binary_write_line( FILE *file, const char *line );
+int makeflow_log_binary_write_checkpoint_begin( FILE *file, timestamp_t time, int completed_files, int deleted_files );
+
+/*
+Finish the checkpoint that began at the given position, and once it is on
+disk, record that position in the header.  The file must not be in append
+mode, as the header is rewritten in place.
+*/
+int makeflow_log_binary_write_checkpoint_end( FILE *file, uint64_t begin );
+
+/*
+Read the next record.  Returns one if a record was read, zero at the end of
+the log, or -1 if the log ends in a record that was not completely written,
+or in one whose length runs past the end of the log.
+Records of unknown type are returned as they are, and should be ignored.
+*/
+int makeflow_log_binary_read( FILE *file, struct makeflow_log_record *r );
+
+/* Write a record as its line in the text log.  Checkpoint records have no text form, and are not written. */
+void makeflow_log_binary_print( FILE *out, const struct makeflow_log_record *r );
+
+/* Release the memory held by a record that was read. */
+void makeflow_log_record_free( struct makeflow_log_record *r );
+
+#endif
@@ -0,0 +1,160 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Convert a makeflow log written with --log-binary into the text log, for
+tools such as makeflow_monitor and makeflow_graph_log.  The checkpoints
+are left out, so that the result is the same as if the workflow had been
+run with a text log.  A text log is copied as it is.
+
+A reader that follows a growing log, as makeflow_monitor does, asks with
+--resume for the offset at which the records not yet converted begin, and
+gives it back with --start to convert only those the next time.
+*/
+
+#include "makeflow_log_binary.h"
+
+#include "cctools.h"
+#include "copy_stream.h"
+#include "getopt_aux.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void show_help(const char *cmd)
+{
+	fprintf(stdout, "Use: %s [options] <makeflowlog> [output]\n", cmd);
+	fprintf(stdout, "Writes the text form of a makeflow log to output, or to stdout.\n");
+	fprintf(stdout, "where options are:\n");
+	fprintf(stdout, " %-30s Start converting at this offset, as given by --resume.\n", "-s,--start=<offset>");
+	fprintf(stdout, " %-30s End with a line \"# OFFSET <offset>\" giving where to start next time.\n", "-r,--resume");
+	fprintf(stdout, " %-30s Show the version string.\n", "-v,--version");
+	fprintf(stdout, " %-30s Show this help screen.\n", "-h,--help");
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	int64_t start = 0;
+	int resume = 0;
+
+	static const struct option long_options[] = {
+		{"start", required_argument, 0, 's'},
+		{"resume", no_argument, 0, 'r'},
+		{"version", no_argument, 0, 'v'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while((c = getopt_long(argc, argv, "s:rvh", long_options, NULL)) > -1) {
+		switch(c) {
+			case 's':
+				start = strtoll(optarg, 0, 10);
+				break;
+			case 'r':
+				resume = 1;
+				break;
+			case 'v':
+				cctools_version_print(stdout, argv[0]);
+				return 0;
+			case 'h':
+				show_help(argv[0]);
+				return 0;
+			default:
+				show_help(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind < 1 || argc - optind > 2) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	const char *logname = argv[optind];
+	const char *outname = argv[optind + 1];
+
+	FILE *file = fopen(logname, "r");
+	if(!file) {
+		fprintf(stderr, "%s: couldn't open %s: %s\n", argv[0], logname, strerror(errno));
+		return 1;
+	}
+
+	FILE *out = stdout;
+	if(outname) {
+		out = fopen(outname, "w");
+		if(!out) {
+			fprintf(stderr, "%s: couldn't open %s: %s\n", argv[0], outname, strerror(errno));
+			return 1;
+		}
+	}
+
+	uint64_t checkpoint;
+	int64_t offset;
+
+	if(makeflow_log_binary_check(file, &checkpoint)) {
+		struct makeflow_log_record r;
+		int in_checkpoint = 0;
+		int status;
+
+		/* An offset given back by --resume is never within the header or a checkpoint. */
+		if(start > ftell(file) && fseek(file, start, SEEK_SET) != 0) {
+			fprintf(stderr, "%s: couldn't seek to %" PRId64 " in %s: %s\n", argv[0], start, logname, strerror(errno));
+			return 1;
+		}
+
+		/* A checkpoint not yet finished is converted again from its beginning the next time. */
+		offset = ftell(file);
+
+		memset(&r, 0, sizeof(r));
+
+		while((status = makeflow_log_binary_read(file, &r)) > 0) {
+			if(r.type == MAKEFLOW_LOG_RECORD_CHECKPOINT_BEGIN) {
+				in_checkpoint = 1;
+			} else if(r.type == MAKEFLOW_LOG_RECORD_CHECKPOINT_END) {
+				in_checkpoint = 0;
+			} else if(!in_checkpoint) {
+				makeflow_log_binary_print(out, &r);
+			}
+
+			if(!in_checkpoint) {
+				offset = ftell(file);
+			}
+		}
+
+		/* A record cut short is the last one written before a crash, and makeflow discards it as well. */
+		if(status < 0) {
+			fprintf(stderr, "%s: %s ends with an incomplete record.\n", argv[0], logname);
+		}
+
+		makeflow_log_record_free(&r);
+	} else {
+		if(start > 0 && fseek(file, start, SEEK_SET) != 0) {
+			fprintf(stderr, "%s: couldn't seek to %" PRId64 " in %s: %s\n", argv[0], start, logname, strerror(errno));
+			return 1;
+		}
+		copy_stream_to_stream(file, out);
+		offset = ftell(file);
+	}
+
+	fclose(file);
+
+	if(resume) {
+		fprintf(out, "# OFFSET %" PRId64 "\n", offset);
+	}
+
+	if(fclose(out) != 0) {
+		fprintf(stderr, "%s: couldn't write output: %s\n", argv[0], strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
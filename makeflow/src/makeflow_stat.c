@@ -0,0 +1,268 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "makeflow_stat.h"
+
+#include "debug.h"
+#include "hash_table.h"
+#include "macros.h"
+#include "xxmalloc.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Seconds between reports of progress. */
+#define MAKEFLOW_STAT_PROGRESS_INTERVAL 10
+
+/*
+The files in one directory, each given by its index into the array of
+stats, and the offset of its name within its path.
+*/
+
+struct stat_dir {
+	char *dirname;
+	int *members;
+	int *names;
+	int count;
+	int capacity;
+};
+
+struct stat_pool {
+	struct makeflow_stat *stats;
+	struct stat_dir **dirs;
+	int ndirs;
+	int next_dir;
+	int done;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static void stat_dir_add( struct stat_dir *dir, int member, int name )
+{
+	if(dir->count == dir->capacity) {
+		dir->capacity = MAX(dir->capacity * 2, 8);
+		dir->members = xxrealloc(dir->members, dir->capacity * sizeof(*dir->members));
+		dir->names = xxrealloc(dir->names, dir->capacity * sizeof(*dir->names));
+	}
+	dir->members[dir->count] = member;
+	dir->names[dir->count] = name;
+	dir->count++;
+}
+
+/*
+Find the directory of a path, and the offset of the name within it.
+A path without a directory is in the current directory.  A path ending
+in a slash has no name of its own, and gives -1, to be checked as it is.
+*/
+
+static char * split_path( const char *path, int *name )
+{
+	const char *slash = strrchr(path, '/');
+
+	if(!slash) {
+		*name = 0;
+		return xxstrdup(".");
+	}
+
+	if(!slash[1]) {
+		*name = -1;
+		return 0;
+	}
+
+	*name = slash - path + 1;
+
+	if(slash == path) {
+		return xxstrdup("/");
+	}
+
+	char *dirname = xxstrdup(path);
+	dirname[slash - path] = 0;
+	return dirname;
+}
+
+/*
+Check the files of one directory.  If the directory cannot be opened,
+perhaps for lack of permission to read it, each path is checked as it is,
+so that the results are just as stat would give.  Each name is looked up
+rather than found in a listing of the directory, as a filesystem that
+ignores case or normalizes names may find a file under a name other than
+the one it lists.
+*/
+
+static void stat_directory( struct stat_pool *p, struct stat_dir *dir )
+{
+	struct makeflow_stat *s;
+	int i;
+
+	int dirfd = open(dir->dirname, O_RDONLY | O_DIRECTORY);
+	if(dirfd < 0) {
+		for(i = 0; i < dir->count; i++) {
+			s = &p->stats[dir->members[i]];
+			s->result = stat(s->path, &s->buf);
+		}
+		return;
+	}
+
+	for(i = 0; i < dir->count; i++) {
+		s = &p->stats[dir->members[i]];
+		const char *name = s->path + dir->names[i];
+
+		s->result = fstatat(dirfd, name, &s->buf, 0);
+	}
+
+	close(dirfd);
+}
+
+static void * stat_worker( void *arg )
+{
+	struct stat_pool *p = arg;
+
+	while(1) {
+		pthread_mutex_lock(&p->mutex);
+		int i = p->next_dir++;
+		pthread_mutex_unlock(&p->mutex);
+
+		if(i >= p->ndirs) break;
+
+		stat_directory(p, p->dirs[i]);
+
+		pthread_mutex_lock(&p->mutex);
+		p->done += p->dirs[i]->count;
+		pthread_cond_signal(&p->cond);
+		pthread_mutex_unlock(&p->mutex);
+	}
+
+	return 0;
+}
+
+static void report_progress( int done, int count, time_t *last_report )
+{
+	time_t now = time(0);
+	if(now - *last_report >= MAKEFLOW_STAT_PROGRESS_INTERVAL) {
+		printf("checked %d of %d files...\n", done, count);
+		fflush(stdout);
+		*last_report = now;
+	}
+}
+
+static void stat_serial( struct batch_queue *queue, struct makeflow_stat *stats, int count )
+{
+	time_t last_report = time(0);
+	int i;
+
+	for(i = 0; i < count; i++) {
+		stats[i].result = batch_fs_stat(queue, stats[i].path, &stats[i].buf);
+		report_progress(i + 1, count, &last_report);
+	}
+}
+
+static void stat_parallel( struct makeflow_stat *stats, int count, int threads )
+{
+	struct stat_pool pool;
+	struct stat_pool *p = &pool;
+	struct hash_table *dirs_by_name = hash_table_create(0, 0);
+	struct stat_dir *dir;
+	char *dirname;
+	int name;
+	int i;
+
+	p->stats = stats;
+	p->dirs = xxmalloc(count * sizeof(*p->dirs));
+	p->ndirs = 0;
+	p->next_dir = 0;
+	p->done = 0;
+	pthread_mutex_init(&p->mutex, 0);
+	pthread_cond_init(&p->cond, 0);
+
+	for(i = 0; i < count; i++) {
+		dirname = split_path(stats[i].path, &name);
+		if(!dirname) {
+			stats[i].result = stat(stats[i].path, &stats[i].buf);
+			p->done++;
+			continue;
+		}
+
+		dir = hash_table_lookup(dirs_by_name, dirname);
+		if(!dir) {
+			dir = xxcalloc(1, sizeof(*dir));
+			dir->dirname = dirname;
+			hash_table_insert(dirs_by_name, dirname, dir);
+			p->dirs[p->ndirs++] = dir;
+		} else {
+			free(dirname);
+		}
+
+		stat_dir_add(dir, i, name);
+	}
+
+	threads = MAX(1, MIN(threads, p->ndirs));
+	pthread_t *tids = xxmalloc(threads * sizeof(*tids));
+
+	int started;
+	for(started = 0; started < threads; started++) {
+		int result = pthread_create(&tids[started], 0, stat_worker, p);
+		if(result != 0) {
+			debug(D_MAKEFLOW_RUN, "couldn't start file check thread: %s", strerror(result));
+			break;
+		}
+	}
+
+	debug(D_MAKEFLOW_RUN, "checking %d files in %d directories with %d threads", count, p->ndirs, started);
+
+	if(started == 0) {
+		stat_worker(p);
+	}
+
+	time_t last_report = time(0);
+
+	pthread_mutex_lock(&p->mutex);
+	while(p->done < count) {
+		struct timespec deadline;
+		deadline.tv_sec = time(0) + 1;
+		deadline.tv_nsec = 0;
+		pthread_cond_timedwait(&p->cond, &p->mutex, &deadline);
+		report_progress(p->done, count, &last_report);
+	}
+	pthread_mutex_unlock(&p->mutex);
+
+	for(i = 0; i < started; i++) {
+		pthread_join(tids[i], 0);
+	}
+
+	for(i = 0; i < p->ndirs; i++) {
+		dir = p->dirs[i];
+		free(dir->dirname);
+		free(dir->members);
+		free(dir->names);
+		free(dir);
+	}
+
+	free(tids);
+	free(p->dirs);
+	hash_table_delete(dirs_by_name);
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->cond);
+}
+
+void makeflow_stat_many( struct batch_queue *queue, struct makeflow_stat *stats, int count, int threads )
+{
+	if(count < 1) return;
+
+	/* Only a plain stat of the local filesystem may be divided among threads. */
+	if(batch_queue_supports_feature(queue, "local_fs_stat")) {
+		stat_parallel(stats, count, threads);
+	} else {
+		stat_serial(queue, stats, count);
+	}
+}
+
+/* vim: set noexpandtab tabstop=4: */
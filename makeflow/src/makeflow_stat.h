@@ -0,0 +1,38 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef MAKEFLOW_STAT_H
+#define MAKEFLOW_STAT_H
+
+#include "batch_job.h"
+
+#include <sys/stat.h>
+
+/*
+This module checks a large number of files at once, as when makeflow
+starts and verifies every file of the dag.  If the queue reads the local
+filesystem, the paths are grouped by directory, and the directories are
+divided among a bounded number of threads.  Each thread opens a directory
+once, and looks up each file relative to it with fstatat, so that the
+path of the directory is resolved once rather than for each file.
+Otherwise, each path is checked in turn with batch_fs_stat.
+*/
+
+struct makeflow_stat {
+	const char *path;   /* The path to check, which must remain valid until done. */
+	struct stat buf;    /* Filled in if the path exists. */
+	int result;         /* As returned by stat: zero if the path exists, or -1 if not. */
+};
+
+/*
+Check each of the paths with the equivalent of batch_fs_stat, using
+no more than the given number of threads, and reporting progress on the
+standard output if it takes a long time.
+*/
+
+void makeflow_stat_many( struct batch_queue *queue, struct makeflow_stat *stats, int count, int threads );
+
+#endif
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+test_output=`basename $0 .sh`.output
+
+# The workflow runs in a tmpfs of 512k mounted in a private namespace,
+# so that the space available is known.  With a threshold of 300k, space
+# runs low once the three intermediate files are complete, and deleting
+# the largest is then enough.  Space runs low again after the filler is
+# written, and the largest of the files left queued is deleted.
+
+check_needed()
+{
+	unshare -rm true > /dev/null 2>&1 || return 1
+	return 0
+}
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+cat > size.makeflow <<EOF
+MAKEFLOW_INPUTS=""
+MAKEFLOW_OUTPUTS="_size.out _size.filler"
+
+_size.small:
+	dd if=/dev/zero of=_size.small bs=1024 count=32
+
+_size.large:
+	dd if=/dev/zero of=_size.large bs=1024 count=160
+
+_size.medium:
+	dd if=/dev/zero of=_size.medium bs=1024 count=96
+
+_size.out: _size.small _size.large _size.medium
+	cat _size.small _size.large _size.medium | wc -c > _size.out
+
+_size.filler: _size.out
+	dd if=/dev/zero of=_size.filler bs=1024 count=128
+EOF
+cat > ../$test_output <<EOF
+deleted _size.large
+submitting job: dd if=/dev/zero of=_size.filler bs=1024 count=128
+deleted _size.medium
+_size.small
+EOF
+	exit 0
+}
+
+run()
+{
+	cd $test_dir
+	makeflow=`pwd`/makeflow
+	unshare -rm sh -c "mkdir -p mnt && mount -t tmpfs -o size=512k none mnt && cp size.makeflow mnt && cd mnt && $makeflow -g size --gc-size 300K -j 1 size.makeflow > ../makeflow.out 2>&1 && ls _size.small _size.large _size.medium >> ../makeflow.out 2>/dev/null"
+	grep "^deleted\|^submitting job: .*_size.filler\|^_size" makeflow.out > makeflow.result
+	exec diff -w ../$test_output makeflow.result
+}
+
+clean()
+{
+	rm -fr $test_dir $test_output
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
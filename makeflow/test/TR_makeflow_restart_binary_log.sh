@@ -0,0 +1,128 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+test_output=`basename $0 .sh`.output
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+	ln -sf ../../src/makeflow_log_convert .
+	echo "hello" > file.1
+
+	# A chain long enough that the log holds checkpoints, which stops at rule 200 while the file "fail" exists.
+	i=1
+	while [ $i -le 300 ]
+	do
+		if [ $i -eq 200 ]
+		then
+			check="test ! -f fail && "
+		else
+			check=""
+		fi
+		printf "file.%d: file.%d\n\t%scp file.%d file.%d\n\n" $((i+1)) $i "$check" $i $((i+1)) >> test.mf
+		i=$((i+1))
+	done
+
+	exit 0
+}
+
+run()
+{
+	cd $test_dir
+
+	echo "+++++ first run: should stop at rule 200 +++++"
+	touch fail
+	./makeflow --log-binary test.mf | tee output.1
+
+	if [ "`head -c 8 test.mf.makeflowlog`" != "MFLOGBIN" ]
+	then
+		echo "+++++ log is not binary +++++"
+		exit 1
+	fi
+
+	# Converted in two parts, as makeflow_monitor does while the log grows.
+	./makeflow_log_convert --resume test.mf.makeflowlog > part.1
+	offset=`awk '$1 == "#" && $2 == "OFFSET" {print $3}' part.1`
+
+	echo "+++++ second run: should recover from a checkpoint and run 101 rules +++++"
+	rm fail
+	./makeflow test.mf | tee output.2
+
+	if ! grep -q "recovering from checkpoint" output.2
+	then
+		exit 1
+	fi
+
+	count=`grep "submitted job" output.2 | wc -l`
+	echo "+++++ $count rules run +++++"
+
+	if [ $count -ne 101 ]
+	then
+		exit 1
+	fi
+
+	echo "+++++ converted log should show 300 rules complete +++++"
+	./makeflow_log_convert test.mf.makeflowlog > test.log
+
+	count=`awk '$1 != "#" && $3 == 2' test.log | wc -l`
+	echo "+++++ $count rules complete +++++"
+
+	if [ $count -ne 300 ]
+	then
+		exit 1
+	fi
+
+	if ! grep -q "^# COMPLETED" test.log
+	then
+		exit 1
+	fi
+
+	echo "+++++ log converted in two parts should be the same +++++"
+	./makeflow_log_convert --resume --start $offset test.mf.makeflowlog > part.2
+	cat part.1 part.2 | grep -v "^# OFFSET" > test.parts.log
+
+	if ! cmp test.log test.parts.log
+	then
+		exit 1
+	fi
+
+	echo "+++++ a record with a corrupt length should be discarded +++++"
+	printf '\003\200\200\200\200\200\200\200\200\001' >> test.mf.makeflowlog
+	./makeflow_log_convert test.mf.makeflowlog > test.corrupt.log 2> convert.err
+
+	if ! grep -q "incomplete record" convert.err || ! cmp test.log test.corrupt.log
+	then
+		exit 1
+	fi
+
+	./makeflow test.mf 2>&1 | tee output.3
+
+	if ! grep -q "incomplete record" output.3 || ! grep -q "nothing left to do" output.3
+	then
+		exit 1
+	fi
+
+	count=`./makeflow_log_convert test.mf.makeflowlog 2>&1 | awk '$1 != "#" && $3 == 2' | wc -l`
+	echo "+++++ $count rules complete +++++"
+
+	if [ $count -ne 300 ]
+	then
+		exit 1
+	fi
+
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir $test_output
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4: 
@@ -0,0 +1,62 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+test_output=`basename $0 .sh`.output
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+	mkdir out
+
+cat > test.jx << EOF2
+{
+	"rules" :
+	[
+		{
+			"command" : format("echo %d > out/file.%d",i,i),
+			"outputs" : [ "out/file."+i ]
+		} for i in range(0,200)
+	]
+}
+EOF2
+	exit 0
+}
+
+run()
+{
+	cd $test_dir
+
+	echo "+++++ first run: should make 200 files +++++"
+	./makeflow --jx test.jx > output.1 || exit 1
+
+	echo "+++++ deleting and changing files manually +++++"
+	rm out/file.17 out/file.150
+	sleep 2
+	touch out/file.42
+
+	echo "+++++ second run: should find 2 deleted and 1 modified +++++"
+	./makeflow --jx test.jx | tee output.2
+
+	grep "out/file.17 was previously created by makeflow, but someone else deleted it" output.2 || exit 1
+	grep "out/file.150 was previously created by makeflow, but someone else deleted it" output.2 || exit 1
+	grep "out/file.42 was previously created by makeflow, but someone else modified it" output.2 || exit 1
+	grep "found 0 errors and 3 warnings during consistency check" output.2 || exit 1
+
+	[ -f out/file.17 -a -f out/file.150 ] || exit 1
+
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir $test_output
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
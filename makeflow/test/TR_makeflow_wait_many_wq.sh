@@ -0,0 +1,65 @@
+#!/bin/sh
+
+# Test that makeflow collects the jobs that complete together in one wait,
+# rather than one per pass of its main loop.  The jobs all run at once on a
+# single worker and finish at the same time, so all but the first are
+# collected without waiting.
+
+. ../../dttools/test/test_runner_common.sh
+
+TEST_DIR=wait_many_wq.test.dir
+JOBS=8
+
+prepare()
+{
+	mkdir -p $TEST_DIR
+	cd $TEST_DIR
+
+	echo "MAKEFLOW_INPUTS=\"\"" > test.mf
+	echo "MAKEFLOW_OUTPUTS=\"\"" >> test.mf
+	echo "CORES=1" >> test.mf
+	echo "MEMORY=10" >> test.mf
+	echo "DISK=10" >> test.mf
+	i=0
+	while [ $i -lt $JOBS ]
+	do
+		printf "output.$i:\n\tsleep 2; echo $i > output.$i\n\n" >> test.mf
+		i=$((i+1))
+	done
+
+	exit 0
+}
+
+run()
+{
+	cd $TEST_DIR
+
+	../../src/makeflow -d all -o makeflow.debug -T wq -Z master.port test.mf &
+	pid=$!
+
+	wait_for_file_creation master.port 5
+
+	"$WORK_QUEUE_WORKER" --single-shot --timeout=10s --cores $JOBS --memory 250 --disk 250 -d all -o worker.log localhost $(cat master.port)
+
+	wait $pid || exit 1
+
+	i=0
+	while [ $i -lt $JOBS ]
+	do
+		[ -f output.$i ] || exit 1
+		i=$((i+1))
+	done
+
+	grep "jobs returned together" makeflow.debug
+	exit $?
+}
+
+clean()
+{
+	rm -rf ${TEST_DIR}
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
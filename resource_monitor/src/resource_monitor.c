@@ -118,6 +118,7 @@ See the file COPYING for details.
 #include <limits.h>
 
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <sys/resource.h>
 #include <sys/time.h>
@@ -152,6 +153,7 @@ See the file COPYING for details.
 #include "rmonitor.h"
 #include "rmonitor_poll_internal.h"
 #include "rmonitor_file_watch.h"
+#include "rmonitor_proc_events.h"
 
 #define RESOURCE_MONITOR_USE_INOTIFY 1
 #if defined(RESOURCE_MONITOR_USE_INOTIFY)
@@ -182,8 +184,19 @@ struct jx *verbatim_summary_fields; /* fields added to the summary without chang
 
 int    rmonitor_queue_fd = -1;  /* File descriptor of a datagram socket to which (great)
                                   grandchildren processes report to the monitor. */
+struct rmonitor_events *rmonitor_events = NULL; /* Rings in shared memory with the frequent messages
+                                                   from the (great) grandchildren processes. */
+static int use_events_rings = 1;
+static int use_proc_events  = 1;
 static int rmonitor_inotify_fd = -1;
 
+static int rmonitor_proc_events_fd = -1; /* Netlink socket with the fork and exit events of processes, or -1. */
+static int poll_for_children = 1;        /* Whether to look for untracked children in /proc in the next round. */
+static struct rmonitor_process_info exited_acc; /* Usage of processes between their last poll and their exit. */
+
+static int use_cgroup = 0;
+static struct rmonitor_cgroup_info *rmonitor_cgroup = NULL; /* cgroup v2 of the task, with --cgroup-accounting. */
+
 pid_t  first_process_pid;                 /* pid of the process given at the command line. */
 int    first_process_sigchild_status;     /* exit status flags of the process given at the command line */
 int    first_process_already_waited = 0;  /* exit status flags of the process given at the command line */
@@ -952,6 +965,12 @@ void rmonitor_collate_tree(struct rmsummary *tr, struct rmonitor_process_info *p
 	/* using .delta here because if we use .accumulated, then we lose information of processes that already terminated. */
 	tr->cpu_time  += p->cpu.delta;
 
+	/* the cgroup also accounts for processes we did not get to track. */
+	int cgroup_ok = rmonitor_cgroup && rmonitor_poll_cgroup_once(rmonitor_cgroup) == 0;
+	if(cgroup_ok) {
+		tr->cpu_time = MAX(tr->cpu_time, (int64_t) rmonitor_cgroup->cpu_time);
+	}
+
 	tr->start = summary->start;
 	tr->end   = usecs_since_epoch();
 
@@ -985,6 +1004,10 @@ void rmonitor_collate_tree(struct rmsummary *tr, struct rmonitor_process_info *p
 		tr->swap_memory       = (int64_t) p->mem.swap;
 	}
 
+	if(cgroup_ok) {
+		tr->memory = MAX(tr->memory, (int64_t) rmonitor_cgroup->memory_current);
+	}
+
 	tr->bytes_read        = (int64_t) (p->io.delta_chars_read + tr->bytes_read);
 	tr->bytes_read       += (int64_t)  p->io.delta_bytes_faulted;
 	tr->bytes_written     = (int64_t) (p->io.delta_chars_written + tr->bytes_written);
@@ -1360,6 +1383,61 @@ void rmonitor_untrack_process(uint64_t pid)
 		p->running = 0;
 }
 
+static int rmonitor_is_tracked(pid_t pid)
+{
+	struct rmonitor_process_info *p = itable_lookup(processes, pid);
+
+	return p && p->running;
+}
+
+/* From a fork event of a tracked process. */
+static int rmonitor_process_forked(pid_t pid)
+{
+	if(itable_lookup(processes, pid))
+		return 0;
+
+	if(rmonitor_track_process(pid))
+		return 1;
+
+	/* the child already exited, but it still counts as a process of the task. */
+	summary->total_processes++;
+
+	return 0;
+}
+
+/* From an exit event. The process is polled a last time, as it may still be
+ * read as a zombie, so that its usage since the last round is not lost. */
+static void rmonitor_process_exited(pid_t pid)
+{
+	struct rmonitor_process_info *p = itable_lookup(processes, pid);
+
+	if(!p)
+		return;
+
+	/* an exited process has no memory to report, but its final cpu time
+	 * and io are still readable, and their deltas are zero otherwise. */
+	rmonitor_poll_process_once(p);
+	acc_cpu_time_usage(&exited_acc.cpu, &p->cpu);
+	acc_sys_io_usage(&exited_acc.io, &p->io);
+
+	rmonitor_untrack_process(pid);
+}
+
+static void rmonitor_dispatch_proc_events(void)
+{
+	int status = rmonitor_proc_events_dispatch(rmonitor_proc_events_fd, rmonitor_is_tracked, rmonitor_process_forked, rmonitor_process_exited);
+
+	if(status < 0) {
+		rmonitor_proc_events_close(rmonitor_proc_events_fd);
+		rmonitor_proc_events_fd = -1;
+	}
+
+	/* events were lost, or are no longer available. */
+	if(status != 0) {
+		poll_for_children = 1;
+	}
+}
+
 void rmonitor_add_children_by_polling() {
 
 	uint64_t pid;
@@ -1398,14 +1476,20 @@ void cleanup_zombie(struct rmonitor_process_info *p)
     dec_wd_count(p->wd);
 
   itable_remove(processes, p->pid);
+  rmonitor_poll_process_close(p);
   free(p);
 }
 
+int rmonitor_dispatch_events(void);
+
 void cleanup_zombies(void)
 {
   uint64_t pid;
   struct rmonitor_process_info *p;
 
+  /* messages of the processes are accounted before they are forgotten. */
+  rmonitor_dispatch_events();
+
   itable_firstkey(processes);
   while(itable_nextkey(processes, &pid, (void **) &p))
     if(!p->running)
@@ -1588,6 +1672,16 @@ void cleanup_library() {
 	unlink(lib_helper_name);
 }
 
+void cleanup_events() {
+	rmonitor_events_delete(rmonitor_events);
+	rmonitor_events = NULL;
+}
+
+void cleanup_proc_events() {
+	rmonitor_proc_events_close(rmonitor_proc_events_fd);
+	rmonitor_proc_events_fd = -1;
+}
+
 //SIGINT, SIGQUIT, SIGTERM signal handler.
 void rmonitor_final_cleanup(int signum)
 {
@@ -1695,140 +1789,126 @@ void write_helper_lib(void)
 }
 
 /* return 1 if urgent message (wait, branch), 0 otherwise) */
-int rmonitor_dispatch_msg(void)
+int rmonitor_handle_msg(struct rmonitor_msg *msg)
 {
-	struct rmonitor_msg msg;
 	struct rmonitor_process_info *p;
 
-	int recv_status = recv_monitor_msg(rmonitor_queue_fd, &msg);
-
-	if(recv_status < 0) {
-		if(errno != EAGAIN) {
-			debug(D_RMON, "Error receiving message: %s", strerror(errno));
-			return 1;
-		}
-	}
-
-	if(((unsigned int) recv_status) < sizeof(msg)) {
-		debug(D_RMON, "Malformed message from monitored processes. Ignoring.");
-		return 1;
-	}
-
 	//Next line commented: Useful for detailed debugging, but too spammy for regular operations.
-	//debug(D_RMON,"message '%s' (%d) from %d with status '%s' (%d)\n", str_msgtype(msg.type), msg.type, msg.origin, strerror(msg.error), msg.error);
+	//debug(D_RMON,"message '%s' (%d) from %d with status '%s' (%d)\n", str_msgtype(msg->type), msg->type, msg->origin, strerror(msg->error), msg->error);
 
-	p = itable_lookup(processes, (uint64_t) msg.origin);
+	p = itable_lookup(processes, (uint64_t) msg->origin);
 
 	if(!p)
 	{
 		/* We either got a malformed message, message from a
 		process we are not tracking anymore, a message from
 		a newly created process, or a message from a snapshot process.  */
-		if( msg.type == END_WAIT )
+		if( msg->type == END_WAIT )
         {
-			release_waiting_process(msg.origin);
+			release_waiting_process(msg->origin);
 			return 1;
         }
-		else if(msg.type != BRANCH && msg.type != SNAPSHOT) {
+		else if(msg->type != BRANCH && msg->type != SNAPSHOT) {
 			return 1;
 		}
 	}
 
-    switch(msg.type)
+    switch(msg->type)
     {
         case BRANCH:
-			msg.error = 0;
-            rmonitor_track_process(msg.origin);
+			msg->error = 0;
+            rmonitor_track_process(msg->origin);
             if(summary->max_concurrent_processes < itable_size(processes)) {
                 summary->max_concurrent_processes = itable_size(processes);
 			}
             break;
         case END_WAIT:
-			msg.error = 0;
+			msg->error = 0;
             p->waiting = 1;
-			if(msg.origin == first_process_pid) {
-				first_process_exit_status = msg.data.n;
+			if(msg->origin == first_process_pid) {
+				first_process_exit_status = msg->data.n;
 			}
             break;
         case END:
-			msg.error = 0;
-            rmonitor_untrack_process(msg.origin);
+			msg->error = 0;
+            rmonitor_untrack_process(msg->origin);
             break;
         case CHDIR:
-			msg.error = 0;
+			msg->error = 0;
 			if(follow_chdir) {
-				p->wd = lookup_or_create_wd(p->wd, msg.data.s);
+				p->wd = lookup_or_create_wd(p->wd, msg->data.s);
 			}
             break;
 		case OPEN_INPUT:
 		case OPEN_OUTPUT:
-			switch(msg.error) {
+			switch(msg->error) {
 				case 0:
-					debug(D_RMON, "File %s has been opened.\n", msg.data.s);
+					debug(D_RMON, "File %s has been opened.\n", msg->data.s);
 					if(log_inotify) {
-						rmonitor_add_file_watch(msg.data.s, msg.type == OPEN_OUTPUT, 0);
+						rmonitor_add_file_watch(msg->data.s, msg->type == OPEN_OUTPUT, 0);
 					}
 					break;
 				case EMFILE:
 					/* Eventually report that we ran out of file descriptors. */
-					debug(D_RMON, "Process %d ran out of file descriptors.\n", msg.origin);
+					debug(D_RMON, "Process %d ran out of file descriptors.\n", msg->origin);
 					break;
 				default:
 					/* Clear the error, as it is not related to resources. */
-					msg.error = 0;
+					msg->error = 0;
 					break;
 			}
 			break;
 		case RX:
-			msg.error = 0;
-			if(msg.data.n > 0) {
-				total_bytes_rx += msg.data.n;
-				append_network_bw(&msg);
+			msg->error = 0;
+			if(msg->data.n > 0) {
+				total_bytes_rx += msg->data.n;
+				append_network_bw(msg);
 			}
 			break;
 		case TX:
-			msg.error = 0;
-			if(msg.data.n > 0) {
-				total_bytes_tx += msg.data.n;
-				append_network_bw(&msg);
+			msg->error = 0;
+			if(msg->data.n > 0) {
+				total_bytes_tx += msg->data.n;
+				append_network_bw(msg);
 			}
 			break;
         case READ:
-			msg.error = 0;
+			msg->error = 0;
 			break;
         case WRITE:
-			switch(msg.error) {
+			switch(msg->error) {
 				case ENOSPC:
 					/* Eventually report that we ran out of space. */
-					debug(D_RMON, "Process %d ran out of disk space.\n", msg.origin);
+					debug(D_RMON, "Process %d ran out of disk space.\n", msg->origin);
 					break;
 				default:
 					/* Clear the error, as it is not related to resources. */
-					msg.error = 0;
+					msg->error = 0;
 					break;
 			}
             break;
 		case SNAPSHOT:
-			debug(D_RMON, "Snapshot msg label: '%s'\n", msg.data.s);
-			list_push_tail(snapshot_labels, xxstrdup(msg.data.s));
+			debug(D_RMON, "Snapshot msg label: '%s'\n", msg->data.s);
+			list_push_tail(snapshot_labels, xxstrdup(msg->data.s));
+			break;
+		case EVENTS:
+			/* the ring of the process is read after dispatching the datagram. */
+			msg->error = 0;
 			break;
         default:
             break;
     };
 
-	summary->last_error = msg.error;
-
-	if(!rmsummary_check_limits(summary, resources_limits))
-		rmonitor_final_cleanup(SIGTERM);
+	summary->last_error = msg->error;
 
 	// find out if messages are urgent:
-	if(msg.type == SNAPSHOT) {
+	if(msg->type == SNAPSHOT) {
 		// SNAPSHOTs are always urgent
 		return 1;
 	}
 
-	if(msg.type == END_WAIT || msg.type == END) {
-		if(msg.origin == first_process_pid) {
+	if(msg->type == END_WAIT || msg->type == END) {
+		if(msg->origin == first_process_pid) {
 			// ENDs from the first process are always urgent.
 			return 1;
 		}
@@ -1838,7 +1918,7 @@ int rmonitor_dispatch_msg(void)
 			return 1;
 		}
 
-		if(msg.end < (msg.start + RESOURCE_MONITOR_SHORT_TIME)) {
+		if(msg->end < (msg->start + RESOURCE_MONITOR_SHORT_TIME)) {
 			// for short running processes END_WAIT and END are not urgent.
 			return 0;
 		}
@@ -1851,6 +1931,81 @@ int rmonitor_dispatch_msg(void)
 	return 0;
 }
 
+/* return 1 if urgent message (wait, branch), 0 otherwise) */
+int rmonitor_dispatch_msg(void)
+{
+	struct rmonitor_msg msg;
+
+	int recv_status = recv_monitor_msg(rmonitor_queue_fd, &msg);
+
+	if(recv_status < 0) {
+		if(errno != EAGAIN) {
+			debug(D_RMON, "Error receiving message: %s", strerror(errno));
+			return 1;
+		}
+	}
+
+	if(((unsigned int) recv_status) < sizeof(msg)) {
+		debug(D_RMON, "Malformed message from monitored processes. Ignoring.");
+		return 1;
+	}
+
+	int urgent = rmonitor_handle_msg(&msg);
+
+	if(!rmsummary_check_limits(summary, resources_limits))
+		rmonitor_final_cleanup(SIGTERM);
+
+	return urgent;
+}
+
+/* return 1 if a datagram is waiting to be dispatched, 0 otherwise. */
+int rmonitor_pending_msg(void)
+{
+	char c;
+	return recv(rmonitor_queue_fd, &c, sizeof(c), MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
+/* Dispatch the messages in the rings of the processes. Limits are checked
+ * once for all the messages read. Return 1 if any message was urgent, 0
+ * otherwise. */
+int rmonitor_dispatch_events(void)
+{
+	struct rmonitor_msg msg;
+
+	if(!rmonitor_events)
+		return 0;
+
+	int urgent = 0;
+	int count  = 0;
+
+	int i;
+	for(i = 0; i < RMONITOR_EVENTS_RINGS; i++) {
+		pid_t owner = rmonitor_events_owner(rmonitor_events, i);
+		if(!owner)
+			continue;
+
+		while(rmonitor_events_peek(rmonitor_events, i, &msg)) {
+			/* A new process sends its BRANCH as a datagram before writing to
+			 * its ring. If the datagram has not been dispatched, we leave the
+			 * message in the ring for later. */
+			if(!itable_lookup(processes, msg.origin) && rmonitor_pending_msg())
+				break;
+
+			rmonitor_events_pop(rmonitor_events, i);
+			urgent |= rmonitor_handle_msg(&msg);
+			count++;
+		}
+
+		if(!ping_process(owner))
+			rmonitor_events_release(rmonitor_events, i);
+	}
+
+	if(count > 0 && !rmsummary_check_limits(summary, resources_limits))
+		rmonitor_final_cleanup(SIGTERM);
+
+	return urgent;
+}
+
 int wait_for_messages(int interval)
 {
 	struct timeval timeout;
@@ -1861,7 +2016,7 @@ int wait_for_messages(int interval)
 
 	//If grandchildren processes cannot talk to us, simply wait.
 	//Else, wait, and check socket for messages.
-	if (rmonitor_queue_fd < 0)
+	if (rmonitor_queue_fd < 0 && rmonitor_proc_events_fd < 0)
 	{
 		/* wait for interval. */
 		select(1, NULL, NULL, NULL, &timeout);
@@ -1870,7 +2025,7 @@ int wait_for_messages(int interval)
 	{
 
 		/* Figure out the number of file descriptors to pass to select */
-		int nfds = 1 + MAX(rmonitor_queue_fd, rmonitor_inotify_fd);
+		int nfds = 1 + MAX(rmonitor_proc_events_fd, MAX(rmonitor_queue_fd, rmonitor_inotify_fd));
 		fd_set rset;
 
 		int urgent = 0;
@@ -1886,16 +2041,26 @@ int wait_for_messages(int interval)
 				FD_SET(rmonitor_inotify_fd, &rset);
 			}
 
+			if (rmonitor_proc_events_fd > 0) {
+				FD_SET(rmonitor_proc_events_fd, &rset);
+			}
+
 			count = select(nfds, &rset, NULL, NULL, &timeout);
 
-			if (FD_ISSET(rmonitor_queue_fd, &rset)) {
+			if (rmonitor_proc_events_fd > 0 && FD_ISSET(rmonitor_proc_events_fd, &rset)) {
+				rmonitor_dispatch_proc_events();
+			}
+
+			if (rmonitor_queue_fd > 0 && FD_ISSET(rmonitor_queue_fd, &rset)) {
 				urgent |= rmonitor_dispatch_msg();
 			}
 
-			if (FD_ISSET(rmonitor_inotify_fd, &rset)) {
+			if (rmonitor_inotify_fd > 0 && FD_ISSET(rmonitor_inotify_fd, &rset)) {
 				urgent |= rmonitor_handle_inotify();
 			}
 
+			urgent |= rmonitor_dispatch_events();
+
 			if(urgent) {
 				timeout.tv_sec  = 0;
 				timeout.tv_usec = 0;
@@ -2035,6 +2200,10 @@ static void show_help(const char *cmd)
     fprintf(stdout, "%-30s Maximum interval between observations, in seconds. (default=%d)\n", "-i,--interval=<n>", DEFAULT_INTERVAL);
     fprintf(stdout, "%-30s Track <pid> instead of executing a command line (warning: less precise measurements).\n", "--pid=<pid>");
     fprintf(stdout, "%-30s Accurately measure short running processes (adds overhead).\n", "--accurate-short-processes");
+    fprintf(stdout, "%-30s Send every message from the monitored processes as a datagram (adds overhead).\n", "--no-events-rings");
+    fprintf(stdout, "%-30s Find children by polling /proc, rather than from fork events.\n", "--no-proc-events");
+    fprintf(stdout, "%-30s Also measure memory and cpu time from the cgroup v2 of the command,\n", "--cgroup-accounting");
+    fprintf(stdout, "%-30s if it is not the cgroup of the monitor.\n", "");
     fprintf(stdout, "%-30s Read command line from <str>, and execute as '/bin/sh -c <str>'\n", "-c,--sh=<str>");
     fprintf(stdout, "\n");
     fprintf(stdout, "%-30s Use maxfile with list of var: value pairs for resource limits.\n", "-l,--limits-file=<maxfile>");
@@ -2094,6 +2263,10 @@ int rmonitor_resources(long int interval /*in seconds */)
 		rmonitor_poll_all_processes_once(processes, p_acc);
 		rmonitor_poll_maps_once(processes, m_acc);
 
+		acc_cpu_time_usage(&p_acc->cpu, &exited_acc.cpu);
+		acc_sys_io_usage(&p_acc->io, &exited_acc.io);
+		bzero(&exited_acc, sizeof(exited_acc));
+
 		if(resources_flags->disk) {
 			rmonitor_poll_all_wds_once(wdirs, d_acc, MAX(1, interval/(MAX(1, hash_table_size(wdirs)))));
 		}
@@ -2105,6 +2278,10 @@ int rmonitor_resources(long int interval /*in seconds */)
 		rmonitor_find_max_tree(snapshot, resources_now);
 		rmonitor_log_row(resources_now);
 
+		if(rmonitor_cgroup) {
+			summary->memory = MAX(summary->memory, (int64_t) rmonitor_cgroup->memory_peak);
+		}
+
 		if(!rmsummary_check_limits(summary, resources_limits)) {
 			rmonitor_final_cleanup(SIGTERM);
 		}
@@ -2128,8 +2305,12 @@ int rmonitor_resources(long int interval /*in seconds */)
 		wait_for_messages(interval);
 
 		//if monitoring a static executable, this adds children missed by
-		//BRANCH messages.
-		rmonitor_add_children_by_polling();
+		//BRANCH messages. With process events, children are added as they
+		//fork, and polling is only needed if events were lost.
+		if(poll_for_children) {
+			rmonitor_add_children_by_polling();
+			poll_for_children = rmonitor_proc_events_fd < 0;
+		}
 
 
 		//cleanup processes which by terminating may have awaken
@@ -2208,6 +2389,9 @@ int main(int argc, char **argv) {
 		LONG_OPT_SNAPSHOT_FILE,
 		LONG_OPT_SNAPSHOT_WATCH_CONF,
 		LONG_OPT_STOP_SHORT_RUNNING,
+		LONG_OPT_NO_EVENTS_RINGS,
+		LONG_OPT_NO_PROC_EVENTS,
+		LONG_OPT_CGROUP_ACCOUNTING,
 		LONG_OPT_CATALOG_TASK_READABLE_NAME,
 		LONG_OPT_CATALOG_SERVER,
 		LONG_OPT_CATALOG_PROJECT,
@@ -2235,6 +2419,9 @@ int main(int argc, char **argv) {
 		    {"no-pprint",    no_argument,       0,  LONG_OPT_NO_PPRINT},
 
 		    {"accurate-short-processes", no_argument, 0, LONG_OPT_STOP_SHORT_RUNNING},
+		    {"no-events-rings",          no_argument, 0, LONG_OPT_NO_EVENTS_RINGS},
+		    {"no-proc-events",           no_argument, 0, LONG_OPT_NO_PROC_EVENTS},
+		    {"cgroup-accounting",        no_argument, 0, LONG_OPT_CGROUP_ACCOUNTING},
 
 		    {"with-output-files",      required_argument, 0,  'O'},
 		    {"with-time-series",       no_argument, 0, LONG_OPT_TIME_SERIES},
@@ -2326,6 +2513,15 @@ int main(int argc, char **argv) {
 			case LONG_OPT_STOP_SHORT_RUNNING:
 				stop_short_running = 1;
 				break;
+			case LONG_OPT_NO_EVENTS_RINGS:
+				use_events_rings = 0;
+				break;
+			case LONG_OPT_NO_PROC_EVENTS:
+				use_proc_events = 0;
+				break;
+			case LONG_OPT_CGROUP_ACCOUNTING:
+				use_cgroup = 1;
+				break;
 			case LONG_OPT_NO_PPRINT:
 				pprint_summaries = 0;
 				break;
@@ -2486,6 +2682,20 @@ int main(int argc, char **argv) {
     write_helper_lib();
     rmonitor_helper_init(lib_helper_name, &rmonitor_queue_fd, stop_short_running);
 
+	if(rmonitor_queue_fd > -1 && use_events_rings) {
+		rmonitor_events = rmonitor_events_create();
+		if(rmonitor_events) {
+			atexit(cleanup_events);
+		}
+	}
+
+	if(use_proc_events) {
+		rmonitor_proc_events_fd = rmonitor_proc_events_open();
+		if(rmonitor_proc_events_fd > -1) {
+			atexit(cleanup_proc_events);
+		}
+	}
+
 	summary_path = default_summary_name(template_path);
 
     if(use_series)
@@ -2531,6 +2741,13 @@ int main(int argc, char **argv) {
 		spawn_first_process(executable, argv + optind, child_in_foreground);
 	}
 
+	if(use_cgroup) {
+		rmonitor_cgroup = rmonitor_cgroup_open(first_process_pid);
+		if(!rmonitor_cgroup) {
+			debug(D_NOTICE, "could not measure the cgroup of the command. Measuring its processes only.\n");
+		}
+	}
+
     rmonitor_resources(interval);
     rmonitor_final_cleanup(SIGTERM);
 
@@ -395,7 +395,7 @@ ssize_t write(int fd, const void *buf, size_t count)
 	END(msg)
 
 	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	send_monitor_event(&msg);
 
 	return real_count;
 }
@@ -422,7 +422,7 @@ ssize_t read(int fd, void *buf, size_t count)
 	END(msg)
 
 	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	send_monitor_event(&msg);
 
 	return real_count;
 }
@@ -445,7 +445,7 @@ ssize_t recv(int fd, void *buf, size_t count, int flags)
 	END(msg)
 
 	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	send_monitor_event(&msg);
 
 	return real_count;
 }
@@ -468,7 +468,7 @@ ssize_t recvfrom(int fd, void *buf, size_t count, int flags, struct sockaddr *sr
 	END(msg)
 
 	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	send_monitor_event(&msg);
 
 	return real_count;
 }
@@ -491,7 +491,7 @@ ssize_t send(int fd, const void *buf, size_t count, int flags)
 	END(msg)
 
 	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	send_monitor_event(&msg);
 
 	return real_count;
 }
@@ -514,7 +514,7 @@ ssize_t sendmsg(int fd, const struct msghdr *mg, int flags)
 	END(msg)
 
 	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	send_monitor_event(&msg);
 
 	return real_count;
 }
@@ -538,7 +538,7 @@ ssize_t recvmsg(int fd, struct msghdr *mg, int flags)
 	END(msg)
 
 	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	send_monitor_event(&msg);
 
 	return real_count;
 }
@@ -0,0 +1,250 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Measures the overhead the helper library of resource_monitor adds to a task
+that does many small writes. The task writes to /dev/null, and sends and
+receives datagrams over the loopback interface, a given number of times. It
+is run without monitoring, under resource_monitor with the shared memory
+rings for its messages, and under resource_monitor sending each message as
+a datagram (--no-events-rings). For each mode, the time the task took, the
+overhead per operation, and the bytes sent accounted by the monitor are
+reported.
+*/
+
+#include "cctools.h"
+#include "jx.h"
+#include "jx_parse.h"
+#include "stringtools.h"
+#include "timestamp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char *monitor_exe = "./resource_monitor";
+static int operations = 100000;
+static int size       = 64;
+
+static void show_help(const char *cmd)
+{
+	printf("Usage: %s [options]\n", cmd);
+	printf("Where options are:\n");
+	printf("-n <n>     Number of writes, sends, and receives of the task. (default: %d)\n", operations);
+	printf("-s <n>     Size in bytes of each write, send, and receive. (default: %d)\n", size);
+	printf("-m <path>  resource_monitor executable. (default: %s)\n", monitor_exe);
+	printf("-h         Show this help screen.\n");
+}
+
+/* The monitored task. Writes the microseconds it took to result_path. */
+static int run_task(int n, int length, const char *result_path)
+{
+	char *buffer = calloc(1, length);
+
+	struct sockaddr_in addr;
+	socklen_t addr_length = sizeof(addr);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int in  = socket(AF_INET, SOCK_DGRAM, 0);
+	int out = socket(AF_INET, SOCK_DGRAM, 0);
+	int null = open("/dev/null", O_WRONLY);
+
+	if(in < 0 || out < 0 || null < 0
+		|| bind(in, (struct sockaddr *) &addr, sizeof(addr)) < 0
+		|| getsockname(in, (struct sockaddr *) &addr, &addr_length) < 0
+		|| connect(out, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "could not set up the task: %s\n", strerror(errno));
+		return 1;
+	}
+
+	timestamp_t start = timestamp_get();
+
+	int i;
+	for(i = 0; i < n; i++) {
+		if(write(null, buffer, length) != length
+			|| send(out, buffer, length, 0) != length
+			|| recv(in, buffer, length, 0) != length) {
+			fprintf(stderr, "task failed: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+
+	timestamp_t elapsed = timestamp_get() - start;
+
+	FILE *f = fopen(result_path, "w");
+	if(!f) {
+		return 1;
+	}
+
+	fprintf(f, "%" PRIu64 "\n", elapsed);
+	fclose(f);
+
+	free(buffer);
+
+	return 0;
+}
+
+/* Run the task as a child, under resource_monitor with the given options if
+ * not null. Returns the microseconds the task took, or -1 on error. */
+static int64_t run_mode(const char *self, const char *monitor_option, const char *tmpdir, double *bytes_sent)
+{
+	char *result_path   = string_format("%s/result", tmpdir);
+	char *template_path = string_format("%s/task", tmpdir);
+	char *summary_path  = string_format("%s/task.summary", tmpdir);
+	char *n_str         = string_format("%d", operations);
+	char *size_str      = string_format("%d", size);
+
+	unlink(result_path);
+	unlink(summary_path);
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		if(!monitor_option) {
+			execl(self, self, "-T", n_str, size_str, result_path, (char *) 0);
+		} else if(!*monitor_option) {
+			execl(monitor_exe, monitor_exe, "--no-pprint", "-O", template_path, "--", self, "-T", n_str, size_str, result_path, (char *) 0);
+		} else {
+			execl(monitor_exe, monitor_exe, monitor_option, "--no-pprint", "-O", template_path, "--", self, "-T", n_str, size_str, result_path, (char *) 0);
+		}
+		_exit(127);
+	}
+
+	int status;
+	waitpid(pid, &status, 0);
+
+	int64_t elapsed = -1;
+
+	FILE *f = fopen(result_path, "r");
+	if(f) {
+		if(fscanf(f, "%" SCNd64, &elapsed) != 1) {
+			elapsed = -1;
+		}
+		fclose(f);
+	}
+
+	*bytes_sent = -1;
+
+	struct jx *summary = jx_parse_file(summary_path);
+	if(summary) {
+		struct jx *sent = jx_lookup(summary, "bytes_sent");
+		if(jx_istype(sent, JX_ARRAY) && sent->u.items) {
+			struct jx *value = sent->u.items->value;
+			if(jx_istype(value, JX_DOUBLE)) {
+				*bytes_sent = value->u.double_value;
+			} else if(jx_istype(value, JX_INTEGER)) {
+				*bytes_sent = value->u.integer_value;
+			}
+		}
+		jx_delete(summary);
+	}
+
+	unlink(result_path);
+	unlink(summary_path);
+
+	free(result_path);
+	free(template_path);
+	free(summary_path);
+	free(n_str);
+	free(size_str);
+
+	return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc == 5 && !strcmp(argv[1], "-T")) {
+		return run_task(atoi(argv[2]), atoi(argv[3]), argv[4]);
+	}
+
+	int c;
+	while((c = getopt(argc, argv, "n:s:m:hv")) != -1) {
+		switch(c) {
+		case 'n':
+			operations = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'm':
+			monitor_exe = optarg;
+			break;
+		case 'v':
+			cctools_version_print(stdout, argv[0]);
+			return 0;
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if(operations < 1 || size < 1) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	char self[PATH_MAX];
+	if(!realpath(argv[0], self)) {
+		fprintf(stderr, "could not find %s: %s\n", argv[0], strerror(errno));
+		return 1;
+	}
+
+	char tmpdir[] = "rmonitor_helper_benchmark.XXXXXX";
+	if(!mkdtemp(tmpdir)) {
+		fprintf(stderr, "could not create temporary directory: %s\n", strerror(errno));
+		return 1;
+	}
+
+	const char *names[]   = { "none", "rings", "datagrams" };
+	const char *options[] = { NULL, "", "--no-events-rings" };
+
+	double expected = ((double) operations) * size / (1024 * 1024);
+	int64_t baseline = -1;
+
+	printf("%10s %12s %16s %14s %14s\n", "monitor", "task(s)", "overhead(us/op)", "sent(MB)", "accounted(MB)");
+
+	int i;
+	for(i = 0; i < 3; i++) {
+		double bytes_sent;
+		int64_t elapsed = run_mode(self, options[i], tmpdir, &bytes_sent);
+
+		if(elapsed < 0) {
+			printf("%10s failed\n", names[i]);
+			continue;
+		}
+
+		if(!options[i]) {
+			baseline = elapsed;
+			printf("%10s %12.3f %16s %14.3f %14s\n", names[i], elapsed / 1000000.0, "-", expected, "-");
+		} else {
+			/* each operation is a write, a send, and a receive. */
+			double overhead = baseline < 0 ? 0 : ((double) (elapsed - baseline)) / operations;
+			printf("%10s %12.3f %16.2f %14.3f %14.3f\n", names[i], elapsed / 1000000.0, overhead, expected, bytes_sent);
+		}
+	}
+
+	rmdir(tmpdir);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -16,9 +16,11 @@ See the file COPYING for details.
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <limits.h>
+#include <sched.h>
 
 #include "stringtools.h"
 #include "xxmalloc.h"
@@ -70,6 +72,9 @@ const char *str_msgtype(enum rmonitor_msg_type n)
 		case SNAPSHOT:
 			return "snapshot";
 			break;
+		case EVENTS:
+			return "events";
+			break;
 		default:
 			return "unknown";
 			break;
@@ -280,6 +285,286 @@ int rmonitor_helper_init(char *lib_default_path, int *fd, int stop_short_running
 	return port;
 }
 
+/* Message as stored in a ring. Only the frequent messages, which carry
+ * numbers and no paths, are sent through the rings. */
+struct rmonitor_event
+{
+	/* For the position of the event, its lap (the position without the
+	 * index in the ring) when free, lap + 1 when written, and the next lap
+	 * when read. Thus, a ring of zeros is empty. */
+	volatile uint64_t seq;
+	int32_t           type;
+	int32_t           origin;
+	int32_t           error;
+	int32_t           padding;
+	uint64_t          start;
+	uint64_t          end;
+	uint64_t          n;
+};
+
+/* Processes may have several threads, thus a ring has many writers (which
+ * reserve a position moving head forward), and one reader, the monitor. The
+ * counters are kept in different cache lines so that readers and writers do
+ * not contend for them. */
+struct rmonitor_events_ring
+{
+	volatile int32_t  owner;
+	char              padding_owner[60];
+	volatile uint64_t head;
+	char              padding_head[56];
+	volatile uint64_t tail;
+	char              padding_tail[56];
+	struct rmonitor_event events[RMONITOR_EVENTS_RING_SIZE];
+};
+
+struct rmonitor_events
+{
+	char *path;
+	int   fd;
+	struct rmonitor_events_ring *rings;
+};
+
+#define RMONITOR_EVENTS_BYTES (RMONITOR_EVENTS_RINGS * sizeof(struct rmonitor_events_ring))
+#define RING_FULL_WAITS 1000
+#define RING_LAP(pos) ((pos) & ~((uint64_t) RMONITOR_EVENTS_RING_SIZE - 1))
+
+static struct rmonitor_events_ring *rmonitor_events_attach(void)
+{
+	static int attempted = 0;
+	static struct rmonitor_events_ring *rings = NULL;
+
+	if(attempted)
+		return rings;
+
+	attempted = 1;
+
+	char *path = getenv(RESOURCE_MONITOR_EVENTS_ENV_VAR);
+	if(!path)
+		return NULL;
+
+	/* openat, as open is wrapped by the helper library. */
+	int fd = openat(AT_FDCWD, path, O_RDWR);
+	if(fd < 0) {
+		debug(D_RMON, "couldn't open events file %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	struct stat info;
+	if(fstat(fd, &info) == 0 && (size_t) info.st_size == RMONITOR_EVENTS_BYTES) {
+		void *m = mmap(NULL, RMONITOR_EVENTS_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(m != MAP_FAILED) {
+			rings = m;
+		}
+	}
+
+	/* the mapping remains after closing the file. */
+	close(fd);
+
+	return rings;
+}
+
+static struct rmonitor_events_ring *rmonitor_events_ring_of(pid_t pid)
+{
+	static struct rmonitor_events_ring *mine = NULL;
+	static pid_t unclaimed = 0;
+
+	/* a child inherits the ring of its parent, but not its ownership. */
+	if(mine && mine->owner == pid)
+		return mine;
+
+	if(unclaimed == pid)
+		return NULL;
+
+	struct rmonitor_events_ring *rings = rmonitor_events_attach();
+	if(!rings)
+		return NULL;
+
+	int i;
+	/* after an exec, the process keeps the ring it had. */
+	for(i = 0; i < RMONITOR_EVENTS_RINGS; i++) {
+		if(rings[i].owner == pid) {
+			mine = &rings[i];
+			return mine;
+		}
+	}
+
+	for(i = 0; i < RMONITOR_EVENTS_RINGS; i++) {
+		if(__sync_bool_compare_and_swap(&rings[i].owner, 0, pid)) {
+			mine = &rings[i];
+			return mine;
+		}
+	}
+
+	/* all rings are taken, this process sends datagrams. */
+	unclaimed = pid;
+
+	return NULL;
+}
+
+static void send_monitor_wakeup(pid_t origin, uint64_t waiting)
+{
+	struct rmonitor_msg msg;
+
+	msg.type   = EVENTS;
+	msg.origin = origin;
+	msg.error  = 0;
+	msg.data.n = waiting;
+
+	send_monitor_msg(&msg);
+}
+
+int send_monitor_event(struct rmonitor_msg *msg)
+{
+	struct rmonitor_events_ring *r = rmonitor_events_ring_of(msg->origin);
+
+	if(!r)
+		return send_monitor_msg(msg);
+
+	uint64_t pos = r->head;
+	struct rmonitor_event *e;
+	int waits = 0;
+
+	for(;;) {
+		e = &r->events[pos & (RMONITOR_EVENTS_RING_SIZE - 1)];
+
+		uint64_t seq = e->seq;
+		__sync_synchronize();
+
+		int64_t diff = (int64_t) (seq - RING_LAP(pos));
+		if(diff == 0) {
+			if(__sync_bool_compare_and_swap(&r->head, pos, pos + 1))
+				break;
+		} else if(diff < 0) {
+			/* ring is full. We wake up the monitor, and give it some time to
+			 * read the ring before sending the message as a datagram. */
+			if(waits == 0)
+				send_monitor_wakeup(msg->origin, pos - r->tail);
+
+			if(waits++ > RING_FULL_WAITS)
+				return send_monitor_msg(msg);
+
+			sched_yield();
+		}
+
+		pos = r->head;
+	}
+
+	e->type   = msg->type;
+	e->origin = msg->origin;
+	e->error  = msg->error;
+	e->start  = msg->start;
+	e->end    = msg->end;
+	e->n      = msg->data.n;
+
+	__sync_synchronize();
+	e->seq = RING_LAP(pos) + 1;
+
+	uint64_t waiting = pos + 1 - r->tail;
+	if(waiting % (RMONITOR_EVENTS_RING_SIZE / 4) == 0)
+		send_monitor_wakeup(msg->origin, waiting);
+
+	return sizeof(*msg);
+}
+
+struct rmonitor_events *rmonitor_events_create(void)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	if(!tmpdir)
+		tmpdir = "/tmp";
+
+	struct rmonitor_events *e = xxmalloc(sizeof(*e));
+	e->path = string_format("%s/rmonitor-events-XXXXXX", tmpdir);
+
+	e->fd = mkstemp(e->path);
+	if(e->fd < 0) {
+		debug(D_RMON, "couldn't create events file %s: %s\n", e->path, strerror(errno));
+		free(e->path);
+		free(e);
+		return NULL;
+	}
+
+	void *m = MAP_FAILED;
+	if(ftruncate(e->fd, RMONITOR_EVENTS_BYTES) == 0) {
+		m = mmap(NULL, RMONITOR_EVENTS_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, e->fd, 0);
+	}
+
+	if(m == MAP_FAILED) {
+		debug(D_RMON, "couldn't map events file %s: %s\n", e->path, strerror(errno));
+		close(e->fd);
+		unlink(e->path);
+		free(e->path);
+		free(e);
+		return NULL;
+	}
+
+	e->rings = m;
+
+	debug(D_RMON,"setting %s to %s\n", RESOURCE_MONITOR_EVENTS_ENV_VAR, e->path);
+	setenv(RESOURCE_MONITOR_EVENTS_ENV_VAR, e->path, 1);
+
+	return e;
+}
+
+pid_t rmonitor_events_owner(struct rmonitor_events *e, int ring)
+{
+	return e->rings[ring].owner;
+}
+
+int rmonitor_events_peek(struct rmonitor_events *e, int ring, struct rmonitor_msg *msg)
+{
+	struct rmonitor_events_ring *r = &e->rings[ring];
+	struct rmonitor_event *v = &r->events[r->tail & (RMONITOR_EVENTS_RING_SIZE - 1)];
+
+	uint64_t seq = v->seq;
+	__sync_synchronize();
+
+	/* empty, or the writer of the oldest message has not finished. */
+	if(seq != RING_LAP(r->tail) + 1)
+		return 0;
+
+	msg->type   = v->type;
+	msg->origin = v->origin;
+	msg->error  = v->error;
+	msg->start  = v->start;
+	msg->end    = v->end;
+	msg->data.n = v->n;
+
+	return 1;
+}
+
+void rmonitor_events_pop(struct rmonitor_events *e, int ring)
+{
+	struct rmonitor_events_ring *r = &e->rings[ring];
+	struct rmonitor_event *v = &r->events[r->tail & (RMONITOR_EVENTS_RING_SIZE - 1)];
+
+	__sync_synchronize();
+	v->seq = RING_LAP(r->tail) + RMONITOR_EVENTS_RING_SIZE;
+	r->tail++;
+}
+
+void rmonitor_events_release(struct rmonitor_events *e, int ring)
+{
+	struct rmonitor_events_ring *r = &e->rings[ring];
+
+	if(r->head != r->tail)
+		return;
+
+	r->owner = 0;
+}
+
+void rmonitor_events_delete(struct rmonitor_events *e)
+{
+	if(!e)
+		return;
+
+	munmap(e->rings, RMONITOR_EVENTS_BYTES);
+	close(e->fd);
+	unlink(e->path);
+
+	free(e->path);
+	free(e);
+}
+
 int send_monitor_msg(struct rmonitor_msg *msg)
 {
 	static int fd = -1;
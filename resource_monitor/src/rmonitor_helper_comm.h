@@ -5,6 +5,7 @@ See the file COPYING for details.
 */
 
 #include <inttypes.h>
+#include <sys/types.h>
 #include "timestamp.h"
 
 #ifndef RMONITOR_HELPER_COMM_H
@@ -15,11 +16,12 @@ See the file COPYING for details.
 #define RESOURCE_MONITOR_ROOT_PROCESS      "CCTOOLS_RESOURCE_ROOT_PROCESS"
 #define RESOURCE_MONITOR_PROCESS_START     "CCTOOLS_RESOURCE_PROCESS_START"
 #define RESOURCE_MONITOR_INFO_ENV_VAR      "CCTOOLS_RESOURCE_MONITOR_INFO"
+#define RESOURCE_MONITOR_EVENTS_ENV_VAR    "CCTOOLS_RESOURCE_MONITOR_EVENTS"
 
 // in useconds
 #define RESOURCE_MONITOR_SHORT_TIME      250000
 
-enum rmonitor_msg_type { BRANCH, WAIT, END_WAIT, END, CHDIR, OPEN_INPUT, OPEN_OUTPUT, READ, WRITE, RX, TX, SNAPSHOT };
+enum rmonitor_msg_type { BRANCH, WAIT, END_WAIT, END, CHDIR, OPEN_INPUT, OPEN_OUTPUT, READ, WRITE, RX, TX, SNAPSHOT, EVENTS };
 
 /* BRANCH: pid of parent
  * END:    pid of child that ended
@@ -31,6 +33,7 @@ enum rmonitor_msg_type { BRANCH, WAIT, END_WAIT, END, CHDIR, OPEN_INPUT, OPEN_OU
  * RX:     Number of bytes received.
  * TX:     Number of bytes sent.
  * SNAPSHOT: snapshot name
+ * EVENTS: Number of messages waiting in the ring of the process.
  */
 
 struct rmonitor_msg
@@ -47,6 +50,19 @@ struct rmonitor_msg
 	}                     data;
 };
 
+/* Frequent messages (READ, WRITE, RX, TX) are written to rings in a file
+ * shared by the monitor and the helper libraries, so that the monitored
+ * processes do not pay a sendto for each of their reads and writes. Each
+ * process claims a ring for itself on its first message, so that no locks
+ * are needed. Rare messages, and frequent messages that find their ring
+ * full, are sent as datagrams. As the monitor may be sleeping, a process
+ * sends an EVENTS datagram each time a quarter of its ring fills up. */
+
+#define RMONITOR_EVENTS_RINGS       64
+#define RMONITOR_EVENTS_RING_SIZE 1024 /* a power of 2 */
+
+struct rmonitor_events;
+
 int rmonitor_helper_init(char *path_from_cmdline, int *fd, int stop_short_running);
 
 const char *str_msgtype(enum rmonitor_msg_type n);
@@ -54,4 +70,22 @@ const char *str_msgtype(enum rmonitor_msg_type n);
 int send_monitor_msg(struct rmonitor_msg *msg);
 int recv_monitor_msg(int fd, struct rmonitor_msg *msg);
 
+/* Send a frequent message through the ring of the calling process, or as a datagram if not possible. */
+int send_monitor_event(struct rmonitor_msg *msg);
+
+/* Create the shared rings, and export their location to the helper libraries. */
+struct rmonitor_events *rmonitor_events_create(void);
+
+/* Read the oldest message of the ring owned by pid, if any. Returns 1 if a message was read, 0 otherwise. */
+int rmonitor_events_peek(struct rmonitor_events *e, int ring, struct rmonitor_msg *msg);
+void rmonitor_events_pop(struct rmonitor_events *e, int ring);
+
+/* Returns the pid that owns the ring, or 0 if the ring is free. */
+pid_t rmonitor_events_owner(struct rmonitor_events *e, int ring);
+
+/* Free an empty ring of a process that no longer exists. */
+void rmonitor_events_release(struct rmonitor_events *e, int ring);
+
+void rmonitor_events_delete(struct rmonitor_events *e);
+
 #endif
@@ -0,0 +1,223 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "rmonitor_proc_events.h"
+
+#include "debug.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(CCTOOLS_OPSYS_LINUX)
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#define PROC_EVENTS_BUFFER 8192
+
+/* Seconds to wait for the kernel to acknowledge the subscription. */
+#define PROC_EVENTS_ACK_TIMEOUT 1
+
+static int proc_events_subscribe(int fd, enum proc_cn_mcast_op op)
+{
+	char buffer[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+	memset(buffer, 0, sizeof(buffer));
+
+	struct nlmsghdr *nl = (struct nlmsghdr *) buffer;
+	nl->nlmsg_len  = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op));
+	nl->nlmsg_type = NLMSG_DONE;
+
+	struct cn_msg *cn = NLMSG_DATA(nl);
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len    = sizeof(enum proc_cn_mcast_op);
+
+	memcpy(cn->data, &op, sizeof(op));
+
+	return send(fd, nl, nl->nlmsg_len, 0) == (ssize_t) nl->nlmsg_len;
+}
+
+/* Read one datagram from the kernel. Returns the number of bytes read, 0 if
+ * it did not come from the kernel, and -1 on error. */
+static ssize_t proc_events_recv(int fd, char *buffer, size_t size)
+{
+	struct sockaddr_nl from;
+	socklen_t from_length = sizeof(from);
+
+	ssize_t n = recvfrom(fd, buffer, size, 0, (struct sockaddr *) &from, &from_length);
+	if(n < 0) {
+		return -1;
+	}
+
+	if(from.nl_pid != 0) {
+		return 0;
+	}
+
+	return n;
+}
+
+/* Wait for the acknowledgment of the subscription, which the kernel sends
+ * as an event of no type. Without CAP_NET_ADMIN it carries an error. */
+static int proc_events_wait_ack(int fd)
+{
+	char buffer[PROC_EVENTS_BUFFER];
+
+	struct timeval timeout;
+	timeout.tv_sec  = PROC_EVENTS_ACK_TIMEOUT;
+	timeout.tv_usec = 0;
+
+	if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+		return 0;
+	}
+
+	while(1) {
+		ssize_t n = proc_events_recv(fd, buffer, sizeof(buffer));
+		if(n < 0) {
+			return 0;
+		}
+
+		struct nlmsghdr *nl;
+		for(nl = (struct nlmsghdr *) buffer; NLMSG_OK(nl, (size_t) n); nl = NLMSG_NEXT(nl, n)) {
+			struct cn_msg *cn = NLMSG_DATA(nl);
+			if(cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC) {
+				continue;
+			}
+
+			struct proc_event *ev = (struct proc_event *) cn->data;
+			if(ev->what == PROC_EVENT_NONE) {
+				if(ev->event_data.ack.err != 0) {
+					errno = ev->event_data.ack.err;
+					return 0;
+				}
+				return 1;
+			}
+		}
+	}
+}
+
+int rmonitor_proc_events_open(void)
+{
+	int fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR);
+	if(fd < 0) {
+		debug(D_RMON, "could not open netlink connector: %s", strerror(errno));
+		return -1;
+	}
+
+	struct sockaddr_nl addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid    = 0;
+
+	if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+		|| !proc_events_subscribe(fd, PROC_CN_MCAST_LISTEN)
+		|| !proc_events_wait_ack(fd)) {
+		debug(D_RMON, "could not listen to process events: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	debug(D_RMON, "listening to process events.");
+
+	return fd;
+}
+
+int rmonitor_proc_events_dispatch(int fd, int (*is_tracked)(pid_t pid), int (*on_fork)(pid_t pid), void (*on_exit)(pid_t pid))
+{
+	char buffer[PROC_EVENTS_BUFFER];
+	int lost = 0;
+
+	while(1) {
+		ssize_t n = proc_events_recv(fd, buffer, sizeof(buffer));
+
+		if(n < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				break;
+			} else if(errno == ENOBUFS) {
+				debug(D_RMON, "process events were lost.");
+				lost = 1;
+				continue;
+			} else {
+				debug(D_RMON, "could not read process events: %s", strerror(errno));
+				return -1;
+			}
+		}
+
+		struct nlmsghdr *nl;
+		for(nl = (struct nlmsghdr *) buffer; NLMSG_OK(nl, (size_t) n); nl = NLMSG_NEXT(nl, n)) {
+			if(nl->nlmsg_type == NLMSG_ERROR || nl->nlmsg_type == NLMSG_NOOP) {
+				continue;
+			}
+
+			struct cn_msg *cn = NLMSG_DATA(nl);
+			if(cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC) {
+				continue;
+			}
+
+			struct proc_event *ev = (struct proc_event *) cn->data;
+
+			switch(ev->what) {
+				case PROC_EVENT_FORK:
+					/* threads have the tgid of the process that created them. */
+					if(ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid
+						&& is_tracked(ev->event_data.fork.parent_tgid)) {
+						if(on_fork(ev->event_data.fork.child_pid)) {
+							debug(D_RMON, "added by fork event pid %d", ev->event_data.fork.child_pid);
+						}
+					}
+					break;
+				case PROC_EVENT_EXIT:
+					if(ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid
+						&& is_tracked(ev->event_data.exit.process_pid)) {
+						on_exit(ev->event_data.exit.process_pid);
+					}
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	return lost;
+}
+
+void rmonitor_proc_events_close(int fd)
+{
+	if(fd < 0) {
+		return;
+	}
+
+	proc_events_subscribe(fd, PROC_CN_MCAST_IGNORE);
+	close(fd);
+}
+
+#else
+
+int rmonitor_proc_events_open(void)
+{
+	return -1;
+}
+
+int rmonitor_proc_events_dispatch(int fd, int (*is_tracked)(pid_t pid), int (*on_fork)(pid_t pid), void (*on_exit)(pid_t pid))
+{
+	return -1;
+}
+
+void rmonitor_proc_events_close(int fd)
+{
+}
+
+#endif
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,33 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef RMONITOR_PROC_EVENTS_H
+#define RMONITOR_PROC_EVENTS_H
+
+/*
+Fork and exit events of processes, from the netlink process connector of
+linux. With them, the monitor learns of children when they are created,
+rather than when the tree is polled, and so it does not miss short lived
+processes. Listening needs CAP_NET_ADMIN; when the connector cannot be used,
+rmonitor_proc_events_open returns -1 and the monitor keeps polling.
+*/
+
+#include <sys/types.h>
+
+/* Returns a descriptor to select on for events, or -1 if events are not available. */
+int rmonitor_proc_events_open(void);
+
+/* Read the pending events. A fork is reported with on_fork(child) if the
+ * parent is tracked, as given by is_tracked, and an exit with on_exit(pid).
+ * Returns 1 if events were lost, in which case the tree should be polled
+ * once, -1 if events are no longer available, and 0 otherwise. */
+int rmonitor_proc_events_dispatch(int fd, int (*is_tracked)(pid_t pid), int (*on_fork)(pid_t pid), void (*on_exit)(pid_t pid));
+
+void rmonitor_proc_events_close(int fd);
+
+#endif
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,69 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+# A cgroup v2 subtree of our own, in which the monitor and a busy sibling run.
+cgroup_root=/sys/fs/cgroup
+cgroup_test=$cgroup_root/rmonitor_cgroup_siblings.$$
+
+check_needed()
+{
+	[ -d /proc ] || exit 1
+
+	# needs a cgroup v2 with the memory controller, in which we may create cgroups.
+	grep -qw memory $cgroup_root/cgroup.controllers 2>/dev/null || exit 1
+	grep -qw memory $cgroup_root/cgroup.subtree_control 2>/dev/null || exit 1
+	mkdir $cgroup_test 2>/dev/null || exit 1
+	rmdir $cgroup_test
+
+	which perl > /dev/null 2>&1 || exit 1
+
+	exit 0
+}
+
+prepare()
+{
+	exit 0
+}
+
+run()
+{
+	mkdir $cgroup_test || exit 1
+	echo "+memory" > $cgroup_test/cgroup.subtree_control || exit 1
+	mkdir $cgroup_test/shared || exit 1
+
+	# The sibling holds about 300 MB for as long as the task runs.
+	sh -c "echo \$\$ > $cgroup_test/shared/cgroup.procs; exec perl -e '\$x = \"a\" x (300*1024*1024); sleep 20'" &
+	sibling=$!
+	sleep 2
+
+	# The monitor, and so the task, run in the same cgroup as the sibling.
+	sh -c "echo \$\$ > $cgroup_test/shared/cgroup.procs; exec ../src/resource_monitor -d rmonitor -o cgroup_siblings.debug --cgroup-accounting -O cgroup_siblings -- sleep 2"
+
+	memory=$(grep -A2 '^  "memory":' cgroup_siblings.summary | sed -n 3p | tr -dc 0-9)
+	echo "memory of the task: $memory MB"
+
+	status=0
+	if [ -z "$memory" ] || [ "$memory" -ge 100 ]
+	then
+		echo "the task was charged for the memory of its sibling"
+		cat cgroup_siblings.debug
+		status=1
+	fi
+
+	kill $sibling
+	wait $sibling
+
+	exit $status
+}
+
+clean()
+{
+	rmdir $cgroup_root/rmonitor_cgroup_siblings.*/shared $cgroup_root/rmonitor_cgroup_siblings.* 2>/dev/null
+	rm -f cgroup_siblings.*
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,51 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+check_needed()
+{
+	# do not run the test if not on linux.
+	[ -d /proc ] || exit 1
+
+	# exits are only seen as process events if the kernel sends them to us.
+	../src/resource_monitor -d rmonitor -o exit_events.probe -O exit_events.probe -- true > /dev/null 2>&1
+	grep -q "listening to process events" exit_events.probe
+	status=$?
+	rm -f exit_events.probe*
+	exit $status
+}
+
+prepare()
+{
+	exit 0
+}
+
+run()
+{
+	# The inner shell spins for about a second and kills itself, so the helper
+	# library does not see it exit, and its last cpu time is only read when its
+	# exit event arrives. The long interval keeps the monitor from polling it meanwhile.
+	../src/resource_monitor -d rmonitor -o exit_events.debug -i 30 --with-time-series -O exit_events -- \
+		sh -c "sh -c 'i=0; while [ \$i -lt 1000000 ]; do i=\$((i+1)); done; kill -9 \$\$'; sleep 1"
+
+	cpu_time=$(tail -n1 exit_events.series | awk '{print $2}')
+	echo "cpu time in last sample: $cpu_time us"
+
+	if [ -z "$cpu_time" ] || [ "$cpu_time" -lt 200000 ]
+	then
+		echo "cpu time of the process that exited was lost"
+		cat exit_events.debug
+		exit 1
+	fi
+
+	exit 0
+}
+
+clean()
+{
+	rm -f exit_events.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -1069,6 +1069,26 @@ Set the minimum timeout when sending a brief message to a foreman. (default=1h)
 
 Set the number of tasks considered when computing category buckets.
 
+=item "dispatch-batch-size"
+
+Set the maximum number of tasks sent to workers before checking again for results and messages from workers. (default=1000)
+
+=item "dispatch-batch-time"
+
+Set the maximum number of seconds spent sending tasks to workers before checking again for results and messages from workers. (default=1s)
+
+=item "content-addressed-cache"
+
+If set to 1, name cached input files at the workers by the md5 of their contents rather than by their local path, so that identical files are transferred and stored once, and files modified in place are sent again. (default=0)
+
+=item "peer-transfer-limit"
+
+Set the maximum number of cached input files a worker started with --peer-transfers sends at once to other workers, instead of the master sending them. 0 disables peer transfers. (default=3)
+
+=item "compress-threshold"
+
+Send input and output files of at least this many bytes compressed, when a probe of their first bytes shows that it pays. Applies to workers that connect afterwards. 0 disables compression. (default=0)
+
 =back
 
 =head3 C<specify_max_resources>
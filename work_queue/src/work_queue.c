@@ -8,6 +8,7 @@ See the file COPYING for details.
 #include "work_queue_protocol.h"
 #include "work_queue_internal.h"
 #include "work_queue_resources.h"
+#include "work_queue_compress.h"
 
 #include "cctools.h"
 #include "int_sizes.h"
@@ -22,6 +23,7 @@ See the file COPYING for details.
 #include "interfaces_address.h"
 #include "itable.h"
 #include "list.h"
+#include "set.h"
 #include "macros.h"
 #include "username.h"
 #include "create_dir.h"
@@ -33,6 +35,7 @@ See the file COPYING for details.
 #include "rmonitor_poll.h"
 #include "category_internal.h"
 #include "copy_stream.h"
+#include "full_io.h"
 #include "random.h"
 #include "process.h"
 #include "path.h"
@@ -128,6 +131,21 @@ int wq_option_scheduler = WORK_QUEUE_SCHEDULE_TIME;
 /* default timeout for slow workers to come back to the pool */
 double wq_option_blacklist_slow_workers_timeout = 900;
 
+/* Counts of tasks per state and allocation request. */
+struct task_counts {
+	int state[WORK_QUEUE_TASK_CANCELED + 1];
+	int request[CATEGORY_ALLOCATION_ERROR + 1];
+};
+
+struct task_entry {
+	struct work_queue_task *task;
+	work_queue_task_state_t state;
+	category_allocation_t request;
+	struct task_counts *counts;   // of the category of the task
+	struct task_entry *prev;
+	struct task_entry *next;
+};
+
 struct work_queue {
 	char *name;
 	int port;
@@ -139,20 +157,39 @@ struct work_queue {
 	char workingdir[PATH_MAX];
 
 	struct link      *master_link;   // incoming tcp connection for workers.
-	struct link_info *poll_table;
+	int master_link_ready;           // master link had activity in the last poll.
+	struct link_poller *poller;      // master link, foreman uplink, and worker links.
+	struct link_info *poll_table;    // links reported ready by the poller.
 	int poll_table_size;
 
 	struct itable *tasks;           // taskid -> task
 	struct itable *task_state_map;  // taskid -> state
-	struct list   *ready_list;      // ready to be sent to a worker
+	struct itable *task_entries;    // taskid -> struct task_entry, for each task in tasks
+	struct task_entry *task_state_heads[WORK_QUEUE_TASK_CANCELED + 1]; // tasks in each state, in order of arrival
+	struct task_entry *task_state_tails[WORK_QUEUE_TASK_CANCELED + 1];
+	struct task_counts *task_counts;              // counts of the tasks in tasks
+	struct hash_table *category_task_counts;      // category name -> struct task_counts
+	int check_task_index;                         // compare the index against all the tasks at every change of state, for testing.
+	struct hash_table *ready_shapes; // shape key -> struct ready_shape, tasks ready to be sent to a worker
+	struct itable *ready_tasks;      // taskid -> struct ready_task, for each task in ready_shapes
+	uint64_t ready_seq;              // order of insertion into the ready queue
+	uint64_t ready_epoch;            // shapes parked in an older epoch are considered again
+	int ready_with_deadline;         // ready tasks with an end time, which may expire
 
 	struct hash_table *worker_table;
 	struct hash_table *worker_blacklist;
 	struct itable  *worker_task_map;
 
+	struct itable *worker_index;        // free cores -> set of workers that may run tasks
+	uint64_t *worker_index_keys;        // keys of worker_index, in increasing order
+	int worker_index_keys_size;
+	int worker_index_keys_capacity;
+	int worker_index_coreless;          // indexed workers that report no cores at all
+
 	struct hash_table *categories;
 
 	struct hash_table *workers_with_available_results;
+	struct hash_table *workers_retrieving;   // workers sending back the outputs of a task
 
 	struct work_queue_stats *stats;
 	struct work_queue_stats *stats_measure;
@@ -163,6 +200,17 @@ struct work_queue {
 	int task_ordering;
 	int process_pending_check;
 
+	int dispatch_batch_size;        // max tasks sent per dispatch phase of work_queue_wait
+	double dispatch_batch_time;     // max seconds spent per dispatch phase of work_queue_wait
+
+	int content_addressed_cache;          // name cached input files by the md5 of their contents.
+	struct hash_table *content_digests;   // "dev:inode" -> struct content_digest of the last version read
+
+	int peer_transfer_limit;              // max concurrent transfers served by one worker to its peers, 0 disables.
+	int64_t compress_threshold;           // min size of files sent or received compressed, 0 disables.
+	struct hash_table *peer_transfers;    // "dest hashkey/cached name" -> hashkey of the source worker
+	struct hash_table *peer_sources;      // cached name -> set of workers holding the file
+
 	int short_timeout;		// timeout to send/recv a brief message from worker
 	int long_timeout;		// timeout to send/recv a brief message from a foreman
 
@@ -225,9 +273,16 @@ struct work_queue_worker {
 	char *workerid;
 
 	struct hash_table *current_files;
+	int transfer_port;                        // port of the worker's transfer server, or 0 if it has none
+	int compression;                          // file payloads may be compressed to and from this worker
+	int peer_transfers_active;                // transfers currently served by this worker to its peers
+	struct hash_table *peer_failed_files;     // cached names this worker could not fetch from a peer
+	struct work_queue_retrieval *retrieval;   // outputs being sent back by the worker, if any
 	struct link *link;
 	struct itable *current_tasks;
 	struct itable *current_tasks_boxes;
+	int64_t index_key;                        // bucket of q->worker_index this worker is in, or -1
+	int index_coreless;
 	int finished_tasks;
 	int64_t total_tasks_complete;
 	int64_t total_bytes_transferred;
@@ -264,11 +319,18 @@ static void commit_task_to_worker(struct work_queue *q, struct work_queue_worker
 static void reap_task_from_worker(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, work_queue_task_state_t new_state);
 static int cancel_task_on_worker(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state);
 static void count_worker_resources(struct work_queue *q, struct work_queue_worker *w);
+static void worker_index_remove(struct work_queue *q, struct work_queue_worker *w);
 
 static void find_max_worker(struct work_queue *q);
 static void update_max_worker(struct work_queue *q, struct work_queue_worker *w);
 
 static void push_task_to_ready_list( struct work_queue *q, struct work_queue_task *t );
+static void ready_queue_remove(struct work_queue *q, struct work_queue_task *t);
+static void ready_queue_delete(struct work_queue *q);
+
+static void task_index_delete(struct work_queue *q);
+
+static void retrieval_delete(struct work_queue_retrieval *r);
 
 /* returns old state */
 static work_queue_task_state_t change_task_state( struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state);
@@ -294,6 +356,8 @@ static work_queue_msg_code_t process_workqueue(struct work_queue *q, struct work
 static work_queue_msg_code_t process_queue_status(struct work_queue *q, struct work_queue_worker *w, const char *line, time_t stoptime);
 static work_queue_msg_code_t process_resource(struct work_queue *q, struct work_queue_worker *w, const char *line);
 static work_queue_msg_code_t process_feature(struct work_queue *q, struct work_queue_worker *w, const char *line);
+static work_queue_msg_code_t process_peerget_complete(struct work_queue *q, struct work_queue_worker *w, const char *line);
+static void cancel_peer_transfers(struct work_queue *q, struct work_queue_worker *w);
 
 static struct jx * queue_to_jx( struct work_queue *q, struct link *foreman_uplink );
 static struct jx * queue_lean_to_jx( struct work_queue *q, struct link *foreman_uplink );
@@ -311,6 +375,7 @@ static void write_transaction_task(struct work_queue *q, struct work_queue_task
 static void write_transaction_category(struct work_queue *q, struct category *c);
 static void write_transaction_worker(struct work_queue *q, struct work_queue_worker *w, int leaving, worker_disconnect_reason reason_leaving);
 static void write_transaction_worker_resources(struct work_queue *q, struct work_queue_worker *w);
+static void write_transaction_transfer(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *direction, const char *name, struct work_queue_compress_stats *s);
 
 /** Clone a @ref work_queue_file
 This performs a deep copy of the file struct.
@@ -600,6 +665,13 @@ work_queue_msg_code_t process_info(struct work_queue *q, struct work_queue_worke
 		free(w->workerid);
 		w->workerid = xxstrdup(value);
 		write_transaction_worker(q, w, 0, 0);
+	} else if(string_prefix_is(field, "transfer-port")) {
+		w->transfer_port = atoi(value);
+	} else if(string_prefix_is(field, "compression")) {
+		if(q->compress_threshold > 0 && !strcmp(value, WORK_QUEUE_COMPRESS_METHOD)) {
+			w->compression = 1;
+			send_worker_msg(q, w, "compression %s %"PRId64"\n", WORK_QUEUE_COMPRESS_METHOD, q->compress_threshold);
+		}
 	}
 
 	//Note we always mark info messages as processed, as they are optional.
@@ -644,6 +716,8 @@ static work_queue_msg_code_t recv_worker_msg(struct work_queue *q, struct work_q
 		result = process_resource(q, w, line);
 	} else if (string_prefix_is(line, "feature")) {
 		result = process_feature(q, w, line);
+	} else if (string_prefix_is(line, "peerget-complete")) {
+		result = process_peerget_complete(q, w, line);
 	} else if (string_prefix_is(line, "auth")) {
 		debug(D_WQ|D_NOTICE,"worker (%s) is attempting to use a password, but I do not have one.",w->addrport);
 		result = MSG_FAILURE;
@@ -818,6 +892,38 @@ static void clean_task_state(struct work_queue_task *t) {
 		t->result = WORK_QUEUE_RESULT_UNKNOWN;
 }
 
+/*
+Record a file in the cache of a worker, and index the worker as a
+source of the file for peer transfers.
+*/
+
+static void worker_cache_insert(struct work_queue *q, struct work_queue_worker *w, const char *cached_name, struct stat *info)
+{
+	free(hash_table_remove(w->current_files, cached_name));
+	hash_table_insert(w->current_files, cached_name, info);
+
+	struct set *holders = hash_table_lookup(q->peer_sources, cached_name);
+	if(!holders) {
+		holders = set_create(0);
+		hash_table_insert(q->peer_sources, cached_name, holders);
+	}
+	set_insert(holders, w);
+}
+
+static void worker_cache_remove(struct work_queue *q, struct work_queue_worker *w, const char *cached_name)
+{
+	struct set *holders = hash_table_lookup(q->peer_sources, cached_name);
+	if(holders) {
+		set_remove(holders, w);
+		if(set_size(holders) < 1) {
+			hash_table_remove(q->peer_sources, cached_name);
+			set_delete(holders);
+		}
+	}
+
+	free(hash_table_remove(w->current_files, cached_name));
+}
+
 static void cleanup_worker(struct work_queue *q, struct work_queue_worker *w)
 {
 	char *key, *value;
@@ -829,11 +935,19 @@ static void cleanup_worker(struct work_queue *q, struct work_queue_worker *w)
 
 	hash_table_firstkey(w->current_files);
 	while(hash_table_nextkey(w->current_files, &key, (void **) &value)) {
-		hash_table_remove(w->current_files, key);
-		free(value);
+		worker_cache_remove(q, w, key);
 		hash_table_firstkey(w->current_files);
 	}
 
+	cancel_peer_transfers(q, w);
+	hash_table_clear(w->peer_failed_files);
+
+	if(w->retrieval) {
+		retrieval_delete(w->retrieval);
+		w->retrieval = NULL;
+		hash_table_remove(q->workers_retrieving, w->hashkey);
+	}
+
 	itable_firstkey(w->current_tasks);
 	while(itable_nextkey(w->current_tasks, &taskid, (void **)&t)) {
 		if (t->time_when_commit_end >= t->time_when_commit_start) {
@@ -902,18 +1016,25 @@ static void remove_worker(struct work_queue *q, struct work_queue_worker *w, wor
 	write_transaction_worker(q, w, 1, reason);
 
 	cleanup_worker(q, w);
+	worker_index_remove(q, w);
+
+	// The largest worker may change, and with it the size of first allocations.
+	q->ready_epoch++;
 
 	hash_table_remove(q->worker_table, w->hashkey);
 	hash_table_remove(q->workers_with_available_results, w->hashkey);
 
 	record_removed_worker_stats(q, w);
 
-	if(w->link)
+	if(w->link) {
+		link_poller_remove(q->poller, w->link);
 		link_close(w->link);
+	}
 
 	itable_delete(w->current_tasks);
 	itable_delete(w->current_tasks_boxes);
 	hash_table_delete(w->current_files);
+	hash_table_delete(w->peer_failed_files);
 	work_queue_resources_delete(w->resources);
 
 	free(w->workerid);
@@ -977,9 +1098,17 @@ static void add_worker(struct work_queue *q)
 		}
 	}
 
+	/* A worker that is never polled would still be sent tasks, so reject it. */
+	if(!link_poller_add(q->poller, link, LINK_READ)) {
+		debug(D_NOTICE, "Cannot watch link of worker %s:%d.", addr, port);
+		link_close(link);
+		return;
+	}
+
 	w = malloc(sizeof(*w));
 	if(!w) {
 		debug(D_NOTICE, "Cannot allocate memory for worker %s:%d.", addr, port);
+		link_poller_remove(q->poller, link);
 		link_close(link);
 		return;
 	}
@@ -993,8 +1122,10 @@ static void add_worker(struct work_queue *q)
 	w->draining = 0;
 	w->link = link;
 	w->current_files = hash_table_create(0, 0);
+	w->peer_failed_files = hash_table_create(0, 0);
 	w->current_tasks = itable_create(0);
 	w->current_tasks_boxes = itable_create(0);
+	w->index_key = -1;
 	w->finished_tasks = 0;
 	w->start_time = timestamp_get();
 
@@ -1012,157 +1143,6 @@ static void add_worker(struct work_queue *q)
 	return;
 }
 
-/*
-Get a single file from a remote worker.
-*/
-static work_queue_result_code_t get_file( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *local_name, int64_t length, int64_t * total_bytes)
-{
-	// If a bandwidth limit is in effect, choose the effective stoptime.
-	timestamp_t effective_stoptime = 0;
-	if(q->bandwidth) {
-		effective_stoptime = (length/q->bandwidth)*1000000 + timestamp_get();
-	}
-
-	// Choose the actual stoptime.
-	time_t stoptime = time(0) + get_transfer_wait_time(q, w, t, length);
-
-	// If necessary, create parent directories of the file.
-	char dirname[WORK_QUEUE_LINE_MAX];
-	path_dirname(local_name,dirname);
-	if(strchr(local_name,'/')) {
-		if(!create_dir(dirname, 0777)) {
-			debug(D_WQ, "Could not create directory - %s (%s)", dirname, strerror(errno));
-			link_soak(w->link, length, stoptime);
-			return WQ_APP_FAILURE;
-		}
-	}
-
-	// Create the local file.
-	debug(D_WQ, "Receiving file %s (size: %"PRId64" bytes) from %s (%s) ...", local_name, length, w->addrport, w->hostname);
-	// Check if there is space for incoming file at master
-	if(!check_disk_space_for_filesize(dirname, length, disk_avail_threshold)) {
-		debug(D_WQ, "Could not recieve file %s, not enough disk space (%"PRId64" bytes needed)\n", local_name, length);
-		return WQ_APP_FAILURE;
-	}
-
-	int fd = open(local_name, O_WRONLY | O_TRUNC | O_CREAT, 0777);
-	if(fd < 0) {
-		debug(D_NOTICE, "Cannot open file %s for writing: %s", local_name, strerror(errno));
-		link_soak(w->link, length, stoptime);
-		return WQ_APP_FAILURE;
-	}
-
-	// Write the data on the link to file.
-	int64_t actual = link_stream_to_fd(w->link, fd, length, stoptime);
-
-	close(fd);
-
-	if(actual != length) {
-		debug(D_WQ, "Received item size (%"PRId64") does not match the expected size - %"PRId64" bytes.", actual, length);
-		unlink(local_name);
-		return WQ_WORKER_FAILURE;
-	}
-
-	*total_bytes += length;
-
-	// If the transfer was too fast, slow things down.
-	timestamp_t current_time = timestamp_get();
-	if(effective_stoptime && effective_stoptime > current_time) {
-		usleep(effective_stoptime - current_time);
-	}
-
-	return WQ_SUCCESS;
-}
-
-/*
-This function implements the recursive get protocol.
-The master sents a single get message, then the worker
-responds with a continuous stream of dir and file message
-that indicate the entire contents of the directory.
-This makes it efficient to move deep directory hierarchies with
-high throughput and low latency.
-*/
-static work_queue_result_code_t get_file_or_directory( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *remote_name, const char *local_name, int64_t * total_bytes)
-{
-	// Remember the length of the specified remote path so it can be chopped from the result.
-	int remote_name_len = strlen(remote_name);
-
-	// Send the name of the file/dir name to fetch
-	debug(D_WQ, "%s (%s) sending back %s to %s", w->hostname, w->addrport, remote_name, local_name);
-	send_worker_msg(q,w, "get %s 1\n",remote_name);
-
-	work_queue_result_code_t result = WQ_SUCCESS; //return success unless something fails below
-
-	char *tmp_remote_path = NULL;
-	char *length_str      = NULL;
-	char *errnum_str      = NULL;
-
-	// Process the recursive file/dir responses as they are sent.
-	while(1) {
-		char line[WORK_QUEUE_LINE_MAX];
-
-		free(tmp_remote_path);
-		free(length_str);
-
-		tmp_remote_path = NULL;
-		length_str      = NULL;
-
-		if(recv_worker_msg_retry(q, w, line, sizeof(line)) == MSG_FAILURE) {
-			result = WQ_WORKER_FAILURE;
-			break;
-		}
-
-		if(pattern_match(line, "^dir (%S+) (%d+)$", &tmp_remote_path, &length_str) >= 0) {
-			char *tmp_local_name = string_format("%s%s",local_name, (tmp_remote_path + remote_name_len));
-			int result_dir = create_dir(tmp_local_name,0777);
-			if(!result_dir) {
-				debug(D_WQ, "Could not create directory - %s (%s)", tmp_local_name, strerror(errno));
-				result = WQ_APP_FAILURE;
-				free(tmp_local_name);
-				break;
-			}
-			free(tmp_local_name);
-		} else if(pattern_match(line, "^file (.+) (%d+)$", &tmp_remote_path, &length_str) >= 0) {
-			int64_t length = strtoll(length_str, NULL, 10);
-			char *tmp_local_name = string_format("%s%s",local_name, (tmp_remote_path + remote_name_len));
-			result = get_file(q,w,t,tmp_local_name,length,total_bytes);
-			free(tmp_local_name);
-			//Return if worker failure. Else wait for end message from worker.
-			if(result == WQ_WORKER_FAILURE) break;
-		} else if(pattern_match(line, "^missing (.+) (%d+)$", &tmp_remote_path, &errnum_str) >= 0) {
-			// If the output file is missing, we make a note of that in the task result,
-			// but we continue and consider the transfer a 'success' so that other
-			// outputs are transferred and the task is given back to the caller.
-			int errnum = atoi(errnum_str);
-			debug(D_WQ, "%s (%s): could not access requested file %s (%s)",w->hostname,w->addrport,remote_name,strerror(errnum));
-			update_task_result(t, WORK_QUEUE_RESULT_OUTPUT_MISSING);
-		} else if(!strcmp(line,"end")) {
-			// We have to return on receiving an end message.
-			if (result == WQ_SUCCESS) {
-				return result;
-			} else {
-				break;
-			}
-		} else {
-			debug(D_WQ, "%s (%s): sent invalid response to get: %s",w->hostname,w->addrport,line);
-			result = WQ_WORKER_FAILURE; //signal sys-level failure
-			break;
-		}
-	}
-
-	free(tmp_remote_path);
-	free(length_str);
-
-	// If we failed to *transfer* the output file, then that is a hard
-	// failure which causes this function to return failure and the task
-	// to be returned to the queue to be attempted elsewhere.
-	debug(D_WQ, "%s (%s) failed to return output %s to %s", w->addrport, w->hostname, remote_name, local_name);
-	if(result == WQ_APP_FAILURE) {
-		update_task_result(t, WORK_QUEUE_RESULT_OUTPUT_MISSING);;
-	}
-	return result;
-}
-
 /*
 For a given task and file, generate the name under which the file
 should be stored in the remote cache directory.
@@ -1228,137 +1208,10 @@ char *make_cached_name( const struct work_queue_file *f )
 	}
 }
 
-/*
-This function stores an output file from the remote cache directory
-to a third-party location, which can be either a remote filesystem
-(WORK_QUEUE_FS_PATH) or a command to run (WORK_QUEUE_FS_CMD).
-Returns 1 on success at worker and 0 on invalid message from worker.
-*/
-static int do_thirdput( struct work_queue *q, struct work_queue_worker *w,  const char *cached_name, const char *payload, int command )
-{
-	char line[WORK_QUEUE_LINE_MAX];
-	int result;
-
-	send_worker_msg(q,w,"thirdput %d %s %s\n",command,cached_name,payload);
-
-	if(recv_worker_msg_retry(q, w, line, WORK_QUEUE_LINE_MAX) == MSG_FAILURE)
-		return WQ_WORKER_FAILURE;
-
-	if(sscanf(line, "thirdput-complete %d", &result)) {
-		return result;
-	} else {
-		debug(D_WQ, "Error: invalid message received (%s)\n", line);
-		return WQ_WORKER_FAILURE;
-	}
-}
-
-/*
-Get a single output file, located at the worker under 'cached_name'.
-*/
-static work_queue_result_code_t get_output_file( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, struct work_queue_file *f )
-{
-	int64_t total_bytes = 0;
-	work_queue_result_code_t result = WQ_SUCCESS; //return success unless something fails below.
-
-	timestamp_t open_time = timestamp_get();
-
-	if(f->flags & WORK_QUEUE_THIRDPUT) {
-		if(!strcmp(f->cached_name, f->payload)) {
-			debug(D_WQ, "output file %s already on shared filesystem", f->cached_name);
-			f->flags |= WORK_QUEUE_PREEXIST;
-		} else {
-			result = do_thirdput(q,w,f->cached_name,f->payload,WORK_QUEUE_FS_PATH);
-		}
-	} else if(f->type == WORK_QUEUE_REMOTECMD) {
-		result = do_thirdput(q,w,f->cached_name,f->payload,WORK_QUEUE_FS_CMD);
-	} else {
-		result = get_file_or_directory(q, w, t, f->cached_name, f->payload, &total_bytes);
-	}
-
-	timestamp_t close_time = timestamp_get();
-	timestamp_t sum_time = close_time - open_time;
-
-	if(total_bytes>0) {
-		q->stats->bytes_received += total_bytes;
-
-		t->bytes_received    += total_bytes;
-		t->bytes_transferred += total_bytes;
-
-		w->total_bytes_transferred += total_bytes;
-		w->total_transfer_time += sum_time;
-
-		debug(D_WQ, "%s (%s) sent %.2lf MB in %.02lfs (%.02lfs MB/s) average %.02lfs MB/s", w->hostname, w->addrport, total_bytes / 1000000.0, sum_time / 1000000.0, (double) total_bytes / sum_time, (double) w->total_bytes_transferred / w->total_transfer_time);
-	}
-
-	// If the transfer was successful, make a record of it in the cache.
-	if(result == WQ_SUCCESS && f->flags & WORK_QUEUE_CACHE) {
-		struct stat local_info;
-		if (stat(f->payload,&local_info) == 0) {
-			struct stat *remote_info = malloc(sizeof(*remote_info));
-			if(!remote_info) {
-				debug(D_NOTICE, "Cannot allocate memory for cache entry for output file %s at %s (%s)", f->payload, w->hostname, w->addrport);
-				return WQ_APP_FAILURE;
-			}
-			memcpy(remote_info, &local_info, sizeof(local_info));
-			hash_table_insert(w->current_files, f->cached_name, remote_info);
-		} else {
-			debug(D_NOTICE, "Cannot stat file %s: %s", f->payload, strerror(errno));
-		}
-	}
-
-	return result;
-}
-
-static work_queue_result_code_t get_output_files( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t )
-{
-	struct work_queue_file *f;
-	work_queue_result_code_t result = WQ_SUCCESS;
-
-	if(t->output_files) {
-		list_first_item(t->output_files);
-		while((f = list_next_item(t->output_files))) {
-			result = get_output_file(q,w,t,f);
-			//if success or app-level failure, continue to get other files.
-			//if worker failure, return.
-			if(result == WQ_WORKER_FAILURE) {
-				break;
-			}
-		}
-	}
-
-	// tell the worker you no longer need that task's output directory.
-	send_worker_msg(q,w, "kill %d\n",t->taskid);
-
-	return result;
-}
-
-static work_queue_result_code_t get_monitor_output_file( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t )
-{
-	struct work_queue_file *f;
-	work_queue_result_code_t result = WQ_SUCCESS;
-
-	const char *summary_name = RESOURCE_MONITOR_REMOTE_NAME ".summary";
-
-	if(t->output_files) {
-		list_first_item(t->output_files);
-		while((f = list_next_item(t->output_files))) {
-			if(!strcmp(summary_name, f->remote_name)) {
-				result = get_output_file(q,w,t,f);
-				break;
-			}
-		}
-	}
-
-	// tell the worker you no longer need that task's output directory.
-	send_worker_msg(q,w, "kill %d\n",t->taskid);
-
-	return result;
-}
-
 static void delete_worker_file( struct work_queue *q, struct work_queue_worker *w, const char *filename, int flags, int except_flags ) {
 	if(!(flags & except_flags)) {
 		send_worker_msg(q,w, "unlink %s\n", filename);
-		hash_table_remove(w->current_files, filename);
+		worker_cache_remove(q, w, filename);
 	}
 }
 
@@ -1488,27 +1341,13 @@ void resource_monitor_compress_logs(struct work_queue *q, struct work_queue_task
 	free(command);
 }
 
-static void fetch_output_from_worker(struct work_queue *q, struct work_queue_worker *w, int taskid)
-{
-	struct work_queue_task *t;
-	work_queue_result_code_t result = WQ_SUCCESS;
-
-	t = itable_lookup(w->current_tasks, taskid);
-	if(!t) {
-		debug(D_WQ, "Failed to find task %d at worker %s (%s).", taskid, w->hostname, w->addrport);
-		handle_failure(q, w, t, WQ_WORKER_FAILURE);
-		return;
-	}
-
-	// Start receiving output...
-	t->time_when_retrieval = timestamp_get();
-
-	if(t->result == WORK_QUEUE_RESULT_RESOURCE_EXHAUSTION) {
-		result = get_monitor_output_file(q,w,t);
-	} else {
-		result = get_output_files(q,w,t);
-	}
+/*
+Once the outputs of a task have been received (or have failed to be),
+give the task back to the application, or resubmit it as appropriate.
+*/
 
+static void finish_output_from_worker(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, work_queue_result_code_t result)
+{
 	if(result != WQ_SUCCESS) {
 		debug(D_WQ, "Failed to receive output from worker %s (%s).", w->hostname, w->addrport);
 		handle_failure(q, w, t, result);
@@ -1611,7 +1450,919 @@ static void fetch_output_from_worker(struct work_queue *q, struct work_queue_wor
 			(long long) w->total_tasks_complete,
 			w->total_task_time / w->total_tasks_complete / 1000000.0);
 
-	return;
+	return;
+}
+
+/*
+Decide whether a payload of the given length, from data if not null and
+otherwise from fd, should be sent compressed to the worker.
+*/
+
+static int compression_pays(struct work_queue *q, struct work_queue_worker *w, int fd, const char *data, int64_t length)
+{
+	if(!w->compression || length < q->compress_threshold) {
+		return 0;
+	}
+
+	if(data) {
+		return work_queue_compress_probe_buffer(data, length);
+	} else {
+		return work_queue_compress_probe_fd(fd, length);
+	}
+}
+
+static void record_compressed_transfer(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *direction, const char *name, struct work_queue_compress_stats *s)
+{
+	if(s->bytes < 1) {
+		return;
+	}
+
+	q->stats->bytes_compressed      += s->bytes;
+	q->stats->bytes_compressed_wire += s->wire_bytes;
+	q->stats->time_compress         += s->time + s->peer_time;
+
+	debug(D_WQ, "%s (%s) %s %s compressed from %"PRId64" to %"PRId64" bytes", w->hostname, w->addrport, direction, name, s->bytes, s->wire_bytes);
+
+	write_transaction_transfer(q, w, t, direction, name, s);
+}
+
+/*
+Output files are retrieved asynchronously, so that a worker sending back a
+large output does not stall the rest of the queue. A worker sends back the
+outputs of one task at a time, tracked by a struct work_queue_retrieval. For
+each output file, the master sends a get (or thirdput) message, and the reply
+is consumed whenever the link of the worker is readable: a stream of dir,
+file, filez, and missing messages closed by end, or a single thirdput-complete.
+While retrieving, a worker is not sent new tasks nor asked for results, as it
+will not read them until it is done.
+*/
+
+typedef enum {
+	RETRIEVAL_REPLY,       // waiting for the next message of the reply to get or thirdput
+	RETRIEVAL_FILE_DATA,   // receiving the contents of a file (or of a frame of a compressed file) of the reply to get
+	RETRIEVAL_FILE_FRAME   // waiting for the length of the next frame of a compressed file
+} work_queue_retrieval_state_t;
+
+struct work_queue_retrieval {
+	struct work_queue_task *task;     // null if the task was cancelled during the retrieval
+	struct work_queue_file **files;   // output files to retrieve
+	int files_count;
+	int files_next;
+	int done;                         // all outputs were retrieved
+
+	work_queue_retrieval_state_t state;
+	time_t stoptime;                  // give up if the worker makes no progress by this time
+
+	int thirdput;                     // the current output was requested with thirdput
+	char *remote_name;                // name of the current output at the worker
+	char *local_name;                 // name of the current output at the master
+	work_queue_result_code_t file_result;
+	int64_t file_bytes;
+	timestamp_t file_start;
+
+	char *data_name;                  // local file being written
+	int data_fd;                      // or -1 if the contents are discarded
+	int64_t data_length;
+	int64_t data_remaining;                   // of the file, or of the current frame if compressed
+	timestamp_t data_effective_stoptime;
+	timestamp_t throttle_until;               // under a bandwidth limit, the worker is not read before this time
+	struct work_queue_inflate *inflate;       // if the file is compressed
+	struct work_queue_compress_stats compress_stats;
+
+	work_queue_result_code_t result;  // result of the last output retrieved
+};
+
+static void retrieval_delete(struct work_queue_retrieval *r)
+{
+	if(!r) return;
+
+	// A partially received file is not left behind.
+	if(r->data_fd >= 0) {
+		close(r->data_fd);
+		unlink(r->data_name);
+	}
+
+	work_queue_inflate_delete(r->inflate);
+
+	free(r->data_name);
+	free(r->remote_name);
+	free(r->local_name);
+	free(r->files);
+	free(r);
+}
+
+static time_t retrieval_reply_stoptime(struct work_queue *q, struct work_queue_worker *w)
+{
+	if(w->type == WORKER_TYPE_FOREMAN) {
+		return time(0) + q->long_timeout;
+	} else {
+		return time(0) + q->short_timeout;
+	}
+}
+
+static void retrieval_next_output(struct work_queue *q, struct work_queue_worker *w);
+
+/*
+Account for an output that was received, and request the next one.
+*/
+
+static void retrieval_end_output(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct work_queue_retrieval *r = w->retrieval;
+	struct work_queue_task *t = r->task;
+
+	r->result = r->file_result;
+
+	if(!t) {
+		retrieval_next_output(q, w);
+		return;
+	}
+
+	struct work_queue_file *f = r->files[r->files_next - 1];
+
+	timestamp_t sum_time = timestamp_get() - r->file_start;
+
+	if(r->file_bytes > 0) {
+		q->stats->bytes_received += r->file_bytes;
+
+		t->bytes_received    += r->file_bytes;
+		t->bytes_transferred += r->file_bytes;
+
+		w->total_bytes_transferred += r->file_bytes;
+		w->total_transfer_time += sum_time;
+
+		debug(D_WQ, "%s (%s) sent %.2lf MB in %.02lfs (%.02lfs MB/s) average %.02lfs MB/s", w->hostname, w->addrport, r->file_bytes / 1000000.0, sum_time / 1000000.0, (double) r->file_bytes / sum_time, (double) w->total_bytes_transferred / w->total_transfer_time);
+	}
+
+	// If the transfer was successful, make a record of it in the cache.
+	if(r->result == WQ_SUCCESS && f->flags & WORK_QUEUE_CACHE) {
+		struct stat local_info;
+		if (stat(f->payload,&local_info) == 0) {
+			struct stat *remote_info = malloc(sizeof(*remote_info));
+			if(!remote_info) {
+				debug(D_NOTICE, "Cannot allocate memory for cache entry for output file %s at %s (%s)", f->payload, w->hostname, w->addrport);
+				r->result = WQ_APP_FAILURE;
+			} else {
+				memcpy(remote_info, &local_info, sizeof(local_info));
+				worker_cache_insert(q, w, f->cached_name, remote_info);
+			}
+		} else {
+			debug(D_NOTICE, "Cannot stat file %s: %s", f->payload, strerror(errno));
+		}
+	}
+
+	retrieval_next_output(q, w);
+}
+
+/*
+Request the next output of the task from the worker. If there are no more
+outputs, the retrieval is marked as done.
+*/
+
+static void retrieval_next_output(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct work_queue_retrieval *r = w->retrieval;
+
+	if(!r->task || r->files_next >= r->files_count) {
+		r->done = 1;
+		return;
+	}
+
+	struct work_queue_file *f = r->files[r->files_next++];
+
+	free(r->remote_name);
+	free(r->local_name);
+	r->remote_name = xxstrdup(f->cached_name);
+	r->local_name  = xxstrdup(f->payload);
+	r->file_result = WQ_SUCCESS;
+	r->file_bytes  = 0;
+	r->file_start  = timestamp_get();
+	r->state       = RETRIEVAL_REPLY;
+	r->stoptime    = retrieval_reply_stoptime(q, w);
+
+	if(f->flags & WORK_QUEUE_THIRDPUT) {
+		if(!strcmp(f->cached_name, f->payload)) {
+			debug(D_WQ, "output file %s already on shared filesystem", f->cached_name);
+			f->flags |= WORK_QUEUE_PREEXIST;
+			retrieval_end_output(q, w);
+		} else {
+			r->thirdput = 1;
+			send_worker_msg(q,w,"thirdput %d %s %s\n",WORK_QUEUE_FS_PATH,f->cached_name,f->payload);
+		}
+	} else if(f->type == WORK_QUEUE_REMOTECMD) {
+		r->thirdput = 1;
+		send_worker_msg(q,w,"thirdput %d %s %s\n",WORK_QUEUE_FS_CMD,f->cached_name,f->payload);
+	} else {
+		r->thirdput = 0;
+		debug(D_WQ, "%s (%s) sending back %s to %s", w->hostname, w->addrport, f->cached_name, f->payload);
+		send_worker_msg(q,w, "get %s 1\n",f->cached_name);
+	}
+}
+
+/*
+Prepare to receive a file of the given length announced by the worker.
+If the file cannot be written, its contents are read and discarded, so
+that the rest of the outputs can still be retrieved. A compressed file
+comes as a stream of frames, each received as file data.
+*/
+
+static work_queue_result_code_t retrieval_end_file(struct work_queue *q, struct work_queue_worker *w);
+
+static work_queue_result_code_t retrieval_start_file(struct work_queue *q, struct work_queue_worker *w, char *local_name, int64_t length, int compressed)
+{
+	struct work_queue_retrieval *r = w->retrieval;
+
+	r->state = compressed ? RETRIEVAL_FILE_FRAME : RETRIEVAL_FILE_DATA;
+	r->data_name = local_name;
+	r->data_fd = -1;
+	r->data_length = length;
+	r->data_remaining = length;
+	r->stoptime = time(0) + get_transfer_wait_time(q, w, r->task, length);
+
+	// If a bandwidth limit is in effect, choose the effective stoptime.
+	r->data_effective_stoptime = 0;
+	if(q->bandwidth) {
+		r->data_effective_stoptime = (length/q->bandwidth)*1000000 + timestamp_get();
+	}
+
+	// If necessary, create parent directories of the file.
+	char dirname[WORK_QUEUE_LINE_MAX];
+	path_dirname(local_name,dirname);
+	if(!r->task) {
+		// The task was cancelled, so the contents are discarded.
+	} else if(strchr(local_name,'/') && !create_dir(dirname, 0777)) {
+		debug(D_WQ, "Could not create directory - %s (%s)", dirname, strerror(errno));
+		r->file_result = WQ_APP_FAILURE;
+	} else {
+		debug(D_WQ, "Receiving file %s (size: %"PRId64" bytes) from %s (%s) ...", local_name, length, w->addrport, w->hostname);
+		// Check if there is space for incoming file at master
+		if(!check_disk_space_for_filesize(dirname, length, disk_avail_threshold)) {
+			debug(D_WQ, "Could not recieve file %s, not enough disk space (%"PRId64" bytes needed)\n", local_name, length);
+			r->file_result = WQ_APP_FAILURE;
+		} else {
+			r->data_fd = open(local_name, O_WRONLY | O_TRUNC | O_CREAT, 0777);
+			if(r->data_fd < 0) {
+				debug(D_NOTICE, "Cannot open file %s for writing: %s", local_name, strerror(errno));
+				r->file_result = WQ_APP_FAILURE;
+			}
+		}
+	}
+
+	if(compressed) {
+		memset(&r->compress_stats, 0, sizeof(r->compress_stats));
+		r->data_remaining = 0;
+		r->inflate = work_queue_inflate_create(r->data_fd);
+		if(!r->inflate) {
+			return WQ_WORKER_FAILURE;
+		}
+	} else if(length == 0) {
+		return retrieval_end_file(q, w);
+	}
+
+	return WQ_SUCCESS;
+}
+
+static work_queue_result_code_t retrieval_end_file(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct work_queue_retrieval *r = w->retrieval;
+
+	int throttled = 0;
+
+	if(r->data_fd >= 0) {
+		close(r->data_fd);
+		r->data_fd = -1;
+		r->file_bytes += r->inflate ? r->compress_stats.wire_bytes : r->data_length;
+
+		// If the transfer was too fast, stop reading from this worker until
+		// the bandwidth limit allows it, while serving the others.
+		timestamp_t current_time = timestamp_get();
+		if(r->data_effective_stoptime && r->data_effective_stoptime > current_time) {
+			r->throttle_until = r->data_effective_stoptime;
+			link_poller_remove(q->poller, w->link);
+			throttled = 1;
+		}
+	}
+
+	work_queue_inflate_delete(r->inflate);
+	r->inflate = NULL;
+
+	free(r->data_name);
+	r->data_name = NULL;
+
+	r->state = RETRIEVAL_REPLY;
+	r->stoptime = retrieval_reply_stoptime(q, w);
+	if(throttled) {
+		r->stoptime += (r->throttle_until - timestamp_get()) / 1000000 + 1;
+	}
+
+	return WQ_SUCCESS;
+}
+
+static work_queue_result_code_t retrieval_read_data(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct work_queue_retrieval *r = w->retrieval;
+	char buffer[1<<16];
+
+	ssize_t chunk = link_read_avail(w->link, buffer, MIN((int64_t) sizeof(buffer), r->data_remaining), r->stoptime);
+	if(chunk <= 0) {
+		debug(D_WQ, "Received item size (%"PRId64") does not match the expected size - %"PRId64" bytes.", r->data_length - r->data_remaining, r->data_length);
+		return WQ_WORKER_FAILURE;
+	}
+
+	w->last_msg_recv_time = timestamp_get();
+
+	int written = 1;
+	if(r->inflate) {
+		r->compress_stats.wire_bytes += chunk;
+		written = work_queue_inflate_write(r->inflate, buffer, chunk, &r->compress_stats);
+		if(written < 0) {
+			return WQ_WORKER_FAILURE;
+		}
+	} else if(r->data_fd >= 0) {
+		written = full_write(r->data_fd, buffer, chunk) == chunk;
+	}
+
+	if(!written) {
+		debug(D_NOTICE, "Cannot write file %s: %s", r->data_name, strerror(errno));
+		close(r->data_fd);
+		unlink(r->data_name);
+		r->data_fd = -1;
+		r->file_result = WQ_APP_FAILURE;
+	}
+
+	r->data_remaining -= chunk;
+
+	if(r->data_remaining == 0) {
+		if(r->inflate) {
+			r->state = RETRIEVAL_FILE_FRAME;
+			return WQ_SUCCESS;
+		}
+		return retrieval_end_file(q, w);
+	}
+
+	return WQ_SUCCESS;
+}
+
+static work_queue_result_code_t retrieval_read_frame(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct work_queue_retrieval *r = w->retrieval;
+	char line[WORK_QUEUE_LINE_MAX];
+	int64_t length;
+	timestamp_t peer_time;
+
+	if(!link_readline(w->link, line, sizeof(line), r->stoptime)) {
+		return WQ_WORKER_FAILURE;
+	}
+
+	w->last_msg_recv_time = timestamp_get();
+	r->compress_stats.wire_bytes += strlen(line) + 1;
+
+	if(!work_queue_compress_frame(line, &length, &peer_time)) {
+		debug(D_WQ, "%s (%s): sent invalid compressed frame: %s", w->hostname, w->addrport, line);
+		return WQ_WORKER_FAILURE;
+	}
+
+	if(length > 0) {
+		r->data_remaining = length;
+		r->state = RETRIEVAL_FILE_DATA;
+		return WQ_SUCCESS;
+	}
+
+	r->compress_stats.peer_time += peer_time;
+
+	if(r->compress_stats.bytes != r->data_length) {
+		debug(D_WQ, "Received item size (%"PRId64") does not match the expected size - %"PRId64" bytes.", r->compress_stats.bytes, r->data_length);
+		return WQ_WORKER_FAILURE;
+	}
+
+	if(!work_queue_inflate_ended(r->inflate)) {
+		debug(D_WQ, "%s (%s): compressed stream of %s ended early.", w->hostname, w->addrport, r->data_name);
+		return WQ_WORKER_FAILURE;
+	}
+
+	record_compressed_transfer(q, w, r->task, "OUTPUT", r->data_name, &r->compress_stats);
+
+	return retrieval_end_file(q, w);
+}
+
+static work_queue_result_code_t retrieval_read_reply(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct work_queue_retrieval *r = w->retrieval;
+	char line[WORK_QUEUE_LINE_MAX];
+
+	work_queue_msg_code_t mcode = recv_worker_msg(q, w, line, sizeof(line));
+	if(mcode == MSG_FAILURE) {
+		return WQ_WORKER_FAILURE;
+	}
+
+	r->stoptime = retrieval_reply_stoptime(q, w);
+
+	if(mcode == MSG_PROCESSED) {
+		return WQ_SUCCESS;
+	}
+
+	if(r->thirdput) {
+		int ok;
+		if(sscanf(line, "thirdput-complete %d", &ok) == 1) {
+			r->file_result = ok ? WQ_SUCCESS : WQ_APP_FAILURE;
+			retrieval_end_output(q, w);
+			return WQ_SUCCESS;
+		} else {
+			debug(D_WQ, "Error: invalid message received (%s)\n", line);
+			return WQ_WORKER_FAILURE;
+		}
+	}
+
+	work_queue_result_code_t result = WQ_SUCCESS;
+
+	// Remember the length of the requested remote path so it can be chopped from the result.
+	int remote_name_len = strlen(r->remote_name);
+
+	char *tmp_remote_path = NULL;
+	char *length_str      = NULL;
+	char *errnum_str      = NULL;
+
+	if(pattern_match(line, "^dir (%S+) (%d+)$", &tmp_remote_path, &length_str) >= 0) {
+		if(r->task && r->file_result == WQ_SUCCESS) {
+			char *tmp_local_name = string_format("%s%s",r->local_name, (tmp_remote_path + remote_name_len));
+			if(!create_dir(tmp_local_name,0777)) {
+				debug(D_WQ, "Could not create directory - %s (%s)", tmp_local_name, strerror(errno));
+				r->file_result = WQ_APP_FAILURE;
+			}
+			free(tmp_local_name);
+		}
+	} else if(pattern_match(line, "^file (.+) (%d+)$", &tmp_remote_path, &length_str) >= 0) {
+		int64_t length = strtoll(length_str, NULL, 10);
+		char *tmp_local_name = string_format("%s%s",r->local_name, (tmp_remote_path + remote_name_len));
+		result = retrieval_start_file(q, w, tmp_local_name, length, 0);
+	} else if(pattern_match(line, "^filez (.+) (%d+)$", &tmp_remote_path, &length_str) >= 0) {
+		int64_t length = strtoll(length_str, NULL, 10);
+		char *tmp_local_name = string_format("%s%s",r->local_name, (tmp_remote_path + remote_name_len));
+		result = retrieval_start_file(q, w, tmp_local_name, length, 1);
+	} else if(pattern_match(line, "^missing (.+) (%d+)$", &tmp_remote_path, &errnum_str) >= 0) {
+		// If the output file is missing, we make a note of that in the task result,
+		// but we continue and consider the transfer a 'success' so that other
+		// outputs are transferred and the task is given back to the caller.
+		int errnum = atoi(errnum_str);
+		debug(D_WQ, "%s (%s): could not access requested file %s (%s)",w->hostname,w->addrport,r->remote_name,strerror(errnum));
+		if(r->task) {
+			update_task_result(r->task, WORK_QUEUE_RESULT_OUTPUT_MISSING);
+		}
+	} else if(!strcmp(line,"end")) {
+		if(r->file_result != WQ_SUCCESS) {
+			debug(D_WQ, "%s (%s) failed to return output %s to %s", w->addrport, w->hostname, r->remote_name, r->local_name);
+			if(r->task) {
+				update_task_result(r->task, WORK_QUEUE_RESULT_OUTPUT_MISSING);
+			}
+		}
+		retrieval_end_output(q, w);
+	} else {
+		debug(D_WQ, "%s (%s): sent invalid response to get: %s",w->hostname,w->addrport,line);
+		result = WQ_WORKER_FAILURE;
+	}
+
+	free(tmp_remote_path);
+	free(length_str);
+	free(errnum_str);
+
+	return result;
+}
+
+/*
+Release the retrieval of the worker, and hand over the task to finish_output_from_worker.
+Note that the worker may be removed on failure.
+*/
+
+static work_queue_result_code_t retrieval_finish(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct work_queue_retrieval *r = w->retrieval;
+	struct work_queue_task *t = r->task;
+	work_queue_result_code_t result = r->result;
+
+	w->retrieval = NULL;
+	hash_table_remove(q->workers_retrieving, w->hashkey);
+	retrieval_delete(r);
+
+	// The worker may take tasks again.
+	q->ready_epoch++;
+
+	if(t) {
+		// tell the worker you no longer need that task's output directory.
+		send_worker_msg(q,w, "kill %d\n",t->taskid);
+		finish_output_from_worker(q, w, t, result);
+	} else if(result == WQ_WORKER_FAILURE) {
+		handle_worker_failure(q, w);
+	}
+
+	return result;
+}
+
+/*
+Consume what the worker has sent back so far, without waiting for more.
+A single call is bounded in time, so that other workers are also served.
+*/
+
+#define RETRIEVAL_SLICE 100000
+
+static work_queue_result_code_t advance_output_retrieval(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct work_queue_retrieval *r = w->retrieval;
+	timestamp_t stoptime = timestamp_get() + RETRIEVAL_SLICE;
+	work_queue_result_code_t result;
+
+	do {
+		if(r->state == RETRIEVAL_FILE_DATA) {
+			result = retrieval_read_data(q, w);
+		} else if(r->state == RETRIEVAL_FILE_FRAME) {
+			result = retrieval_read_frame(q, w);
+		} else {
+			result = retrieval_read_reply(q, w);
+		}
+	} while(result == WQ_SUCCESS && !r->done && !r->throttle_until && timestamp_get() < stoptime && link_usleep(w->link, 0, 1, 0));
+
+	if(result == WQ_WORKER_FAILURE) {
+		debug(D_WQ, "Failed to receive output from worker %s (%s).", w->hostname, w->addrport);
+		r->result = WQ_WORKER_FAILURE;
+	}
+
+	if(r->result == WQ_WORKER_FAILURE || r->done) {
+		return retrieval_finish(q, w);
+	}
+
+	return WQ_SUCCESS;
+}
+
+/*
+Read again from the workers held back by the bandwidth limit, once their time has come.
+Returns the milliseconds until the next one may be read, or -1 if none is waiting.
+*/
+
+static int resume_throttled_retrievals(struct work_queue *q)
+{
+	struct work_queue_worker *w;
+	char *key;
+	int msec = -1;
+	timestamp_t current_time = timestamp_get();
+
+	hash_table_firstkey(q->workers_retrieving);
+	while(hash_table_nextkey(q->workers_retrieving, &key, (void **) &w)) {
+		struct work_queue_retrieval *r = w->retrieval;
+		if(!r->throttle_until) {
+			continue;
+		} else if(current_time >= r->throttle_until) {
+			r->throttle_until = 0;
+			link_poller_add(q->poller, w->link, LINK_READ);
+		} else {
+			int wait_msec = (r->throttle_until - current_time) / 1000 + 1;
+			msec = msec < 0 ? wait_msec : MIN(msec, wait_msec);
+		}
+	}
+
+	return msec;
+}
+
+/*
+Give up on the retrievals of workers that have not sent anything in time.
+Returns the number of workers removed.
+*/
+
+static int expire_output_retrievals(struct work_queue *q)
+{
+	struct work_queue_worker *w;
+	char *key;
+	int removed = 0;
+	time_t current_time = time(0);
+
+	hash_table_firstkey(q->workers_retrieving);
+	while(hash_table_nextkey(q->workers_retrieving, &key, (void **) &w)) {
+		if(current_time > w->retrieval->stoptime) {
+			debug(D_WQ, "%s (%s) did not send back outputs in time.", w->hostname, w->addrport);
+			w->retrieval->result = WQ_WORKER_FAILURE;
+			retrieval_finish(q, w);
+			removed++;
+			hash_table_firstkey(q->workers_retrieving);
+		}
+	}
+
+	return removed;
+}
+
+static void fetch_output_from_worker(struct work_queue *q, struct work_queue_worker *w, int taskid)
+{
+	struct work_queue_task *t;
+	struct work_queue_file *f;
+
+	t = itable_lookup(w->current_tasks, taskid);
+	if(!t) {
+		debug(D_WQ, "Failed to find task %d at worker %s (%s).", taskid, w->hostname, w->addrport);
+		handle_failure(q, w, t, WQ_WORKER_FAILURE);
+		return;
+	}
+
+	// Start receiving output...
+	t->time_when_retrieval = timestamp_get();
+
+	struct work_queue_retrieval *r = xxcalloc(1, sizeof(*r));
+	r->task = t;
+	r->data_fd = -1;
+	r->result = WQ_SUCCESS;
+
+	if(t->output_files) {
+		const char *summary_name = RESOURCE_MONITOR_REMOTE_NAME ".summary";
+
+		r->files = xxmalloc(sizeof(*r->files) * (list_size(t->output_files) + 1));
+
+		list_first_item(t->output_files);
+		while((f = list_next_item(t->output_files))) {
+			// On resource exhaustion, only the summary of the monitor is retrieved.
+			if(t->result == WORK_QUEUE_RESULT_RESOURCE_EXHAUSTION) {
+				if(!strcmp(summary_name, f->remote_name)) {
+					r->files[r->files_count++] = f;
+					break;
+				}
+			} else {
+				r->files[r->files_count++] = f;
+			}
+		}
+	}
+
+	w->retrieval = r;
+	hash_table_insert(q->workers_retrieving, w->hashkey, w);
+
+	retrieval_next_output(q, w);
+
+	if(r->done) {
+		retrieval_finish(q, w);
+	}
+}
+
+/*
+Start retrieving the outputs of tasks that are waiting for it,
+from the workers that are not already retrieving. Returns the number of
+retrievals started.
+*/
+
+static int receive_tasks( struct work_queue *q )
+{
+	struct work_queue_worker *w;
+	struct task_entry *e;
+	int started = 0;
+
+	int count = task_state_count(q, NULL, WORK_QUEUE_TASK_WAITING_RETRIEVAL);
+	if(count < 1) {
+		return 0;
+	}
+
+	// Starting a retrieval may change the state of any task (e.g., if the
+	// worker fails), so the candidates are taken before starting any.
+	uint64_t *taskids = xxmalloc(count * sizeof(*taskids));
+	int n = 0;
+	for(e = q->task_state_heads[WORK_QUEUE_TASK_WAITING_RETRIEVAL]; e; e = e->next) {
+		taskids[n++] = e->task->taskid;
+	}
+
+	int i;
+	for(i = 0; i < n; i++) {
+		if( task_state_is(q, taskids[i], WORK_QUEUE_TASK_WAITING_RETRIEVAL) ) {
+			w = itable_lookup(q->worker_task_map, taskids[i]);
+			if(w && !w->retrieval) {
+				fetch_output_from_worker(q, w, taskids[i]);
+				started++;
+			}
+		}
+	}
+
+	free(taskids);
+
+	return started;
+}
+
+/*
+The ready queue keeps the tasks ready to be sent to a worker, grouped by
+shape: the category, allocation label, requested resources, and features of
+the task, which are all that decide whether a worker can take the task. The
+tasks of a shape are kept in a binary heap ordered by priority, with equal
+priorities in submission order, and with tasks that should go first (those
+resubmitted after resource exhaustion) ahead of everything else. Inserting
+and removing a task is thus O(log n).
+
+As tasks of the same shape fit the same workers, send_one_task only tries the
+first task of each shape, and parks the shapes for which no worker was found
+until the next dispatch pass, so that a long run of tasks that cannot be
+placed is skipped at once.
+*/
+
+struct ready_task {
+	struct work_queue_task *task;
+	struct ready_shape *shape;
+	int index;
+	int first;
+	double priority;
+	int64_t end;
+	uint64_t seq;
+};
+
+struct ready_shape {
+	char *key;
+	struct ready_task **heap;
+	int size;
+	int capacity;
+	uint64_t parked_epoch;
+};
+
+static char *ready_shape_key(struct work_queue_task *t)
+{
+	const struct rmsummary *r = t->resources_requested;
+
+	char *key = string_format("%s:%d:%" PRId64 ":%" PRId64 ":%" PRId64 ":%" PRId64,
+			t->category ? t->category : "default",
+			(int) t->resource_request,
+			r->cores, r->memory, r->disk, r->gpus);
+
+	if(t->features) {
+		char *feature;
+		list_first_item(t->features);
+		while((feature = list_next_item(t->features))) {
+			key = string_combine_multi(key, ":", feature, 0);
+		}
+	}
+
+	return key;
+}
+
+/* returns 1 if a should be sent before b. */
+static int ready_task_before(struct ready_task *a, struct ready_task *b)
+{
+	if(a->first != b->first)
+		return a->first;
+
+	/* tasks pushed to the head go in reverse order, newest first. */
+	if(a->first)
+		return a->seq > b->seq;
+
+	if(a->priority != b->priority)
+		return a->priority > b->priority;
+
+	return a->seq < b->seq;
+}
+
+static void ready_shape_set(struct ready_shape *shape, int index, struct ready_task *rt)
+{
+	shape->heap[index] = rt;
+	rt->index = index;
+}
+
+static void ready_shape_sift_up(struct ready_shape *shape, int index)
+{
+	struct ready_task *rt = shape->heap[index];
+
+	while(index > 0) {
+		int parent = (index - 1) / 2;
+		if(!ready_task_before(rt, shape->heap[parent]))
+			break;
+		ready_shape_set(shape, index, shape->heap[parent]);
+		index = parent;
+	}
+
+	ready_shape_set(shape, index, rt);
+}
+
+static void ready_shape_sift_down(struct ready_shape *shape, int index)
+{
+	struct ready_task *rt = shape->heap[index];
+
+	while(1) {
+		int child = 2 * index + 1;
+		if(child >= shape->size)
+			break;
+		if(child + 1 < shape->size && ready_task_before(shape->heap[child + 1], shape->heap[child]))
+			child++;
+		if(!ready_task_before(shape->heap[child], rt))
+			break;
+		ready_shape_set(shape, index, shape->heap[child]);
+		index = child;
+	}
+
+	ready_shape_set(shape, index, rt);
+}
+
+static void ready_queue_push(struct work_queue *q, struct work_queue_task *t, int first)
+{
+	char *key = ready_shape_key(t);
+
+	struct ready_shape *shape = hash_table_lookup(q->ready_shapes, key);
+	if(!shape) {
+		shape = calloc(1, sizeof(*shape));
+		if(!shape) {
+			fatal("allocating memory for ready queue failed.");
+		}
+		shape->key = key;
+		hash_table_insert(q->ready_shapes, key, shape);
+	} else {
+		free(key);
+	}
+
+	if(shape->size >= shape->capacity) {
+		shape->capacity = MAX(8, 2*shape->capacity);
+		shape->heap = realloc(shape->heap, sizeof(*shape->heap) * shape->capacity);
+		if(!shape->heap) {
+			fatal("reallocating memory for ready queue failed.");
+		}
+	}
+
+	struct ready_task *rt = malloc(sizeof(*rt));
+	if(!rt) {
+		fatal("allocating memory for ready queue failed.");
+	}
+
+	rt->task     = t;
+	rt->shape    = shape;
+	rt->first    = first;
+	rt->priority = t->priority;
+	rt->end      = t->resources_requested->end;
+	rt->seq      = q->ready_seq++;
+
+	itable_insert(q->ready_tasks, t->taskid, rt);
+
+	/* the end time is kept as it was pushed, so that it is counted out as it was counted in. */
+	if(rt->end > 0)
+		q->ready_with_deadline++;
+
+	shape->size++;
+	ready_shape_set(shape, shape->size - 1, rt);
+	ready_shape_sift_up(shape, shape->size - 1);
+}
+
+static void ready_queue_remove(struct work_queue *q, struct work_queue_task *t)
+{
+	struct ready_task *rt = itable_remove(q->ready_tasks, t->taskid);
+	if(!rt)
+		return;
+
+	if(rt->end > 0)
+		q->ready_with_deadline--;
+
+	struct ready_shape *shape = rt->shape;
+	int index = rt->index;
+
+	shape->size--;
+	if(index < shape->size) {
+		ready_shape_set(shape, index, shape->heap[shape->size]);
+		if(index > 0 && ready_task_before(shape->heap[index], shape->heap[(index - 1) / 2])) {
+			ready_shape_sift_up(shape, index);
+		} else {
+			ready_shape_sift_down(shape, index);
+		}
+	}
+
+	free(rt);
+
+	if(shape->size < 1) {
+		hash_table_remove(q->ready_shapes, shape->key);
+		free(shape->key);
+		free(shape->heap);
+		free(shape);
+	}
+}
+
+/* Returns the shape, not parked in this epoch, with the first task to send. */
+static struct ready_shape *ready_queue_next_shape(struct work_queue *q)
+{
+	struct ready_shape *best = NULL;
+	struct ready_shape *shape;
+	char *key;
+
+	hash_table_firstkey(q->ready_shapes);
+	while(hash_table_nextkey(q->ready_shapes, &key, (void **) &shape)) {
+		if(shape->parked_epoch == q->ready_epoch)
+			continue;
+		if(!best || ready_task_before(shape->heap[0], best->heap[0]))
+			best = shape;
+	}
+
+	return best;
+}
+
+static void ready_queue_delete(struct work_queue *q)
+{
+	uint64_t taskid;
+	struct ready_task *rt;
+
+	itable_firstkey(q->ready_tasks);
+	while(itable_nextkey(q->ready_tasks, &taskid, (void **) &rt)) {
+		free(rt);
+	}
+	itable_delete(q->ready_tasks);
+
+	char *key;
+	struct ready_shape *shape;
+	hash_table_firstkey(q->ready_shapes);
+	while(hash_table_nextkey(q->ready_shapes, &key, (void **) &shape)) {
+		free(shape->key);
+		free(shape->heap);
+		free(shape);
+	}
+	hash_table_delete(q->ready_shapes);
 }
 
 /*
@@ -1631,28 +2382,30 @@ static int expire_waiting_tasks(struct work_queue *q)
 {
 	struct work_queue_task *t;
 	int expired = 0;
-	int count;
 
-	timestamp_t current_time = timestamp_get();
-	count = task_state_count(q, NULL, WORK_QUEUE_TASK_READY);
+	if(q->ready_with_deadline < 1)
+		return 0;
 
-	while(count > 0)
-	{
-		count--;
+	timestamp_t current_time = timestamp_get();
 
-		t = list_pop_head(q->ready_list);
+	struct list *expiring = list_create();
 
-		if(t->resources_requested->end > 0 && (uint64_t) t->resources_requested->end <= current_time)
-		{
-			expire_waiting_task(q, t);
-			expired++;
-		}
-		else
-		{
-			list_push_tail(q->ready_list, t);
+	uint64_t taskid;
+	struct ready_task *rt;
+	itable_firstkey(q->ready_tasks);
+	while(itable_nextkey(q->ready_tasks, &taskid, (void **) &rt)) {
+		if(rt->end > 0 && (uint64_t) rt->end <= current_time) {
+			list_push_tail(expiring, rt->task);
 		}
 	}
 
+	while((t = list_pop_head(expiring))) {
+		expire_waiting_task(q, t);
+		expired++;
+	}
+
+	list_delete(expiring);
+
 	return expired;
 }
 
@@ -2044,8 +2797,11 @@ static struct rmsummary *largest_waiting_declared_resources(struct work_queue *q
 	struct rmsummary *max_resources_waiting = rmsummary_create(-1);
 	struct work_queue_task *t;
 
-	list_first_item(q->ready_list);
-	while((t = list_next_item(q->ready_list))) {
+	uint64_t taskid;
+	struct ready_task *rt;
+	itable_firstkey(q->ready_tasks);
+	while(itable_nextkey(q->ready_tasks, &taskid, (void **) &rt)) {
+		t = rt->task;
 
 		if(!category || (t->category && !strcmp(t->category, category))) {
 			rmsummary_merge_max(max_resources_waiting, t->resources_requested);
@@ -2067,8 +2823,11 @@ static struct rmsummary  *total_resources_needed(struct work_queue *q) {
 	struct rmsummary *total = rmsummary_create(0);
 
 	/* for waiting tasks, we use what they would request if dispatched right now. */
-	list_first_item(q->ready_list);
-	while((t = list_next_item(q->ready_list))) {
+	uint64_t taskid;
+	struct ready_task *rt;
+	itable_firstkey(q->ready_tasks);
+	while(itable_nextkey(q->ready_tasks, &taskid, (void **) &rt)) {
+		t = rt->task;
 		const struct rmsummary *s = task_min_resources(q, t);
 		rmsummary_add(total, s);
 	}
@@ -2096,8 +2855,11 @@ static struct rmsummary *largest_waiting_measured_resources(struct work_queue *q
 	struct rmsummary *max_resources_waiting = rmsummary_create(-1);
 	struct work_queue_task *t;
 
-	list_first_item(q->ready_list);
-	while((t = list_next_item(q->ready_list))) {
+	uint64_t taskid;
+	struct ready_task *rt;
+	itable_firstkey(q->ready_tasks);
+	while(itable_nextkey(q->ready_tasks, &taskid, (void **) &rt)) {
+		t = rt->task;
 
 		if(!category || (t->category && !strcmp(t->category, category))) {
 			const struct rmsummary *r = task_min_resources(q, t);
@@ -2314,6 +3076,7 @@ static struct jx * queue_to_jx( struct work_queue *q, struct link *foreman_uplin
 	jx_insert_integer(j,"tasks_failed",info.tasks_failed);
 	jx_insert_integer(j,"tasks_cancelled",info.tasks_cancelled);
 	jx_insert_integer(j,"tasks_exhausted_attempts",info.tasks_exhausted_attempts);
+	jx_insert_integer(j,"dispatch_batch",info.dispatch_batch);
 
 	// tasks_complete is deprecated, but the old work_queue_status expects it.
 	jx_insert_integer(j,"tasks_complete",info.tasks_done);
@@ -2335,6 +3098,9 @@ static struct jx * queue_to_jx( struct work_queue *q, struct link *foreman_uplin
 
 	jx_insert_integer(j,"bytes_sent",info.bytes_sent);
 	jx_insert_integer(j,"bytes_received",info.bytes_received);
+	jx_insert_integer(j,"bytes_compressed",info.bytes_compressed);
+	jx_insert_integer(j,"bytes_compressed_wire",info.bytes_compressed_wire);
+	jx_insert_integer(j,"time_compress",info.time_compress);
 
 	jx_insert_integer(j,"capacity_tasks",info.capacity_tasks);
 	jx_insert_integer(j,"capacity_cores",info.capacity_cores);
@@ -2702,6 +3468,45 @@ static work_queue_msg_code_t process_feature( struct work_queue *q, struct work_
 	return MSG_PROCESSED;
 }
 
+/*
+The worker reports whether it could fetch a file from a peer.
+If it could not, the file is no longer considered cached in the worker,
+and it will be sent by the master from now on.
+*/
+
+static work_queue_msg_code_t process_peerget_complete( struct work_queue *q, struct work_queue_worker *w, const char *line )
+{
+	char name_encoded[WORK_QUEUE_LINE_MAX];
+	char cached_name[WORK_QUEUE_LINE_MAX];
+	int ok;
+
+	if(sscanf(line, "peerget-complete %d %s", &ok, name_encoded) != 2) {
+		return MSG_FAILURE;
+	}
+
+	url_decode(name_encoded, cached_name, sizeof(cached_name));
+
+	char *key = string_format("%s/%s", w->hashkey, cached_name);
+	char *source_key = hash_table_remove(q->peer_transfers, key);
+	free(key);
+
+	if(source_key) {
+		struct work_queue_worker *source = hash_table_lookup(q->worker_table, source_key);
+		if(source) {
+			source->peer_transfers_active--;
+		}
+		free(source_key);
+	}
+
+	if(!ok) {
+		debug(D_WQ, "%s (%s) could not fetch %s from a peer, the master will send it instead.", w->hostname, w->addrport, cached_name);
+		worker_cache_remove(q, w, cached_name);
+		hash_table_insert(w->peer_failed_files, cached_name, (void **) 1);
+	}
+
+	return MSG_PROCESSED;
+}
+
 static work_queue_result_code_t handle_worker(struct work_queue *q, struct link *l)
 {
 	char line[WORK_QUEUE_LINE_MAX];
@@ -2732,57 +3537,6 @@ static work_queue_result_code_t handle_worker(struct work_queue *q, struct link
 	return WQ_SUCCESS;
 }
 
-static int build_poll_table(struct work_queue *q, struct link *master)
-{
-	int n = 0;
-	char *key;
-	struct work_queue_worker *w;
-
-	// Allocate a small table, if it hasn't been done yet.
-	if(!q->poll_table) {
-		q->poll_table = malloc(sizeof(*q->poll_table) * q->poll_table_size);
-		if(!q->poll_table) {
-			//if we can't allocate a poll table, we can't do anything else.
-			fatal("allocating memory for poll table failed.");
-		}
-	}
-
-	// The first item in the poll table is the master link, which accepts new connections.
-	q->poll_table[0].link = q->master_link;
-	q->poll_table[0].events = LINK_READ;
-	q->poll_table[0].revents = 0;
-	n = 1;
-
-	if(master) {
-		/* foreman uplink */
-		q->poll_table[1].link = master;
-		q->poll_table[1].events = LINK_READ;
-		q->poll_table[1].revents = 0;
-		n++;
-	}
-
-	// For every worker in the hash table, add an item to the poll table
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		// If poll table is not large enough, reallocate it
-		if(n >= q->poll_table_size) {
-			q->poll_table_size *= 2;
-			q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
-			if(q->poll_table == NULL) {
-				//if we can't allocate a poll table, we can't do anything else.
-				fatal("reallocating memory for poll table failed.");
-			}
-		}
-
-		q->poll_table[n].link = w->link;
-		q->poll_table[n].events = LINK_READ;
-		q->poll_table[n].revents = 0;
-		n++;
-	}
-
-	return n;
-}
-
 /*
 Send a symbolic link to the remote worker.
 Note that the target of the link is sent
@@ -2857,11 +3611,21 @@ static int send_file( struct work_queue *q, struct work_queue_worker *w, struct
 	url_encode(remotename,remotename_encoded,sizeof(remotename_encoded));
 
 	stoptime = time(0) + get_transfer_wait_time(q, w, t, length);
-	send_worker_msg(q,w, "put %s %"PRId64" 0%o\n",remotename_encoded, length, mode );
-	actual = link_stream_from_fd(w->link, fd, length, stoptime);
-	close(fd);
 
-	*total_bytes += actual;
+	if(compression_pays(q, w, fd, NULL, length)) {
+		struct work_queue_compress_stats s;
+		memset(&s, 0, sizeof(s));
+		send_worker_msg(q,w, "putz %s %"PRId64" 0%o\n",remotename_encoded, length, mode );
+		actual = work_queue_compress_send(w->link, fd, NULL, length, stoptime, &s);
+		record_compressed_transfer(q, w, t, "INPUT", localname, &s);
+		*total_bytes += s.wire_bytes;
+	} else {
+		send_worker_msg(q,w, "put %s %"PRId64" 0%o\n",remotename_encoded, length, mode );
+		actual = link_stream_from_fd(w->link, fd, length, stoptime);
+		*total_bytes += actual;
+	}
+
+	close(fd);
 
 	if(actual != length) return WQ_WORKER_FAILURE;
 
@@ -2960,6 +3724,207 @@ static work_queue_result_code_t send_item( struct work_queue *q, struct work_que
 	return result;
 }
 
+/*
+With content addressed caching, cacheable input files are named at the worker
+by the md5 of their contents, rather than of their local path. The same bytes
+reached through different paths are then cached once, and even shared among
+masters using the same worker, while a file changed in place gets a new name
+instead of silently reusing the old copy. The digests are memoized by device
+and inode, together with the version of the file they were computed from,
+so that each version of a file is read only once. A file rewritten within
+the same second is told apart by the nanoseconds of its modification time,
+and by its change time. Only the last version of each file is remembered.
+*/
+
+#if defined(CCTOOLS_OPSYS_DARWIN)
+#define STAT_MTIME_NSEC(s) ((s)->st_mtimespec.tv_nsec)
+#define STAT_CTIME_NSEC(s) ((s)->st_ctimespec.tv_nsec)
+#else
+#define STAT_MTIME_NSEC(s) ((s)->st_mtim.tv_nsec)
+#define STAT_CTIME_NSEC(s) ((s)->st_ctim.tv_nsec)
+#endif
+
+struct content_digest {
+	char *version;    // "mtime:ctime:size" of the file when it was read
+	char *digest;
+};
+
+static void content_digest_delete(struct content_digest *d)
+{
+	if(!d)
+		return;
+
+	free(d->version);
+	free(d->digest);
+	free(d);
+}
+
+static const char *content_digest(struct work_queue *q, const char *path, const struct stat *info)
+{
+	char key[64];
+	snprintf(key, sizeof(key), "%llu:%llu",
+			(unsigned long long) info->st_dev,
+			(unsigned long long) info->st_ino);
+
+	char version[128];
+	snprintf(version, sizeof(version), "%lld.%09ld:%lld.%09ld:%lld",
+			(long long) info->st_mtime, (long) STAT_MTIME_NSEC(info),
+			(long long) info->st_ctime, (long) STAT_CTIME_NSEC(info),
+			(long long) info->st_size);
+
+	struct content_digest *d = hash_table_lookup(q->content_digests, key);
+	if(d && !strcmp(d->version, version))
+		return d->digest;
+
+	/* the file changed since it was last read, so its old digest is of no further use. */
+	content_digest_delete(hash_table_remove(q->content_digests, key));
+
+	unsigned char md5[MD5_DIGEST_LENGTH];
+	if(!md5_file(path, md5)) {
+		debug(D_WQ, "Could not checksum %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	d = xxmalloc(sizeof(*d));
+	d->version = xxstrdup(version);
+	d->digest = xxstrdup(md5_string(md5));
+	hash_table_insert(q->content_digests, key, d);
+	debug(D_WQ, "%s has contents %s", path, d->digest);
+
+	return d->digest;
+}
+
+/* Returns true if the cached name of the file is now derived from its contents. */
+static int update_content_cached_name(struct work_queue *q, struct work_queue_file *f, const char *path)
+{
+	if(!q->content_addressed_cache || f->type != WORK_QUEUE_FILE || !(f->flags & WORK_QUEUE_CACHE))
+		return 0;
+
+	struct stat info;
+	if(stat(path, &info) < 0 || !S_ISREG(info.st_mode))
+		return 0;
+
+	const char *digest = content_digest(q, path, &info);
+	if(!digest)
+		return 0;
+
+	/* the permissions are part of the name, as they are kept in the cache. */
+	char *cached_name = string_format("content-%s-%o", digest, (unsigned int) (info.st_mode & 0777));
+
+	if(strcmp(cached_name, f->cached_name)) {
+		free(f->cached_name);
+		f->cached_name = cached_name;
+	} else {
+		free(cached_name);
+	}
+
+	return 1;
+}
+
+/*
+Rather than sending a cached file from the master, a worker with a transfer
+server may be asked to fetch it from a peer that already holds the same
+version. A worker serves at most peer_transfer_limit transfers at a time,
+and a file it is still fetching cannot be served to others. A worker that
+fails to fetch a file from a peer gets it from the master thereafter.
+*/
+
+static struct work_queue_worker *find_peer_source(struct work_queue *q, struct work_queue_worker *dest, const char *cached_name, const struct stat *local_info)
+{
+	struct work_queue_worker *w;
+	struct work_queue_worker *best = 0;
+
+	struct set *holders = hash_table_lookup(q->peer_sources, cached_name);
+	if(!holders)
+		return 0;
+
+	set_first_element(holders);
+	while((w = set_next_element(holders))) {
+		if(w == dest || w->transfer_port < 1 || w->peer_transfers_active >= q->peer_transfer_limit)
+			continue;
+
+		if(best && best->peer_transfers_active <= w->peer_transfers_active)
+			continue;
+
+		struct stat *info = hash_table_lookup(w->current_files, cached_name);
+		if(!info || info->st_mtime != local_info->st_mtime || info->st_size != local_info->st_size)
+			continue;
+
+		char *key = string_format("%s/%s", w->hashkey, cached_name);
+		int pending = hash_table_lookup(q->peer_transfers, key) != 0;
+		free(key);
+
+		if(!pending) {
+			best = w;
+		}
+	}
+
+	return best;
+}
+
+static int send_item_from_peer(struct work_queue *q, struct work_queue_worker *w, struct work_queue_file *tf, const struct stat *local_info)
+{
+	if(q->peer_transfer_limit < 1 || w->transfer_port < 1)
+		return 0;
+
+	if(tf->type != WORK_QUEUE_FILE || !(tf->flags & WORK_QUEUE_CACHE) || !S_ISREG(local_info->st_mode))
+		return 0;
+
+	if(hash_table_lookup(w->peer_failed_files, tf->cached_name))
+		return 0;
+
+	struct work_queue_worker *source = find_peer_source(q, w, tf->cached_name, local_info);
+	if(!source)
+		return 0;
+
+	char addr[LINK_ADDRESS_MAX];
+	int port;
+	if(!link_address_remote(source->link, addr, &port))
+		return 0;
+
+	char name_encoded[WORK_QUEUE_LINE_MAX];
+	url_encode(tf->cached_name, name_encoded, sizeof(name_encoded));
+
+	debug(D_WQ, "%s (%s) will fetch %s from peer %s (%s)", w->hostname, w->addrport, tf->cached_name, source->hostname, source->addrport);
+
+	if(send_worker_msg(q, w, "peerget %s %s %d\n", name_encoded, addr, source->transfer_port) < 0)
+		return 0;
+
+	// The file is considered cached from now on, so that other tasks
+	// do not ask for it again while the transfer is in progress.
+	struct stat *remote_info = xxmalloc(sizeof(*remote_info));
+	memcpy(remote_info, local_info, sizeof(*local_info));
+	worker_cache_insert(q, w, tf->cached_name, remote_info);
+
+	char *key = string_format("%s/%s", w->hashkey, tf->cached_name);
+	hash_table_insert(q->peer_transfers, key, xxstrdup(source->hashkey));
+	free(key);
+	source->peer_transfers_active++;
+
+	return 1;
+}
+
+static void cancel_peer_transfers(struct work_queue *q, struct work_queue_worker *w)
+{
+	char *key;
+	char *source_key;
+	size_t n = strlen(w->hashkey);
+
+	hash_table_firstkey(q->peer_transfers);
+	while(hash_table_nextkey(q->peer_transfers, &key, (void **) &source_key)) {
+		if(strncmp(key, w->hashkey, n) || key[n] != '/')
+			continue;
+
+		struct work_queue_worker *source = hash_table_lookup(q->worker_table, source_key);
+		if(source) {
+			source->peer_transfers_active--;
+		}
+
+		free(hash_table_remove(q->peer_transfers, key));
+		hash_table_firstkey(q->peer_transfers);
+	}
+}
+
 /*
 Send an item to a remote worker, if it is not already cached.
 The local file name should already have been expanded by the caller.
@@ -2976,9 +3941,12 @@ static work_queue_result_code_t send_item_if_not_cached( struct work_queue *q, s
 		return WQ_APP_FAILURE;
 	}
 
+	int content_named = update_content_cached_name(q, tf, expanded_local_name);
+
 	struct stat *remote_info = hash_table_lookup(w->current_files, tf->cached_name);
 
-	if(remote_info && (remote_info->st_mtime != local_info.st_mtime || remote_info->st_size != local_info.st_size)) {
+	/* A name derived from the contents cannot be stale, even if the copy on the worker came from another path. */
+	if(remote_info && !content_named && (remote_info->st_mtime != local_info.st_mtime || remote_info->st_size != local_info.st_size)) {
 		debug(D_NOTICE|D_WQ, "File %s changed locally. Task %d will be executed with an older version.", expanded_local_name, t->taskid);
 		return WQ_SUCCESS;
 	} else if(!remote_info) {
@@ -2989,6 +3957,10 @@ static work_queue_result_code_t send_item_if_not_cached( struct work_queue *q, s
 		  debug(D_WQ, "%s (%s) needs file %s (offset %lld length %lld) as '%s'", w->hostname, w->addrport, expanded_local_name, (long long) tf->offset, (long long) tf->length, tf->cached_name );
 		}
 
+		if(send_item_from_peer(q, w, tf, &local_info)) {
+			return WQ_SUCCESS;
+		}
+
 		work_queue_result_code_t result;
 		result = send_item(q, w, t, expanded_local_name, tf->cached_name, tf->offset, tf->piece_length, total_bytes, 1 );
 
@@ -2996,7 +3968,7 @@ static work_queue_result_code_t send_item_if_not_cached( struct work_queue *q, s
 			remote_info = xxmalloc(sizeof(*remote_info));
 			if(remote_info) {
 				memcpy(remote_info, &local_info, sizeof(local_info));
-				hash_table_insert(w->current_files, tf->cached_name, remote_info);
+				worker_cache_insert(q, w, tf->cached_name, remote_info);
 			}
 		}
 
@@ -3092,12 +4064,21 @@ static work_queue_result_code_t send_input_file(struct work_queue *q, struct wor
 	case WORK_QUEUE_BUFFER:
 		debug(D_WQ, "%s (%s) needs literal as %s", w->hostname, w->addrport, f->remote_name);
 		time_t stoptime = time(0) + get_transfer_wait_time(q, w, t, f->length);
-		send_worker_msg(q,w, "put %s %d %o\n",f->cached_name, f->length, 0777 );
-		actual = link_putlstring(w->link, f->payload, f->length, stoptime);
+		if(compression_pays(q, w, -1, f->payload, f->length)) {
+			struct work_queue_compress_stats s;
+			memset(&s, 0, sizeof(s));
+			send_worker_msg(q,w, "putz %s %d %o\n",f->cached_name, f->length, 0777 );
+			actual = work_queue_compress_send(w->link, -1, f->payload, f->length, stoptime, &s);
+			record_compressed_transfer(q, w, t, "INPUT", f->remote_name, &s);
+			total_bytes = s.wire_bytes;
+		} else {
+			send_worker_msg(q,w, "put %s %d %o\n",f->cached_name, f->length, 0777 );
+			actual = link_putlstring(w->link, f->payload, f->length, stoptime);
+			total_bytes = actual;
+		}
 		if(actual!=f->length) {
 			result = WQ_WORKER_FAILURE;
 		}
-		total_bytes = actual;
 		break;
 
 	case WORK_QUEUE_REMOTECMD:
@@ -3259,10 +4240,19 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 		command_line = xxstrdup(t->command_line);
 	}
 
+	time_t stoptime = time(0) + (w->type == WORKER_TYPE_FOREMAN ? q->long_timeout : q->short_timeout);
+
+	/* The messages of the task, and those of its small input files, are
+	 * held and sent together when uncorked. */
+	link_cork(w->link);
+
 	work_queue_result_code_t result = send_input_files(q, w, t);
 
 	if (result != WQ_SUCCESS) {
 		free(command_line);
+		if(!link_uncork(w->link, stoptime)) {
+			return WQ_WORKER_FAILURE;
+		}
 		return result;
 	}
 
@@ -3270,7 +4260,7 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 
 	long long cmd_len = strlen(command_line);
 	send_worker_msg(q,w, "cmd %lld\n", (long long) cmd_len);
-	link_putlstring(w->link, command_line, cmd_len, /* stoptime */ time(0) + (w->type == WORKER_TYPE_FOREMAN ? q->long_timeout : q->short_timeout));
+	link_putlstring(w->link, command_line, cmd_len, stoptime);
 	debug(D_WQ, "%s\n", command_line);
 	free(command_line);
 
@@ -3323,12 +4313,11 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 		}
 	}
 
-	// send_worker_msg returns the number of bytes sent, or a number less than
-	// zero to indicate errors. We are lazy here, we only check the last
-	// message we sent to the worker (other messages may have failed above).
-	int result_msg = send_worker_msg(q,w,"end\n");
+	send_worker_msg(q,w,"end\n");
 
-	if(result_msg > -1)
+	// The messages above were only held by the link, so whether they were
+	// all sent is known once uncorked.
+	if(link_uncork(w->link, stoptime))
 	{
 		debug(D_WQ, "%s (%s) busy on '%s'", w->hostname, w->addrport, t->command_line);
 		return WQ_SUCCESS;
@@ -3484,6 +4473,11 @@ static int check_hand_against_task(struct work_queue *q, struct work_queue_worke
 		return 0;
 	}
 
+	/* the worker would not read the task until done sending back outputs. */
+	if(w->retrieval) {
+		return 0;
+	}
+
 	if(w->type != WORKER_TYPE_FOREMAN) {
 		struct blacklist_host_info *info = hash_table_lookup(q->worker_blacklist, w->hostname);
 		if (info && info->blacklisted) {
@@ -3528,45 +4522,226 @@ static int check_hand_against_task(struct work_queue *q, struct work_queue_worke
 	return ok;
 }
 
-static struct work_queue_worker *find_worker_by_files(struct work_queue *q, struct work_queue_task *t)
+/*
+The worker index keeps the workers that may run tasks bucketed by the number
+of cores they have free (after overcommit), so that the schedulers only
+consider workers that have room for a task, rather than every connected
+worker. The index is kept up to date by count_worker_resources, which is
+called whenever a task is committed to or reaped from a worker, and whenever
+a worker reports its resources. Buckets are never deleted, as the number of
+different free core counts is small.
+
+Only the cores are indexed. Whether a worker fits a task also depends on its
+memory, disk, gpus and features, which check_hand_against_task checks for
+each worker in the buckets with enough cores. An index over all of them
+would have to be updated on every commit and reap, for each dimension,
+while the cores alone already set aside the busy workers.
+*/
+
+static void worker_index_add_key(struct work_queue *q, uint64_t key)
+{
+	if(q->worker_index_keys_size >= q->worker_index_keys_capacity) {
+		q->worker_index_keys_capacity = MAX(8, 2*q->worker_index_keys_capacity);
+		q->worker_index_keys = realloc(q->worker_index_keys, sizeof(*q->worker_index_keys) * q->worker_index_keys_capacity);
+		if(!q->worker_index_keys) {
+			fatal("reallocating memory for worker index failed.");
+		}
+	}
+
+	int i = q->worker_index_keys_size;
+	while(i > 0 && q->worker_index_keys[i-1] > key) {
+		q->worker_index_keys[i] = q->worker_index_keys[i-1];
+		i--;
+	}
+
+	q->worker_index_keys[i] = key;
+	q->worker_index_keys_size++;
+}
+
+/* position of the first bucket with at least min_cores free cores. */
+static int worker_index_lower_bound(struct work_queue *q, int64_t min_cores)
+{
+	int lo = 0;
+	int hi = q->worker_index_keys_size;
+
+	if(min_cores < 1)
+		return 0;
+
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+		if(q->worker_index_keys[mid] < (uint64_t) min_cores) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+static void worker_index_remove(struct work_queue *q, struct work_queue_worker *w)
+{
+	if(w->index_key < 0)
+		return;
+
+	struct set *bucket = itable_lookup(q->worker_index, w->index_key);
+	if(bucket)
+		set_remove(bucket, w);
+
+	if(w->index_coreless)
+		q->worker_index_coreless--;
+
+	w->index_key = -1;
+	w->index_coreless = 0;
+}
+
+static void worker_index_update(struct work_queue *q, struct work_queue_worker *w)
+{
+	worker_index_remove(q, w);
+
+	/* workers that have not reported their resources cannot run tasks. */
+	if(w->resources->tag < 0 || w->resources->workers.total < 1)
+		return;
+
+	int64_t key = overcommitted_resource_total(q, w->resources->cores.total, 1) - w->resources->cores.inuse;
+	key = MAX(key, 0);
+
+	struct set *bucket = itable_lookup(q->worker_index, key);
+	if(!bucket) {
+		bucket = set_create(0);
+		itable_insert(q->worker_index, key, bucket);
+		worker_index_add_key(q, key);
+	}
+
+	set_insert(bucket, w);
+	w->index_key = key;
+
+	if(w->resources->cores.largest < 1) {
+		w->index_coreless = 1;
+		q->worker_index_coreless++;
+	}
+}
+
+/* needed when the overcommit parameters change. */
+static void worker_index_rebuild(struct work_queue *q)
 {
 	char *key;
 	struct work_queue_worker *w;
+
+	hash_table_firstkey(q->worker_table);
+	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+		worker_index_update(q, w);
+	}
+}
+
+/* Lower bound of the free cores a worker needs to run t. When the task does
+ * not specify cores, it takes a whole worker, which means at least one core,
+ * unless there are workers without cores. */
+static int64_t task_cores_lower_bound(struct work_queue *q, struct work_queue_task *t)
+{
+	const struct rmsummary *max = task_max_resources(q, t);
+
+	if(max->cores > -1)
+		return max->cores;
+
+	return q->worker_index_coreless > 0 ? 0 : 1;
+}
+
+/* Returns the workers that can run t, in increasing order of free cores. If
+ * limit is positive, stop after finding that many workers. */
+static struct list *find_candidate_workers(struct work_queue *q, struct work_queue_task *t, int limit)
+{
+	struct list *candidates = list_create();
+	struct work_queue_worker *w;
+
+	int i;
+	for(i = worker_index_lower_bound(q, task_cores_lower_bound(q, t)); i < q->worker_index_keys_size; i++) {
+		struct set *bucket = itable_lookup(q->worker_index, q->worker_index_keys[i]);
+
+		set_first_element(bucket);
+		while((w = set_next_element(bucket))) {
+			if(check_hand_against_task(q, w, t)) {
+				list_push_tail(candidates, w);
+
+				if(limit > 0 && list_size(candidates) >= limit) {
+					return candidates;
+				}
+			}
+		}
+	}
+
+	return candidates;
+}
+
+/* The workers that hold cached inputs of the task are found from the holders
+ * of each input, so only those are ranked by the bytes they already have. If
+ * none of them can run the task, any worker that can is as good as another. */
+static struct work_queue_worker *find_worker_by_files(struct work_queue *q, struct work_queue_task *t)
+{
+	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = 0;
 	int64_t most_task_cached_bytes = 0;
-	int64_t task_cached_bytes;
 	struct stat *remote_info;
 	struct work_queue_file *tf;
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		if( check_hand_against_task(q, w, t) ) {
-			task_cached_bytes = 0;
-			list_first_item(t->input_files);
-			while((tf = list_next_item(t->input_files))) {
-				if((tf->type == WORK_QUEUE_FILE || tf->type == WORK_QUEUE_FILE_PIECE) && (tf->flags & WORK_QUEUE_CACHE)) {
-					remote_info = hash_table_lookup(w->current_files, tf->cached_name);
-					if(remote_info)
-						task_cached_bytes += remote_info->st_size;
+	struct itable *cached_bytes = itable_create(0);
+
+	list_first_item(t->input_files);
+	while((tf = list_next_item(t->input_files))) {
+		if((tf->type == WORK_QUEUE_FILE || tf->type == WORK_QUEUE_FILE_PIECE) && (tf->flags & WORK_QUEUE_CACHE)) {
+			struct set *holders = hash_table_lookup(q->peer_sources, tf->cached_name);
+			if(!holders)
+				continue;
+
+			set_first_element(holders);
+			while((w = set_next_element(holders))) {
+				remote_info = hash_table_lookup(w->current_files, tf->cached_name);
+				if(remote_info) {
+					int64_t bytes = (int64_t) (intptr_t) itable_lookup(cached_bytes, (uintptr_t) w);
+					itable_insert(cached_bytes, (uintptr_t) w, (void *) (intptr_t) (bytes + remote_info->st_size));
 				}
 			}
+		}
+	}
 
-			if(!best_worker || task_cached_bytes > most_task_cached_bytes) {
-				best_worker = w;
-				most_task_cached_bytes = task_cached_bytes;
-			}
+	uint64_t key;
+	void *value;
+	itable_firstkey(cached_bytes);
+	while(itable_nextkey(cached_bytes, &key, &value)) {
+		w = (struct work_queue_worker *) (uintptr_t) key;
+		int64_t task_cached_bytes = (int64_t) (intptr_t) value;
+
+		if(task_cached_bytes > most_task_cached_bytes && check_hand_against_task(q, w, t)) {
+			best_worker = w;
+			most_task_cached_bytes = task_cached_bytes;
 		}
 	}
 
+	itable_delete(cached_bytes);
+
+	if(!best_worker) {
+		struct list *candidates = find_candidate_workers(q, t, 1);
+		best_worker = list_pop_head(candidates);
+		list_delete(candidates);
+	}
+
 	return best_worker;
 }
 
+/* First come, first served keeps the order of the worker table, which the
+ * index does not, and so may visit every worker, but workers that the index
+ * shows to lack the free cores for the task are passed over without a full
+ * check. */
 static struct work_queue_worker *find_worker_by_fcfs(struct work_queue *q, struct work_queue_task *t)
 {
 	char *key;
 	struct work_queue_worker *w;
+	int64_t min_cores = task_cores_lower_bound(q, t);
+
 	hash_table_firstkey(q->worker_table);
 	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
+		if(w->index_key < min_cores)
+			continue;
 		if( check_hand_against_task(q, w, t) ) {
 			return w;
 		}
@@ -3574,21 +4749,14 @@ static struct work_queue_worker *find_worker_by_fcfs(struct work_queue *q, struc
 	return NULL;
 }
 
+/* A uniform choice needs every worker that can run the task, as only the free
+ * cores are indexed, and so this visits each worker with room for the task. */
 static struct work_queue_worker *find_worker_by_random(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w = NULL;
 	int random_worker;
-	struct list *valid_workers = list_create();
-
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
-		if(check_hand_against_task(q, w, t)) {
-			list_push_tail(valid_workers, w);
-		}
-	}
+	struct list *valid_workers = find_candidate_workers(q, t, 0);
 
-	w = NULL;
 	if(list_size(valid_workers) > 0) {
 		random_worker = (rand() % list_size(valid_workers)) + 1;
 
@@ -3639,7 +4807,6 @@ static int compare_worst_fit(struct work_queue_resources *a, struct work_queue_r
 
 static struct work_queue_worker *find_worker_by_worst_fit(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = NULL;
 
@@ -3649,52 +4816,71 @@ static struct work_queue_worker *find_worker_by_worst_fit(struct work_queue *q,
 	memset(&bres, 0, sizeof(struct work_queue_resources));
 	memset(&wres, 0, sizeof(struct work_queue_resources));
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		if( check_hand_against_task(q, w, t) ) {
+	/* Without overcommit, buckets are ordered by the free cores as computed
+	 * below, thus the worst fit is in the first bucket, from the top, that has
+	 * a worker for the task. */
+	int overcommit = q->asynchrony_multiplier > 1.0 || q->asynchrony_modifier > 0;
 
-			//Use total field on bres, wres to indicate free resources.
-			wres.cores.total   = w->resources->cores.total   - w->resources->cores.inuse;
-			wres.memory.total  = w->resources->memory.total  - w->resources->memory.inuse;
-			wres.disk.total    = w->resources->disk.total    - w->resources->disk.inuse;
-			wres.gpus.total    = w->resources->gpus.total    - w->resources->gpus.inuse;
+	int lower = worker_index_lower_bound(q, task_cores_lower_bound(q, t));
 
-			if(!best_worker || compare_worst_fit(&bres, &wres))
-			{
-				best_worker = w;
-				memcpy(&bres, &wres, sizeof(struct work_queue_resources));
+	int i;
+	for(i = q->worker_index_keys_size - 1; i >= lower; i--) {
+		struct set *bucket = itable_lookup(q->worker_index, q->worker_index_keys[i]);
+
+		set_first_element(bucket);
+		while((w = set_next_element(bucket))) {
+			if( check_hand_against_task(q, w, t) ) {
+
+				//Use total field on bres, wres to indicate free resources.
+				wres.cores.total   = w->resources->cores.total   - w->resources->cores.inuse;
+				wres.memory.total  = w->resources->memory.total  - w->resources->memory.inuse;
+				wres.disk.total    = w->resources->disk.total    - w->resources->disk.inuse;
+				wres.gpus.total    = w->resources->gpus.total    - w->resources->gpus.inuse;
+
+				if(!best_worker || compare_worst_fit(&bres, &wres))
+				{
+					best_worker = w;
+					memcpy(&bres, &wres, sizeof(struct work_queue_resources));
+				}
 			}
 		}
+
+		if(best_worker && !overcommit) {
+			break;
+		}
 	}
 
 	return best_worker;
 }
 
+/* The average time of a worker is not indexed, and so this ranks each worker
+ * with room for the task. */
 static struct work_queue_worker *find_worker_by_time(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = 0;
 	double best_time = HUGE_VAL;
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		if(check_hand_against_task(q, w, t)) {
-			if(w->total_tasks_complete > 0) {
-				double t = (w->total_task_time + w->total_transfer_time) / w->total_tasks_complete;
-				if(!best_worker || t < best_time) {
-					best_worker = w;
-					best_time = t;
-				}
+	struct list *candidates = find_candidate_workers(q, t, 0);
+
+	list_first_item(candidates);
+	while((w = list_next_item(candidates))) {
+		if(w->total_tasks_complete > 0) {
+			double t = (w->total_task_time + w->total_transfer_time) / w->total_tasks_complete;
+			if(!best_worker || t < best_time) {
+				best_worker = w;
+				best_time = t;
 			}
 		}
 	}
 
-	if(best_worker) {
-		return best_worker;
-	} else {
-		return find_worker_by_fcfs(q, t);
+	if(!best_worker) {
+		best_worker = list_peek_head(candidates);
 	}
+
+	list_delete(candidates);
+
+	return best_worker;
 }
 
 // use task-specific algorithm if set, otherwise default to the queue's setting.
@@ -3735,6 +4921,7 @@ static void count_worker_resources(struct work_queue *q, struct work_queue_worke
 
 	if(w->resources->workers.total < 1)
 	{
+		worker_index_remove(q, w);
 		return;
 	}
 
@@ -3745,6 +4932,8 @@ static void count_worker_resources(struct work_queue *q, struct work_queue_worke
 		w->resources->disk.inuse      += box->disk;
 		w->resources->gpus.inuse      += box->gpus;
 	}
+
+	worker_index_update(q, w);
 }
 
 static void update_max_worker(struct work_queue *q, struct work_queue_worker *w) {
@@ -3845,15 +5034,20 @@ static int send_one_task( struct work_queue *q )
 	struct work_queue_task *t;
 	struct work_queue_worker *w;
 
-	// Consider each task in the order of priority:
-	list_first_item(q->ready_list);
-	while( (t = list_next_item(q->ready_list))) {
+	// Consider each task in the order of priority. Tasks of a shape are
+	// equivalent for placement, so only the first task of each shape is tried:
+	struct ready_shape *shape;
+	while((shape = ready_queue_next_shape(q))) {
+		t = shape->heap[0]->task;
 
 		// Find the best worker for the task at the head of the list
 		w = find_best_worker(q,t);
 
-		// If there is no suitable worker, consider the next task.
-		if(!w) continue;
+		// If there is no suitable worker, park the shape and consider the next task.
+		if(!w) {
+			shape->parked_epoch = q->ready_epoch;
+			continue;
+		}
 
 		// Otherwise, remove it from the ready list and start it:
 		commit_task_to_worker(q,w,t);
@@ -3864,23 +5058,37 @@ static int send_one_task( struct work_queue *q )
 	return 0;
 }
 
-static int receive_one_task( struct work_queue *q )
+/*
+Send as many tasks as workers can take, up to the count and time budgets of
+the dispatch phase, so that a wave of newly connected workers is filled in
+one pass rather than one task per iteration of work_queue_wait. Returns the
+number of tasks sent.
+*/
+
+static int send_tasks( struct work_queue *q )
 {
-	struct work_queue_task *t;
+	int sent = 0;
+	timestamp_t stoptime = timestamp_get() + (timestamp_t) (q->dispatch_batch_time * 1000000);
 
-	struct work_queue_worker *w;
-	uint64_t taskid;
+	// Workers may have room for parked shapes since the last dispatch.
+	q->ready_epoch++;
 
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if( task_state_is(q, taskid, WORK_QUEUE_TASK_WAITING_RETRIEVAL) ) {
-			w = itable_lookup(q->worker_task_map, taskid);
-			fetch_output_from_worker(q, w, taskid);
-			return 1;
-		}
+	while(sent < q->dispatch_batch_size) {
+		if(!send_one_task(q))
+			break;
+
+		sent++;
+
+		if(timestamp_get() >= stoptime)
+			break;
 	}
 
-	return 0;
+	if(sent > 0) {
+		q->stats->dispatch_batch = sent;
+		debug(D_WQ, "dispatched %d tasks in this iteration.", sent);
+	}
+
+	return sent;
 }
 
 //Sends keepalives to check if connected workers are responsive, and ask for updates If not, removes those workers.
@@ -3903,6 +5111,11 @@ static void ask_for_workers_updates(struct work_queue *q) {
 				continue;
 			}
 
+			// a worker sending back outputs does not answer until done,
+			// and the retrieval has its own timeout.
+			if(w->retrieval) {
+				continue;
+			}
 
 			// send new keepalive check only (1) if we received a response since last keepalive check AND
 			// (2) we are past keepalive interval
@@ -4063,6 +5276,11 @@ static int cancel_task_on_worker(struct work_queue *q, struct work_queue_task *t
 	struct work_queue_worker *w = itable_lookup(q->worker_task_map, t->taskid);
 
 	if (w) {
+		// The outputs of the task that are still being sent back are discarded.
+		if(w->retrieval && w->retrieval->task == t) {
+			w->retrieval->task = NULL;
+		}
+
 		//send message to worker asking to kill its task.
 		send_worker_msg(q,w, "kill %d\n",t->taskid);
 		debug(D_WQ, "Task with id %d is aborted at worker %s (%s) and removed.", t->taskid, w->hostname, w->addrport);
@@ -4979,19 +6197,34 @@ struct work_queue *work_queue_create(int port)
 		link_address_local(q->master_link, address, &q->port);
 	}
 
+	q->poller = link_poller_create();
+	if(!q->poller || !link_poller_add(q->poller, q->master_link, LINK_READ)) {
+		debug(D_NOTICE, "Could not watch connections to work_queue on port %i.", q->port);
+		link_poller_delete(q->poller);
+		link_close(q->master_link);
+		free(q);
+		return 0;
+	}
+
 	getcwd(q->workingdir,PATH_MAX);
 
 	q->next_taskid = 1;
 
-	q->ready_list = list_create();
+	q->ready_shapes = hash_table_create(0, 0);
+	q->ready_tasks  = itable_create(0);
+	q->ready_epoch  = 1;
 
 	q->tasks          = itable_create(0);
 
 	q->task_state_map = itable_create(0);
+	q->task_entries = itable_create(0);
+	q->task_counts = xxcalloc(1, sizeof(*q->task_counts));
+	q->category_task_counts = hash_table_create(0, 0);
 
 	q->worker_table = hash_table_create(0, 0);
 	q->worker_blacklist = hash_table_create(0, 0);
 	q->worker_task_map = itable_create(0);
+	q->worker_index = itable_create(0);
 
 	q->measured_local_resources   = rmsummary_create(-1);
 	q->current_max_worker         = rmsummary_create(-1);
@@ -5001,9 +6234,10 @@ struct work_queue *work_queue_create(int port)
 	q->stats_measure              = calloc(1, sizeof(struct work_queue_stats));
 
 	q->workers_with_available_results = hash_table_create(0, 0);
+	q->workers_retrieving = hash_table_create(0, 0);
 
 	// The poll table is initially null, and will be created
-	// (and resized) as needed by build_poll_table.
+	// (and resized) as needed by poll_active_workers.
 	q->poll_table_size = 8;
 
 	q->worker_selection_algorithm = wq_option_scheduler;
@@ -5012,6 +6246,15 @@ struct work_queue *work_queue_create(int port)
 	q->short_timeout = 5;
 	q->long_timeout = 3600;
 
+	q->dispatch_batch_size = 1000;
+	q->dispatch_batch_time = 1;
+
+	q->content_digests = hash_table_create(0, 0);
+
+	q->peer_transfer_limit = 3;
+	q->peer_transfers = hash_table_create(0, 0);
+	q->peer_sources = hash_table_create(0, 0);
+
 	q->stats->time_when_started = timestamp_get();
 	q->task_reports = list_create();
 
@@ -5050,6 +6293,11 @@ struct work_queue *work_queue_create(int port)
 		}
 	}
 
+	if(getenv("WORK_QUEUE_CHECK_TASK_INDEX")) {
+		q->check_task_index = 1;
+		debug(D_WQ, "checking the task index at every change of task state");
+	}
+
 	//Deprecated:
 	q->task_ordering = WORK_QUEUE_TASK_ORDER_FIFO;
 	//
@@ -5280,6 +6528,15 @@ void work_queue_delete(struct work_queue *q)
 		hash_table_delete(q->worker_blacklist);
 		itable_delete(q->worker_task_map);
 
+		struct set *bucket;
+		uint64_t free_cores;
+		itable_firstkey(q->worker_index);
+		while(itable_nextkey(q->worker_index, &free_cores, (void **) &bucket)) {
+			set_delete(bucket);
+		}
+		itable_delete(q->worker_index);
+		free(q->worker_index_keys);
+
 		struct category *c;
 		hash_table_firstkey(q->categories);
 		while(hash_table_nextkey(q->categories, &key, (void **) &c)) {
@@ -5287,13 +6544,36 @@ void work_queue_delete(struct work_queue *q)
 		}
 		hash_table_delete(q->categories);
 
-		list_delete(q->ready_list);
+		ready_queue_delete(q);
 
 		itable_delete(q->tasks);
 
 		itable_delete(q->task_state_map);
+		task_index_delete(q);
 
 		hash_table_delete(q->workers_with_available_results);
+		hash_table_delete(q->workers_retrieving);
+
+		struct content_digest *digest;
+		hash_table_firstkey(q->content_digests);
+		while(hash_table_nextkey(q->content_digests, &key, (void **) &digest)) {
+			content_digest_delete(digest);
+		}
+		hash_table_delete(q->content_digests);
+
+		char *source_key;
+		hash_table_firstkey(q->peer_transfers);
+		while(hash_table_nextkey(q->peer_transfers, &key, (void **) &source_key)) {
+			free(source_key);
+		}
+		hash_table_delete(q->peer_transfers);
+
+		struct set *holders;
+		hash_table_firstkey(q->peer_sources);
+		while(hash_table_nextkey(q->peer_sources, &key, (void **) &holders)) {
+			set_delete(holders);
+		}
+		hash_table_delete(q->peer_sources);
 
 		struct work_queue_task_report *tr;
 		list_first_item(q->task_reports);
@@ -5314,6 +6594,7 @@ void work_queue_delete(struct work_queue *q)
 
 		free(q->poll_table);
 		link_close(q->master_link);
+		link_poller_delete(q->poller);
 		if(q->logfile) {
 			fclose(q->logfile);
 		}
@@ -5455,12 +6736,6 @@ char *work_queue_monitor_wrap(struct work_queue *q, struct work_queue_worker *w,
 	return wrap_cmd;
 }
 
-static double work_queue_task_priority(void *item) {
-	assert(item);
-	struct work_queue_task *t = item;
-	return t->priority;
-}
-
 /* Put a given task on the ready list, taking into account the task priority and the queue schedule. */
 
 void push_task_to_ready_list( struct work_queue *q, struct work_queue_task *t )
@@ -5475,11 +6750,7 @@ void push_task_to_ready_list( struct work_queue *q, struct work_queue_task *t )
 		by_priority = 0;
 	}
 
-	if(by_priority) {
-		list_push_priority(q->ready_list, work_queue_task_priority, t);
-	} else {
-		list_push_head(q->ready_list,t);
-	}
+	ready_queue_push(q, t, !by_priority);
 
 	/* If the task has been used before, clear out accumulated state. */
 	clean_task_state(t);
@@ -5518,17 +6789,223 @@ static void fill_deprecated_tasks_stats(struct work_queue_task *t) {
 }
 
 
+/*
+The tasks known to the queue (those in q->tasks) are also indexed by state:
+each has a task_entry, linked in the list of its state in the order it got
+there, and counted per state and allocation request, overall and for its
+category. The index is maintained by change_task_state, so that
+task_state_any, task_state_count, and task_request_count do not need to
+walk all the tasks.
+*/
+
+static struct task_counts *category_task_counts(struct work_queue *q, const char *category)
+{
+	struct task_counts *c = hash_table_lookup(q->category_task_counts, category);
+	if(!c) {
+		c = xxcalloc(1, sizeof(*c));
+		hash_table_insert(q->category_task_counts, category, c);
+	}
+
+	return c;
+}
+
+static void task_index_unlink(struct work_queue *q, struct task_entry *e)
+{
+	if(e->prev) {
+		e->prev->next = e->next;
+	} else {
+		q->task_state_heads[e->state] = e->next;
+	}
+
+	if(e->next) {
+		e->next->prev = e->prev;
+	} else {
+		q->task_state_tails[e->state] = e->prev;
+	}
+
+	e->prev = e->next = NULL;
+
+	q->task_counts->state[e->state]--;
+	e->counts->state[e->state]--;
+}
+
+static void task_index_link(struct work_queue *q, struct task_entry *e, work_queue_task_state_t state)
+{
+	e->state = state;
+	e->next = NULL;
+	e->prev = q->task_state_tails[state];
+
+	if(e->prev) {
+		e->prev->next = e;
+	} else {
+		q->task_state_heads[state] = e;
+	}
+	q->task_state_tails[state] = e;
+
+	q->task_counts->state[state]++;
+	e->counts->state[state]++;
+}
+
+static void task_index_update(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state)
+{
+	struct task_entry *e = itable_lookup(q->task_entries, t->taskid);
+
+	if(e) {
+		task_index_unlink(q, e);
+		q->task_counts->request[e->request]--;
+		e->counts->request[e->request]--;
+	}
+
+	/* tasks done or canceled are no longer in q->tasks. */
+	if(new_state == WORK_QUEUE_TASK_DONE || new_state == WORK_QUEUE_TASK_CANCELED || new_state == WORK_QUEUE_TASK_UNKNOWN) {
+		if(e) {
+			itable_remove(q->task_entries, t->taskid);
+			free(e);
+		}
+		return;
+	}
+
+	if(!e) {
+		e = xxcalloc(1, sizeof(*e));
+		e->task = t;
+		e->counts = category_task_counts(q, t->category);
+		itable_insert(q->task_entries, t->taskid, e);
+	}
+
+	/* the allocation request only changes right before a change of state. */
+	e->request = t->resource_request;
+	q->task_counts->request[e->request]++;
+	e->counts->request[e->request]++;
+
+	task_index_link(q, e, new_state);
+}
+
+static void task_index_delete(struct work_queue *q)
+{
+	uint64_t taskid;
+	struct task_entry *e;
+	char *name;
+	struct task_counts *c;
+
+	itable_firstkey(q->task_entries);
+	while(itable_nextkey(q->task_entries, &taskid, (void **) &e)) {
+		free(e);
+	}
+	itable_delete(q->task_entries);
+
+	hash_table_firstkey(q->category_task_counts);
+	while(hash_table_nextkey(q->category_task_counts, &name, (void **) &c)) {
+		free(c);
+	}
+	hash_table_delete(q->category_task_counts);
+
+	free(q->task_counts);
+}
+
+/*
+Recount the tasks by walking all of them, and abort if the index disagrees.
+This is only for testing, as it takes time proportional to the number of tasks.
+*/
+
+static void task_index_check(struct work_queue *q)
+{
+	struct task_counts total;
+	struct hash_table *categories = hash_table_create(0, 0);
+	struct work_queue_task *t;
+	struct task_entry *e;
+	struct task_counts *c;
+	uint64_t taskid;
+	char *name;
+	int i;
+
+	memset(&total, 0, sizeof(total));
+
+	itable_firstkey(q->tasks);
+	while(itable_nextkey(q->tasks, &taskid, (void **) &t)) {
+		work_queue_task_state_t state = (uintptr_t) itable_lookup(q->task_state_map, taskid);
+
+		e = itable_lookup(q->task_entries, taskid);
+		if(!e || e->task != t || e->state != state || e->request != t->resource_request) {
+			fatal("task index: task %d is not indexed in state %s", (int) taskid, task_state_str(state));
+		}
+
+		c = hash_table_lookup(categories, t->category);
+		if(!c) {
+			c = xxcalloc(1, sizeof(*c));
+			hash_table_insert(categories, t->category, c);
+		}
+
+		total.state[state]++;
+		total.request[t->resource_request]++;
+		c->state[state]++;
+		c->request[t->resource_request]++;
+	}
+
+	if(itable_size(q->task_entries) != itable_size(q->tasks)) {
+		fatal("task index: %d entries for %d tasks", itable_size(q->task_entries), itable_size(q->tasks));
+	}
+
+	for(i = 0; i <= WORK_QUEUE_TASK_CANCELED; i++) {
+		int length = 0;
+		for(e = q->task_state_heads[i]; e; e = e->next) {
+			length++;
+		}
+		if(length != total.state[i] || q->task_counts->state[i] != total.state[i]) {
+			fatal("task index: %d tasks %s, but %d listed and %d counted", total.state[i], task_state_str(i), length, q->task_counts->state[i]);
+		}
+	}
+
+	hash_table_firstkey(q->category_task_counts);
+	while(hash_table_nextkey(q->category_task_counts, &name, (void **) &c)) {
+		struct task_counts *expected = hash_table_lookup(categories, name);
+		struct task_counts none;
+		if(!expected) {
+			memset(&none, 0, sizeof(none));
+			expected = &none;
+		}
+		if(memcmp(c, expected, sizeof(*c))) {
+			fatal("task index: counts of category %s do not match its tasks", name);
+		}
+	}
+
+	if(memcmp(q->task_counts->request, total.request, sizeof(total.request))) {
+		fatal("task index: counts of allocation requests do not match the tasks");
+	}
+
+	int with_deadline = 0;
+	struct ready_task *rt;
+	itable_firstkey(q->ready_tasks);
+	while(itable_nextkey(q->ready_tasks, &taskid, (void **) &rt)) {
+		if(rt->end > 0)
+			with_deadline++;
+	}
+
+	if(itable_size(q->ready_tasks) != total.state[WORK_QUEUE_TASK_READY] || q->ready_with_deadline != with_deadline) {
+		fatal("task index: %d tasks ready, with %d counted and %d found with an end time", itable_size(q->ready_tasks), q->ready_with_deadline, with_deadline);
+	}
+
+	hash_table_firstkey(categories);
+	while(hash_table_nextkey(categories, &name, (void **) &c)) {
+		if(!hash_table_lookup(q->category_task_counts, name)) {
+			fatal("task index: category %s has tasks, but no counts", name);
+		}
+		free(c);
+	}
+	hash_table_delete(categories);
+}
+
 /* Changes task state. Returns old state */
 /* State of the task. One of WORK_QUEUE_TASK(UNKNOWN|READY|RUNNING|WAITING_RETRIEVAL|RETRIEVED|DONE) */
 static work_queue_task_state_t change_task_state( struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state ) {
 
 	work_queue_task_state_t old_state = (uintptr_t) itable_lookup(q->task_state_map, t->taskid);
 	itable_insert(q->task_state_map, t->taskid, (void *) new_state);
+	task_index_update(q, t, new_state);
 	// remove from current tables:
 
 	if( old_state == WORK_QUEUE_TASK_READY ) {
 		// Treat WORK_QUEUE_TASK_READY specially, as it has the order of the tasks
-		list_remove(q->ready_list, t);
+		ready_queue_remove(q, t);
 	}
 
 	// insert to corresponding table
@@ -5550,6 +7027,10 @@ static work_queue_task_state_t change_task_state( struct work_queue *q, struct w
 			break;
 	}
 	
+	if(q->check_task_index) {
+		task_index_check(q);
+	}
+
 	log_queue_stats(q);
 	write_transaction_task(q, t);
 
@@ -5655,60 +7136,47 @@ static int task_state_is( struct work_queue *q, uint64_t taskid, work_queue_task
 	return itable_lookup(q->task_state_map, taskid) == (void *) state;
 }
 
+/* Returns the task that has been the longest in the given state, if any. */
 static struct work_queue_task *task_state_any(struct work_queue *q, work_queue_task_state_t state) {
-	struct work_queue_task *t;
-	uint64_t taskid;
-
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if( task_state_is(q, taskid, state) ) {
-			return t;
-		}
-	}
-
-	return NULL;
+	struct task_entry *e = q->task_state_heads[state];
+	return e ? e->task : NULL;
 }
 
 static int task_state_count(struct work_queue *q, const char *category, work_queue_task_state_t state) {
-	struct work_queue_task *t;
-	uint64_t taskid;
-
-	int count = 0;
-
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if( task_state_is(q, taskid, state) ) {
-			if(!category || strcmp(category, t->category) == 0) {
-				count++;
-			}
-		}
+	if(!category) {
+		return q->task_counts->state[state];
 	}
 
-	return count;
+	struct task_counts *c = hash_table_lookup(q->category_task_counts, category);
+	return c ? c->state[state] : 0;
 }
 
 static int task_request_count( struct work_queue *q, const char *category, category_allocation_t request) {
-	struct work_queue_task *t;
-	uint64_t taskid;
-
-	int count = 0;
-
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if(t->resource_request == request) {
-			if(!category || strcmp(category, t->category) == 0) {
-				count++;
-			}
-		}
+	if(!category) {
+		return q->task_counts->request[request];
 	}
 
-	return count;
+	struct task_counts *c = hash_table_lookup(q->category_task_counts, category);
+	return c ? c->request[request] : 0;
 }
 
 int work_queue_submit_internal(struct work_queue *q, struct work_queue_task *t)
 {
 	itable_insert(q->tasks, t->taskid, t);
 
+	/* Name cached inputs by content now, so that the schedulers can match
+	 * them against the files at the workers. Names that depend on the
+	 * worker are resolved when the files are sent. */
+	if(q->content_addressed_cache && t->input_files) {
+		struct work_queue_file *f;
+		list_first_item(t->input_files);
+		while((f = list_next_item(t->input_files))) {
+			if(f->payload && !strchr(f->payload, '$')) {
+				update_content_cached_name(q, f, f->payload);
+			}
+		}
+	}
+
 	/* Ensure category structure is created. */
 	work_queue_category_lookup_or_create(q, t->category);
 
@@ -5841,9 +7309,9 @@ struct work_queue_task *work_queue_wait(struct work_queue *q, int timeout)
 
 	if(timeout == 0) {
 		// re-establish old, if unintended behavior, where 0 would wait at
-		// least a second. With 0, we would like the loop to be executed at
-		// least once, but right now we cannot enforce that. Making it 1, we
-		// guarantee that the wait loop is executed once.
+		// least a second, which callers that wait in a loop rely on to not
+		// busy wait. work_queue_wait_internal takes 0 to mean a single pass
+		// that only collects the tasks that have already completed.
 		timeout = 1;
 	}
 
@@ -5860,11 +7328,36 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 {
 	BEGIN_ACCUM_TIME(q, time_polling);
 
-	int n = build_poll_table(q, foreman_uplink);
+	// The poller keeps the links between calls, so only the foreman uplink,
+	// which may change from call to call, is added here.
+	if(foreman_uplink) {
+		link_poller_add(q->poller, foreman_uplink, LINK_READ);
+	}
+
+	// At most every worker, the master link, and the foreman uplink can be ready.
+	int max = hash_table_size(q->worker_table) + 2;
+	if(!q->poll_table || q->poll_table_size < max) {
+		while(q->poll_table_size < max) {
+			q->poll_table_size *= 2;
+		}
+		free(q->poll_table);
+		q->poll_table = malloc(sizeof(*q->poll_table) * q->poll_table_size);
+		if(!q->poll_table) {
+			//if we can't allocate a poll table, we can't do anything else.
+			fatal("allocating memory for poll table failed.");
+		}
+	}
 
 	// We poll in at most small time segments (of a second). This lets
 	// promptly dispatch tasks, while avoiding busy waiting.
 	int msec = q->busy_waiting_flag ? 1000 : 0;
+
+	// Wake up in time to read again from workers held back by the bandwidth limit.
+	int throttle_msec = resume_throttled_retrievals(q);
+	if(throttle_msec >= 0) {
+		msec = MIN(msec, throttle_msec);
+	}
+
 	if(stoptime) {
 		msec = MIN(msec, (stoptime - time(0)) * 1000);
 	}
@@ -5877,40 +7370,61 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 
 	BEGIN_ACCUM_TIME(q, time_polling);
 
-	// Poll all links for activity.
-	link_poll(q->poll_table, n, msec);
+	// Wait for activity, getting back only the links that are ready.
+	int n = link_poller_wait(q->poller, q->poll_table, q->poll_table_size, msec);
 	q->link_poll_end = timestamp_get();
 
-	int i, j = 1;
-	// Consider the foreman_uplink passed into the function and disregard if inactive.
+	q->master_link_ready = 0;
 	if(foreman_uplink) {
-		if(q->poll_table[1].revents) {
-			*foreman_uplink_active = 1; //signal that the master link saw activity
-		} else {
-			*foreman_uplink_active = 0;
-		}
-		j++;
+		*foreman_uplink_active = 0;
 	}
 
 	END_ACCUM_TIME(q, time_polling);
 
 	BEGIN_ACCUM_TIME(q, time_status_msgs);
 
+	int i;
 	int workers_failed = 0;
-	// Then consider all existing active workers
-	for(i = j; i < n; i++) {
-		if(q->poll_table[i].revents) {
-			if(handle_worker(q, q->poll_table[i].link) == WQ_WORKER_FAILURE) {
+	for(i = 0; i < n; i++) {
+		struct link *l = q->poll_table[i].link;
+		char key[WORK_QUEUE_LINE_MAX];
+
+		if(l == q->master_link) {
+			q->master_link_ready = 1;
+		} else if(l == foreman_uplink) {
+			*foreman_uplink_active = 1; //signal that the master link saw activity
+		} else {
+			link_to_hash_key(l, key);
+			struct work_queue_worker *w = hash_table_lookup(q->worker_table, key);
+			if(!w) {
+				// a foreman uplink from a previous call, not ours to read.
+				link_poller_remove(q->poller, l);
+			} else if(w->retrieval) {
+				END_ACCUM_TIME(q, time_status_msgs);
+				BEGIN_ACCUM_TIME(q, time_receive);
+				work_queue_result_code_t result = advance_output_retrieval(q, w);
+				END_ACCUM_TIME(q, time_receive);
+				BEGIN_ACCUM_TIME(q, time_status_msgs);
+				if(result == WQ_WORKER_FAILURE) {
+					workers_failed++;
+				}
+			} else if(handle_worker(q, l) == WQ_WORKER_FAILURE) {
 				workers_failed++;
 			}
 		}
 	}
 
+	workers_failed += expire_output_retrievals(q);
+
 	if(hash_table_size(q->workers_with_available_results) > 0) {
 		char *key;
 		struct work_queue_worker *w;
 		hash_table_firstkey(q->workers_with_available_results);
 		while(hash_table_nextkey(q->workers_with_available_results,&key,(void**)&w)) {
+			// results are asked for once the worker is done sending back outputs.
+			if(w->retrieval) {
+				continue;
+			}
 			get_available_results(q, w);
 			hash_table_remove(q->workers_with_available_results, key);
 			hash_table_firstkey(q->workers_with_available_results);
@@ -5930,7 +7444,7 @@ static int connect_new_workers(struct work_queue *q, int stoptime, int max_new_w
 	// If the master link was awake, then accept at most max_new_workers.
 	// Note we are using the information gathered in poll_active_workers, which
 	// is a little ugly.
-	if(q->poll_table[0].revents) {
+	if(q->master_link_ready) {
 		do {
 			add_worker(q);
 			new_workers++;
@@ -5949,7 +7463,7 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
    - update catalog if appropiate
    - retrieve workers status messages
    - tasks waiting to be retrieved?          Yes: retrieve one task and go to S.
-   - tasks waiting to be dispatched?         Yes: dispatch one task and go to S.
+   - tasks waiting to be dispatched?         Yes: dispatch a batch of tasks and go to S.
    - send keepalives to appropiate workers
    - fast-abort workers
    - if new workers, connect n of them
@@ -5972,11 +7486,15 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 	// compute stoptime
 	time_t stoptime = (timeout == WORK_QUEUE_WAITFORTASK) ? 0 : time(0) + timeout;
 
+	// A timeout of zero makes a single pass, and keeps going only to collect
+	// the tasks that have already completed, never waiting for one to run.
+	int drain = (timeout == 0);
+
 	int result;
 	struct work_queue_task *t = NULL;
 	// time left?
 
-	while( (stoptime == 0) || (time(0) < stoptime) ) {
+	do {
 
 		BEGIN_ACCUM_TIME(q, time_internal);
 
@@ -6008,8 +7526,9 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 
 		END_ACCUM_TIME(q, time_internal);
 
-		// retrieve worker status messages
-		if(poll_active_workers(q, stoptime, foreman_uplink, foreman_uplink_active) > 0) {
+		// retrieve worker status messages. When draining, the poll may wait
+		// for the outputs of completed tasks, but never past the usual second.
+		if(poll_active_workers(q, drain ? 0 : stoptime, foreman_uplink, foreman_uplink_active) > 0) {
 			//at least one worker was removed.
 			events++;
 			// note we keep going, and we do not restart the loop as we do in
@@ -6022,10 +7541,10 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 
 		// tasks waiting to be retrieved?
 		BEGIN_ACCUM_TIME(q, time_receive);
-		result = receive_one_task(q);
+		result = receive_tasks(q);
 		END_ACCUM_TIME(q, time_receive);
 		if(result) {
-			// retrieved at least one task
+			// started retrieving at least one task
 			events++;
 			compute_master_load(q, 1);
 			continue;
@@ -6047,7 +7566,7 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 
 		// tasks waiting to be dispatched?
 		BEGIN_ACCUM_TIME(q, time_send);
-		result = send_one_task(q);
+		result = send_tasks(q);
 		END_ACCUM_TIME(q, time_send);
 		if(result) {
 			// sent at least one task
@@ -6113,7 +7632,7 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 		if(foreman_uplink) {
 			break;
 		}
-	}
+	} while( (stoptime == 0) || (time(0) < stoptime) || (drain && (task_state_any(q, WORK_QUEUE_TASK_RETRIEVED) || task_state_any(q, WORK_QUEUE_TASK_WAITING_RETRIEVAL))) );
 
 	if(events > 0) {
 		log_queue_stats(q);
@@ -6323,9 +7842,11 @@ int work_queue_tune(struct work_queue *q, const char *name, double value)
 
 	if(!strcmp(name, "asynchrony-multiplier")) {
 		q->asynchrony_multiplier = MAX(value, 1.0);
+		worker_index_rebuild(q);
 
 	} else if(!strcmp(name, "asynchrony-modifier")) {
 		q->asynchrony_modifier = MAX(value, 0);
+		worker_index_rebuild(q);
 
 	} else if(!strcmp(name, "min-transfer-timeout")) {
 		q->minimum_transfer_timeout = (int)value;
@@ -6357,6 +7878,21 @@ int work_queue_tune(struct work_queue *q, const char *name, double value)
 	} else if(!strcmp(name, "category-steady-n-tasks")) {
 		category_tune_bucket_size("category-steady-n-tasks", (int) value);
 
+	} else if(!strcmp(name, "dispatch-batch-size")) {
+		q->dispatch_batch_size = MAX(1, (int)value);
+
+	} else if(!strcmp(name, "dispatch-batch-time")) {
+		q->dispatch_batch_time = MAX(0, value);
+
+	} else if(!strcmp(name, "content-addressed-cache")) {
+		q->content_addressed_cache = value > 0;
+
+	} else if(!strcmp(name, "peer-transfer-limit")) {
+		q->peer_transfer_limit = MAX(0, (int)value);
+
+	} else if(!strcmp(name, "compress-threshold")) {
+		q->compress_threshold = MAX(0, (int64_t)value);
+
 	} else {
 		debug(D_NOTICE|D_WQ, "Warning: tuning parameter \"%s\" not recognized\n", name);
 		return -1;
@@ -6848,6 +8384,24 @@ static void write_transaction_worker_resources(struct work_queue *q, struct work
 	free(rjx);
 }
 
+static void write_transaction_transfer(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *direction, const char *name, struct work_queue_compress_stats *s) {
+	if(!q->transactions_logfile)
+		return;
+
+	struct buffer B;
+	buffer_init(&B);
+
+	buffer_printf(&B, "TRANSFER %d %s %s COMPRESSED", t ? t->taskid : 0, w->workerid, direction);
+	buffer_printf(&B, " %" PRId64 " %" PRId64, s->bytes, s->wire_bytes);
+	buffer_printf(&B, " %.3f", (double) s->wire_bytes / s->bytes);
+	buffer_printf(&B, " %" PRIu64, s->time + s->peer_time);
+	buffer_printf(&B, " %s", name);
+
+	write_transaction(q, buffer_tostring(&B));
+
+	buffer_free(&B);
+}
+
 
 int work_queue_specify_transactions_log(struct work_queue *q, const char *logfile) {
 	q->transactions_logfile =fopen(logfile, "a");
@@ -6864,7 +8418,8 @@ int work_queue_specify_transactions_log(struct work_queue *q, const char *logfil
 		fprintf(q->transactions_logfile, "# time master-pid TASK taskid WAITING category-name {FIRST_RESOURCES|MAX_RESOURCES} resources-requested\n");
 		fprintf(q->transactions_logfile, "# time master-pid TASK taskid RUNNING worker-address {FIRST_RESOURCES|MAX_RESOURCES} resources-given\n");
 		fprintf(q->transactions_logfile, "# time master-pid TASK taskid WAITING_RETRIEVAL worker-address\n");
-		fprintf(q->transactions_logfile, "# time master-pid TASK taskid {RETRIEVED|DONE} {SUCCESS|SIGNAL|END_TIME|FORSAKEN|MAX_RETRIES|MAX_WALLTIME|UNKNOWN|RESOURCE_EXHAUSTION} {exit-code} {limits-exceeded} {resources-measured}\n\n");
+		fprintf(q->transactions_logfile, "# time master-pid TASK taskid {RETRIEVED|DONE} {SUCCESS|SIGNAL|END_TIME|FORSAKEN|MAX_RETRIES|MAX_WALLTIME|UNKNOWN|RESOURCE_EXHAUSTION} {exit-code} {limits-exceeded} {resources-measured}\n");
+		fprintf(q->transactions_logfile, "# time master-pid TRANSFER taskid worker-id {INPUT|OUTPUT} COMPRESSED bytes compressed-bytes ratio compression-time file-name\n\n");
 
 		write_transaction(q, "MASTER START");
 		return 1;
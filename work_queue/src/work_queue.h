@@ -315,6 +315,14 @@ struct work_queue_stats {
 	int workers_full;               /**< @deprecated Use workers_busy insead. */
 	int total_worker_slots;         /**< @deprecated Use tasks_running instead. */
 	int avg_capacity;               /**< @deprecated Use capacity_cores instead. */
+
+	/* Fields added later go here, so that the offsets of those above do not change. */
+
+	int dispatch_batch;            /**< Number of tasks sent to workers in the last dispatch phase of @ref work_queue_wait. (See "dispatch-batch-size" in @ref work_queue_tune.) */
+
+	int64_t bytes_compressed;      /**< Total number of file bytes sent or received compressed, before compression. (See "compress-threshold" in @ref work_queue_tune.) */
+	int64_t bytes_compressed_wire; /**< Total number of bytes those files took on the wire. Included in bytes_sent and bytes_received. */
+	timestamp_t time_compress;     /**< Total time spent by the master and the workers compressing and decompressing files. */
 };
 
 /* Forward declare the queue's structure. This structure is opaque and defined in work_queue.c */
@@ -446,6 +454,8 @@ void work_queue_task_specify_gpus( struct work_queue_task *t, int gpus );
 /** Specify the maximum end time allowed for the task (in microseconds since the
  * Epoch). If less than 1, then no end time is specified (this is the default).
 This is useful, for example, when the task uses certificates that expire.
+The end time is read when the task is submitted, or returned to the ready list,
+and changing it while the task waits to run has no effect.
 @param t A task object.
 @param seconds Number of seconds since the Epoch.
 */
@@ -977,6 +987,11 @@ void work_queue_master_preferred_connection(struct work_queue *q, const char *pr
  - "short-timeout" Set the minimum timeout when sending a brief message to a single worker. (default=5s)
  - "long-timeout" Set the minimum timeout when sending a brief message to a foreman. (default=1h)
  - "category-steady-n-tasks" Set the number of tasks considered when computing category buckets.
+ - "dispatch-batch-size" Set the maximum number of tasks sent to workers before checking again for results and messages from workers. (default=1000)
+ - "dispatch-batch-time" Set the maximum number of seconds spent sending tasks to workers before checking again for results and messages from workers. (default=1s)
+ - "content-addressed-cache" If set to 1, name cached input files at the workers by the md5 of their contents rather than by their local path, so that identical files are transferred and stored once, and files modified in place are sent again. (default=0)
+ - "peer-transfer-limit" Set the maximum number of cached input files a worker started with --peer-transfers sends at once to other workers, instead of the master sending them. 0 disables peer transfers. (default=3)
+ - "compress-threshold" Send input and output files of at least this many bytes compressed, when a probe of their first bytes shows that it pays. Applies to workers that connect afterwards. 0 disables compression. (default=0)
 @param value The value to set the parameter to.
 @return 0 on succes, -1 on failure.
 */
@@ -0,0 +1,302 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "work_queue_compress.h"
+
+#include "debug.h"
+#include "full_io.h"
+#include "macros.h"
+#include "xxmalloc.h"
+
+#include <zlib.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Size of the pieces read, compressed, and sent at once. */
+#define COMPRESS_CHUNK (1<<16)
+
+/* Room left before each frame for its length line. */
+#define FRAME_HEADER_MAX 32
+
+/* Only the first bytes of a file are compressed to decide whether compressing it pays. */
+#define PROBE_SIZE (1<<16)
+
+/* Compressing pays if the probe shrinks to at most this fraction of its size. */
+#define PROBE_RATIO 0.8
+
+struct work_queue_inflate {
+	z_stream zs;
+	int fd;
+	int ended;
+};
+
+int work_queue_compress_probe_buffer( const char *data, int64_t length )
+{
+	uLongf size = MIN(length, PROBE_SIZE);
+	if(size == 0) return 0;
+
+	uLongf zsize = compressBound(size);
+	Bytef *zdata = xxmalloc(zsize);
+
+	int result = compress2(zdata, &zsize, (const Bytef *) data, size, Z_BEST_SPEED) == Z_OK && zsize <= size * PROBE_RATIO;
+
+	free(zdata);
+
+	return result;
+}
+
+int work_queue_compress_probe_fd( int fd, int64_t length )
+{
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+	if(offset < 0) return 0;
+
+	char *data = xxmalloc(PROBE_SIZE);
+	ssize_t size = pread(fd, data, MIN(length, PROBE_SIZE), offset);
+
+	int result = size > 0 && work_queue_compress_probe_buffer(data, size);
+
+	free(data);
+
+	return result;
+}
+
+int64_t work_queue_compress_send( struct link *link, int fd, const char *data, int64_t length, time_t stoptime, struct work_queue_compress_stats *s )
+{
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+
+	if(deflateInit(&zs, Z_BEST_SPEED) != Z_OK) {
+		debug(D_WQ, "could not initialize compression: %s", zs.msg ? zs.msg : "unknown error");
+		return -1;
+	}
+
+	char *in  = data ? NULL : xxmalloc(COMPRESS_CHUNK);
+	char *out = xxmalloc(FRAME_HEADER_MAX + COMPRESS_CHUNK);
+
+	int64_t remaining = length;
+	int64_t wire_bytes = 0;
+	timestamp_t time = 0;
+	int result = 1;
+	int flush;
+
+	do {
+		int64_t chunk = MIN(remaining, COMPRESS_CHUNK);
+
+		if(data) {
+			zs.next_in = (Bytef *) data + (length - remaining);
+		} else {
+			if(full_read(fd, in, chunk) != chunk) {
+				debug(D_WQ, "could not read data to compress: %s", strerror(errno));
+				result = 0;
+				break;
+			}
+			zs.next_in = (Bytef *) in;
+		}
+
+		zs.avail_in = chunk;
+		remaining  -= chunk;
+		flush = remaining > 0 ? Z_NO_FLUSH : Z_FINISH;
+
+		do {
+			zs.next_out  = (Bytef *) out + FRAME_HEADER_MAX;
+			zs.avail_out = COMPRESS_CHUNK;
+
+			timestamp_t start = timestamp_get();
+			deflate(&zs, flush);
+			time += timestamp_get() - start;
+
+			int have = COMPRESS_CHUNK - zs.avail_out;
+			if(have > 0) {
+				char header[FRAME_HEADER_MAX];
+				int header_length = snprintf(header, sizeof(header), "%d\n", have);
+				char *frame = out + FRAME_HEADER_MAX - header_length;
+				memcpy(frame, header, header_length);
+
+				if(link_write(link, frame, header_length + have, stoptime) != header_length + have) {
+					result = 0;
+					break;
+				}
+
+				wire_bytes += header_length + have;
+			}
+		} while(zs.avail_out == 0);
+	} while(result && flush != Z_FINISH);
+
+	deflateEnd(&zs);
+	free(in);
+	free(out);
+
+	if(!result) {
+		return -1;
+	}
+
+	char trailer[FRAME_HEADER_MAX];
+	int trailer_length = snprintf(trailer, sizeof(trailer), "0 %" PRIu64 "\n", time);
+	if(link_write(link, trailer, trailer_length, stoptime) != trailer_length) {
+		return -1;
+	}
+
+	wire_bytes += trailer_length;
+
+	s->bytes      += length;
+	s->wire_bytes += wire_bytes;
+	s->time       += time;
+
+	return length;
+}
+
+int64_t work_queue_compress_recv( struct link *link, int fd, time_t stoptime, struct work_queue_compress_stats *s )
+{
+	struct work_queue_inflate *z = work_queue_inflate_create(fd);
+	if(!z) {
+		return -1;
+	}
+
+	char line[FRAME_HEADER_MAX];
+	char *buffer = xxmalloc(COMPRESS_CHUNK);
+
+	int64_t initial_bytes = s->bytes;
+	int result = 0;
+
+	while(link_readline(link, line, sizeof(line), stoptime)) {
+		int64_t length;
+		timestamp_t peer_time;
+
+		s->wire_bytes += strlen(line) + 1;
+
+		if(!work_queue_compress_frame(line, &length, &peer_time)) {
+			debug(D_WQ, "invalid compressed frame: %s", line);
+			break;
+		}
+
+		if(length == 0) {
+			s->peer_time += peer_time;
+			result = 1;
+			break;
+		}
+
+		while(length > 0) {
+			ssize_t chunk = link_read(link, buffer, MIN(length, COMPRESS_CHUNK), stoptime);
+			if(chunk <= 0) {
+				break;
+			}
+
+			s->wire_bytes += chunk;
+			length -= chunk;
+
+			if(work_queue_inflate_write(z, buffer, chunk, s) != 1) {
+				break;
+			}
+		}
+
+		if(length > 0) {
+			break;
+		}
+	}
+
+	if(!work_queue_inflate_delete(z)) {
+		result = 0;
+	}
+
+	free(buffer);
+
+	return result ? s->bytes - initial_bytes : -1;
+}
+
+int work_queue_compress_frame( const char *line, int64_t *length, timestamp_t *peer_time )
+{
+	*peer_time = 0;
+
+	int n = sscanf(line, "%" SCNd64 " %" SCNu64, length, peer_time);
+
+	if(n < 1 || *length < 0 || *length > COMPRESS_CHUNK) {
+		return 0;
+	}
+
+	/* only the last frame carries the time of the sender. */
+	return (*length == 0) == (n == 2);
+}
+
+struct work_queue_inflate * work_queue_inflate_create( int fd )
+{
+	struct work_queue_inflate *z = xxmalloc(sizeof(*z));
+	memset(z, 0, sizeof(*z));
+
+	if(inflateInit(&z->zs) != Z_OK) {
+		debug(D_WQ, "could not initialize decompression: %s", z->zs.msg ? z->zs.msg : "unknown error");
+		free(z);
+		return NULL;
+	}
+
+	z->fd = fd;
+
+	return z;
+}
+
+int work_queue_inflate_write( struct work_queue_inflate *z, const char *data, int64_t length, struct work_queue_compress_stats *s )
+{
+	char out[COMPRESS_CHUNK];
+	int result = 1;
+
+	z->zs.next_in  = (Bytef *) data;
+	z->zs.avail_in = length;
+
+	do {
+		if(z->ended) {
+			/* nothing may follow the end of the stream. */
+			return z->zs.avail_in > 0 ? -1 : result;
+		}
+
+		z->zs.next_out  = (Bytef *) out;
+		z->zs.avail_out = sizeof(out);
+
+		timestamp_t start = timestamp_get();
+		int rc = inflate(&z->zs, Z_NO_FLUSH);
+		s->time += timestamp_get() - start;
+
+		if(rc == Z_STREAM_END) {
+			z->ended = 1;
+		} else if(rc != Z_OK && rc != Z_BUF_ERROR) {
+			debug(D_WQ, "corrupt compressed stream: %s", z->zs.msg ? z->zs.msg : "unknown error");
+			return -1;
+		}
+
+		int have = sizeof(out) - z->zs.avail_out;
+		if(have > 0) {
+			s->bytes += have;
+			if(z->fd >= 0 && full_write(z->fd, out, have) != have) {
+				z->fd = -1;
+				result = 0;
+			}
+		}
+	} while(z->zs.avail_in > 0 || z->zs.avail_out == 0);
+
+	return result;
+}
+
+int work_queue_inflate_ended( struct work_queue_inflate *z )
+{
+	return z && z->ended;
+}
+
+int work_queue_inflate_delete( struct work_queue_inflate *z )
+{
+	if(!z) return 0;
+
+	int ended = z->ended;
+
+	inflateEnd(&z->zs);
+	free(z);
+
+	return ended;
+}
+
+/* vim: set noexpandtab tabstop=4: */
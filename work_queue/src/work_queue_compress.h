@@ -0,0 +1,67 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef WORK_QUEUE_COMPRESS_H
+#define WORK_QUEUE_COMPRESS_H
+
+/*
+Compressed transfers of file payloads between the master and the workers.
+
+A worker announces the methods it supports with "info compression <method>",
+and the master enables one with "compression <method> <threshold>". From then
+on, either side may send a file of at least threshold bytes as "putz" (master)
+or "filez" (worker) instead of "put" or "file", if a probe of its first bytes
+shows that compressing it pays. The payload is then a deflate stream cut in
+frames: each frame is a line with its length followed by that many bytes, and
+the stream ends with the line "0 <usecs>", where usecs is the time the sender
+spent compressing.
+*/
+
+#include "link.h"
+#include "timestamp.h"
+
+#include <stdint.h>
+
+#define WORK_QUEUE_COMPRESS_METHOD "deflate"
+
+struct work_queue_compress_stats {
+	int64_t bytes;           // payload bytes, before compression
+	int64_t wire_bytes;      // bytes that went over the link, framing included
+	timestamp_t time;        // time spent here compressing or decompressing
+	timestamp_t peer_time;   // time the sender reported spent compressing
+};
+
+struct work_queue_inflate;
+
+/* Return true if the first bytes of the data compress well enough to be worth sending compressed. */
+int work_queue_compress_probe_buffer( const char *data, int64_t length );
+
+/* As above, for the length bytes of fd from its current offset, which is not changed. */
+int work_queue_compress_probe_fd( int fd, int64_t length );
+
+/* Send length bytes, from data if not null and otherwise read from fd, as a compressed stream.
+Returns length on success, or -1 on failure. */
+int64_t work_queue_compress_send( struct link *link, int fd, const char *data, int64_t length, time_t stoptime, struct work_queue_compress_stats *s );
+
+/* Receive a compressed stream and write it to fd. Returns the number of bytes written, or -1 on failure. */
+int64_t work_queue_compress_recv( struct link *link, int fd, time_t stoptime, struct work_queue_compress_stats *s );
+
+/* Parse a frame line. Returns true if valid, with length zero and peer_time set for the last line of the stream. */
+int work_queue_compress_frame( const char *line, int64_t *length, timestamp_t *peer_time );
+
+/* Decompress a stream given in arbitrary pieces, writing the result to fd, or discarding it if fd is negative. */
+struct work_queue_inflate * work_queue_inflate_create( int fd );
+
+/* Returns 1 on success, 0 if writing to fd failed (the rest of the stream is then discarded), and -1 if the stream is corrupt. */
+int work_queue_inflate_write( struct work_queue_inflate *z, const char *data, int64_t length, struct work_queue_compress_stats *s );
+
+/* Returns true if the end of the stream has been reached. */
+int work_queue_inflate_ended( struct work_queue_inflate *z );
+
+/* Returns true if the whole stream was received. */
+int work_queue_inflate_delete( struct work_queue_inflate *z );
+
+#endif
@@ -0,0 +1,228 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Measures how fast the master dispatches tasks as the number of connected
+workers grows. For each worker count given on the command line, a fresh queue
+is created, that many local workers are started, and a batch of trivial one
+core tasks is run to completion. For each round, the total wall time, the
+dispatch rate (tasks dispatched per second spent sending tasks), and the
+dispatch latency (microseconds spent sending each task) are reported.
+*/
+
+#include "work_queue.h"
+
+#include "cctools.h"
+#include "debug.h"
+#include "timestamp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+static const char *worker_exe = "./work_queue_worker";
+static int cores_per_worker = 1;
+static int tasks_per_round  = 1000;
+static int connect_timeout  = 60;
+static int inputs_per_task  = 0;
+static int envs_per_task    = 0;
+
+static void show_help(const char *cmd)
+{
+	printf("Usage: %s [options] <workers> [<workers> ...]\n", cmd);
+	printf("Where options are:\n");
+	printf("-t <n>     Number of tasks per round. (default: %d)\n", tasks_per_round);
+	printf("-c <n>     Cores per worker. (default: %d)\n", cores_per_worker);
+	printf("-i <n>     Small input buffers per task. (default: %d)\n", inputs_per_task);
+	printf("-e <n>     Environment variables per task. (default: %d)\n", envs_per_task);
+	printf("-x <path>  Worker executable. (default: %s)\n", worker_exe);
+	printf("-T <secs>  Seconds to wait for workers to connect. (default: %d)\n", connect_timeout);
+	printf("-d <flag>  Enable debugging for this subsystem.\n");
+	printf("-o <file>  Send debugging output to this file.\n");
+	printf("-h         Show this help screen.\n");
+}
+
+static pid_t start_worker(int port)
+{
+	char port_str[16];
+	char cores_str[16];
+
+	snprintf(port_str, sizeof(port_str), "%d", port);
+	snprintf(cores_str, sizeof(cores_str), "%d", cores_per_worker);
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		/* keep the output of the benchmark readable. */
+		int fd = open("/dev/null", O_WRONLY);
+		if(fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+
+		execl(worker_exe, worker_exe, "localhost", port_str, "--single-shot", "--timeout", "30",
+				"--cores", cores_str, "--memory", "1000", "--memory-threshold", "10", (char *) 0);
+		_exit(127);
+	}
+
+	return pid;
+}
+
+static int run_round(int nworkers)
+{
+	struct work_queue *q = work_queue_create(0);
+	if(!q) {
+		fprintf(stderr, "could not create queue: %s\n", strerror(errno));
+		return 0;
+	}
+
+	pid_t *workers = malloc(nworkers * sizeof(pid_t));
+
+	int i;
+	for(i = 0; i < nworkers; i++) {
+		workers[i] = start_worker(work_queue_port(q));
+	}
+
+	struct work_queue_stats s;
+	time_t stoptime = time(0) + connect_timeout;
+	do {
+		work_queue_wait(q, 1);
+		work_queue_get_stats(q, &s);
+	} while(s.workers_connected < nworkers && time(0) < stoptime);
+
+	if(s.workers_connected < nworkers) {
+		fprintf(stderr, "only %d of %d workers connected.\n", s.workers_connected, nworkers);
+	}
+
+	int ok = s.workers_connected > 0;
+	if(!ok) {
+		goto end;
+	}
+
+	for(i = 0; i < tasks_per_round; i++) {
+		struct work_queue_task *t = work_queue_task_create(":");
+		work_queue_task_specify_cores(t, 1);
+		work_queue_task_specify_memory(t, 1);
+		work_queue_task_specify_disk(t, 1);
+
+		int j;
+		for(j = 0; j < inputs_per_task; j++) {
+			char name[32];
+			snprintf(name, sizeof(name), "input.%d", j);
+			work_queue_task_specify_buffer(t, name, strlen(name), name, WORK_QUEUE_NOCACHE);
+		}
+
+		for(j = 0; j < envs_per_task; j++) {
+			char name[32];
+			snprintf(name, sizeof(name), "BENCHMARK_VAR_%d", j);
+			work_queue_task_specify_environment_variable(t, name, "value");
+		}
+
+		work_queue_submit(q, t);
+	}
+
+	timestamp_t start = timestamp_get();
+
+	while(!work_queue_empty(q)) {
+		struct work_queue_task *t = work_queue_wait(q, 5);
+		if(t) {
+			work_queue_task_delete(t);
+		}
+	}
+
+	timestamp_t elapsed = timestamp_get() - start;
+
+	work_queue_get_stats(q, &s);
+
+	double wall = elapsed / 1000000.0;
+	double send = s.time_send / 1000000.0;
+
+	printf("%8d %8d %10.3f %12.1f %12.1f %10.1f %8d\n",
+			s.workers_connected,
+			s.tasks_dispatched,
+			wall,
+			wall > 0 ? s.tasks_done / wall : 0,
+			send > 0 ? s.tasks_dispatched / send : 0,
+			s.tasks_dispatched > 0 ? (double) s.time_send / s.tasks_dispatched : 0,
+			s.dispatch_batch);
+	fflush(stdout);
+
+end:
+	work_queue_delete(q);
+
+	for(i = 0; i < nworkers; i++) {
+		if(workers[i] > 0) {
+			kill(workers[i], SIGTERM);
+			waitpid(workers[i], NULL, 0);
+		}
+	}
+
+	free(workers);
+
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+
+	while((c = getopt(argc, argv, "t:c:i:e:x:T:d:o:h")) != -1) {
+		switch (c) {
+		case 't':
+			tasks_per_round = atoi(optarg);
+			break;
+		case 'c':
+			cores_per_worker = atoi(optarg);
+			break;
+		case 'i':
+			inputs_per_task = atoi(optarg);
+			break;
+		case 'e':
+			envs_per_task = atoi(optarg);
+			break;
+		case 'x':
+			worker_exe = optarg;
+			break;
+		case 'T':
+			connect_timeout = atoi(optarg);
+			break;
+		case 'd':
+			debug_flags_set(optarg);
+			break;
+		case 'o':
+			debug_config_file(optarg);
+			break;
+		case 'h':
+		default:
+			show_help(argv[0]);
+			return 0;
+		}
+	}
+
+	if(optind >= argc) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	printf("%8s %8s %10s %12s %12s %10s %8s\n", "workers", "tasks", "wall(s)", "tasks/s", "dispatch/s", "us/task", "batch");
+
+	for(; optind < argc; optind++) {
+		if(!run_round(atoi(argv[optind]))) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -15,7 +15,7 @@ See the file COPYING for details.
 #include <string.h>
 
 static const char *work_queue_properties[] = { "name", "port", "priority", "num_tasks_left", "next_taskid", "workingdir", "master_link",
-	"poll_table", "poll_table_size", "tasks", "task_state_map", "ready_list", "worker_table",
+	"poll_table", "poll_table_size", "tasks", "task_state_map", "ready_shapes", "ready_tasks", "worker_table",
 	"worker_blacklist", "worker_task_map", "categories", "workers_with_available_results",
 	"stats", "stats_measure", "stats_disconnected_workers", "time_last_wait",
 	"worker_selection_algorithm", "task_ordering", "process_pending_check", "short_timeout",
@@ -13,6 +13,7 @@ See the file COPYING for details.
 #include "itable.h"
 #include "list.h"
 #include "get_line.h"
+#include "timestamp.h"
 
 #include <errno.h>
 #include <limits.h>
@@ -63,6 +64,80 @@ int submit_tasks(struct work_queue *q, int input_size, int run_time, int output_
 	return 1;
 }
 
+/*
+Measure how fast tasks enter and leave the ready queue: submit count trivial
+tasks spread over the given number of priorities, then cancel them all.
+No workers are needed, as the tasks never leave the ready state.
+*/
+
+void benchmark_submit( struct work_queue *q, int count, int priorities )
+{
+	struct work_queue_task **tasks = malloc(count * sizeof(*tasks));
+	if(!tasks) {
+		fprintf(stderr, "couldn't allocate memory for %d tasks\n", count);
+		return;
+	}
+
+	if(priorities < 1)
+		priorities = 1;
+
+	int i;
+	for(i=0;i<count;i++) {
+		tasks[i] = work_queue_task_create(":");
+		work_queue_task_specify_cores(tasks[i], 1);
+		work_queue_task_specify_priority(tasks[i], (i * 7919) % priorities);
+	}
+
+	timestamp_t start = timestamp_get();
+	for(i=0;i<count;i++) {
+		work_queue_submit(q, tasks[i]);
+	}
+	timestamp_t submitted = timestamp_get();
+
+	for(i=0;i<count;i++) {
+		work_queue_cancel_by_taskid(q, tasks[i]->taskid);
+	}
+	timestamp_t cancelled = timestamp_get();
+
+	double submit_time = (submitted - start) / 1000000.0;
+	double cancel_time = (cancelled - submitted) / 1000000.0;
+
+	printf("submitted %d tasks in %.3lfs (%.0lf tasks/s)\n", count, submit_time, submit_time > 0 ? count / submit_time : 0);
+	printf("cancelled %d tasks in %.3lfs (%.0lf tasks/s)\n", count, cancel_time, cancel_time > 0 ? count / cancel_time : 0);
+
+	for(i=0;i<count;i++) {
+		work_queue_task_delete(tasks[i]);
+	}
+	free(tasks);
+}
+
+/*
+Submit count trivial tasks whose end time has already passed, so that they
+expire before they can be sent to a worker.  Every third task is cancelled
+instead, and every other third has its end time cleared while it waits,
+which has no effect.
+*/
+
+void expire_tasks( struct work_queue *q, int count )
+{
+	timestamp_t now = timestamp_get();
+
+	int i;
+	for(i=0;i<count;i++) {
+		struct work_queue_task *t = work_queue_task_create(":");
+		work_queue_task_specify_cores(t, 1);
+		work_queue_task_specify_end_time(t, now);
+		work_queue_submit(q, t);
+
+		if(i % 3 == 0) {
+			work_queue_cancel_by_taskid(q, t->taskid);
+			work_queue_task_delete(t);
+		} else if(i % 3 == 1) {
+			work_queue_task_specify_end_time(t, 0);
+		}
+	}
+}
+
 void wait_for_all_tasks( struct work_queue *q )
 {
 	struct work_queue_task *t;
@@ -77,7 +152,7 @@ void work_queue_mainloop( struct work_queue *q )
 	char line[1024];
 	char category[1024];
 
-	int sleep_time, run_time, input_size, output_size, count;
+	int sleep_time, run_time, input_size, output_size, count, priorities;
 
 	while(1) {
 		printf("work_queue_test > ");
@@ -100,6 +175,12 @@ void work_queue_mainloop( struct work_queue *q )
 		} else if(sscanf(line, "submit %d %d %d %d %s",&input_size, &run_time, &output_size, &count, category) >= 4) {
 			printf("submitting %d tasks...\n",count);
 			submit_tasks(q,input_size,run_time,output_size,count,category);
+		} else if(sscanf(line, "benchmark %d %d", &count, &priorities) == 2) {
+			printf("benchmarking submission of %d tasks...\n",count);
+			benchmark_submit(q,count,priorities);
+		} else if(sscanf(line, "expire %d", &count) == 1) {
+			printf("submitting %d expired tasks...\n",count);
+			expire_tasks(q,count);
 		} else if(!strcmp(line,"quit") || !strcmp(line,"exit")) {
 			break;
 		} else if(!strcmp(line,"help")) {
@@ -108,6 +189,9 @@ void work_queue_mainloop( struct work_queue *q )
 			printf("wait                    Wait for all submitted tasks to finish.\n");
 			printf("submit <I> <T> <O> <N>  Submit N tasks that read I MB input,\n");
 			printf("                        run for T seconds, and produce O MB of output.\n");
+			printf("benchmark <N> <P>       Submit and cancel N tasks over P priorities,\n");
+			printf("                        and report the rates.\n");
+			printf("expire <N>              Submit N tasks past their end time.\n");
 			printf("quit, exit              Wait for all tasks to complete, then exit.\n");
 			printf("\n");
 		} else {
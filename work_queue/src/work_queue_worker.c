@@ -11,6 +11,7 @@ See the file COPYING for details.
 #include "work_queue_process.h"
 #include "work_queue_catalog.h"
 #include "work_queue_watcher.h"
+#include "work_queue_compress.h"
 
 #include "cctools.h"
 #include "macros.h"
@@ -131,6 +132,35 @@ char *password = 0;
 // Allow worker to use symlinks when link() fails.  Enabled by default.
 static int symlinks_enabled = 1;
 
+// If set, serve files in the cache to other workers, and fetch files from them when asked by the master.
+static int peer_transfers_enabled = 0;
+
+// Port and process of the server that sends cached files to other workers.
+static int transfer_port = 0;
+static pid_t transfer_server_pid = 0;
+
+// Maximum time to connect to another worker to fetch a file.
+static const int peer_connect_timeout = 15;
+
+// Cached files ("cache/name") that could not be fetched from a peer, until the master sends them.
+static struct hash_table *peer_failed_files = NULL;
+
+// A file being fetched into the cache from another worker by a child process.
+struct peer_fetch {
+	pid_t pid;
+	char *filename;
+	char *host;
+	int port;
+	time_t stoptime;
+	int result;
+};
+
+// Files being fetched from peers, indexed by the pid of the child fetching each.
+static struct itable *peer_fetches = NULL;
+
+// Files of at least this size are sent and received compressed when it pays, or never if 0. Set by the master.
+static int64_t compress_threshold = 0;
+
 // Worker id. A unique id for this worker instance.
 static char *worker_id;
 
@@ -198,6 +228,10 @@ static struct itable *procs_running = NULL;
 // These are additional pointers into procs_table.
 static struct list   *procs_waiting = NULL;
 
+// List of all procs with an input still being fetched from a peer, before their sandbox is set up.
+// These are additional pointers into procs_table.
+static struct list   *procs_fetching = NULL;
+
 // Table of all processes with results to be sent back, indexed by taskid.
 // These are additional pointers into procs_table.
 static struct itable *procs_complete = NULL;
@@ -417,6 +451,8 @@ static void send_stats_update(struct link *master)
 
 static int send_keepalive(struct link *master, int force_resources){
 
+	link_cork(master);
+
 	send_master_message(master, "alive\n");
 
 	/* for regular workers we only send resources on special ocassions, thus
@@ -427,7 +463,7 @@ static int send_keepalive(struct link *master, int force_resources){
 
 	send_stats_update(master);
 
-	return 1;
+	return link_uncork(master, time(0)+active_timeout);
 }
 
 /*
@@ -439,10 +475,16 @@ static void report_worker_ready( struct link *master )
 {
 	char hostname[DOMAIN_NAME_MAX];
 	domain_name_cache_guess(hostname);
+	link_cork(master);
 	send_master_message(master,"workqueue %d %s %s %s %d.%d.%d\n",WORK_QUEUE_PROTOCOL_VERSION,hostname,os_name,arch_name,CCTOOLS_VERSION_MAJOR,CCTOOLS_VERSION_MINOR,CCTOOLS_VERSION_MICRO);
 	send_master_message(master, "info worker-id %s\n", worker_id);
+	send_master_message(master, "info compression %s\n", WORK_QUEUE_COMPRESS_METHOD);
+	if(transfer_port > 0) {
+		send_master_message(master, "info transfer-port %d\n", transfer_port);
+	}
 	send_features(master);
 	send_keepalive(master, 1);
+	link_uncork(master, time(0)+active_timeout);
 }
 
 
@@ -564,9 +606,14 @@ static void report_task_complete( struct link *master, struct work_queue_process
 	struct stat st;
 
 	if(worker_mode==WORKER_MODE_WORKER) {
-		fstat(p->output_fd, &st);
-		output_length = st.st_size;
-		lseek(p->output_fd, 0, SEEK_SET);
+		if(p->output_fd > 0) {
+			fstat(p->output_fd, &st);
+			output_length = st.st_size;
+			lseek(p->output_fd, 0, SEEK_SET);
+		} else {
+			// The task never ran, e.g. it was forsaken.
+			output_length = 0;
+		}
 		send_master_message(master, "result %d %d %lld %llu %d\n", p->task_status, p->exit_status, (long long) output_length, (unsigned long long) p->execution_end-p->execution_start, p->task->taskid);
 		link_stream_from_fd(master, p->output_fd, output_length, time(0)+active_timeout);
 
@@ -617,6 +664,9 @@ static void report_tasks_complete( struct link *master )
 {
 	struct work_queue_process *p;
 
+	/* the results are sent together, except for large outputs, which are streamed. */
+	link_cork(master);
+
 	while((p=itable_pop(procs_complete))) {
 		report_task_complete(master,p);
 	}
@@ -625,6 +675,8 @@ static void report_tasks_complete( struct link *master )
 
 	send_master_message(master, "end\n");
 
+	link_uncork(master, time(0)+active_timeout);
+
 	results_to_be_sent_msg = 0;
 }
 
@@ -798,8 +850,18 @@ static int stream_output_item(struct link *master, const char *filename, int rec
 		fd = open(cached_filename, O_RDONLY, 0);
 		if(fd >= 0) {
 			length = info.st_size;
-			send_master_message(master, "file %s %"PRId64"\n", filename, length );
-			actual = link_stream_from_fd(master, fd, length, time(0) + active_timeout);
+			if(compress_threshold > 0 && length >= compress_threshold && work_queue_compress_probe_fd(fd, length)) {
+				struct work_queue_compress_stats s;
+				memset(&s, 0, sizeof(s));
+				send_master_message(master, "filez %s %"PRId64"\n", filename, length );
+				actual = work_queue_compress_send(master, fd, NULL, length, time(0) + active_timeout, &s);
+				if(actual == length) {
+					debug(D_WQ, "compressed %s from %"PRId64" to %"PRId64" bytes in %.02lfs", filename, s.bytes, s.wire_bytes, s.time / 1000000.0);
+				}
+			} else {
+				send_master_message(master, "file %s %"PRId64"\n", filename, length );
+				actual = link_stream_from_fd(master, fd, length, time(0) + active_timeout);
+			}
 			close(fd);
 			if(actual != length) {
 				debug(D_WQ, "Sending back output file - %s failed: bytes to send = %"PRId64" and bytes actually sent = %"PRId64".", filename, length, actual);
@@ -861,6 +923,67 @@ int setup_sandbox( struct work_queue_process *p )
 	return 1;
 }
 
+void forsake_waiting_process(struct link *master, struct work_queue_process *p) {
+
+	/* the task cannot run in this worker */
+	p->task_status = WORK_QUEUE_RESULT_FORSAKEN;
+	itable_insert(procs_complete, p->task->taskid, p);
+
+	debug(D_WQ, "Waiting task %d has been forsaken.", p->task->taskid);
+
+	/* we also send updated resources to the master. */
+	send_keepalive(master, 1);
+}
+
+/*
+Return true if an input of the task is missing because it could not be fetched from a peer.
+*/
+
+static int peer_input_failed( struct work_queue_process *p )
+{
+	struct work_queue_file *f;
+
+	if(!peer_failed_files || hash_table_size(peer_failed_files) < 1)
+		return 0;
+
+	list_first_item(p->task->input_files);
+	while((f = list_next_item(p->task->input_files))) {
+		if(hash_table_lookup(peer_failed_files, f->payload)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+Return true if an input of the task is still being fetched from a peer.
+*/
+
+static int peer_input_pending( struct work_queue_process *p )
+{
+	struct work_queue_file *f;
+	struct peer_fetch *fetch;
+	uint64_t pid;
+
+	if(!peer_fetches || itable_size(peer_fetches) < 1)
+		return 0;
+
+	list_first_item(p->task->input_files);
+	while((f = list_next_item(p->task->input_files))) {
+		if(strncmp(f->payload, "cache/", 6))
+			continue;
+		itable_firstkey(peer_fetches);
+		while(itable_nextkey(peer_fetches, &pid, (void **) &fetch)) {
+			if(!strcmp(f->payload + 6, fetch->filename)) {
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
 /*
 For a task run locally, if the resources are all set to -1,
 then assume that the task occupies all worker resources.
@@ -884,6 +1007,32 @@ static void normalize_resources( struct work_queue_process *p )
 	}
 }
 
+/*
+Set up the sandbox of a received task, and put it in the waiting list.
+If the sandbox cannot be set up, the task is deleted and zero returned.
+*/
+
+static int make_process_ready( struct link *master, struct work_queue_process *p )
+{
+	// XXX sandbox setup should be done in task execution,
+	// so that it can be returned cleanly as a failure to execute.
+	if(!setup_sandbox(p)) {
+		// If an input could not be fetched from a peer, the master
+		// sends it and tries the task again.
+		if(peer_input_failed(p)) {
+			forsake_waiting_process(master, p);
+			return 1;
+		}
+		itable_remove(procs_table, p->task->taskid);
+		work_queue_watcher_remove_process(watcher, p);
+		work_queue_process_delete(p);
+		return 0;
+	}
+	normalize_resources(p);
+	list_push_tail(procs_waiting,p);
+	return 1;
+}
+
 /*
 Handle an incoming task message from the master.
 Generate a work_queue_process wrapped around a work_queue_task,
@@ -972,15 +1121,12 @@ static int do_task( struct link *master, int taskid, time_t stoptime )
 	if(worker_mode==WORKER_MODE_FOREMAN) {
 		work_queue_submit_internal(foreman_q,task);
 	} else {
-		// XXX sandbox setup should be done in task execution,
-		// so that it can be returned cleanly as a failure to execute.
-		if(!setup_sandbox(p)) {
-			itable_remove(procs_table,taskid);
-			work_queue_process_delete(p);
+		// A task waits for inputs still coming from peers before its sandbox is set up.
+		if(peer_input_pending(p)) {
+			list_push_tail(procs_fetching,p);
+		} else if(!make_process_ready(master, p)) {
 			return 0;
 		}
-		normalize_resources(p);
-		list_push_tail(procs_waiting,p);
 	}
 
 	work_queue_watcher_add_process(watcher,p);
@@ -1034,10 +1180,11 @@ static int do_put_symlink_internal( struct link *master, char *filename, int len
 Handle an incoming file inside the rput protocol.
 Notice that we trust the caller to have created
 the necessary parent directories and checked the
-name for validity.
+name for validity. If compressed, the contents
+come as a compressed stream (see work_queue_compress.h).
 */
 
-static int do_put_file_internal( struct link *master, char *filename, int64_t length, int mode )
+static int do_put_file_internal( struct link *master, char *filename, int64_t length, int mode, int compressed )
 {
 	if(!check_disk_space_for_filesize(".", length, disk_avail_threshold)) {
 		debug(D_WQ, "Could not put file %s, not enough disk space (%"PRId64" bytes needed)\n", filename, length);
@@ -1053,7 +1200,14 @@ static int do_put_file_internal( struct link *master, char *filename, int64_t le
 		return 0;
 	}
 
-	int64_t actual = link_stream_to_fd(master, fd, length, time(0) + active_timeout);
+	int64_t actual;
+	if(compressed) {
+		struct work_queue_compress_stats s;
+		memset(&s, 0, sizeof(s));
+		actual = work_queue_compress_recv(master, fd, time(0) + active_timeout, &s);
+	} else {
+		actual = link_stream_to_fd(master, fd, length, time(0) + active_timeout);
+	}
 	close(fd);
 	if(actual!=length) {
 		debug(D_WQ, "Failed to put file - %s (%s)\n", filename, strerror(errno));
@@ -1091,13 +1245,15 @@ static int do_put_dir_internal( struct link *master, char *dirname )
 
 		int r = 0;
 
-		if(sscanf(line,"put %s %" SCNd64 " %o",name_encoded,&size,&mode)==3) {
+		if(sscanf(line,"put %s %" SCNd64 " %o",name_encoded,&size,&mode)==3 || sscanf(line,"putz %s %" SCNd64 " %o",name_encoded,&size,&mode)==3) {
+
+			int compressed = !strncmp(line,"putz ",5);
 
 			url_decode(name_encoded,name,sizeof(name));
 			if(!is_valid_filename(name)) return 0;
 
 			char *subname = string_format("%s/%s",dirname,name);
-			r = do_put_file_internal(master,subname,size,mode);
+			r = do_put_file_internal(master,subname,size,mode,compressed);
 			free(subname);
 
 		} else if(sscanf(line,"symlink %s %" SCNd64,name_encoded,&size)==2) {
@@ -1148,7 +1304,7 @@ sending a large directory tree.  The direction put
 protocol (above) is preferred instead.
 */
 
-static int do_put_single_file( struct link *master, char *filename, int64_t length, int mode )
+static int do_put_single_file( struct link *master, char *filename, int64_t length, int mode, int compressed )
 {
 	if(!path_within_dir(filename, workspace)) {
 		debug(D_WQ, "Path - %s is not within workspace %s.", filename, workspace);
@@ -1167,7 +1323,11 @@ static int do_put_single_file( struct link *master, char *filename, int64_t leng
 		}
 	}
 
-	int result = do_put_file_internal(master,cached_filename,length,mode);
+	int result = do_put_file_internal(master,cached_filename,length,mode,compressed);
+
+	if(result && peer_failed_files) {
+		hash_table_remove(peer_failed_files, cached_filename);
+	}
 
 	free(cached_filename);
 
@@ -1201,6 +1361,334 @@ static int do_url(struct link* master, const char *filename, int length, int mod
 		return file_from_url(url, cache_name);
 }
 
+/*
+Serve one request of another worker for a file in the cache.
+The request is "get <name>", and the reply is "file <length> <mode>"
+followed by the contents, or "missing" if the file is not in the cache.
+*/
+
+static void transfer_server_handle( struct link *peer )
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	char filename_encoded[WORK_QUEUE_LINE_MAX];
+	char filename[WORK_QUEUE_LINE_MAX];
+	time_t stoptime = time(0) + active_timeout;
+
+	if(password && !link_auth_password(peer, password, stoptime)) {
+		debug(D_WQ, "peer presented the wrong password");
+		return;
+	}
+
+	if(!link_readline(peer, line, sizeof(line), stoptime) || sscanf(line, "get %s", filename_encoded) != 1) {
+		return;
+	}
+
+	url_decode(filename_encoded, filename, sizeof(filename));
+
+	struct stat info;
+	int fd = -1;
+
+	if(is_valid_filename(filename)) {
+		char *cached_filename = string_format("cache/%s", filename);
+		fd = open(cached_filename, O_RDONLY);
+		free(cached_filename);
+	}
+
+	if(fd >= 0 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+		debug(D_WQ, "sending %s to peer", filename);
+		link_putfstring(peer, "file %lld %o\n", stoptime, (long long) info.st_size, (unsigned int) (info.st_mode & 0777));
+		link_stream_from_fd(peer, fd, info.st_size, stoptime);
+	} else {
+		debug(D_WQ, "peer requested %s, which is not in the cache", filename);
+		link_putliteral(peer, "missing\n", stoptime);
+	}
+
+	if(fd >= 0) {
+		close(fd);
+	}
+}
+
+/*
+The transfer server runs in a child process, and serves each request in
+a process of its own. It quits when the worker does, even if the worker
+could not stop it.
+*/
+
+static void transfer_server_run( struct link *server, pid_t worker_pid )
+{
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGUSR1, SIG_DFL);
+	signal(SIGUSR2, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+
+	while(getppid() == worker_pid) {
+		struct link *peer = link_accept(server, time(0) + 5);
+
+		while(waitpid(-1, NULL, WNOHANG) > 0) {}
+
+		if(!peer) continue;
+
+		pid_t pid = fork();
+		if(pid == 0) {
+			link_close(server);
+			transfer_server_handle(peer);
+			link_close(peer);
+			_exit(0);
+		} else if(pid < 0) {
+			debug(D_WQ, "could not serve peer: %s", strerror(errno));
+		}
+
+		link_close(peer);
+	}
+
+	_exit(0);
+}
+
+static int transfer_server_start()
+{
+	char addr[LINK_ADDRESS_MAX];
+
+	struct link *server = link_serve(0);
+	if(!server) {
+		warn(D_NOTICE, "could not create transfer server: %s", strerror(errno));
+		return 0;
+	}
+
+	link_address_local(server, addr, &transfer_port);
+
+	pid_t worker_pid = getpid();
+
+	transfer_server_pid = fork();
+	if(transfer_server_pid == 0) {
+		transfer_server_run(server, worker_pid);
+	} else if(transfer_server_pid < 0) {
+		warn(D_NOTICE, "could not start transfer server: %s", strerror(errno));
+		link_close(server);
+		transfer_server_pid = 0;
+		transfer_port = 0;
+		return 0;
+	}
+
+	link_close(server);
+
+	debug(D_WQ, "transfer server listening on port %d", transfer_port);
+
+	return 1;
+}
+
+static void transfer_server_stop()
+{
+	if(transfer_server_pid > 0) {
+		kill(transfer_server_pid, SIGTERM);
+		waitpid(transfer_server_pid, NULL, 0);
+		transfer_server_pid = 0;
+	}
+}
+
+/*
+Fetch a file into the cache from the transfer server of another worker.
+This runs in a child process, which writes to a temporary name and renames
+it when complete, so that a fetch killed midway leaves nothing behind.
+*/
+
+static int peer_fetch_run( const char *filename, const char *host, int port )
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	char filename_encoded[WORK_QUEUE_LINE_MAX];
+	int64_t length;
+	int mode;
+	int result = 0;
+
+	time_t stoptime = time(0) + active_timeout;
+
+	url_encode(filename, filename_encoded, sizeof(filename_encoded));
+
+	struct link *peer = link_connect(host, port, time(0) + peer_connect_timeout);
+	if(!peer) {
+		return 0;
+	}
+
+	char *cached_filename = string_format("cache/%s", filename);
+	char *temp_filename = string_format("cache/.%s.peerget.%d", filename, (int) getpid());
+
+	if(!password || link_auth_password(peer, password, stoptime)) {
+		link_putfstring(peer, "get %s\n", stoptime, filename_encoded);
+		if(link_readline(peer, line, sizeof(line), stoptime) && sscanf(line, "file %" SCNd64 " %o", &length, &mode) == 2) {
+			result = do_put_file_internal(peer, temp_filename, length, mode, 0);
+		}
+	}
+	link_close(peer);
+
+	if(result && rename(temp_filename, cached_filename) < 0) {
+		result = 0;
+	}
+
+	if(!result) {
+		unlink(temp_filename);
+	}
+
+	free(cached_filename);
+	free(temp_filename);
+
+	return result;
+}
+
+/*
+Report the end of a fetch from a peer to the master.  A failure is
+remembered until the master sends the file itself, and tasks that
+need the file in the meantime are forsaken.
+*/
+
+static void peer_fetch_complete( struct link *master, const char *filename, const char *host, int port, int result )
+{
+	char filename_encoded[WORK_QUEUE_LINE_MAX];
+	char *cached_filename = string_format("cache/%s", filename);
+
+	if(result) {
+		debug(D_WQ, "fetched %s from peer %s:%d", filename, host, port);
+		hash_table_remove(peer_failed_files, cached_filename);
+	} else {
+		debug(D_WQ, "could not fetch %s from peer %s:%d", filename, host, port);
+		hash_table_insert(peer_failed_files, cached_filename, (void **) 1);
+	}
+
+	free(cached_filename);
+
+	url_encode(filename, filename_encoded, sizeof(filename_encoded));
+	send_master_message(master, "peerget-complete %d %s\n", result, filename_encoded);
+}
+
+static void peer_fetch_delete( struct peer_fetch *fetch )
+{
+	free(fetch->filename);
+	free(fetch->host);
+	free(fetch);
+}
+
+/*
+Start fetching a file from a peer in a child process, so that the worker
+keeps serving the master and running tasks during the transfer.
+The result is reported when the child is reaped by check_peer_fetches.
+*/
+
+static int do_peerget( struct link *master, const char *filename, const char *host, int port )
+{
+	if(!is_valid_filename(filename)) {
+		peer_fetch_complete(master, filename, host, port, 0);
+		return 1;
+	}
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGQUIT, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGUSR1, SIG_DFL);
+		signal(SIGUSR2, SIG_DFL);
+		signal(SIGCHLD, SIG_DFL);
+		_exit(peer_fetch_run(filename, host, port) ? 0 : 1);
+	} else if(pid < 0) {
+		debug(D_WQ, "could not start fetch of %s from peer: %s", filename, strerror(errno));
+		peer_fetch_complete(master, filename, host, port, 0);
+		return 1;
+	}
+
+	struct peer_fetch *fetch = xxmalloc(sizeof(*fetch));
+	fetch->pid = pid;
+	fetch->filename = xxstrdup(filename);
+	fetch->host = xxstrdup(host);
+	fetch->port = port;
+	fetch->stoptime = time(0) + peer_connect_timeout + active_timeout;
+	fetch->result = 0;
+
+	itable_insert(peer_fetches, pid, fetch);
+
+	debug(D_WQ, "fetching %s from peer %s:%d", filename, host, port);
+
+	return 1;
+}
+
+/*
+Reap the children fetching files from peers, killing any that have run
+past their time, and report each finished fetch to the master. Tasks
+waiting on the fetched files have their sandboxes set up once none of
+their inputs is still pending.
+*/
+
+static int check_peer_fetches( struct link *master )
+{
+	struct peer_fetch *fetch;
+	struct list *finished = NULL;
+	uint64_t pid;
+	int status;
+	int ok = 1;
+
+	itable_firstkey(peer_fetches);
+	while(itable_nextkey(peer_fetches, &pid, (void **) &fetch)) {
+		int result = waitpid(fetch->pid, &status, WNOHANG);
+		if(result == 0) {
+			if(time(0) < fetch->stoptime)
+				continue;
+			debug(D_WQ, "fetch of %s from peer %s:%d timed out", fetch->filename, fetch->host, fetch->port);
+			kill(fetch->pid, SIGKILL);
+			waitpid(fetch->pid, NULL, 0);
+			status = -1;
+		} else if(result < 0) {
+			status = -1;
+		}
+		fetch->result = status >= 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		if(!finished)
+			finished = list_create();
+		list_push_tail(finished, fetch);
+	}
+
+	if(!finished)
+		return 1;
+
+	while((fetch = list_pop_head(finished))) {
+		itable_remove(peer_fetches, fetch->pid);
+		peer_fetch_complete(master, fetch->filename, fetch->host, fetch->port, fetch->result);
+		peer_fetch_delete(fetch);
+	}
+	list_delete(finished);
+
+	struct work_queue_process *p;
+	int i;
+	int size = list_size(procs_fetching);
+
+	for(i = 0; i < size; i++) {
+		p = list_pop_head(procs_fetching);
+		if(peer_input_pending(p)) {
+			list_push_tail(procs_fetching, p);
+		} else {
+			ok &= make_process_ready(master, p);
+		}
+	}
+
+	return ok;
+}
+
+/*
+Stop all fetches from peers, when the worker disconnects from the master.
+*/
+
+static void kill_peer_fetches()
+{
+	struct peer_fetch *fetch;
+	uint64_t pid;
+
+	itable_firstkey(peer_fetches);
+	while(itable_nextkey(peer_fetches, &pid, (void **) &fetch)) {
+		kill(fetch->pid, SIGKILL);
+		waitpid(fetch->pid, NULL, 0);
+		peer_fetch_delete(fetch);
+	}
+
+	itable_clear(peer_fetches);
+}
+
 static int do_unlink(const char *path)
 {
 	char cached_path[WORK_QUEUE_LINE_MAX];
@@ -1385,6 +1873,7 @@ static int do_kill(int taskid)
 
 	itable_remove(procs_complete, p->task->taskid);
 	list_remove(procs_waiting,p);
+	list_remove(procs_fetching,p);
 
 	work_queue_watcher_remove_process(watcher,p);
 
@@ -1414,6 +1903,7 @@ static void kill_all_tasks() {
 	assert(itable_size(procs_running)==0);
 	assert(itable_size(procs_complete)==0);
 	assert(list_size(procs_waiting)==0);
+	assert(list_size(procs_fetching)==0);
 	assert(cores_allocated==0);
 	assert(memory_allocated==0);
 	assert(disk_allocated==0);
@@ -1569,8 +2059,17 @@ static int handle_master(struct link *master) {
 			r = do_task(master, taskid,time(0)+active_timeout);
 		} else if(sscanf(line,"put %s %"SCNd64" %o",filename_encoded,&length,&mode)==3) {
 			url_decode(filename_encoded,filename,sizeof(filename));
-			r = do_put_single_file(master, filename, length, mode);
+			r = do_put_single_file(master, filename, length, mode, 0);
+			reset_idle_timer();
+		} else if(sscanf(line,"putz %s %"SCNd64" %o",filename_encoded,&length,&mode)==3) {
+			url_decode(filename_encoded,filename,sizeof(filename));
+			r = do_put_single_file(master, filename, length, mode, 1);
 			reset_idle_timer();
+		} else if(sscanf(line, "compression %s %"SCNd64, path, &length) == 2) {
+			if(!strcmp(path, WORK_QUEUE_COMPRESS_METHOD)) {
+				compress_threshold = length;
+			}
+			r = 1;
 		} else if(sscanf(line, "dir %s", filename_encoded)==1) {
 			url_decode(filename_encoded,filename,sizeof(filename));
 			r = do_put_dir(master,filename);
@@ -1578,6 +2077,10 @@ static int handle_master(struct link *master) {
 		} else if(sscanf(line, "url %s %" SCNd64 " %o", filename, &length, &mode) == 3) {
 			r = do_url(master, filename, length, mode);
 			reset_idle_timer();
+		} else if(sscanf(line, "peerget %s %s %d", filename_encoded, path, &n) == 3) {
+			url_decode(filename_encoded,filename,sizeof(filename));
+			r = do_peerget(master, filename, path, n);
+			reset_idle_timer();
 		} else if(sscanf(line, "unlink %s", filename_encoded) == 1) {
 			url_decode(filename_encoded,filename,sizeof(filename));
 			r = do_unlink(filename);
@@ -1665,18 +2168,6 @@ static int task_resources_fit_eventually(struct work_queue_task *t)
 		(t->resources_requested->gpus   <= r->gpus.largest);
 }
 
-void forsake_waiting_process(struct link *master, struct work_queue_process *p) {
-
-	/* the task cannot run in this worker */
-	p->task_status = WORK_QUEUE_RESULT_FORSAKEN;
-	itable_insert(procs_complete, p->task->taskid, p);
-
-	debug(D_WQ, "Waiting task %d has been forsaken.", p->task->taskid);
-
-	/* we also send updated resources to the master. */
-	send_keepalive(master, 1);
-}
-
 /*
 If 0, the worker is using more resources than promised. 1 if resource usage holds that promise.
 */
@@ -1795,6 +2286,8 @@ static void work_for_master(struct link *master) {
 
 		ok &= handle_tasks(master);
 
+		ok &= check_peer_fetches(master);
+
 		measure_worker_resources();
 
 		if(!enforce_worker_promises(master)) {
@@ -1855,7 +2348,7 @@ static void work_for_master(struct link *master) {
 		}
 
 		//Reset idle_stoptime if something interesting is happening at this worker.
-		if(list_size(procs_waiting) > 0 || itable_size(procs_table) > 0 || itable_size(procs_complete) > 0) {
+		if(list_size(procs_waiting) > 0 || itable_size(procs_table) > 0 || itable_size(procs_complete) > 0 || itable_size(peer_fetches) > 0) {
 			reset_idle_timer();
 		}
 	}
@@ -2024,8 +2517,12 @@ to remove any state left over from a previous run.
 
 static void workspace_cleanup()
 {
+	if(peer_fetches) kill_peer_fetches();
+
 	debug(D_WQ,"cleaning workspace %s",workspace);
 	delete_dir_contents(workspace);
+
+	if(peer_failed_files) hash_table_clear(peer_failed_files);
 }
 
 /*
@@ -2045,6 +2542,9 @@ static void workspace_delete()
 	if(procs_table)        itable_delete(procs_table);
 	if(procs_complete)     itable_delete(procs_complete);
 	if(procs_waiting)      list_delete(procs_waiting);
+	if(procs_fetching)     list_delete(procs_fetching);
+	if(peer_failed_files)  hash_table_delete(peer_failed_files);
+	if(peer_fetches)       itable_delete(peer_fetches);
 
 	if(watcher)            work_queue_watcher_delete(watcher);
 
@@ -2131,6 +2631,7 @@ static int serve_master_by_hostport( const char *host, int port, const char *ver
 
 	last_task_received     = 0;
 	results_to_be_sent_msg = 0;
+	compress_threshold     = 0;
 
 	workspace_cleanup();
 	disconnect_master(master);
@@ -2398,6 +2899,7 @@ static void show_help(const char *cmd)
 	printf( " %-30s Set the maximum number of seconds the worker may be active. (in s).\n", "--wall-time=<s>");
 	printf( " %-30s Forbid the use of symlinks for cache management.\n", "--disable-symlinks");
 	printf(" %-30s Single-shot mode -- quit immediately after disconnection.\n", "--single-shot");
+	printf(" %-30s Serve cached files to other workers, and fetch files from them when the master asks.\n", "--peer-transfers");
 	printf(" %-30s docker mode -- run each task with a container based on this docker image.\n", "--docker=<image>");
 	printf(" %-30s docker-preserve mode -- tasks execute by a worker share a container based on this docker image.\n", "--docker-preserve=<image>");
 	printf(" %-30s docker-tar mode -- build docker image from tarball, this mode must be used with --docker or --docker-preserve.\n", "--docker-tar=<tarball>");
@@ -2409,7 +2911,7 @@ enum {LONG_OPT_DEBUG_FILESIZE = 256, LONG_OPT_VOLATILITY, LONG_OPT_BANDWIDTH,
 	  LONG_OPT_DISK, LONG_OPT_GPUS, LONG_OPT_FOREMAN, LONG_OPT_FOREMAN_PORT, LONG_OPT_DISABLE_SYMLINKS,
 	  LONG_OPT_IDLE_TIMEOUT, LONG_OPT_CONNECT_TIMEOUT, LONG_OPT_RUN_DOCKER, LONG_OPT_RUN_DOCKER_PRESERVE,
 	  LONG_OPT_BUILD_FROM_TAR, LONG_OPT_SINGLE_SHOT, LONG_OPT_WALL_TIME, LONG_OPT_DISK_ALLOCATION,
-	  LONG_OPT_MEMORY_THRESHOLD, LONG_OPT_FEATURE};
+	  LONG_OPT_MEMORY_THRESHOLD, LONG_OPT_FEATURE, LONG_OPT_PEER_TRANSFERS};
 
 static const struct option long_options[] = {
 	{"advertise",           no_argument,        0,  'a'},
@@ -2454,6 +2956,7 @@ static const struct option long_options[] = {
 	{"docker-preserve",     required_argument,  0,  LONG_OPT_RUN_DOCKER_PRESERVE},
 	{"docker-tar",          required_argument,  0,  LONG_OPT_BUILD_FROM_TAR},
 	{"feature",             required_argument,  0,  LONG_OPT_FEATURE},
+	{"peer-transfers",      no_argument,        0,  LONG_OPT_PEER_TRANSFERS},
 	{0,0,0,0}
 };
 
@@ -2690,6 +3193,9 @@ int main(int argc, char *argv[])
 		case LONG_OPT_FEATURE:
 			hash_table_insert(features, optarg, (void **) 1);
 			break;
+		case LONG_OPT_PEER_TRANSFERS:
+			peer_transfers_enabled = 1;
+			break;
 		default:
 			show_help(argv[0]);
 			return 1;
@@ -2786,6 +3292,13 @@ int main(int argc, char *argv[])
 	// change to workspace
 	chdir(workspace);
 
+	peer_failed_files = hash_table_create(0, 0);
+	peer_fetches = itable_create(0);
+
+	if(peer_transfers_enabled && worker_mode == WORKER_MODE_WORKER) {
+		transfer_server_start();
+	}
+
 	if(worker_mode == WORKER_MODE_FOREMAN) {
 		char foreman_string[WORK_QUEUE_LINE_MAX];
 
@@ -2848,6 +3361,7 @@ int main(int argc, char *argv[])
 	procs_running  = itable_create(0);
 	procs_table    = itable_create(0);
 	procs_waiting  = list_create();
+	procs_fetching = list_create();
 	procs_complete = itable_create(0);
 
 	watcher = work_queue_watcher_create();
@@ -2941,6 +3455,8 @@ int main(int argc, char *argv[])
 
 	}
 
+	transfer_server_stop();
+
 	workspace_delete();
 
 	return 0;
@@ -0,0 +1,85 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+TASKS=6
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+run()
+{
+	cat > master.script << EOF
+submit 1 4 0 $TASKS
+wait
+quit
+EOF
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	port=`cat master.port`
+
+	# The second worker connects once the first holds the cached input,
+	# so that the master has it fetched from the first worker.
+	echo "starting first worker"
+	work_queue_worker -d all -o worker.1.log localhost $port -b 1 --timeout 20 --cores 1 --memory-threshold 10 --memory 50 --single-shot --peer-transfers &
+	pid1=$!
+
+	sleep 2
+
+	echo "starting second worker"
+	work_queue_worker -d all -o worker.2.log localhost $port -b 1 --timeout 20 --cores 1 --memory-threshold 10 --memory 50 --single-shot --peer-transfers &
+	pid2=$!
+
+	wait $pid1
+	wait $pid2
+
+	status=0
+
+	echo "checking for output"
+	i=0
+	while [ $i -lt $TASKS ]
+	do
+		if [ ! -f output.$i ]
+		then
+			echo "output.$i is missing!"
+			status=1
+		fi
+		i=$((i+1))
+	done
+
+	echo "checking for a transfer between the workers"
+	if ! grep -q "fetched .* from peer" worker.2.log
+	then
+		echo "the second worker did not fetch its input from the first"
+		status=1
+	fi
+
+	if [ $status -ne 0 ]
+	then
+		for log in master.log worker.1.log worker.2.log
+		do
+			echo "$log:"
+			cat $log
+		done
+	fi
+
+	return $status
+}
+
+clean()
+{
+	rm -f master.script master.log master.port worker.1.log worker.2.log output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
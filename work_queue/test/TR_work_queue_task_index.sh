@@ -0,0 +1,71 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+# Have the master recount all tasks at every change of state,
+# and abort if its index of tasks by state and category disagrees.
+export WORK_QUEUE_CHECK_TASK_INDEX=1
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+run()
+{
+	cat > master.script << EOF
+benchmark 50 5
+expire 9
+submit 1 0 1 6 small
+submit 1 1 0 6 large
+benchmark 50 5
+wait
+quit
+EOF
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	port=`cat master.port`
+
+	echo "starting worker"
+	work_queue_worker -d all -o worker.log localhost $port -b 1 --timeout 20 --cores 2 --memory-threshold 10 --memory 50 --single-shot
+
+	wait
+
+	if grep -q "fatal" master.log || ! grep -q "checking the task index" master.log
+	then
+		echo "master log:"
+		cat master.log
+		return 1
+	fi
+
+	if [ `grep -c "state change: WAITING (1) to RETRIEVED" master.log` -ne 6 ]
+	then
+		echo "expired tasks are missing"
+		return 1
+	fi
+
+	if [ `ls output.* | wc -l` -ne 12 ]
+	then
+		echo "outputs are missing"
+		return 1
+	fi
+
+	echo "task index matched the tasks throughout"
+	return 0
+}
+
+clean()
+{
+	rm -f master.script master.log master.port worker.log output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4: